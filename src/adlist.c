@@ -115,13 +115,13 @@ void listDelNode(list *list, listNode *node){
     if(node->prev != NULL){
         node->prev->next = node->next;
     }else{
-        list->head = node;
+        list->head = node->next;
     };
 
     if(node->next != NULL){
         node->next->prev = node->prev;
     }else{
-        list->tail = node;
+        list->tail = node->prev;
     };
 
    if(list->free){list->free(node->value);}; 
@@ -252,3 +252,20 @@ void listRotate(list *list){
     tail->next = list->head;
     list->head = tail;
 }
+
+
+void listJoin(list *l, list *o){
+    if(o->head) o->head->prev = l->tail;
+
+    if(l->tail){
+        l->tail->next = o->head;
+    }else{
+        l->head = o->head;
+    };
+
+    if(o->tail) l->tail = o->tail;
+    l->len += o->len;
+
+    o->head = o->tail = NULL;
+    o->len = 0;
+};
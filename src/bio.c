@@ -1,24 +1,31 @@
 #include "server.h"
 #include "bio.h"
 
-static pthread_t bio_threads[BIO_NUM_OPS];
+/* Every job type has a pool of worker threads sharing one queue per
+ * priority, and workers always take high priority jobs first. A handler
+ * may do part of a job and ask to be called again: the job then goes back
+ * to the tail of the low priority queue, so freeing a huge dict never
+ * holds a worker for long while small jobs wait behind it. */
+static pthread_t *bio_threads[BIO_NUM_OPS];
+static int bio_threads_count[BIO_NUM_OPS];
 static pthread_mutex_t bio_mutex[BIO_NUM_OPS];
 static pthread_cond_t bio_newjob_cond[BIO_NUM_OPS];
 static pthread_cond_t bio_step_cond[BIO_NUM_OPS];
 
-static list *bio_jobs[BIO_NUM_OPS];
+static list *bio_jobs[BIO_NUM_OPS][BIO_NUM_PRIOS];
 
 static unsigned long long bio_pending[BIO_NUM_OPS];
 
 struct bio_job{
-    time_t time;
+    mstime_t queued;
 
     void *arg1, *arg2, *arg3;
+    unsigned long cursor[2];
 };
 
 void *bioProcessBackgroundJobs(void *arg);
-void lazyfreeFreeObjectFromBioThread(robj *o);
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2);
+int lazyfreeFreeObjectFromBioThread(robj *o, unsigned long *cursor);
+int lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2, unsigned long *cursor);
 void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl);
 
 #define REDIS_THREAD_STACK_SIZE (1024*1024*4)
@@ -27,13 +34,19 @@ void bioInit(void){
     pthread_attr_t attr;
     pthread_t thread;
     size_t stacksize;
-    int j;
+    int j, i, prio;
+
+    /* AOF fsyncs must complete in order, they keep a single thread. */
+    bio_threads_count[BIO_CLOSE_FILE] = server.bio_close_file_threads;
+    bio_threads_count[BIO_AOF_FSYNC] = 1;
+    bio_threads_count[BIO_LAZY_FREE] = server.bio_lazy_free_threads;
 
     for(j = 0; j < BIO_NUM_OPS; j++){
+        if(bio_threads_count[j] < 1) bio_threads_count[j] = 1;
         pthread_mutex_init(&bio_mutex[j],NULL);
         pthread_cond_init(&bio_newjob_cond[j],NULL);
         pthread_cond_init(&bio_step_cond[j],NULL);
-        bio_jobs[j] = listCreate();
+        for(prio = 0; prio < BIO_NUM_PRIOS; prio++) bio_jobs[j][prio] = listCreate();
         bio_pending[j] = 0;
     };
 
@@ -47,14 +60,37 @@ void bioInit(void){
 
     for(j = 0; j < BIO_NUM_OPS;j++){
         void *arg = (void*)(unsigned long) j;
-        if(pthread_create(&thread,&attr,bioProcessBackgroundJobs,arg) != 0){
-            serverLog(LL_WARNING,"Fatal: Can't initialzie Background Jobs.");
-            exit(1);
+
+        bio_threads[j] = zmalloc(sizeof(pthread_t) * bio_threads_count[j]);
+        for(i = 0; i < bio_threads_count[j]; i++){
+            if(pthread_create(&thread,&attr,bioProcessBackgroundJobs,arg) != 0){
+                serverLog(LL_WARNING,"Fatal: Can't initialzie Background Jobs.");
+                exit(1);
+            };
+            bio_threads[j][i] = thread;
         };
-        bio_threads[j]  = thread;
     };
 };
 
+/* Run a job, or a step of it. Returns 0 if the job has to be called again. */
+static int bioRunJob(unsigned long type, struct bio_job *job){
+    if(type == BIO_CLOSE_FILE){
+        close((long) job->arg1);
+    }else if(type == BIO_AOF_FSYNC){
+        aof_fsync((long)job->arg1);
+    }else if(type == BIO_LAZY_FREE){
+        if(job->arg1){
+            return lazyfreeFreeObjectFromBioThread(job->arg1,job->cursor);
+        }else if(job->arg2 && job->arg3){
+            return lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3,job->cursor);
+        }else if(job->arg3){
+            lazyfreeFreeSlotsMapFromBioThread(job->arg3);
+        }
+    }else{
+        serverPanic("Wrong job type in bioProcessBackgroundJobs().");
+    }
+    return 1;
+};
 
 void *bioProcessBackgroundJobs(void *arg){
     struct bio_job *job;
@@ -80,57 +116,57 @@ void *bioProcessBackgroundJobs(void *arg){
     };
 
     while(1){
+        list *jobs = NULL;
         listNode *ln;
-        if(listLength(bio_jobs[type]) == 0){
+        int prio, done;
+
+        for(prio = 0; prio < BIO_NUM_PRIOS && jobs == NULL; prio++){
+            if(listLength(bio_jobs[type][prio])) jobs = bio_jobs[type][prio];
+        };
+        if(jobs == NULL){
             pthread_cond_wait(&bio_newjob_cond[type],&bio_mutex[type]);
             continue;
         };
 
-        ln = listFirst(bio_jobs[type]);
+        ln = listFirst(jobs);
         job = ln->value;
+        listDelNode(jobs,ln);
 
         pthread_mutex_unlock(&bio_mutex[type]);
+        done = bioRunJob(type,job);
+        pthread_mutex_lock(&bio_mutex[type]);
 
-        if(type == BIO_CLOSE_FILE){
-            close((long) job->arg1);
-        }else if(type == BIO_AOF_FSYNC){
-            aof_fsync((long)job->arg1);
-        }else if(type == BIO_LAZY_FREE){
-            if(job->arg1){
-                lazyfreeFreeObjectFromBioThread(job->arg1);
-            }else if(job->arg2 && job->arg3){
-                lazyfreeFreeDatabaseFromBioThread(job->arg2,job->arg3);
-            }else if(job->arg3){
-                lazyfreeFreeSlotsMapFromBioThread(job->arg3);
-            }
+        if(done){
+            zfree(job);
+            bio_pending[type]--;
+            pthread_cond_broadcast(&bio_step_cond[type]);
         }else{
-            serverPanic("Wrong job type in bioProcessBackgroundJobs().");
-        }
-
-        zfree(job);
-        pthread_cond_broadcast(&bio_step_cond[type]);
-
-        pthread_mutex_lock(&bio_mutex[type]);
-        listDelNode(bio_jobs[type],ln);
-        bio_pending[type]--;
+            job->queued = mstime();
+            listAddNodeTail(bio_jobs[type][BIO_PRIO_LOW],job);
+        };
     };
 };
 
-void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3){
+void bioCreateBackgroundJobWithPriority(int type, int prio, void *arg1, void *arg2, void *arg3){
     struct bio_job *job = zmalloc(sizeof(*job));
      
-    job->time = time(NULL);
+    job->queued = mstime();
     job->arg1 = arg1;
     job->arg2 = arg2;
     job->arg3 = arg3;
+    job->cursor[0] = job->cursor[1] = 0;
 
     pthread_mutex_lock(&bio_mutex[type]);
-    listAddNodeTail(bio_jobs[type],job);
+    listAddNodeTail(bio_jobs[type][prio],job);
     bio_pending[type]++;
     pthread_cond_signal(&bio_newjob_cond[type]);
     pthread_mutex_unlock(&bio_mutex[type]);
 };
 
+void bioCreateBackgroundJob(int type, void *arg1, void *arg2, void *arg3){
+    bioCreateBackgroundJobWithPriority(type,BIO_PRIO_HIGH,arg1,arg2,arg3);
+};
+
 
 unsigned long long bioPendingJobsOfType(int type){
     unsigned long long val;
@@ -140,9 +176,46 @@ unsigned long long bioPendingJobsOfType(int type){
     return val;
 };
 
+/* Return the oldest time a job still queued for 'type' was put in a queue,
+ * or 0 if the queues are empty. Must be called with the mutex held. */
+static mstime_t bioOldestQueuedTime(int type){
+    mstime_t oldest = 0;
+    int prio;
+
+    for(prio = 0; prio < BIO_NUM_PRIOS; prio++){
+        struct bio_job *job;
+
+        if(listLength(bio_jobs[type][prio]) == 0) continue;
+        job = listNodeValue(listFirst(bio_jobs[type][prio]));
+        if(oldest == 0 || job->queued < oldest) oldest = job->queued;
+    };
+    return oldest;
+};
+
+/* How long, in milliseconds, the job waiting the most in the queues of
+ * 'type' has been waiting for a worker. */
+long long bioQueueLatencyOfType(int type){
+    mstime_t oldest;
+
+    pthread_mutex_lock(&bio_mutex[type]);
+    oldest = bioOldestQueuedTime(type);
+    pthread_mutex_unlock(&bio_mutex[type]);
+    return oldest ? mstime() - oldest : 0;
+};
+
+time_t bioOlderJobOfType(int type){
+    mstime_t oldest;
+
+    pthread_mutex_lock(&bio_mutex[type]);
+    oldest = bioOldestQueuedTime(type);
+    pthread_mutex_unlock(&bio_mutex[type]);
+    return oldest / 1000;
+};
+
 unsigned long long bioWaitStepOfType(int type){
     unsigned long long val;
     pthread_mutex_lock(&bio_mutex[type]);
+    val = bio_pending[type];
     if(val != 0){
         pthread_cond_wait(&bio_step_cond[type],&bio_mutex[type]);
         val = bio_pending[type];
@@ -152,15 +225,17 @@ unsigned long long bioWaitStepOfType(int type){
 };
 
 void bioKillThreads(void){
-    int err, j;
+    int err, j, i;
 
     for(j = 0; j < BIO_NUM_OPS;j++){
-        if(pthread_cancel(bio_threads[j]) == 0){
-            if((err = pthread_join(bio_threads[j],NULL)) != 0){
-                serverLog(LL_WARNING, "Bio thread for job type #%d can be joined: %s",j, strerror(err));
-            }else{
-                serverLog(LL_WARNING,"Bio thread for job type #%d terminated",j);
-            }
+        for(i = 0; i < bio_threads_count[j]; i++){
+            if(pthread_cancel(bio_threads[j][i]) == 0){
+                if((err = pthread_join(bio_threads[j][i],NULL)) != 0){
+                    serverLog(LL_WARNING, "Bio thread for job type #%d can be joined: %s",j, strerror(err));
+                }else{
+                    serverLog(LL_WARNING,"Bio thread for job type #%d terminated",j);
+                }
+            };
         };
     };
 };
@@ -1,6 +1,8 @@
 void bioInit(void);
 void bioCreateBackgroundJob(int type, void *arg1, void *arg2,void *arg3);
+void bioCreateBackgroundJobWithPriority(int type, int prio, void *arg1, void *arg2, void *arg3);
 unsigned long long bioPendingJobsOfType(int type);
+long long bioQueueLatencyOfType(int type);
 unsigned long long bioWaitStepOfType(int type);
 time_t bioOlderJobOfType(int type);
 void bioKillThreads(void);
@@ -10,3 +12,7 @@ void bioKillThreads(void);
 #define BIO_AOF_FSYNC 1
 #define BIO_LAZY_FREE 2
 #define BIO_NUM_OPS 3
+
+#define BIO_PRIO_HIGH 0
+#define BIO_PRIO_LOW 1
+#define BIO_NUM_PRIOS 2
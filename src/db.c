@@ -6,30 +6,44 @@
 #include <signal.h>
 #include <ctype.h>
 
+static void lookupKeyTouch(robj *val, int flags){
+    if(server.rdb_child_pid == -1 && server.aof_child_pid == -1 && !(flags & LOOKUP_NOTOUCH)){
+        if(server.maxmemory_policy & MAXMEMORY_FLAG_LFU){
+            unsigned long ldt = val->lru >> 8;
+            unsigned long counter = LFULogIncr(val->lru & 255);
+            val->lru = (ldt << 8) | counter;
+        }else{
+            val->lru = LRU_CLOCK();
+        }
+    };
+};
+
 robj *lookupKey(redisDb *db, robj *key, int flags){
     dictEntry *de = dictFind(db->dict, key->ptr);
     if(de){
         robj *val = dictGetVal(de);
 
-        if(server.rdb_child_pid == -1 && server.aof_child_pid && !(flags & LOOKUP_NOTOUCH)){
-            if(server.maxmemory_policy & MAXMEMORY_FLAG_LFU){
-                unsigned long ldt = val->lru >> 8;
-                unsigned long counter = LFULogIncr(val->lru & 255);
-                val->lru = (ldt << 8) | counter;
-            }else{
-                val->lru = LRU_CLOCK();
-            }
-        };
+        lookupKeyTouch(val,flags);
         return val;
     }else{
         return NULL;
     };
 };
 
+static int expireKeyIfNeeded(redisDb *db, robj *key, mstime_t when);
+
+/* The entry is found once: its expire is read from it, and on a slave,
+ * where an expired key is not deleted, it is still the one to return. */
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags){
+    dictEntry *de = dictFind(db->dict,key->ptr);
     robj *val;
 
-    if(expireIfNeeded(db,key) == 1){
+    if(de == NULL){
+        if(!(flags & LOOKUP_NOSTATS)) server.stat_keyspace_misses++;
+        return NULL;
+    };
+
+    if(expireKeyIfNeeded(db,key,dbGetEntryExpire(db,de)) == 1){
         if(server.masterhost == NULL) return NULL;
 
         if(server.current_client && server.current_client != server.master && server.current_client->cmd && (server.current_client->cmd->flags & CMD_READONLY)){
@@ -37,12 +51,9 @@ robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags){
         };
     };
 
-    val = lookupKey(db,key,flags);
-    if(val == NULL){
-        server.stat_keyspace_misses++;
-    }else{
-        server.stat_keyspace_hits++;
-    }
+    val = dictGetVal(de);
+    lookupKeyTouch(val,flags);
+    if(!(flags & LOOKUP_NOSTATS)) server.stat_keyspace_hits++;
     return val;
 };
 
@@ -50,6 +61,58 @@ robj *lookupKeyRead(redisDb *db, robj *key){
     return lookupKeyReadWithFlags(db,key,LOOKUP_NONE);
 };
 
+/* lookupKeyReadWithFlags() for up to DB_LOOKUP_BATCH keys, storing the
+ * value of keys[j] in vals[j]. The keys, and their db->expires entries
+ * unless expires are inline, are found with dictFindMany() so that their
+ * cache misses overlap. Keys with an expire, and every key after one whose
+ * lookup deleted something (an expired key may be looked up twice in a
+ * batch), take the regular path. */
+void lookupKeysReadWithFlags(redisDb *db, robj **keys, robj **vals, int count, int flags){
+    void *ptrs[DB_LOOKUP_BATCH];
+    dictEntry *entries[DB_LOOKUP_BATCH], *expires[DB_LOOKUP_BATCH];
+    unsigned long size;
+    int j, stale = 0;
+
+    serverAssert(count <= DB_LOOKUP_BATCH);
+    for(j = 0; j < count; j++){
+        ptrs[j] = keys[j]->ptr;
+        expires[j] = NULL;
+    };
+    dictFindMany(db->dict,ptrs,entries,count);
+    if(!server.expires_inline && dictSize(db->expires) > 0){
+        dictFindMany(db->expires,ptrs,expires,count);
+    };
+
+    size = dictSize(db->dict);
+    for(j = 0; j < count; j++){
+        if(stale){
+            vals[j] = lookupKeyReadWithFlags(db,keys[j],flags);
+        }else if(entries[j] == NULL){
+            vals[j] = NULL;
+            if(!(flags & LOOKUP_NOSTATS)) server.stat_keyspace_misses++;
+        }else if(server.expires_inline ? !keyHasInlineExpire(dictGetKey(entries[j])) : expires[j] == NULL){
+            vals[j] = dictGetVal(entries[j]);
+            lookupKeyTouch(vals[j],flags);
+            if(!(flags & LOOKUP_NOSTATS)) server.stat_keyspace_hits++;
+        }else{
+            vals[j] = lookupKeyReadWithFlags(db,keys[j],flags);
+            stale = dictSize(db->dict) != size;
+        };
+    };
+};
+
+/* Bring the entries, keys and values of a batch of keys into the cache
+ * ahead of commands that modify them one by one. */
+void dbPrefetchKeys(redisDb *db, robj **keys, int count){
+    void *ptrs[DB_LOOKUP_BATCH];
+    dictEntry *entries[DB_LOOKUP_BATCH];
+    int j;
+
+    serverAssert(count <= DB_LOOKUP_BATCH);
+    for(j = 0; j < count; j++) ptrs[j] = keys[j]->ptr;
+    dictFindMany(db->dict,ptrs,entries,count);
+};
+
 robj *lookupKeyWrite(redisDb *db, robj *key){
     expireIfNeeded(db,key);
     return lookupKey(db,key,LOOKUP_NONE);
@@ -68,11 +131,14 @@ robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply){
     return o;
 };
 
+/* The key is copied into the dict entry (see dbDictType), the caller
+ * keeps ownership of 'key'. */
 void dbAdd(redisDb *db, robj *key, robj *val){
-   sds copy = sdsdup(key->ptr); 
-   int retval = dictAdd(db->dict, copy,val);
+   dictEntry *de = dictAddRaw(db->dict,key->ptr,NULL);
 
-   serverAssertWithInfo(NULL,key,retval == DICT_OK);
+   serverAssertWithInfo(NULL,key,de != NULL);
+   dictSetVal(db->dict,de,val);
+   evictionIndexAdd(db,de);
    if(val->type == OBJ_LIST) signalListAsReady(db,key);
    if(server.cluster_enabled) slotToKeyAdd(key);
 };
@@ -118,7 +184,7 @@ robj *dbRandomKey(redisDb *db){
         key = dictGetKey(de);
 
         keyobj = createStringObject(key,sdslen(key));
-        if(dictFind(db->expires,key)){
+        if(server.expires_inline ? keyHasInlineExpire(key) : dictFind(db->expires,key) != NULL){
             if(expireIfNeeded(db,keyobj)){
                 decrRefCount(keyobj);
                 continue;
@@ -129,8 +195,15 @@ robj *dbRandomKey(redisDb *db){
 };
 
 int dbSyncDelete(redisDb *db, robj *key){
-    if(dictSize(db->expires) > 0) dictDelete(db->expires,key->ptr);
-    if(dictDelete(db->dict, key->ptr) == DICT_OK){
+    dictEntry *de;
+
+    if(dictSize(db->expires) > 0) dbDeleteExpire(db,key->ptr);
+    if((de = dictUnlink(db->dict,key->ptr)) != NULL){
+        if(server.lazyfree_incremental && lazyfreeReclaimDetach(dictGetVal(de))){
+            dictSetVal(db->dict,de,NULL);
+        };
+        dbForgetKey(db,dictGetKey(de));
+        dictFreeUnlinkedEntry(db->dict,de);
         if(server.cluster_enabled) slotToKeyDel(key);
         return 1;
     }else{
@@ -174,6 +247,9 @@ long long emptyDb(int dbnum, int flags, void(callback)(void *)){
             dictEmpty(server.db[j].dict, callback);
             dictEmpty(server.db[j].expires, callback);
         }
+        server.db[j].inline_expires = 0;
+        evictionIndexEmpty(&server.db[j]);
+        expireIndexEmpty(&server.db[j]);
     }
 
     if(server.cluster_enabled){
@@ -252,6 +328,10 @@ void flushallCommand(client *c){
 void delGenericCommand(client *c, int lazy){
     int numdel = 0, j;
     for(j = 1; j < c->argc; j++){
+        if((j - 1) % DB_LOOKUP_BATCH == 0){
+            int n = c->argc - j;
+            dbPrefetchKeys(c->db,c->argv + j,n > DB_LOOKUP_BATCH ? DB_LOOKUP_BATCH : n);
+        };
         expireIfNeeded(c->db,c->argv[j]);
         int deleted = lazy ? dbAsyncDelete(c->db,c->argv[j]) : dbSyncDelete(c->db,c->argv[j]);
 
@@ -274,12 +354,20 @@ void unlinkCommand(client *c){
     delGenericCommand(c,1);
 };
 
+/* EXISTS neither touches the keys nor counts as a keyspace hit or miss,
+ * as it did when it only checked the dict. */
 void existsCommand(client *c){
+    robj *vals[DB_LOOKUP_BATCH];
     long long count = 0;
-    int j;
-    for(int j = 1; j < c->argc;j++){
-        expireIfNeeded(c->db,c->argv[j]);
-        if(dbExists(c->db,c->argv[j])) count++;
+    int j, k, n;
+
+    for(j = 1; j < c->argc; j += n){
+        n = c->argc - j;
+        if(n > DB_LOOKUP_BATCH) n = DB_LOOKUP_BATCH;
+        lookupKeysReadWithFlags(c->db,c->argv + j,vals,n,LOOKUP_NOTOUCH|LOOKUP_NOSTATS);
+        for(k = 0; k < n; k++){
+            if(vals[k]) count++;
+        };
     };
 
     addReplyLongLong(c,count);
@@ -341,18 +429,20 @@ void propagateExpire(redisDb *db, robj *key, int lazy){
     incrRefCount(argv[0]);
     incrRefCount(argv[1]);
 
-    if(server.aof_state != AOF_OFF){
-        feedAppendOnlyFile(server.delCommand, db->id,argv,2);
-    };
-
-    replicationFeedSlaves(server.slaves, db->id,argv,2);
+    /* Through propagate(), so that inside EXEC the DEL is queued after the
+     * commands that already ran instead of overtaking them. */
+    propagate(server.delCommand,db->id,argv,2,PROPAGATE_AOF|PROPAGATE_REPL);
 
     decrRefCount(argv[0]);
     decrRefCount(argv[1]);
 };
 
 int expireIfNeeded(redisDb *db, robj *key){
-    mstime_t when = getExpire(db,key);
+    return expireKeyIfNeeded(db,key,getExpire(db,key));
+};
+
+/* expireIfNeeded() for a key whose expire time 'when' was already read. */
+static int expireKeyIfNeeded(redisDb *db, robj *key, mstime_t when){
     mstime_t now;
 
     if(when < 0) return 0;
@@ -372,8 +462,178 @@ int expireIfNeeded(redisDb *db, robj *key){
 
 
 
+/* Inline expires.
+ *
+ * With expires-inline (a startup only setting) the absolute expire time of
+ * a volatile key is stored in the db->dict key itself, in the 8 bytes that
+ * follow the sds null terminator, and a bit of the sds flags byte that no
+ * type but SDS_TYPE_5 uses marks the keys carrying one. Keys are embedded
+ * in their dict entry, which reserves that room when the option is on, so
+ * a volatile key costs 8 bytes instead of a dictEntry and a bucket in
+ * db->expires, and reading its TTL is done on the entry the lookup
+ * already touched. db->expires stays empty: the TTL
+ * index (see expire.c) is what active expiration walks, and the room also
+ * has the pointer to the index node of the key, right after the time. */
+#define KEY_FLAG_INLINE_EXPIRE (1<<SDS_TYPE_BITS)
+
+int keyHasInlineExpire(sds key){
+    unsigned char flags = key[-1];
+    return (flags & SDS_TYPE_MASK) != SDS_TYPE_5 && (flags & KEY_FLAG_INLINE_EXPIRE);
+};
+
+long long keyGetInlineExpire(sds key){
+    long long when;
+    memcpy(&when,key + sdslen(key) + 1,sizeof(when));
+    return when;
+};
+
+/* Store 'when' after the key, in the room dictSdsEmbed() reserved. */
+static void keySetInlineExpire(sds key, long long when){
+    serverAssert(sdsavail(key) >= sizeof(when));
+    memcpy(key + sdslen(key) + 1,&when,sizeof(when));
+    key[-1] |= KEY_FLAG_INLINE_EXPIRE;
+};
+
+/* Eviction index handles.
+ *
+ * The eviction index (see evict.c) refers to the db->dict entries of the
+ * keys it tracks. When the index is enabled, dictSdsEmbed() also reserves
+ * a pointer at the end of the key room, where the index keeps the list
+ * node of the key, so that deleting the key can clear that node at once.
+ * A second flag bit marks the keys that have the room: keys created while
+ * the index was disabled are not indexed. */
+#define KEY_FLAG_EVIDX_ROOM (1<<(SDS_TYPE_BITS+1))
+
+/* Bytes of room dictSdsEmbed() reserves after the terminator of a key. */
+size_t keyRoomSize(void){
+    return (server.expires_inline ? sizeof(long long) + sizeof(void*) : 0) +
+           (server.maxmemory_eviction_index ? sizeof(void*) : 0);
+};
+
+void keyInitRoom(sds key){
+    if(server.maxmemory_eviction_index){
+        key[-1] |= KEY_FLAG_EVIDX_ROOM;
+        keySetEvictionHandle(key,NULL);
+    };
+};
+
+int keyHasEvictionRoom(sds key){
+    unsigned char flags = key[-1];
+    return (flags & SDS_TYPE_MASK) != SDS_TYPE_5 && (flags & KEY_FLAG_EVIDX_ROOM);
+};
+
+void *keyGetEvictionHandle(sds key){
+    void *handle;
+    memcpy(&handle,key + sdsalloc(key) + 1 - sizeof(handle),sizeof(handle));
+    return handle;
+};
+
+void keySetEvictionHandle(sds key, void *handle){
+    memcpy(key + sdsalloc(key) + 1 - sizeof(handle),&handle,sizeof(handle));
+};
+
+/* TTL index handles.
+ *
+ * The TTL index (see expire.c) refers to the db->dict keys of volatile
+ * keys and keeps the list node of each one where its expire time lives:
+ * after the inline expire time, or in the room of the db->expires entry
+ * (see expiresDictType). Removing the expire clears the node. */
+static void **dbExpireHandleRef(redisDb *db, sds key, dictEntry *de){
+    if(server.expires_inline){
+        if(!keyHasInlineExpire(key)) return NULL;
+        return (void**)(key + sdslen(key) + 1 + sizeof(long long));
+    };
+    if(de == NULL && (de = dictFind(db->expires,key)) == NULL) return NULL;
+    return (void**)(de + 1);
+};
+
+void dbSetExpireHandle(redisDb *db, sds key, void *handle){
+    void **ref = dbExpireHandleRef(db,key,NULL);
+
+    serverAssert(ref != NULL);
+    memcpy(ref,&handle,sizeof(handle));
+};
+
+/* Called by the TTL index with the key of a node it just took out of the
+ * index. Returns the expire time of the key, -1 if it has none. */
+long long dbExpireIndexRemoved(redisDb *db, sds key){
+    void *handle = NULL;
+    dictEntry *de = NULL;
+    void **ref;
+
+    if(!server.expires_inline && (de = dictFind(db->expires,key)) == NULL) return -1;
+    if((ref = dbExpireHandleRef(db,key,de)) == NULL) return -1;
+    memcpy(ref,&handle,sizeof(handle));
+    return server.expires_inline ? keyGetInlineExpire(key) : dictGetSignedIntegerVal(de);
+};
+
+/* File 'key' in the TTL index, 'de' being its db->expires entry if any. */
+static void dbExpireIndexAdd(redisDb *db, sds key, dictEntry *de, long long when){
+    void *handle = expireIndexAdd(db,key,when);
+
+    memcpy(dbExpireHandleRef(db,key,de),&handle,sizeof(handle));
+};
+
+static void dbClearExpireHandle(redisDb *db, sds key, dictEntry *de){
+    void **ref = dbExpireHandleRef(db,key,de);
+    void *handle;
+
+    if(ref == NULL) return;
+    memcpy(&handle,ref,sizeof(handle));
+    expireIndexDel(handle);
+};
+
+/* Remove 'key' from db->expires. Returns 1 if it was there. */
+int dbDeleteExpire(redisDb *db, sds key){
+    dictEntry *de = dictUnlink(db->expires,key);
+
+    if(de == NULL) return 0;
+    dbClearExpireHandle(db,key,de);
+    dictFreeUnlinkedEntry(db->expires,de);
+    return 1;
+};
+
+/* Called with the key of an entry that is leaving db->dict. */
+void dbForgetKey(redisDb *db, sds key){
+    if(server.expires_inline && keyHasInlineExpire(key)){
+        dbClearExpireHandle(db,key,NULL);
+        db->inline_expires--;
+    };
+    evictionIndexDel(key);
+};
+
+/* Return the expire time of 'key' or -1 if it has none. */
+long long dbGetExpire(redisDb *db, sds key){
+    dictEntry *de;
+
+    if(server.expires_inline){
+        if(db->inline_expires == 0 || (de = dictFind(db->dict,key)) == NULL) return -1;
+        return dbGetEntryExpire(db,de);
+    };
+    if(dictSize(db->expires) == 0 || (de = dictFind(db->expires,key)) == NULL){
+        return -1;
+    };
+    return dictGetSignedIntegerVal(de);
+};
+
+/* dbGetExpire() for a db->dict entry the caller already found: with inline
+ * expires the time is read from its key without another lookup. */
+long long dbGetEntryExpire(redisDb *db, dictEntry *de){
+    sds key = dictGetKey(de);
+
+    if(server.expires_inline) return keyHasInlineExpire(key) ? keyGetInlineExpire(key) : -1;
+    if(dictSize(db->expires) == 0 || (de = dictFind(db->expires,key)) == NULL) return -1;
+    return dictGetSignedIntegerVal(de);
+};
+
+unsigned long dbExpiresCount(redisDb *db){
+    return dictSize(db->expires) + db->inline_expires;
+};
+
 long long getExpire(redisDb *db, robj *key){
     dictEntry *de;
+
+    if(server.expires_inline) return dbGetExpire(db,key->ptr);
     if(dictSize(db->expires) == 0 || (de = dictFind(db->expires,key->ptr)) == NULL){
         return -1;
     };
@@ -382,9 +642,59 @@ long long getExpire(redisDb *db, robj *key){
     return dictGetSignedIntegerVal(de);
 };
 
+/* Set an absolute expire time for an existing key. Only a new or earlier
+ * deadline needs a new TTL index entry: an extended one is found by the
+ * existing entry when it comes due. */
+void setExpire(client *c, redisDb *db, robj *key, long long when){
+    dictEntry *kde, *de, *existing;
+    int writable_slave = server.masterhost && server.repl_slave_ro == 0;
+    sds k;
+
+    kde = dictFind(db->dict,key->ptr);
+    serverAssertWithInfo(NULL,key,kde != NULL);
+    k = dictGetKey(kde);
+    if(server.expires_inline){
+        if(!keyHasInlineExpire(k)){
+            db->inline_expires++;
+            keySetInlineExpire(k,when);
+            dbExpireIndexAdd(db,k,NULL,when);
+        }else if(when < keyGetInlineExpire(k)){
+            dbClearExpireHandle(db,k,NULL);
+            keySetInlineExpire(k,when);
+            dbExpireIndexAdd(db,k,NULL,when);
+        }else{
+            keySetInlineExpire(k,when);
+        };
+    }else if((de = dictAddRaw(db->expires,k,&existing)) != NULL){
+        dictSetSignedIntegerVal(de,when);
+        dbExpireIndexAdd(db,k,de,when);
+    }else if(when < dictGetSignedIntegerVal(existing)){
+        dbClearExpireHandle(db,k,existing);
+        dictSetSignedIntegerVal(existing,when);
+        dbExpireIndexAdd(db,k,existing,when);
+    }else{
+        dictSetSignedIntegerVal(existing,when);
+    };
+
+    if(c && writable_slave && !(c->flags & CLIENT_MASTER)){
+        rememberSlaveKeyWithExpire(db,key);
+    };
+};
+
 int removeExpire(redisDb *db, robj *key){
-    serverAssertWithInfo(NULL,key,dictFind(db->dict,key->ptr) != NULL);
-    return dictDelete(db->expires,key->ptr) == DICT_OK;
+    dictEntry *kde = dictFind(db->dict,key->ptr);
+
+    serverAssertWithInfo(NULL,key,kde != NULL);
+    if(server.expires_inline){
+        sds k = dictGetKey(kde);
+
+        if(!keyHasInlineExpire(k)) return 0;
+        dbClearExpireHandle(db,k,NULL);
+        k[-1] &= ~KEY_FLAG_INLINE_EXPIRE;
+        db->inline_expires--;
+        return 1;
+    };
+    return dbDeleteExpire(db,key->ptr);
 };
 
 
@@ -54,9 +54,29 @@ static void _dictReset(dictht *ht){
 dict *dictCreate(dictType *type, void *privDataPtr){
     dict *d = zmalloc(sizeof(*d));
     _dictInit(d,type,privDataPtr);
+    d->bytes = zmalloc_size(d);
     return d;
 };
 
+/* Allocation size of an entry of a sized dict, key and value included. */
+static size_t _dictEntryBytes(dict *d, dictEntry *he){
+    size_t bytes = zmalloc_size(he) + d->type->keyBytes(he->key);
+    if(d->type->valBytes) bytes += d->type->valBytes(he->v.val);
+    return bytes;
+};
+
+/* Take an entry about to be removed out of the byte counter. A value
+ * changed in place without dictSetValAccounted() would make the counter
+ * smaller than what it is asked to subtract. */
+static void _dictUnaccountEntry(dict *d, dictEntry *he){
+    size_t bytes;
+
+    if(!dictIsSized(d)) return;
+    bytes = _dictEntryBytes(d,he);
+    assert(d->bytes >= bytes);
+    d->bytes -= bytes;
+};
+
 int _dictInit(dict *d, dictType *type, void *privDataPtr){
     _dictReset(&d->ht[0]);
     _dictReset(&d->ht[1]);
@@ -64,6 +84,7 @@ int _dictInit(dict *d, dictType *type, void *privDataPtr){
     d->privdata = privDataPtr;
     d->rehashidx = -1;
     d->iterators = 0;
+    d->bytes = 0;
     return DICT_OK;
 };
 
@@ -90,6 +111,7 @@ int dictExpand(dict *d, unsigned long size){
     n.sizemask = realsize - 1;
     n.table = zcalloc(realsize * sizeof(dictEntry*));    
     n.used = 0;
+    d->bytes += zmalloc_size(n.table);
     
     if(d->ht[0].table == NULL){
         d->ht[0] = n;
@@ -132,6 +154,7 @@ int dictRehash(dict *d, int n){
     }
     
     if(d->ht[0].used == 0){
+        d->bytes -= zmalloc_size(d->ht[0].table);
         zfree(d->ht[0].table);
         d->ht[0] = d->ht[1];
         _dictReset(&d->ht[1]);
@@ -172,6 +195,7 @@ int dictAdd(dict *d, void *key, void *val){
         return DICT_ERR;
     };
     dictSetVal(d,entry,val);
+    if(dictIsSized(d) && d->type->valBytes) d->bytes += d->type->valBytes(entry->v.val);
     return DICT_OK;
  }
 
@@ -187,12 +211,18 @@ dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing){
     }; 
     
     ht= dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
-    entry = zmalloc(sizeof(*entry));
+    if(d->type->keyEmbed){
+        entry = zmalloc(sizeof(*entry) + d->type->keyEmbedSize(key));
+        entry->key = d->type->keyEmbed(entry + 1,key);
+    }else{
+        entry = zmalloc(sizeof(*entry));
+        dictSetKey(d,entry,key);
+    };
     entry->next = ht->table[index];
     ht->table[index] = entry;
     ht->used++;
     
-    dictSetKey(d,entry,key);
+    if(dictIsSized(d)) d->bytes += zmalloc_size(entry) + d->type->keyBytes(entry->key);
     return entry;
 }
 
@@ -201,15 +231,36 @@ int dictReplace(dict *d, void *key, void *val){
     entry = dictAddRaw(d,key,&existing);
     if(entry){
         dictSetVal(d,entry,val);
+        if(dictIsSized(d) && d->type->valBytes) d->bytes += d->type->valBytes(entry->v.val);
         return 1;
     } 
     auxentry = *existing;
     dictSetVal(d,existing,val);
+    if(dictIsSized(d) && d->type->valBytes){
+        d->bytes += d->type->valBytes(existing->v.val);
+        d->bytes -= d->type->valBytes(auxentry.v.val);
+    };
     dictFreeVal(d,&auxentry);
     return 0;
 
 };
 
+/* Set the value of an existing entry in place, freeing the old one. This
+ * is the only way to change a value in place in a sized dict: the byte
+ * counter moves from the old value's size to the new one's. */
+void dictSetValAccounted(dict *d, dictEntry *de, void *val){
+    dictEntry auxentry = *de;
+
+    /* Set the new value before freeing the old one, which may be the same
+     * object with a reference count (as in dictReplace()). */
+    dictSetVal(d,de,val);
+    if(dictIsSized(d) && d->type->valBytes){
+        d->bytes += d->type->valBytes(de->v.val);
+        d->bytes -= d->type->valBytes(auxentry.v.val);
+    };
+    dictFreeVal(d,&auxentry);
+};
+
 dictEntry *dictAddOrFind(dict *d, void *key){
     dictEntry *entry, *existing;
     entry = dictAddRaw(d,key,&existing);
@@ -240,6 +291,7 @@ static dictEntry *dictGenericDelete(dict *d, const void *key,int nofree){
                     d->ht[table].table[idx] = he->next;
                 };
                 
+                _dictUnaccountEntry(d,he);
                 if(!nofree){
                     dictFreeKey(d,he);
                     dictFreeVal(d,he);
@@ -283,6 +335,7 @@ int _dictClear(dict *d, dictht *ht,void(callback)(void *)){
         if((he = ht->table[i]) == NULL){continue;}; 
         while(he){
             nextHe = he->next;
+            _dictUnaccountEntry(d,he);
             dictFreeKey(d,he);
             dictFreeVal(d,he);
             zfree(he);
@@ -291,6 +344,7 @@ int _dictClear(dict *d, dictht *ht,void(callback)(void *)){
         };
 
     };
+    if(ht->table) d->bytes -= zmalloc_size(ht->table);
     zfree(ht->table);
     _dictReset(ht);
     DICT_OK;
@@ -302,13 +356,42 @@ void dictRelease(dict *d){
     zfree(d);
 }
 
-dictEntry *dictFind(dict *d, const void *key){
+/* Free the entries of the next 'buckets' buckets of a dict nobody else
+ * uses anymore, starting at *cursor and advancing it, so that a huge dict
+ * can be destroyed in steps. Returns 1 once no entry is left, the dict can
+ * then be released by dictRelease() at no cost. */
+int dictEmptyStep(dict *d, unsigned long *cursor, unsigned long buckets){
+    while(buckets-- && d->ht[0].used + d->ht[1].used > 0){
+        dictht *ht = &d->ht[0];
+        unsigned long idx = *cursor;
+        dictEntry *he, *nextHe;
+
+        if(idx >= ht->size){
+            idx -= ht->size;
+            ht = &d->ht[1];
+        };
+        if(idx >= ht->size) break;
+
+        he = ht->table[idx];
+        ht->table[idx] = NULL;
+        while(he){
+            nextHe = he->next;
+            _dictUnaccountEntry(d,he);
+            dictFreeKey(d,he);
+            dictFreeVal(d,he);
+            zfree(he);
+            ht->used--;
+            he = nextHe;
+        };
+        (*cursor)++;
+    };
+    return d->ht[0].used + d->ht[1].used == 0;
+}
+
+static dictEntry *_dictFindWithHash(dict *d, const void *key, uint64_t h){
     dictEntry *he;
-    unsigned int h, idx, table;
-    
-    if(d->ht[0].used + d->ht[1].used == 0){ return NULL;};
-    if(dictIsRehashing(d)) _dictRehashStep(d);
-    h = dictHashKey(d,key);
+    unsigned int idx, table;
+
     for(table = 0; table <= 1; table++){
         idx = h & d->ht[table].sizemask;
         he = d->ht[table].table[idx];
@@ -323,6 +406,69 @@ dictEntry *dictFind(dict *d, const void *key){
     return NULL;
 };
 
+dictEntry *dictFind(dict *d, const void *key){
+    if(d->ht[0].used + d->ht[1].used == 0){ return NULL;};
+    if(dictIsRehashing(d)) _dictRehashStep(d);
+    return _dictFindWithHash(d,key,dictHashKey(d,key));
+};
+
+#if defined(__GNUC__)
+#define dictPrefetch(p) __builtin_prefetch(p)
+#else
+#define dictPrefetch(p) ((void)(p))
+#endif
+
+#define DICT_FIND_BATCH 16
+
+/* Look up 'count' keys at once, setting entries[j] to the entry of keys[j]
+ * or to NULL. A lookup is a chain of dependent cache misses: the bucket,
+ * the entry, then the key it points to. Here every stage is issued as a
+ * prefetch for a whole batch of keys before moving to the next one, so the
+ * misses of different keys overlap instead of being paid one after the
+ * other. Values are prefetched as pointers too, which is harmless for
+ * dicts storing integers. */
+void dictFindMany(dict *d, void * const *keys, dictEntry **entries, unsigned long count){
+    uint64_t hashes[DICT_FIND_BATCH];
+    unsigned long base, n, j;
+    int table;
+
+    if(d->ht[0].used + d->ht[1].used == 0){
+        for(j = 0; j < count; j++) entries[j] = NULL;
+        return;
+    };
+    if(dictIsRehashing(d)) _dictRehashStep(d);
+
+    for(base = 0; base < count; base += n){
+        n = count - base;
+        if(n > DICT_FIND_BATCH) n = DICT_FIND_BATCH;
+
+        for(j = 0; j < n; j++){
+            hashes[j] = dictHashKey(d,keys[base + j]);
+            for(table = 0; table <= dictIsRehashing(d); table++){
+                dictPrefetch(d->ht[table].table + (hashes[j] & d->ht[table].sizemask));
+            };
+        };
+        for(j = 0; j < n; j++){
+            for(table = 0; table <= dictIsRehashing(d); table++){
+                dictEntry *he = d->ht[table].table[hashes[j] & d->ht[table].sizemask];
+                if(he) dictPrefetch(he);
+            };
+        };
+        for(j = 0; j < n; j++){
+            for(table = 0; table <= dictIsRehashing(d); table++){
+                dictEntry *he = d->ht[table].table[hashes[j] & d->ht[table].sizemask];
+                if(he){
+                    dictPrefetch(he->key);
+                    dictPrefetch(he->v.val);
+                };
+            };
+        };
+        for(j = 0; j < n; j++){
+            entries[base + j] = _dictFindWithHash(d,keys[base + j],hashes[j]);
+        };
+    };
+};
+
 void *dictFetchValue(dict *d, const void *key){
     dictEntry *he;
     he = dictFind(d,key);
@@ -27,6 +27,21 @@ typedef struct dictType {
     int (*keyCompare)(void *privdata,const void *key1, const void *key2);
     void (*keyDestructor)(void *privdata, void *key);
     void (*valDestructor)(void *privdata, void *obj);
+    /* Optional. When set, the dict keeps in 'bytes' the exact allocation
+     * size of its tables, entries, keys and values (the latter only with
+     * valBytes). Values of such dicts must be set with dictAdd(),
+     * dictReplace() or dictSetValAccounted(): assigning dictGetVal() in
+     * place is not accounted, and trips an assert when the entry goes. */
+    size_t (*keyBytes)(const void *key);
+    size_t (*valBytes)(const void *obj);
+    /* Optional. When set, keys are copied into the entry allocation itself:
+     * keyEmbedSize returns the room a key needs and keyEmbed builds the copy
+     * in 'buf', returning the pointer to store as the key. The caller keeps
+     * ownership of the key it passes to dictAdd(), and such types have no
+     * keyDestructor since keys go away with their entry. A type may also
+     * use the room for per entry data and return the key as it is. */
+    size_t (*keyEmbedSize)(const void *key);
+    void *(*keyEmbed)(void *buf, const void *key);
 } dictType;
 
 
@@ -44,6 +59,7 @@ typedef struct dict {
     dictht ht[2];
     long rehashidx;
     unsigned long iterators;
+    size_t bytes;
 } dict;
 
 
@@ -63,7 +79,7 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define DICT_HT_INITIAL_SIZE 4
 
 #define dictFreeVal(d,entry)\
-    if((d)->type->valDup) \
+    if((d)->type->valDestructor) \
     (d)->type->valDestructor((d)->privdata,(entry)->v.val)
 
 #define dictSetVal(d,entry,_val_) do { \
@@ -108,6 +124,8 @@ typedef void (dictScanBucketFunction)(void *privdata, dictEntry **bucketref);
 #define dictSlots(d) ((d)->ht[0].size + (d)->ht[1].size)
 #define dictSize(d) ((d)->ht[0].used + (d)->ht[1].used)
 #define dictIsRehashing(d) ((d)->rehashidx != -1)
+#define dictIsSized(d) ((d)->type->keyBytes != NULL)
+#define dictBytes(d) ((d)->bytes)
 /*API*/
 
 
@@ -117,11 +135,14 @@ int dictAdd(dict *d, void *key, void *val);
 dictEntry *dictAddRaw(dict *d, void *key, dictEntry **existing);
 dictEntry *dictAddOrFind(dict *d, void *key);
 int dictReplace(dict *d, void *key, void *value);
+void dictSetValAccounted(dict *d, dictEntry *de, void *val);
 int dictDelete(dict *d, const void *key);
 dictEntry *dictUnlink(dict *ht, const void *key);
 void dictFreeUnlinkedEntry(dict *d, dictEntry *he);
 void dictRelease(dict *d);
+int dictEmptyStep(dict *d, unsigned long *cursor, unsigned long buckets);
 dictEntry *dictFind(dict *d, const void *key);
+void dictFindMany(dict *d, void * const *keys, dictEntry **entries, unsigned long count);
 void *dictFetchValue(dict *d, const void *key);
 int dictResize(dict *d);
 dictIterator *dictGetIterator(dict *d);
@@ -46,6 +46,38 @@ void evictionPoolAlloc(void){
 };
 
 
+/* GDSF-style victim score: the colder the object and the more memory it
+ * holds, the better candidate it is. The product saturates instead of
+ * wrapping so huge cold values still sort last. */
+static unsigned long long evictionSizeAwareScore(unsigned long long idle, robj *o){
+    unsigned long long size = objectComputeSize(o,OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+
+    idle++;
+    if(size && idle > ULLONG_MAX / size) return ULLONG_MAX;
+    return idle * size;
+};
+
+
+#define EVICTION_MIXED_MAX_ROUNDS 16
+
+/* With inline expires a volatile policy has no dict of volatile keys to
+ * sample from: db->dict is sampled instead and non volatile keys skipped,
+ * giving up after a few rounds if they are too rare to be found. */
+static int evictionSamplesMixed(void){
+    return server.expires_inline && !(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS);
+};
+
+static dict *evictionSampleDict(redisDb *db){
+    if(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS || server.expires_inline) return db->dict;
+    return db->expires;
+};
+
+static unsigned long evictionCandidatesCount(redisDb *db){
+    if(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) return dictSize(db->dict);
+    return dbExpiresCount(db);
+};
+
+
 void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool){
     int j, k, count;
     dictEntry *samples[server.maxmemory_samples];
@@ -59,6 +91,7 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
 
         de = samples[j];
         key = dictGetKey(de);
+        if(evictionSamplesMixed() && !keyHasInlineExpire(key)) continue;
 
         if(server.maxmemory_policy != MAXMEMORY_VOLATILE_TTL){
             if(sampledict != keydict) de = dictFind(keydict, key);
@@ -70,11 +103,16 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
         }else if(server.maxmemory_policy & MAXMEMORY_FLAG_LFU){
             idle = 255 - LFUDecrAndReturn(o); 
         }else if(server.maxmemory_policy  == MAXMEMORY_VOLATILE_TTL){
-            idle = ULLONG_MAX - (long) dictGetVal(de);
+            idle = ULLONG_MAX - (server.expires_inline ? keyGetInlineExpire(key) : (long) dictGetVal(de));
         }else{
             serverPanic("Unknown eviction policy in evictionPoolPolulate()");
         };
 
+        if(server.maxmemory_eviction_size_aware &&
+           server.maxmemory_policy & (MAXMEMORY_FLAG_LRU | MAXMEMORY_FLAG_LFU)){
+            idle = evictionSizeAwareScore(idle,o);
+        };
+
         k = 0;
         while(k < EVPOOL_SIZE && pool[k].key && pool[k].idle < idle) k++;
 
@@ -137,7 +175,9 @@ uint8_t LFULogIncr(uint8_t counter){
 
 
 #define LFU_DECR_INTERVAL 1
-unsigned long LFUDecrAndReturn(robj *o){
+/* The counter of 'o' once decayed, without storing it back: for callers
+ * that only inspect keys and must not change their eviction state. */
+unsigned long LFUPeekDecayed(const robj *o){
     unsigned long ldt = o->lru >> 8;
     unsigned long counter = o->lru & 255;
     if(LFUTimeElapsed(ldt) >= server.lfu_decay_time && counter){
@@ -147,11 +187,275 @@ unsigned long LFUDecrAndReturn(robj *o){
         }else{
             counter--;
         }
-        o->lru = (LFUGetTimeInMinutes()<<8) | counter;
     };
     return counter;
 };
 
+unsigned long LFUDecrAndReturn(robj *o){
+    unsigned long counter = LFUPeekDecayed(o);
+
+    if(counter != (o->lru & 255)) o->lru = (LFUGetTimeInMinutes()<<8) | counter;
+    return counter;
+};
+
+
+
+/* Approximate global eviction index.
+ *
+ * When maxmemory_eviction_index is enabled with an allkeys LRU/LFU policy,
+ * every key added to a db is also appended to one of EVIDX_BUCKETS coarse
+ * buckets: the counter value for LFU, or the time slot of the last access
+ * for LRU, where LRU buckets form a ring starting at the oldest slot. The
+ * index is never touched on access: lookupKey() only refreshes the 24 bit
+ * lru field as usual, and a key found in a bucket that no longer matches
+ * its lru/counter is simply moved to the right bucket when eviction
+ * reaches it.
+ *
+ * List nodes point to the db->dict entry of the key, and the key keeps a
+ * handle to its node (see keyGetEvictionHandle()). Deleting a key only
+ * clears the node it points to: cleared nodes are dropped when they are
+ * popped, or by evictionIndexCompact() if they pile up. */
+
+#define EVIDX_BUCKETS 256
+#define EVIDX_LRU_SLOT_BITS 4
+#define EVIDX_POP_MAX_REFILE 64
+
+typedef struct evictionIndex {
+    list *buckets[EVIDX_BUCKETS];
+    unsigned long long cursor;
+    unsigned long count;
+    int policy;
+} evictionIndex;
+
+static unsigned long long evidx_clock = 0;
+static unsigned int evidx_lastlru = 0;
+
+static int evictionIndexEnabled(void){
+    return server.maxmemory_eviction_index &&
+           (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) &&
+           (server.maxmemory_policy & (MAXMEMORY_FLAG_LRU | MAXMEMORY_FLAG_LFU));
+};
+
+/* The LRU clock wraps every LRU_CLOCK_MAX ticks: the index uses its own
+ * monotonic version of it so that slot numbers can be compared directly. */
+static unsigned long long evictionIndexClock(void){
+    unsigned int now = LRU_CLOCK();
+    evidx_clock += (now - evidx_lastlru) & LRU_CLOCK_MAX;
+    evidx_lastlru = now;
+    return evidx_clock;
+};
+
+static unsigned long long evictionIndexSlotOf(evictionIndex *idx, robj *o){
+    unsigned long long now, idle, slot;
+
+    if(idx->policy & MAXMEMORY_FLAG_LFU) return LFUDecrAndReturn(o);
+
+    now = evictionIndexClock();
+    idle = estimateObjectIdleTime(o) / LRU_CLOCK_RESOLUTION;
+    slot = ((idle > now) ? 0 : now - idle) >> EVIDX_LRU_SLOT_BITS;
+    return (slot < idx->cursor) ? idx->cursor : slot;
+};
+
+static list **evictionIndexBucket(evictionIndex *idx, unsigned long long slot){
+    return idx->buckets + (slot % EVIDX_BUCKETS);
+};
+
+/* Make room in the LRU ring for 'slot' by merging the oldest buckets into
+ * the following ones, so the oldest bucket simply gets colder. */
+static void evictionIndexAdvance(evictionIndex *idx, unsigned long long slot){
+    int moved = 0;
+
+    if(idx->count == 0 && slot >= EVIDX_BUCKETS){
+        idx->cursor = slot - EVIDX_BUCKETS + 1;
+        return;
+    };
+
+    while(slot - idx->cursor >= EVIDX_BUCKETS && moved < EVIDX_BUCKETS){
+        list **old = evictionIndexBucket(idx,idx->cursor);
+        list **next = evictionIndexBucket(idx,idx->cursor + 1);
+        list *tmp;
+
+        listJoin(*old,*next);
+        tmp = *next;
+        *next = *old;
+        *old = tmp;
+        idx->cursor++;
+        moved++;
+    };
+
+    if(slot - idx->cursor >= EVIDX_BUCKETS){
+        /* Everything is now in the cursor bucket: move it to the new start. */
+        unsigned long long newcursor = slot - EVIDX_BUCKETS + 1;
+        list **old = evictionIndexBucket(idx,idx->cursor);
+        list **next = evictionIndexBucket(idx,newcursor);
+        list *tmp = *next;
+
+        *next = *old;
+        *old = tmp;
+        idx->cursor = newcursor;
+    };
+};
+
+static void evictionIndexInsert(evictionIndex *idx, dictEntry *de, unsigned long long slot){
+    list *bucket;
+
+    if(!(idx->policy & MAXMEMORY_FLAG_LFU)) evictionIndexAdvance(idx,slot);
+    bucket = *evictionIndexBucket(idx,slot);
+    listAddNodeTail(bucket,de);
+    keySetEvictionHandle(dictGetKey(de),listLast(bucket));
+    idx->count++;
+};
+
+static evictionIndex *evictionIndexCreate(void){
+    evictionIndex *idx = zmalloc(sizeof(*idx));
+    int j;
+
+    for(j = 0; j < EVIDX_BUCKETS; j++) idx->buckets[j] = listCreate();
+    idx->cursor = 0;
+    idx->count = 0;
+    idx->policy = server.maxmemory_policy;
+    if(!(idx->policy & MAXMEMORY_FLAG_LFU)){
+        idx->cursor = evictionIndexClock() >> EVIDX_LRU_SLOT_BITS;
+    };
+    return idx;
+};
+
+/* Free the index of a db whose keys are being dropped as well, so the
+ * handles stored in the keys are left alone. */
+void evictionIndexEmpty(redisDb *db){
+    evictionIndex *idx = db->evidx;
+    int j;
+
+    if(idx == NULL) return;
+    for(j = 0; j < EVIDX_BUCKETS; j++) listRelease(idx->buckets[j]);
+    zfree(idx);
+    db->evidx = NULL;
+};
+
+/* Free the index of a db whose keys stay, after a policy change. */
+static void evictionIndexDrop(redisDb *db){
+    evictionIndex *idx = db->evidx;
+    int j;
+
+    for(j = 0; j < EVIDX_BUCKETS; j++){
+        listIter li;
+        listNode *ln;
+
+        listRewind(idx->buckets[j],&li);
+        while((ln = listNext(&li))){
+            dictEntry *de = listNodeValue(ln);
+            if(de) keySetEvictionHandle(dictGetKey(de),NULL);
+        };
+    };
+    evictionIndexEmpty(db);
+};
+
+/* Called when 'key' leaves its db: clear the node pointing to its entry. */
+void evictionIndexDel(sds key){
+    listNode *ln;
+
+    if(!keyHasEvictionRoom(key) || (ln = keyGetEvictionHandle(key)) == NULL) return;
+    listNodeValue(ln) = NULL;
+    keySetEvictionHandle(key,NULL);
+};
+
+static int evictionIndexColdest(evictionIndex *idx, unsigned long long *slot);
+
+/* Nodes of deleted keys are only cleared. If they pile up because nothing
+ * gets evicted, walk a few entries from the coldest bucket, dropping
+ * cleared nodes and moving live keys to the bucket they belong to. */
+#define EVIDX_COMPACT_STEPS 8
+static void evictionIndexCompact(redisDb *db){
+    evictionIndex *idx = db->evidx;
+    unsigned long long slot;
+    int j;
+
+    for(j = 0; j < EVIDX_COMPACT_STEPS && evictionIndexColdest(idx,&slot); j++){
+        list *bucket = *evictionIndexBucket(idx,slot);
+        listNode *ln = listFirst(bucket);
+        dictEntry *de = listNodeValue(ln);
+
+        listDelNode(bucket,ln);
+        idx->count--;
+        if(de) evictionIndexInsert(idx,de,evictionIndexSlotOf(idx,dictGetVal(de)));
+    };
+};
+
+void evictionIndexAdd(redisDb *db, dictEntry *de){
+    if(!evictionIndexEnabled() || !keyHasEvictionRoom(dictGetKey(de))) return;
+    if(db->evidx && db->evidx->policy != server.maxmemory_policy) evictionIndexDrop(db);
+    if(db->evidx == NULL) db->evidx = evictionIndexCreate();
+    evictionIndexInsert(db->evidx,de,evictionIndexSlotOf(db->evidx,dictGetVal(de)));
+    if(db->evidx->count > dictSize(db->dict) * 2 + EVIDX_BUCKETS) evictionIndexCompact(db);
+};
+
+/* Return the coldest non empty slot of the index, advancing the LRU
+ * cursor past empty buckets. */
+static int evictionIndexColdest(evictionIndex *idx, unsigned long long *slot){
+    unsigned long long s;
+    int j;
+
+    if(idx->count == 0) return 0;
+    s = (idx->policy & MAXMEMORY_FLAG_LFU) ? 0 : idx->cursor;
+    for(j = 0; j < EVIDX_BUCKETS; j++, s++){
+        if(listLength(*evictionIndexBucket(idx,s))){
+            if(!(idx->policy & MAXMEMORY_FLAG_LFU)) idx->cursor = s;
+            *slot = s;
+            return 1;
+        };
+    };
+    return 0;
+};
+
+/* Pop the coldest key across all the dbs. The returned sds is the key owned
+ * by the db dictionary, like the keys returned by the sampling pool. NULL
+ * is returned if the index is empty or if too many stale entries had to be
+ * moved, in which case the caller falls back to sampling. */
+static sds evictionIndexPop(int *dbid){
+    evictionIndex *idx;
+    redisDb *db = NULL;
+    unsigned long long slot = 0, s;
+    int j, refiled = 0;
+
+    for(j = 0; j < server.dbnum; j++){
+        idx = server.db[j].evidx;
+        if(idx == NULL) continue;
+        if(idx->policy != server.maxmemory_policy){
+            evictionIndexDrop(server.db + j);
+            continue;
+        };
+        if(evictionIndexColdest(idx,&s) && (db == NULL || s < slot)){
+            db = server.db + j;
+            slot = s;
+        };
+    };
+    if(db == NULL) return NULL;
+
+    idx = db->evidx;
+    while(refiled < EVIDX_POP_MAX_REFILE && evictionIndexColdest(idx,&slot)){
+        list *bucket = *evictionIndexBucket(idx,slot);
+        listNode *ln = listFirst(bucket);
+        dictEntry *de = listNodeValue(ln);
+
+        listDelNode(bucket,ln);
+        idx->count--;
+        if(de == NULL) continue;
+
+        /* Refile keys touched (or, with LFU, decayed) since they were
+         * filed: a colder key is popped right away from its new bucket. */
+        s = evictionIndexSlotOf(idx,dictGetVal(de));
+        if(s != slot){
+            evictionIndexInsert(idx,de,s);
+            refiled++;
+            continue;
+        };
+
+        keySetEvictionHandle(dictGetKey(de),NULL);
+        *dbid = db->id;
+        return dictGetKey(de);
+    };
+    return NULL;
+};
 
 
 size_t freeMemoryGetNotCountedMemory(void){
@@ -174,23 +478,142 @@ size_t freeMemoryGetNotCountedMemory(void){
         overhead += sdslen(server.aof_buf) + aofRewriteBufferSize();
     };
 
+    overhead += lazyfreeReclaimPendingBytes();
     return overhead;
 };
 
 
+size_t freeMemoryGetUsedMemory(void){
+    size_t mem_used = zmalloc_used_memory();
+    size_t overhead = freeMemoryGetNotCountedMemory();
+    return (mem_used > overhead) ? mem_used - overhead : 0;
+};
+
+
+/* Pick the next key to evict according to the configured policy. Returns
+ * NULL when there is nothing left that can be evicted, otherwise the key
+ * is owned by the db dictionary and its db is stored in *dbid. */
+static sds evictionSelectKey(int *dbid){
+    int j, k, i, rounds = 0;
+    static int next_db = 0;
+    sds bestKey = NULL;
+    redisDb *db;
+    dict *dict;
+    dictEntry *de;
+
+    if(evictionIndexEnabled() && (bestKey = evictionIndexPop(dbid)) != NULL){
+        return bestKey;
+    };
+
+    if(server.maxmemory_policy & (MAXMEMORY_FLAG_LRU | MAXMEMORY_FLAG_LFU)||
+    server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL){
+        struct evictionPoolEntry *pool = evictionPoolLRU;
+        while(bestKey == NULL){
+            unsigned long total_keys = 0, keys;
+
+            for(i = 0; i < server.dbnum; i++){
+                db = server.db + i;
+                dict = evictionSampleDict(db);
+                if((keys = evictionCandidatesCount(db)) != 0){
+                    evictionPoolPopulate(i,dict, db->dict, pool);
+                    total_keys += keys;
+                };
+            };
+            if(!total_keys) break;
+            if(evictionSamplesMixed() && ++rounds > EVICTION_MIXED_MAX_ROUNDS) break;
+            for(k = EVPOOL_SIZE - 1; k >= 0; k--){
+                if(pool[k].key == NULL) continue;
+                *dbid = pool[k].dbid;
+
+                if(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS){
+                    de = dictFind(server.db[pool[k].dbid].dict,pool[k].key);
+                }else if(server.expires_inline){
+                    de = dictFind(server.db[pool[k].dbid].dict,pool[k].key);
+                    if(de && !keyHasInlineExpire(dictGetKey(de))) de = NULL;
+                }else{
+                    de = dictFind(server.db[pool[k].dbid].expires, pool[k].key);
+                };
+
+                if(pool[k].key != pool[k].cached){
+                    sdsfree(pool[k].key);
+                }
+
+                pool[k].key = NULL;
+                pool[k].idle = 0;
+
+                if(de){
+                    bestKey = dictGetKey(de);
+                    break;
+                };
+            };
+        };
+
+    }else if(server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
+             server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM
+    ){
+        for(i = 0; i < server.dbnum; i++){
+            j = (++next_db) % server.dbnum;
+            db = server.db + j;
+            if(evictionCandidatesCount(db) == 0) continue;
+            dict = evictionSampleDict(db);
+            for(k = 0; k < EVICTION_MIXED_MAX_ROUNDS && bestKey == NULL; k++){
+                de = dictGetRandomKey(dict);
+                if(evictionSamplesMixed() && !keyHasInlineExpire(dictGetKey(de))) continue;
+                bestKey = dictGetKey(de);
+                *dbid = j;
+            };
+            if(bestKey) break;
+        };
+    };
+    return bestKey;
+};
+
+
+/* Evict the key and return the number of bytes the allocator reports as
+ * released, plus the estimated size of the value if the incremental
+ * reclaimer took it. With lazy freeing most of the value is reclaimed
+ * later by the BIO thread, so the returned delta can be much smaller than
+ * the value. */
+static long long evictionDeleteKey(int dbid, sds key, int lazy, mstime_t *latency){
+    redisDb *db = server.db + dbid;
+    robj *keyobj = createStringObject(key, sdslen(key));
+    mstime_t eviction_latency;
+    long long delta;
+    size_t detached = lazyfreeReclaimPendingBytes();
+
+    propagateExpire(db,keyobj,lazy);
+
+    delta = (long long)zmalloc_used_memory();
+    latencyStartMonitor(eviction_latency);
+    if(lazy){
+        dbAsyncDelete(db,keyobj);
+    }else{
+        dbSyncDelete(db,keyobj);
+    }
+    latencyEndMonitor(eviction_latency);
+    latencyAddSampleIfNeeded("eviction-del",eviction_latency);
+    latencyRemoveNestedEvent(*latency,eviction_latency);
+    delta -= (long long) zmalloc_used_memory();
+    delta += (long long)(lazyfreeReclaimPendingBytes() - detached);
+
+    server.stat_evictedkeys++;
+    notifyKeyspaceEvent(NOTIFY_EVICTED,"evicted",keyobj,db->id);
+    decrRefCount(keyobj);
+    return delta;
+};
+
+
 int freeMemoryIfNeeded(void){
     size_t mem_reported, mem_used, mem_tofree, mem_freed;
-    mstime_t latency, eviction_latency;
+    mstime_t latency;
     long long delta;
 
-    int slaves = listLength(server.slaves); 
-    mem_reported = zmalloc_used_memory(); 
+    int slaves = listLength(server.slaves);
+    mem_reported = zmalloc_used_memory();
 
     if(mem_reported <= server.maxmemory) return C_OK;
-    mem_used = mem_reported;
 
-    size_t overhead = freeMemoryGetNotCountedMemory();
-    mem_used = (mem_used > overhead) ? mem_used - overhead : 0;
+    mem_used = freeMemoryGetUsedMemory();
     if(mem_used <= server.maxmemory) return C_OK;
 
 
@@ -204,101 +627,19 @@ int freeMemoryIfNeeded(void){
 
     latencyStartMonitor(latency);
     while(mem_freed < mem_tofree){
-        int j, k, i, keys_freed = 0;
-        static int next_db = 0;
-        sds bestKey = NULL;
+        int keys_freed = 0;
         int bestdbid;
-        redisDb *db;
-        dict *dict;
-        dictEntry *de;
-
-        if(server.maxmemory_policy & (MAXMEMORY_FLAG_LRU | MAXMEMORY_FLAG_LFU)|| 
-        server.maxmemory_policy == MAXMEMORY_VOLATILE_TTL){
-            struct evictionPoolEntry *pool = evictionPoolLRU;
-            while(bestKey == NULL){
-                unsigned long total_keys = 0, keys;
-
-                for(i = 0; i < server.dbnum; i++){
-                    db = server.db + i;
-                    dict = (server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS) ? db->dict : db->expires;
-                    if((keys = dictSize(dict)) != 0){
-                        evictionPoolPopulate(i,dict, db->dict, pool);
-                        total_keys += keys;
-                    };
-                };
-                if(!total_keys) break;
-                for(k = EVPOOL_SIZE - 1; k >= 0; k--){
-                    if(pool[k].key == NULL) continue;
-                    bestdbid = pool[k].dbid;
-
-                    if(server.maxmemory_policy & MAXMEMORY_FLAG_ALLKEYS){
-                        de = dictFind(server.db[pool[k].dbid].dict,pool[k].key);
-                    }else{
-                        de = dictFind(server.db[pool[k].dbid].expires, pool[k].key);
-                    };
-
-                    if(pool[k].key != pool[k].cached){
-                        sdsfree(pool[k].key);
-                    }
-
-                    pool[k].key = NULL;
-                    pool[k].idle = 0;
-
-                    if(de){
-                        bestKey = dictGetKey(de);
-                        break;
-                    }else{
-
-                    };
-                };
-            };
-
-        }else if(server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM ||
-                 server.maxmemory_policy == MAXMEMORY_VOLATILE_RANDOM
-        ){
-            for(i = 0; i < server.dbnum; i++){
-                j = (++next_db) % server.dbnum;
-                db = server.db++;
-                dict = (server.maxmemory_policy == MAXMEMORY_ALLKEYS_RANDOM) ? db->dict : db->expires;
-                if(dictSize(dict)!= 0){
-                    de = dictGetRandomKey(dict);
-                    bestKey = dictGetKey(de);
-                    bestdbid = j;
-                    break;
-                };
-            };
-        };
+        sds bestKey = evictionSelectKey(&bestdbid);
 
         if(bestKey){
-            db = server.db + bestdbid;
-            robj * keyobj = createStringObject(bestKey, sdslen(bestKey));
-            propagateExpire(db,keyobj,server.lazyfree_lazy_eviction);
-
-            delta = (long long)zmalloc_used_memory();
-            latencyStartMonitor(eviction_latency);
-            if(server.lazyfree_lazy_eviction){
-                dbAsyncDelete(db,keyobj);
-            }else{
-                dbSyncDelete(db,keyobj);
-            }
-            latencyEndMonitor(eviction_latency);
-            latencyAddSampleIfNeeded("eviction-del",eviction_latency);
-            latencyRemoveNestedEvent(latency,eviction_latency);
-            delta -= (long long) zmalloc_used_memory();
+            delta = evictionDeleteKey(bestdbid,bestKey,server.lazyfree_lazy_eviction,&latency);
             mem_freed += delta;
-
-            server.stat_evictedkeys++;
-            notifyKeyspaceEvent(NOTIFY_EVICTED,"evicted",keyobj,db->id);
-            decrRefCount(keyobj);
             keys_freed++;
 
             if(slaves) flushSlavesOutputBuffers();
-            
+
             if(server.lazyfree_lazy_eviction && !(keys_freed % 16)){
-                overhead = freeMemoryGetNotCountedMemory();
-                mem_used = zmalloc_used_memory();
-                mem_used = (mem_used > overhead) ? mem_used - overhead : 0;
-                if(mem_used <= server.maxmemory){
+                if(freeMemoryGetUsedMemory() <= server.maxmemory){
                     mem_freed = mem_tofree;
                 }
             };
@@ -326,3 +667,180 @@ int freeMemoryIfNeeded(void){
         return C_ERR;
 }
 
+
+#define EVICTION_CRON_TIME_PERC 5
+#define EVICTION_CRON_KEYS_PER_LOOP 16
+
+/* Background eviction, called by serverCron(). When a low watermark is
+ * configured, keys are evicted ahead of demand until the used memory drops
+ * to maxmemory-eviction-lowwater percent of maxmemory, so that
+ * freeMemoryIfNeeded() rarely has to evict from the command path. Victims
+ * are always freed lazily, which means the allocator does not see the
+ * memory go away right now: progress is tracked with the estimated size of
+ * each evicted value instead. */
+void evictionCron(void){
+    size_t mem_used, mem_lowwater, mem_freed = 0;
+    long long start, timelimit;
+    mstime_t latency;
+    int slaves = listLength(server.slaves);
+    int iteration = 0;
+
+    if(!server.maxmemory || server.maxmemory_eviction_lowwater <= 0) return;
+    if(server.maxmemory_eviction_lowwater > CONFIG_MAX_MAXMEMORY_EVICTION_LOWWATER) return;
+    if(server.maxmemory_policy == MAXMEMORY_NO_EVICTION) return;
+    if(server.masterhost && server.repl_slave_ro) return;
+
+    mem_lowwater = server.maxmemory / 100 * server.maxmemory_eviction_lowwater;
+    mem_used = freeMemoryGetUsedMemory();
+    if(mem_used <= mem_lowwater) return;
+
+    start = ustime();
+    timelimit = 1000000 * EVICTION_CRON_TIME_PERC / server.hz / 100;
+    if(timelimit <= 0) timelimit = 1;
+
+    latencyStartMonitor(latency);
+    while(mem_used > mem_lowwater + mem_freed){
+        int bestdbid;
+        sds bestKey = evictionSelectKey(&bestdbid);
+        dictEntry *de;
+        size_t size;
+
+        if(bestKey == NULL) break;
+        de = dictFind(server.db[bestdbid].dict,bestKey);
+        size = sdsAllocSize(bestKey) + sizeof(dictEntry);
+        if(de) size += objectComputeSize(dictGetVal(de),OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+
+        evictionDeleteKey(bestdbid,bestKey,1,&latency);
+        mem_freed += size;
+
+        if((++iteration % EVICTION_CRON_KEYS_PER_LOOP) == 0){
+            if(slaves) flushSlavesOutputBuffers();
+            if(ustime() - start > timelimit) break;
+        };
+    };
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("eviction-cron",latency);
+};
+
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include <math.h>
+
+#define EVTEST_KEYSPACE 200000
+#define EVTEST_CAPACITY 20000
+#define EVTEST_REQUESTS 2000000
+#define EVTEST_ZIPF_S 0.9
+#define EVTEST_REQUESTS_PER_TICK 1000
+
+static long long evtestUsec(void){
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000) + tv.tv_usec;
+};
+
+static double *evtestZipfCdf(void){
+    double *cdf = zmalloc(sizeof(double) * EVTEST_KEYSPACE);
+    double sum = 0;
+    int j;
+
+    for(j = 0; j < EVTEST_KEYSPACE; j++){
+        sum += 1.0 / pow(j + 1, EVTEST_ZIPF_S);
+        cdf[j] = sum;
+    };
+    for(j = 0; j < EVTEST_KEYSPACE; j++) cdf[j] /= sum;
+    return cdf;
+};
+
+static long evtestZipfNext(double *cdf){
+    double r = (double) rand() / RAND_MAX;
+    long lo = 0, hi = EVTEST_KEYSPACE - 1;
+
+    while(lo < hi){
+        long mid = (lo + hi) / 2;
+        if(cdf[mid] < r) lo = mid + 1; else hi = mid;
+    };
+    return lo;
+};
+
+/* Replay the same Zipf distributed request stream against a cache holding
+ * EVTEST_CAPACITY keys, evicting one key per miss once full, and report the
+ * resulting hit ratio. */
+static void evtestRun(double *cdf, int policy, int use_index){
+    redisDb *db = server.db;
+    long long hits = 0, start;
+    char buf[32];
+    long j;
+
+    server.maxmemory_policy = policy;
+    server.maxmemory_eviction_index = use_index;
+    server.lruclock = 0;
+    dictEmpty(db->dict,NULL);
+    evictionIndexEmpty(db);
+    srand(1234);
+
+    start = evtestUsec();
+    for(j = 0; j < EVTEST_REQUESTS; j++){
+        robj key;
+        int len = ll2string(buf,sizeof(buf),evtestZipfNext(cdf));
+        sds keyname = sdsnewlen(buf,len);
+
+        if((j % EVTEST_REQUESTS_PER_TICK) == 0){
+            server.lruclock = (server.lruclock + 1) & LRU_CLOCK_MAX;
+        };
+
+        initStaticStringObject(key,keyname);
+        if(lookupKey(db,&key,LOOKUP_NONE)){
+            hits++;
+        }else{
+            if(dictSize(db->dict) >= EVTEST_CAPACITY){
+                int dbid;
+                sds victim = evictionSelectKey(&dbid);
+                robj *keyobj;
+
+                if(victim){
+                    keyobj = createStringObject(victim,sdslen(victim));
+                    dbSyncDelete(db,keyobj);
+                    decrRefCount(keyobj);
+                };
+            };
+            dbAdd(db,&key,createStringObject("v",1));
+        };
+        sdsfree(keyname);
+    };
+
+    printf("%-12s %-8s hit ratio: %.4f (%lld usec)\n",
+        (policy & MAXMEMORY_FLAG_LFU) ? "allkeys-lfu" : "allkeys-lru",
+        use_index ? "index" : "sampling",
+        (double) hits / EVTEST_REQUESTS, evtestUsec() - start);
+};
+
+int evictTest(int argc, char **argv){
+    double *cdf = evtestZipfCdf();
+
+    UNUSED(argc);
+    UNUSED(argv);
+
+    server.hz = CONFIG_DEFAULT_HZ;
+    server.dbnum = 1;
+    server.db = zcalloc(sizeof(redisDb));
+    server.db->dict = dictCreate(&dbDictType,NULL);
+    server.db->expires = dictCreate(&expiresDictType,NULL);
+    server.rdb_child_pid = -1;
+    server.aof_child_pid = -1;
+    server.cluster_enabled = 0;
+    server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
+    server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
+    server.unixtime = time(NULL);
+    evictionPoolAlloc();
+
+    evtestRun(cdf,MAXMEMORY_ALLKEYS_LRU,0);
+    evtestRun(cdf,MAXMEMORY_ALLKEYS_LRU,1);
+    evtestRun(cdf,MAXMEMORY_ALLKEYS_LFU,0);
+    evtestRun(cdf,MAXMEMORY_ALLKEYS_LFU,1);
+
+    zfree(cdf);
+    return 0;
+};
+#endif
@@ -0,0 +1,237 @@
+#include "server.h"
+
+
+/* TTL index.
+ *
+ * Every db with volatile keys has a two level timer wheel keyed on the
+ * absolute expire time. Level 0 has one bucket per EXPIRE_INDEX_SLOT_MS
+ * milliseconds for the next EXPIRE_INDEX_SLOTS slots, level 1 has one
+ * bucket per full turn of level 0 (an epoch); deadlines further away are
+ * clamped to the last epoch. When the cursor enters an epoch its level 1
+ * bucket is drained into level 0, so each key is filed at most twice.
+ *
+ * Nodes point at the key owned by the db->dict entry, and the key keeps
+ * its node (see dbExpireHandleRef() in db.c). removeExpire() and deletions
+ * clear the node in place, and the cleared nodes are dropped when their
+ * bucket comes due or is compacted. A TTL that is extended leaves its node
+ * where it is: the node is moved to the right bucket when it comes due. */
+
+#define EXPIRE_INDEX_SLOT_MS 1000
+#define EXPIRE_INDEX_SLOTS 4096
+#define EXPIRE_INDEX_EPOCHS 4096
+#define EXPIRE_INDEX_COMPACT_STEPS 8
+#define EXPIRE_INDEX_COMPACT_SCAN 64
+
+typedef struct expireIndex {
+    list *slots[EXPIRE_INDEX_SLOTS];
+    list *epochs[EXPIRE_INDEX_EPOCHS];
+    long long cursor;
+    unsigned long count;
+    unsigned long compact_bucket;
+} expireIndex;
+
+static expireIndex *expireIndexCreate(void){
+    expireIndex *idx = zcalloc(sizeof(*idx));
+    idx->cursor = mstime() / EXPIRE_INDEX_SLOT_MS;
+    return idx;
+};
+
+static list **expireIndexBucketFor(expireIndex *idx, long long when){
+    long long slot = when / EXPIRE_INDEX_SLOT_MS;
+    long long epoch, cursor_epoch;
+    list **bucket;
+
+    if(slot < idx->cursor) slot = idx->cursor;
+    if(slot - idx->cursor < EXPIRE_INDEX_SLOTS){
+        bucket = idx->slots + (slot % EXPIRE_INDEX_SLOTS);
+    }else{
+        epoch = slot / EXPIRE_INDEX_SLOTS;
+        cursor_epoch = idx->cursor / EXPIRE_INDEX_SLOTS;
+        if(epoch - cursor_epoch >= EXPIRE_INDEX_EPOCHS) epoch = cursor_epoch + EXPIRE_INDEX_EPOCHS - 1;
+        bucket = idx->epochs + (epoch % EXPIRE_INDEX_EPOCHS);
+    };
+    if(*bucket == NULL) *bucket = listCreate();
+    return bucket;
+};
+
+static listNode *expireIndexInsert(expireIndex *idx, sds key, long long when){
+    list *bucket = *expireIndexBucketFor(idx,when);
+
+    listAddNodeTail(bucket,key);
+    idx->count++;
+    return listLast(bucket);
+};
+
+/* Take the first node out of 'bucket'. Returns its key and sets '*when' to
+ * the expire time of the key, or returns NULL if the node was cleared. */
+static sds expireIndexPopBucket(redisDb *db, expireIndex *idx, list *bucket, long long *when){
+    listNode *ln = listFirst(bucket);
+    sds key = listNodeValue(ln);
+
+    listDelNode(bucket,ln);
+    idx->count--;
+    if(key) *when = dbExpireIndexRemoved(db,key);
+    return key;
+};
+
+/* Re-file a key taken out of the index. */
+static void expireIndexRefile(redisDb *db, sds key, long long when){
+    dbSetExpireHandle(db,key,expireIndexInsert(db->expires_index,key,when));
+};
+
+static void expireIndexFreeBuckets(list **buckets, int count){
+    int j;
+
+    for(j = 0; j < count; j++){
+        if(buckets[j]) listRelease(buckets[j]);
+    };
+};
+
+void expireIndexEmpty(redisDb *db){
+    expireIndex *idx = db->expires_index;
+
+    if(idx == NULL) return;
+    expireIndexFreeBuckets(idx->slots,EXPIRE_INDEX_SLOTS);
+    expireIndexFreeBuckets(idx->epochs,EXPIRE_INDEX_EPOCHS);
+    zfree(idx);
+    db->expires_index = NULL;
+};
+
+/* Cleared nodes are reclaimed when they come due, which may be days away.
+ * If they pile up, revisit a few buckets round robin, dropping cleared
+ * nodes and refiling live ones. */
+static void expireIndexCompact(redisDb *db){
+    expireIndex *idx = db->expires_index;
+    int steps = 0, scanned = 0;
+
+    while(steps < EXPIRE_INDEX_COMPACT_STEPS && scanned < EXPIRE_INDEX_COMPACT_SCAN){
+        unsigned long b = idx->compact_bucket % (EXPIRE_INDEX_SLOTS + EXPIRE_INDEX_EPOCHS);
+        list *bucket = (b < EXPIRE_INDEX_SLOTS) ? idx->slots[b] : idx->epochs[b - EXPIRE_INDEX_SLOTS];
+        long long when;
+        sds key;
+
+        if(bucket == NULL || listLength(bucket) == 0){
+            idx->compact_bucket++;
+            scanned++;
+            continue;
+        };
+
+        key = expireIndexPopBucket(db,idx,bucket,&when);
+        if(key) expireIndexRefile(db,key,when);
+        idx->compact_bucket++;
+        steps++;
+    };
+};
+
+/* File 'key', which must be the db->dict key, and return its node. The
+ * caller stores it with the key: compaction runs first so that it never
+ * refiles the key being added. */
+void *expireIndexAdd(redisDb *db, sds key, long long when){
+    if(db->expires_index == NULL){
+        db->expires_index = expireIndexCreate();
+    }else if(db->expires_index->count == 0){
+        long long slot = mstime() / EXPIRE_INDEX_SLOT_MS;
+        if(slot > db->expires_index->cursor) db->expires_index->cursor = slot;
+    }else if(db->expires_index->count > dbExpiresCount(db) * 2 + EXPIRE_INDEX_SLOTS){
+        expireIndexCompact(db);
+    };
+    return expireIndexInsert(db->expires_index,key,when);
+};
+
+/* Clear the node of a key that lost its expire or is being deleted. */
+void expireIndexDel(void *handle){
+    if(handle) listNodeValue((listNode*)handle) = NULL;
+};
+
+
+static void activeExpireCycleExpireKey(redisDb *db, sds key){
+    robj *keyobj = createStringObject(key,sdslen(key));
+
+    propagateExpire(db,keyobj,server.lazyfree_lazy_expire);
+    if(server.lazyfree_lazy_expire){
+        dbAsyncDelete(db,keyobj);
+    }else{
+        dbSyncDelete(db,keyobj);
+    };
+    notifyKeyspaceEvent(NOTIFY_EXPIRED,"expired",keyobj,db->id);
+    decrRefCount(keyobj);
+    server.stat_expiredkeys++;
+};
+
+/* Handle a node popped from a due bucket: expire the key, or move it
+ * where it belongs if the TTL was extended. */
+static void expireIndexProcessEntry(redisDb *db, list *bucket, long long now){
+    long long when;
+    sds key = expireIndexPopBucket(db,db->expires_index,bucket,&when);
+
+    if(key == NULL) return;
+    if(when <= now){
+        activeExpireCycleExpireKey(db,key);
+    }else{
+        expireIndexRefile(db,key,when);
+    };
+};
+
+#define ACTIVE_EXPIRE_CYCLE_CHECK_TIME_EVERY 16
+
+/* Expire the due keys of 'db' in deadline order until nothing is due or
+ * the time limit is reached. Returns 1 if the time limit was hit. */
+static int activeExpireCycleDb(redisDb *db, long long start, long long timelimit){
+    expireIndex *idx = db->expires_index;
+    long long now = mstime();
+    unsigned long iteration = 0;
+
+    while(idx->count){
+        list *epoch = idx->epochs[(idx->cursor / EXPIRE_INDEX_SLOTS) % EXPIRE_INDEX_EPOCHS];
+        list *slot = idx->slots[idx->cursor % EXPIRE_INDEX_SLOTS];
+
+        if((++iteration % ACTIVE_EXPIRE_CYCLE_CHECK_TIME_EVERY) == 0){
+            if(ustime() - start > timelimit) return 1;
+            now = mstime();
+        };
+
+        if(epoch && listLength(epoch)){
+            expireIndexProcessEntry(db,epoch,now);
+        }else if((idx->cursor + 1) * EXPIRE_INDEX_SLOT_MS > now){
+            break;
+        }else if(slot && listLength(slot)){
+            expireIndexProcessEntry(db,slot,now);
+        }else{
+            idx->cursor++;
+        };
+    };
+    return 0;
+};
+
+void activeExpireCycle(int type){
+    static unsigned int current_db = 0;
+    static int timelimit_exit = 0;
+    static long long last_fast_cycle = 0;
+
+    int j, dbs_per_call = server.dbnum;
+    long long start = ustime(), timelimit;
+    mstime_t latency;
+
+    if(type == ACTIVE_EXPIRE_CYCLE_FAST){
+        if(!timelimit_exit) return;
+        if(start < last_fast_cycle + ACTIVE_EXPIRE_CYCLE_FAST_DURATION * 2) return;
+        last_fast_cycle = start;
+        timelimit = ACTIVE_EXPIRE_CYCLE_FAST_DURATION;
+    }else{
+        timelimit = 1000000 * ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC / server.hz / 100;
+    };
+    if(timelimit <= 0) timelimit = 1;
+
+    latencyStartMonitor(latency);
+    timelimit_exit = 0;
+    for(j = 0; j < dbs_per_call && !timelimit_exit; j++){
+        redisDb *db = server.db + (current_db % server.dbnum);
+
+        current_db++;
+        if(db->expires_index == NULL) continue;
+        timelimit_exit = activeExpireCycleDb(db,start,timelimit);
+    };
+
+    latencyEndMonitor(latency);
+    latencyAddSampleIfNeeded("expire-cycle",latency);
+};
@@ -36,7 +36,7 @@ static int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc){
         memrev32ifbe(&v32);
         return v32;
     }else{
-        memcpy(&v16,((int16_t*)is->contents)+pos,sizeof(16));
+        memcpy(&v16,((int16_t*)is->contents)+pos,sizeof(v16));
         memrev16ifbe(&v16);
         return v16;
     };
@@ -79,6 +79,89 @@ static intset *intsetResize(intset *is, uint32_t len){
 };
 
 
+/* Lookups and set algebra work on the typed arrays directly on little
+ * endian hosts. A search narrows the range with a branchless binary
+ * search and finishes on the last few elements with one vector compare.
+ * Intersections of two sets with the same encoding compare a block of one
+ * set against a block of the other per step, 16-bit with SSE4.2 string
+ * compare and 32-bit with SSE2 or AVX2, picked at runtime the first time
+ * they are needed. */
+#if (BYTE_ORDER == LITTLE_ENDIAN) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define INTSET_HAVE_SIMD 1
+#endif
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+/* Branchless narrowing of a lower bound search over a[0..len), len > 0,
+ * down to at most INTSET_SEARCH_TAIL candidates starting at 'base'. All
+ * elements before 'base' are below 'v', all elements after the remaining
+ * candidates are not, so the lower bound is 'base' plus the number of
+ * elements below 'v' in any span that starts at 'base' and covers the
+ * candidates. */
+#define INTSET_SEARCH_TAIL 8
+#define INTSET_LOWER_BOUND_NARROW(T) \
+    const T *base = a, *end = a + len; \
+    while(len > INTSET_SEARCH_TAIL){ \
+        uint32_t half = len / 2; \
+        base = (base[half] < v) ? base + half : base; \
+        len -= half; \
+    }
+
+static uint32_t intsetLowerBound16(const int16_t *a, uint32_t len, int16_t v){
+    INTSET_LOWER_BOUND_NARROW(int16_t);
+#ifdef INTSET_HAVE_SIMD
+    if(base + 8 <= end){
+        __m128i lt = _mm_cmplt_epi16(_mm_loadu_si128((const __m128i*)base),_mm_set1_epi16(v));
+        return (base - a) + __builtin_popcount(_mm_movemask_epi8(lt)) / 2;
+    }
+#endif
+    while(base < end && *base < v) base++;
+    return base - a;
+};
+
+static uint32_t intsetLowerBound32(const int32_t *a, uint32_t len, int32_t v){
+    INTSET_LOWER_BOUND_NARROW(int32_t);
+#ifdef INTSET_HAVE_SIMD
+    if(base + 8 <= end){
+        __m128i vv = _mm_set1_epi32(v);
+        __m128i lt0 = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)base),vv);
+        __m128i lt1 = _mm_cmplt_epi32(_mm_loadu_si128((const __m128i*)(base + 4)),vv);
+        return (base - a) + __builtin_popcount(_mm_movemask_epi8(_mm_packs_epi32(lt0,lt1))) / 2;
+    }
+#endif
+    while(base < end && *base < v) base++;
+    return base - a;
+};
+
+static uint32_t intsetLowerBound64(const int64_t *a, uint32_t len, int64_t v){
+    INTSET_LOWER_BOUND_NARROW(int64_t);
+    while(base < end && *base < v) base++;
+    return base - a;
+};
+
+static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos){
+    uint32_t len = intrev32ifbe(is->length), encoding = intrev32ifbe(is->encoding), p;
+    uint8_t found;
+
+    if(len == 0){
+        if(pos) *pos = 0;
+        return 0;
+    }
+
+    if(encoding == INTSET_ENC_INT64){
+        p = intsetLowerBound64((const int64_t*)is->contents,len,value);
+        found = p < len && ((const int64_t*)is->contents)[p] == value;
+    }else if(encoding == INTSET_ENC_INT32){
+        p = intsetLowerBound32((const int32_t*)is->contents,len,value);
+        found = p < len && ((const int32_t*)is->contents)[p] == value;
+    }else{
+        p = intsetLowerBound16((const int16_t*)is->contents,len,value);
+        found = p < len && ((const int16_t*)is->contents)[p] == value;
+    }
+    if(pos) *pos = p;
+    return found;
+}
+#else
 static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos){
     int min = 0, max = intrev32ifbe(is->length) - 1, mid = -1;
     int64_t cur = -1;
@@ -115,7 +198,8 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos){
         if(pos) *pos = min;
         return 0;
     }
-}   
+}
+#endif
 
 static intset *intsetUpgradeAndAdd(intset *is, int64_t value){
     uint8_t curenc = intrev32ifbe(is->encoding);
@@ -229,6 +313,231 @@ size_t intsetBlobLen(intset *is){
     return sizeof(intset) + intrev32ifbe(is->length)*intrev32ifbe(is->encoding);
 }
 
+
+/* Sorted array kernels behind intsetIntersection() and intsetUnion(). They
+ * write to 'out' and return the number of elements written. */
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+#define INTSET_MERGE_KERNELS(T, suffix) \
+static uint32_t intsetIntersectScalar##suffix(const T *a, uint32_t la, const T *b, uint32_t lb, T *out){ \
+    uint32_t i = 0, j = 0, n = 0; \
+    while(i < la && j < lb){ \
+        T x = a[i], y = b[j]; \
+        out[n] = x; \
+        n += x == y; \
+        i += x <= y; \
+        j += y <= x; \
+    } \
+    return n; \
+} \
+static uint32_t intsetUnion##suffix(const T *a, uint32_t la, const T *b, uint32_t lb, T *out){ \
+    uint32_t i = 0, j = 0, n = 0; \
+    if(la && lb && b[lb - 1] < a[0]){ \
+        const T *t = a; a = b; b = t; \
+        n = la; la = lb; lb = n; \
+        n = 0; \
+    } \
+    if(la && lb && a[la - 1] < b[0]){ \
+        memcpy(out,a,la * sizeof(T)); \
+        memcpy(out + la,b,lb * sizeof(T)); \
+        return la + lb; \
+    } \
+    while(i < la && j < lb){ \
+        T x = a[i], y = b[j]; \
+        out[n++] = x < y ? x : y; \
+        i += x <= y; \
+        j += y <= x; \
+    } \
+    memcpy(out + n,a + i,(la - i) * sizeof(T)); \
+    n += la - i; \
+    memcpy(out + n,b + j,(lb - j) * sizeof(T)); \
+    return n + lb - j; \
+}
+
+INTSET_MERGE_KERNELS(int16_t, 16)
+INTSET_MERGE_KERNELS(int32_t, 32)
+INTSET_MERGE_KERNELS(int64_t, 64)
+
+typedef uint32_t intsetIntersect16Fn(const int16_t *a, uint32_t la, const int16_t *b, uint32_t lb, int16_t *out);
+typedef uint32_t intsetIntersect32Fn(const int32_t *a, uint32_t la, const int32_t *b, uint32_t lb, int32_t *out);
+
+#ifdef INTSET_HAVE_SIMD
+/* Emit the elements of the block at 'a' whose bit is set in 'mask'. */
+#define INTSET_EMIT_MATCHES(a, mask, out, n) \
+    while(mask){ \
+        (out)[(n)++] = (a)[__builtin_ctz(mask)]; \
+        mask &= mask - 1; \
+    }
+
+/* Blocks of 8 from each side are compared all against all by the SSE4.2
+ * string compare; the block with the smaller last element moves on. */
+__attribute__((target("sse4.2")))
+static uint32_t intsetIntersectSSE42_16(const int16_t *a, uint32_t la, const int16_t *b, uint32_t lb, int16_t *out){
+    uint32_t i = 0, j = 0, n = 0;
+
+    while(i + 8 <= la && j + 8 <= lb){
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+        unsigned int mask = _mm_cvtsi128_si32(_mm_cmpestrm(vb,8,va,8,
+                                _SIDD_UWORD_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK));
+        int16_t amax = a[i + 7], bmax = b[j + 7];
+
+        INTSET_EMIT_MATCHES(a + i,mask,out,n);
+        i += (amax <= bmax) * 8;
+        j += (bmax <= amax) * 8;
+    }
+    return n + intsetIntersectScalar16(a + i,la - i,b + j,lb - j,out + n);
+};
+
+__attribute__((target("sse2")))
+static uint32_t intsetIntersectSSE2_32(const int32_t *a, uint32_t la, const int32_t *b, uint32_t lb, int32_t *out){
+    uint32_t i = 0, j = 0, n = 0;
+
+    while(i + 4 <= la && j + 4 <= lb){
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va,vb),
+                         _mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,_MM_SHUFFLE(0,3,2,1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,_MM_SHUFFLE(1,0,3,2))),
+                         _mm_cmpeq_epi32(va,_mm_shuffle_epi32(vb,_MM_SHUFFLE(2,1,0,3)))));
+        unsigned int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        int32_t amax = a[i + 3], bmax = b[j + 3];
+
+        INTSET_EMIT_MATCHES(a + i,mask,out,n);
+        i += (amax <= bmax) * 4;
+        j += (bmax <= amax) * 4;
+    }
+    return n + intsetIntersectScalar32(a + i,la - i,b + j,lb - j,out + n);
+};
+
+__attribute__((target("avx2")))
+static uint32_t intsetIntersectAVX2_32(const int32_t *a, uint32_t la, const int32_t *b, uint32_t lb, int32_t *out){
+    uint32_t i = 0, j = 0, n = 0;
+    const __m256i rot = _mm256_setr_epi32(1,2,3,4,5,6,7,0);
+
+    while(i + 8 <= la && j + 8 <= lb){
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + j));
+        __m256i eq = _mm256_cmpeq_epi32(va,vb);
+        unsigned int mask;
+        int32_t amax = a[i + 7], bmax = b[j + 7];
+
+        for(int k = 1; k < 8; k++){
+            vb = _mm256_permutevar8x32_epi32(vb,rot);
+            eq = _mm256_or_si256(eq,_mm256_cmpeq_epi32(va,vb));
+        }
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        INTSET_EMIT_MATCHES(a + i,mask,out,n);
+        i += (amax <= bmax) * 8;
+        j += (bmax <= amax) * 8;
+    }
+    return n + intsetIntersectSSE2_32(a + i,la - i,b + j,lb - j,out + n);
+};
+#endif
+
+static intsetIntersect16Fn *intsetIntersect16Impl = NULL;
+static intsetIntersect32Fn *intsetIntersect32Impl = NULL;
+
+static void intsetSelectKernels(void){
+    intsetIntersect16Impl = intsetIntersectScalar16;
+    intsetIntersect32Impl = intsetIntersectScalar32;
+#ifdef INTSET_HAVE_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse4.2")) intsetIntersect16Impl = intsetIntersectSSE42_16;
+    if(__builtin_cpu_supports("sse2")) intsetIntersect32Impl = intsetIntersectSSE2_32;
+    if(__builtin_cpu_supports("avx2")) intsetIntersect32Impl = intsetIntersectAVX2_32;
+#endif
+};
+#endif
+
+/* Scalar merge for sets with different encodings, or any set on a big
+ * endian host. Returns the number of elements written to 'out', which is
+ * already sized for the result and has its encoding set. */
+static uint32_t intsetMergeGeneric(intset *a, intset *b, intset *out, int intersect){
+    uint32_t la = intrev32ifbe(a->length), lb = intrev32ifbe(b->length);
+    uint8_t enca = intrev32ifbe(a->encoding), encb = intrev32ifbe(b->encoding);
+    uint32_t i = 0, j = 0, n = 0;
+
+    while(i < la && j < lb){
+        int64_t x = _intsetGetEncoded(a,i,enca), y = _intsetGetEncoded(b,j,encb);
+
+        if(x == y){
+            _intsetSet(out,n++,x);
+            i++;
+            j++;
+        }else if(x < y){
+            if(!intersect) _intsetSet(out,n++,x);
+            i++;
+        }else{
+            if(!intersect) _intsetSet(out,n++,y);
+            j++;
+        }
+    }
+    if(!intersect){
+        for(; i < la; i++) _intsetSet(out,n++,_intsetGetEncoded(a,i,enca));
+        for(; j < lb; j++) _intsetSet(out,n++,_intsetGetEncoded(b,j,encb));
+    }
+    return n;
+};
+
+/* Return a new intset with the elements of both 'a' and 'b'. Its encoding
+ * is the narrower of the two, which holds every common element. */
+intset *intsetIntersection(intset *a, intset *b){
+    uint32_t la = intrev32ifbe(a->length), lb = intrev32ifbe(b->length);
+    uint8_t enca = intrev32ifbe(a->encoding), encb = intrev32ifbe(b->encoding);
+    intset *is = intsetNew();
+    uint32_t n;
+
+    /* One spare slot: the kernels store each candidate before knowing
+     * whether it matches. */
+    is->encoding = intrev32ifbe(enca < encb ? enca : encb);
+    is = intsetResize(is,(la < lb ? la : lb) + 1);
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    if(enca == encb){
+        if(intsetIntersect16Impl == NULL) intsetSelectKernels();
+        if(enca == INTSET_ENC_INT64){
+            n = intsetIntersectScalar64((int64_t*)a->contents,la,(int64_t*)b->contents,lb,(int64_t*)is->contents);
+        }else if(enca == INTSET_ENC_INT32){
+            n = intsetIntersect32Impl((int32_t*)a->contents,la,(int32_t*)b->contents,lb,(int32_t*)is->contents);
+        }else{
+            n = intsetIntersect16Impl((int16_t*)a->contents,la,(int16_t*)b->contents,lb,(int16_t*)is->contents);
+        }
+    }else
+#endif
+    n = intsetMergeGeneric(a,b,is,1);
+
+    is = intsetResize(is,n);
+    is->length = intrev32ifbe(n);
+    return is;
+};
+
+/* Return a new intset with the elements of 'a', 'b' or both. */
+intset *intsetUnion(intset *a, intset *b){
+    uint32_t la = intrev32ifbe(a->length), lb = intrev32ifbe(b->length);
+    uint8_t enca = intrev32ifbe(a->encoding), encb = intrev32ifbe(b->encoding);
+    intset *is = intsetNew();
+    uint32_t n;
+
+    is->encoding = intrev32ifbe(enca > encb ? enca : encb);
+    is = intsetResize(is,la + lb);
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    if(enca == encb){
+        if(enca == INTSET_ENC_INT64){
+            n = intsetUnion64((int64_t*)a->contents,la,(int64_t*)b->contents,lb,(int64_t*)is->contents);
+        }else if(enca == INTSET_ENC_INT32){
+            n = intsetUnion32((int32_t*)a->contents,la,(int32_t*)b->contents,lb,(int32_t*)is->contents);
+        }else{
+            n = intsetUnion16((int16_t*)a->contents,la,(int16_t*)b->contents,lb,(int16_t*)is->contents);
+        }
+    }else
+#endif
+    n = intsetMergeGeneric(a,b,is,0);
+
+    is = intsetResize(is,n);
+    is->length = intrev32ifbe(n);
+    return is;
+};
+
 #ifdef REDIS_TEST
 #include <sys/time.h>
 #include <time.h>
@@ -266,13 +575,13 @@ static void _assert(char *estr, char *file, int line){
 }
 
 static intset *createSet(int bits, int size){
-    uint64_t mask = (1 << bits) - 1;
+    uint64_t mask = (1ULL << bits) - 1;
     uint64_t value;
     intset *is = intsetNew();
     
     for(int i = 0; i < size; i++){
         if(bits > 32){
-            value = (rand() * rand()) & mask;
+            value = (((uint64_t)rand() << 31) ^ (uint64_t)rand() ^ ((uint64_t)rand() << 50)) & mask;
         }else{
             value = rand() & mask;
         }
@@ -335,6 +644,7 @@ int intsetTest(int argc, char **argv){
         is = intsetAdd(is,6,&success);assert(success);
         is = intsetAdd(is,4,&success);assert(success);
         is = intsetAdd(is,4,&success);assert(!success);
+        zfree(is);
         ok();
     }
     
@@ -349,6 +659,7 @@ int intsetTest(int argc, char **argv){
         
         assert(intrev32ifbe(is->length) == inserts);
         checkConsistency(is);
+        zfree(is);
         ok();
     }
     
@@ -358,9 +669,10 @@ int intsetTest(int argc, char **argv){
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT16);        
         is = intsetAdd(is,65535,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT32);
-        assert(intsetFind(32));
-        assert(intsetFind(65535));
+        assert(intsetFind(is,32));
+        assert(intsetFind(is,65535));
         checkConsistency(is);
+        zfree(is);
         
         is = intsetNew();
         is = intsetAdd(is,32,NULL);
@@ -370,6 +682,7 @@ int intsetTest(int argc, char **argv){
         assert(intsetFind(is,32));
         assert(intsetFind(is,-65535));
         checkConsistency(is);
+        zfree(is);
         ok();
     }
         
@@ -382,6 +695,7 @@ int intsetTest(int argc, char **argv){
         assert(intsetFind(is,32));
         assert(intsetFind(is,4294967295));
         checkConsistency(is);
+        zfree(is);
         
         is = intsetNew();
         is = intsetAdd(is,32,NULL); 
@@ -391,6 +705,7 @@ int intsetTest(int argc, char **argv){
         assert(intsetFind(is,32));
         assert(intsetFind(is,-4294967295));
         checkConsistency(is);
+        zfree(is);
         ok(); 
     }
     
@@ -399,10 +714,11 @@ int intsetTest(int argc, char **argv){
         is = intsetAdd(is,65535,NULL);
         assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT32);
         is = intsetAdd(is,4294967295,NULL);
-        assert(intrev32ifbe(is-encoding) == INTSET_ENC_INT64);
+        assert(intrev32ifbe(is->encoding) == INTSET_ENC_INT64);
         assert(intsetFind(is,65535));
         assert(intsetFind(is,4294967295));
         checkConsistency(is);
+        zfree(is);
         
         is= intsetNew();
         is = intsetAdd(is,65535,NULL);
@@ -412,6 +728,7 @@ int intsetTest(int argc, char **argv){
         assert(intsetFind(is,65535));
         assert(intsetFind(is,-4294967295));
         checkConsistency(is);
+        zfree(is);
         ok();
     };
     
@@ -426,8 +743,96 @@ int intsetTest(int argc, char **argv){
             intsetSearch(is,rand() % ((1 << bits) - 1),NULL);
         };
         printf("%ld lookups, %ld element set, %lldusec\n",num,size,usec() - start);
+        zfree(is);
     };
     
+    printf("Search positions match a linear scan: ");{
+        int bits[] = {14, 30, 62};
+        for(int k = 0; k < 3; k++){
+            is = createSet(bits[k],2000);
+            for(i = 0; i < 20000; i++){
+                int64_t v = (int64_t)(rand() - RAND_MAX / 2) * ((int64_t)1 << (bits[k] - 30 > 0 ? bits[k] - 30 : 0));
+                uint32_t pos, expect = 0;
+                uint8_t found;
+
+                if(bits[k] == 14) v = (int16_t)v;
+                else if(bits[k] == 30) v = (int32_t)v;
+                if(_intsetValueEncoding(v) > intrev32ifbe(is->encoding)) continue;
+                while(expect < intrev32ifbe(is->length) && _intsetGet(is,expect) < v) expect++;
+                found = intsetSearch(is,v,&pos);
+                assert(pos == expect);
+                assert(found == (expect < intrev32ifbe(is->length) && _intsetGet(is,expect) == v));
+            }
+            zfree(is);
+        }
+        ok();
+    }
+
+    printf("Intersection and union match a merge: ");{
+        int bits[] = {10, 20, 40};
+        for(i = 0; i < 200; i++){
+            intset *a = createSet(bits[rand() % 3],rand() % 600);
+            intset *b = createSet(bits[rand() % 3],rand() % 600);
+            intset *inter = intsetIntersection(a,b), *uni = intsetUnion(a,b);
+            uint32_t ninter = 0, nuni = 0;
+            int64_t v;
+
+            for(uint32_t j = 0; j < intrev32ifbe(a->length); j++){
+                v = _intsetGet(a,j);
+                if(intsetFind(b,v)){
+                    assert(intsetGet(inter,ninter++,&v) && v == _intsetGet(a,j));
+                }
+                assert(intsetFind(uni,v));
+            }
+            for(uint32_t j = 0; j < intrev32ifbe(b->length); j++){
+                v = _intsetGet(b,j);
+                assert(intsetFind(uni,v));
+                if(!intsetFind(a,v)) nuni++;
+            }
+            nuni += intrev32ifbe(a->length);
+            assert(intrev32ifbe(inter->length) == ninter);
+            assert(intrev32ifbe(uni->length) == nuni);
+            if(ninter > 1) checkConsistency(inter);
+            if(nuni > 1) checkConsistency(uni);
+            zfree(a);
+            zfree(b);
+            zfree(inter);
+            zfree(uni);
+        }
+        ok();
+    }
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    printf("Intersect 500 element sets:\n");{
+        int bits[] = {13, 20};
+        for(int k = 0; k < 2; k++){
+            intset *a = intsetNew(), *b = intsetNew();
+            long long start, scalar, simd;
+            int rounds = 100000;
+
+            while(intrev32ifbe(a->length) < 500) a = intsetAdd(a,rand() & ((1 << bits[k]) - 1),NULL);
+            while(intrev32ifbe(b->length) < 500) b = intsetAdd(b,rand() & ((1 << bits[k]) - 1),NULL);
+            intsetSelectKernels();
+
+            start = usec();
+            for(i = 0; i < rounds; i++) zfree(intsetIntersection(a,b));
+            simd = usec() - start;
+
+            intsetIntersect16Impl = intsetIntersectScalar16;
+            intsetIntersect32Impl = intsetIntersectScalar32;
+            start = usec();
+            for(i = 0; i < rounds; i++) zfree(intsetIntersection(a,b));
+            scalar = usec() - start;
+            intsetSelectKernels();
+
+            printf("  %d bit: %lld ns scalar, %lld ns selected kernel\n",
+                intrev32ifbe(a->encoding) * 8,scalar * 1000 / rounds,simd * 1000 / rounds);
+            zfree(a);
+            zfree(b);
+        }
+    }
+#endif
+
     printf("Stress add+delete: ");{
         int i, v1, v2;
         is = intsetNew();
@@ -441,6 +846,7 @@ int intsetTest(int argc, char **argv){
             assert(!intsetFind(is,v2));
         };
         checkConsistency(is);
+        zfree(is);
         ok();
     }
     return 0; 
@@ -32,8 +32,10 @@ size_t lazyfreeGetFreeEffort(robj *obj){
 
 
 #define LAZYFREE_THRESHOLD 64
+#define LAZYFREE_STEP_ITEMS 512
+#define LAZYFREE_STEP_BUCKETS 256
 int dbAsyncDelete(redisDb *db, robj *key){
-    if(dictSize(db->expires) > 0) dictDelete(db->expires, key->ptr);
+    if(dictSize(db->expires) > 0) dbDeleteExpire(db,key->ptr);
 
     dictEntry *de = dictUnlink(db->dict,key->ptr);
     if(de){
@@ -42,12 +44,14 @@ int dbAsyncDelete(redisDb *db, robj *key){
 
         if(free_effort > LAZYFREE_THRESHOLD){
             atomicIncr(lazyfree_objects, 1, lazyfree_objects_mutex);
-            bioCreateBackgroundJob(BIO_LAZY_FREE,val,NULL,NULL);
+            bioCreateBackgroundJobWithPriority(BIO_LAZY_FREE,
+                (free_effort > LAZYFREE_STEP_ITEMS) ? BIO_PRIO_LOW : BIO_PRIO_HIGH,val,NULL,NULL);
             dictSetVal(db->dict,de,NULL);
         };
     }
 
     if(de){
+        dbForgetKey(db,dictGetKey(de));
         dictFreeUnlinkedEntry(db->dict,de);
         if(server.cluster_enabled) slotToKeyDel(key);
         return 1;
@@ -59,9 +63,12 @@ int dbAsyncDelete(redisDb *db, robj *key){
 void emptyDbAsync(redisDb *db){
     dict *oldht1 = db->dict, *oldht2 = db->expires;
     db->dict = dictCreate(&dbDictType,NULL);
-    db->expires = dictCreate(&keyptrDictType,NULL);
+    db->expires = dictCreate(&expiresDictType,NULL);
+    db->inline_expires = 0;
+    evictionIndexEmpty(db);
+    expireIndexEmpty(db);
     atomicIncr(lazyfree_objects, dictSize(oldht1),lazyfree_objects_mutex);
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,oldht1,oldht2);
+    bioCreateBackgroundJobWithPriority(BIO_LAZY_FREE,BIO_PRIO_LOW,NULL,oldht1,oldht2);
 };
 
 
@@ -69,19 +76,70 @@ void slotToKeyFlushAsync(void){
     zskiplist *oldsl = server.cluster->slots_to_keys;
     server.cluster->slots_to_keys = zslCreate();
     atomicIncr(lazyfree_objects,oldsl->length,lazyfree_objects_mutex);
-    bioCreateBackgroundJob(BIO_LAZY_FREE,NULL,NULL,oldsl);
+    bioCreateBackgroundJobWithPriority(BIO_LAZY_FREE,BIO_PRIO_LOW,NULL,NULL,oldsl);
 };
 
-void lazyfreeFreeObjectFromBioThread(robj *o){
+/* Free the first 'count' nodes of a skiplist that is being destroyed. Only
+ * the level 0 links are kept valid, which is all zslFree() needs. */
+static int lazyfreeSkiplistStep(zskiplist *zsl, unsigned long count){
+    zskiplistNode *x = zsl->header->level[0].forward, *next;
+    int j;
+
+    while(x && count--){
+        next = x->level[0].forward;
+        sdsfree(x->ele);
+        zfree(x);
+        zsl->length--;
+        x = next;
+    };
+    zsl->header->level[0].forward = x;
+    for(j = 1; j < ZSKIPLIST_MAXLEVEL; j++) zsl->header->level[j].forward = NULL;
+    if(x) x->backward = NULL;
+    return x == NULL;
+};
+
+/* Free a step of a big value nobody else references: up to
+ * LAZYFREE_STEP_ITEMS list items or skiplist nodes, or LAZYFREE_STEP_BUCKETS
+ * dict buckets, resuming from *cursor. Returns 1 once what is left can be
+ * released by decrRefCount() in bounded time. */
+static int lazyfreeFreeObjectStep(robj *o, unsigned long *cursor){
+    if(o->type == OBJ_LIST && o->encoding == OBJ_ENCODING_QUICKLIST){
+        quicklist *ql = o->ptr;
+
+        if(ql->count <= LAZYFREE_STEP_ITEMS) return 1;
+        quicklistDelRange(ql,0,LAZYFREE_STEP_ITEMS);
+        return 0;
+    }else if((o->type == OBJ_SET || o->type == OBJ_HASH) && o->encoding == OBJ_ENCODING_HT){
+        return dictEmptyStep(o->ptr,cursor,LAZYFREE_STEP_BUCKETS);
+    }else if(o->type == OBJ_ZSET && o->encoding == OBJ_ENCODING_SKIPLIST){
+        zset *zs = o->ptr;
+
+        if(!dictEmptyStep(zs->dict,cursor,LAZYFREE_STEP_BUCKETS)) return 0;
+        return lazyfreeSkiplistStep(zs->zsl,LAZYFREE_STEP_ITEMS);
+    };
+    return 1;
+};
+
+/* The handlers below run in the BIO thread. Big values and databases are
+ * freed a step at a time: a handler returning 0 is called again later with
+ * the same cursor, after the jobs that were queued meanwhile. */
+int lazyfreeFreeObjectFromBioThread(robj *o, unsigned long *cursor){
+    if(o->refcount == 1 && !lazyfreeFreeObjectStep(o,cursor)) return 0;
     decrRefCount(o);
     atomicDecr(lazyfree_objects, 1, lazyfree_objects_mutex);
+    return 1;
 };
 
-void lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2){
+int lazyfreeFreeDatabaseFromBioThread(dict *ht1, dict *ht2, unsigned long *cursor){
     size_t numkeys = dictSize(ht1);
+    int done = dictEmptyStep(ht1,cursor,LAZYFREE_STEP_BUCKETS);
+
+    atomicDecr(lazyfree_objects,numkeys - dictSize(ht1),lazyfree_objects_mutex);
+    if(!done) return 0;
+    if(!dictEmptyStep(ht2,cursor + 1,LAZYFREE_STEP_BUCKETS)) return 0;
     dictRelease(ht1);
     dictRelease(ht2);
-    atomicDecr(lazyfree_objects,numkeys,lazyfree_objects_mutex);
+    return 1;
 };
 
 void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl){
@@ -91,16 +149,71 @@ void lazyfreeFreeSlotsMapFromBioThread(zskiplist *sl){
 };
 
 
+/* Incremental reclaimer.
+ *
+ * When lazyfree_incremental is set, dbSyncDelete() does not free a big
+ * value in place but detaches it here, and the main thread frees it a
+ * step at a time from serverCron() and beforeSleep() within a time budget.
+ * This bounds the latency of deleting a huge value without involving the
+ * BIO threads. */
+typedef struct lazyfreeReclaimJob{
+    robj *val;
+    unsigned long cursor;
+    size_t size;
+} lazyfreeReclaimJob;
+
+static list *lazyfree_reclaim_jobs = NULL;
+static size_t lazyfree_reclaim_bytes = 0;
+
+/* Estimated bytes still held by detached values. Eviction does not count
+ * them as used: they go away without evicting anything else. */
+size_t lazyfreeReclaimPendingBytes(void){
+    return lazyfree_reclaim_bytes;
+};
 
+/* Take ownership of 'val' if it is worth freeing incrementally. Returns 1
+ * if it did, the caller must then forget the value without releasing it. */
+int lazyfreeReclaimDetach(robj *val){
+    lazyfreeReclaimJob *job;
+
+    if(val->refcount != 1 || lazyfreeGetFreeEffort(val) <= LAZYFREE_THRESHOLD) return 0;
+    if(lazyfree_reclaim_jobs == NULL) lazyfree_reclaim_jobs = listCreate();
+
+    job = zmalloc(sizeof(*job));
+    job->val = val;
+    job->cursor = 0;
+    job->size = objectComputeSize(val,OBJ_COMPUTE_SIZE_DEF_SAMPLES);
+    lazyfree_reclaim_bytes += job->size;
+    listAddNodeTail(lazyfree_reclaim_jobs,job);
+    atomicIncr(lazyfree_objects,1,lazyfree_objects_mutex);
+    return 1;
+};
 
-
-
-
-
-
-
-
-
-
-
-
+/* Free detached values, oldest first, for about 'timelimit' microseconds.
+ * The pending bytes of a job shrink by what each step released. */
+void lazyfreeReclaimCron(long long timelimit){
+    long long start;
+
+    if(lazyfree_reclaim_jobs == NULL || listLength(lazyfree_reclaim_jobs) == 0) return;
+
+    start = ustime();
+    while(listLength(lazyfree_reclaim_jobs)){
+        listNode *ln = listFirst(lazyfree_reclaim_jobs);
+        lazyfreeReclaimJob *job = listNodeValue(ln);
+        size_t used = zmalloc_used_memory(), released;
+
+        if(lazyfreeFreeObjectStep(job->val,&job->cursor)){
+            decrRefCount(job->val);
+            atomicDecr(lazyfree_objects,1,lazyfree_objects_mutex);
+            lazyfree_reclaim_bytes -= job->size;
+            zfree(job);
+            listDelNode(lazyfree_reclaim_jobs,ln);
+        }else{
+            released = (used > zmalloc_used_memory()) ? used - zmalloc_used_memory() : 0;
+            if(released > job->size) released = job->size;
+            job->size -= released;
+            lazyfree_reclaim_bytes -= released;
+        };
+        if(ustime() - start > timelimit) break;
+    };
+};
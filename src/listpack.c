@@ -0,0 +1,862 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include "zmalloc.h"
+#include "util.h"
+#include "listpack.h"
+#include "redisassert.h"
+
+
+/* Listpack layout:
+ *
+ * <total-bytes:4> <num-elements:2> <entry> ... <entry> <end:0xFF>
+ *
+ * Header fields are little endian. Every entry is <encoding+data> <backlen>,
+ * where backlen is the size of <encoding+data> stored so that it can be read
+ * right to left. Unlike the ziplist prevlen field, an entry only describes
+ * itself, so inserting or deleting never has to rewrite its neighbours. */
+
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_EOF 0xFF
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+
+#define LP_ENCODING_INT 0
+#define LP_ENCODING_STRING 1
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte) & LP_ENCODING_7BIT_UINT_MASK) == LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte) & LP_ENCODING_6BIT_STR_MASK) == LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte) & LP_ENCODING_13BIT_INT_MASK) == LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte) & LP_ENCODING_12BIT_STR_MASK) == LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1] << 0) | \
+                                      ((uint32_t)(p)[2] << 8) | \
+                                      ((uint32_t)(p)[3] << 16) | \
+                                      ((uint32_t)(p)[4] << 24))
+
+#define lpGetTotalBytes(p) (((uint32_t)(p)[0] << 0) | \
+                            ((uint32_t)(p)[1] << 8) | \
+                            ((uint32_t)(p)[2] << 16) | \
+                            ((uint32_t)(p)[3] << 24))
+
+#define lpGetNumElements(p) (((uint32_t)(p)[4] << 0) | \
+                             ((uint32_t)(p)[5] << 8))
+
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v) & 0xff; \
+    (p)[1] = ((v) >> 8) & 0xff; \
+    (p)[2] = ((v) >> 16) & 0xff; \
+    (p)[3] = ((v) >> 24) & 0xff; \
+} while(0)
+
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v) & 0xff; \
+    (p)[5] = ((v) >> 8) & 0xff; \
+} while(0)
+
+
+unsigned char *lpNew(void){
+    unsigned char *lp = zmalloc(LP_HDR_SIZE + 1);
+
+    lpSetTotalBytes(lp,LP_HDR_SIZE + 1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+};
+
+void lpFree(unsigned char *lp){
+    zfree(lp);
+};
+
+/* Pick the smallest encoding for 'ele'. Elements that look like integers
+ * are encoded into 'intenc' and LP_ENCODING_INT is returned, otherwise
+ * LP_ENCODING_STRING. In both cases *enclen is set to the size of the
+ * encoding plus data, without the backlen. */
+static int lpEncodeGetType(unsigned char *ele, uint32_t size, unsigned char *intenc, uint64_t *enclen){
+    long long v;
+
+    if(size <= 20 && string2ll((char*)ele,size,&v)){
+        if(v >= 0 && v <= 127){
+            intenc[0] = v;
+            *enclen = 1;
+        }else if(v >= -4096 && v <= 4095){
+            if(v < 0) v = ((int64_t)1 << 13) + v;
+            intenc[0] = (v >> 8) | LP_ENCODING_13BIT_INT;
+            intenc[1] = v & 0xff;
+            *enclen = 2;
+        }else if(v >= -32768 && v <= 32767){
+            if(v < 0) v = ((int64_t)1 << 16) + v;
+            intenc[0] = LP_ENCODING_16BIT_INT;
+            intenc[1] = v & 0xff;
+            intenc[2] = v >> 8;
+            *enclen = 3;
+        }else if(v >= -8388608 && v <= 8388607){
+            if(v < 0) v = ((int64_t)1 << 24) + v;
+            intenc[0] = LP_ENCODING_24BIT_INT;
+            intenc[1] = v & 0xff;
+            intenc[2] = (v >> 8) & 0xff;
+            intenc[3] = v >> 16;
+            *enclen = 4;
+        }else if(v >= -2147483648LL && v <= 2147483647LL){
+            if(v < 0) v = ((int64_t)1 << 32) + v;
+            intenc[0] = LP_ENCODING_32BIT_INT;
+            intenc[1] = v & 0xff;
+            intenc[2] = (v >> 8) & 0xff;
+            intenc[3] = (v >> 16) & 0xff;
+            intenc[4] = v >> 24;
+            *enclen = 5;
+        }else{
+            uint64_t uv = v;
+            int j;
+
+            intenc[0] = LP_ENCODING_64BIT_INT;
+            for(j = 1; j <= 8; j++){
+                intenc[j] = uv & 0xff;
+                uv >>= 8;
+            };
+            *enclen = 9;
+        };
+        return LP_ENCODING_INT;
+    };
+
+    if(size < 64) *enclen = 1 + size;
+    else if(size < 4096) *enclen = 2 + size;
+    else *enclen = 5 + (uint64_t)size;
+    return LP_ENCODING_STRING;
+};
+
+/* Store the backlen 'l' into 'buf' so that it can be decoded starting from
+ * its last byte. Returns the number of bytes used; with a NULL 'buf' the
+ * size is only computed. */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l){
+    if(l <= 127){
+        if(buf) buf[0] = l;
+        return 1;
+    }else if(l < 16383){
+        if(buf){
+            buf[0] = l >> 7;
+            buf[1] = (l & 127) | 128;
+        };
+        return 2;
+    }else if(l < 2097151){
+        if(buf){
+            buf[0] = l >> 14;
+            buf[1] = ((l >> 7) & 127) | 128;
+            buf[2] = (l & 127) | 128;
+        };
+        return 3;
+    }else if(l < 268435455){
+        if(buf){
+            buf[0] = l >> 21;
+            buf[1] = ((l >> 14) & 127) | 128;
+            buf[2] = ((l >> 7) & 127) | 128;
+            buf[3] = (l & 127) | 128;
+        };
+        return 4;
+    }else{
+        if(buf){
+            buf[0] = l >> 28;
+            buf[1] = ((l >> 21) & 127) | 128;
+            buf[2] = ((l >> 14) & 127) | 128;
+            buf[3] = ((l >> 7) & 127) | 128;
+            buf[4] = (l & 127) | 128;
+        };
+        return 5;
+    };
+};
+
+/* Decode the backlen whose last byte is pointed by 'p'. */
+static uint64_t lpDecodeBacklen(unsigned char *p){
+    uint64_t val = 0;
+    uint64_t shift = 0;
+
+    do{
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if(!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+    }while(shift < 35);
+    return val;
+};
+
+static void lpEncodeString(unsigned char *buf, unsigned char *s, uint32_t len){
+    if(len < 64){
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        memcpy(buf + 1,s,len);
+    }else if(len < 4096){
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        memcpy(buf + 2,s,len);
+    }else{
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        memcpy(buf + 5,s,len);
+    };
+};
+
+/* Size of the encoding plus data of the entry at 'p', without backlen. */
+static uint32_t lpCurrentEncodedSize(unsigned char *p){
+    if(LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if(LP_ENCODING_IS_6BIT_STR(p[0])) return 1 + LP_ENCODING_6BIT_STR_LEN(p);
+    if(LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if(LP_ENCODING_IS_12BIT_STR(p[0])) return 2 + LP_ENCODING_12BIT_STR_LEN(p);
+    if(p[0] == LP_ENCODING_16BIT_INT) return 3;
+    if(p[0] == LP_ENCODING_24BIT_INT) return 4;
+    if(p[0] == LP_ENCODING_32BIT_INT) return 5;
+    if(p[0] == LP_ENCODING_64BIT_INT) return 9;
+    if(p[0] == LP_ENCODING_32BIT_STR) return 5 + LP_ENCODING_32BIT_STR_LEN(p);
+    if(p[0] == LP_EOF) return 1;
+    return 0;
+};
+
+static unsigned char *lpSkip(unsigned char *p){
+    unsigned long entrylen = lpCurrentEncodedSize(p);
+
+    entrylen += lpEncodeBacklen(NULL,entrylen);
+    return p + entrylen;
+};
+
+unsigned char *lpNext(unsigned char *lp, unsigned char *p){
+    ((void) lp);
+    p = lpSkip(p);
+    if(p[0] == LP_EOF) return NULL;
+    return p;
+};
+
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p){
+    uint64_t prevlen;
+
+    if(p - lp == LP_HDR_SIZE) return NULL;
+    p--;
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    return p - prevlen + 1;
+};
+
+unsigned char *lpFirst(unsigned char *lp){
+    unsigned char *p = lp + LP_HDR_SIZE;
+
+    if(p[0] == LP_EOF) return NULL;
+    return p;
+};
+
+unsigned char *lpLast(unsigned char *lp){
+    unsigned char *p = lp + lpGetTotalBytes(lp) - 1;
+    return lpPrev(lp,p);
+};
+
+/* The element count is cached in the header while it fits 16 bits; past
+ * that the list is walked, and the count cached again if it shrank. */
+unsigned long lpLength(unsigned char *lp){
+    uint32_t numele = lpGetNumElements(lp);
+    uint32_t count = 0;
+    unsigned char *p;
+
+    if(numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    p = lpFirst(lp);
+    while(p){
+        count++;
+        p = lpNext(lp,p);
+    };
+    if(count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+};
+
+size_t lpBytes(unsigned char *lp){
+    return lpGetTotalBytes(lp);
+};
+
+/* Decode the entry at 'p'. Strings are returned with their length in
+ * *count. Integers are returned as a NULL pointer with the value in *count,
+ * unless 'intbuf' is given: then they are printed into it (at least
+ * LP_INTBUF_SIZE bytes) and returned as strings. */
+unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf){
+    int64_t val;
+    uint64_t uval, negstart, negmax;
+
+    if(LP_ENCODING_IS_7BIT_UINT(p[0])){
+        negstart = UINT64_MAX;
+        negmax = 0;
+        uval = p[0] & 0x7f;
+    }else if(LP_ENCODING_IS_6BIT_STR(p[0])){
+        *count = LP_ENCODING_6BIT_STR_LEN(p);
+        return p + 1;
+    }else if(LP_ENCODING_IS_13BIT_INT(p[0])){
+        uval = ((p[0] & 0x1f) << 8) | p[1];
+        negstart = (uint64_t)1 << 12;
+        negmax = 8191;
+    }else if(p[0] == LP_ENCODING_16BIT_INT){
+        uval = (uint64_t)p[1] | (uint64_t)p[2] << 8;
+        negstart = (uint64_t)1 << 15;
+        negmax = UINT16_MAX;
+    }else if(p[0] == LP_ENCODING_24BIT_INT){
+        uval = (uint64_t)p[1] | (uint64_t)p[2] << 8 | (uint64_t)p[3] << 16;
+        negstart = (uint64_t)1 << 23;
+        negmax = UINT32_MAX >> 8;
+    }else if(p[0] == LP_ENCODING_32BIT_INT){
+        uval = (uint64_t)p[1] | (uint64_t)p[2] << 8 | (uint64_t)p[3] << 16 | (uint64_t)p[4] << 24;
+        negstart = (uint64_t)1 << 31;
+        negmax = UINT32_MAX;
+    }else if(p[0] == LP_ENCODING_64BIT_INT){
+        int j;
+
+        uval = 0;
+        for(j = 8; j >= 1; j--) uval = (uval << 8) | p[j];
+        negstart = (uint64_t)1 << 63;
+        negmax = UINT64_MAX;
+    }else if(LP_ENCODING_IS_12BIT_STR(p[0])){
+        *count = LP_ENCODING_12BIT_STR_LEN(p);
+        return p + 2;
+    }else if(p[0] == LP_ENCODING_32BIT_STR){
+        *count = LP_ENCODING_32BIT_STR_LEN(p);
+        return p + 5;
+    }else{
+        uval = 12345678900000000ULL + p[0];
+        negstart = UINT64_MAX;
+        negmax = 0;
+    };
+
+    /* Two's complement over the encoding width, without relying on the
+     * implementation defined unsigned to signed conversion. */
+    if(uval >= negstart){
+        uval = negmax - uval;
+        val = uval;
+        val = -val - 1;
+    }else{
+        val = uval;
+    };
+
+    if(intbuf){
+        *count = ll2string((char*)intbuf,LP_INTBUF_SIZE,(long long)val);
+        return intbuf;
+    };
+    *count = val;
+    return NULL;
+};
+
+/* ziplistGet() compatible accessor: returns 0 for a NULL entry, otherwise
+ * sets either *sval and *slen, or *lval with *sval set to NULL. */
+unsigned int lpGetValue(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval){
+    unsigned char *vstr;
+    int64_t vlen;
+
+    if(p == NULL) return 0;
+    vstr = lpGet(p,&vlen,NULL);
+    if(vstr){
+        *sval = vstr;
+        *slen = vlen;
+    }else{
+        *sval = NULL;
+        *lval = vlen;
+    };
+    return 1;
+};
+
+/* Insert, replace or delete an element. 'ele' is inserted before or after
+ * 'p', or replaces it, according to 'where'. A NULL 'ele' deletes the
+ * element at 'p'. If 'newp' is given it is set to the inserted element, or
+ * for a deletion to the element that followed the deleted one (NULL if it
+ * was the last). Returns the new listpack, or NULL if the result would
+ * overflow the 32 bit size field. */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, unsigned char *p, int where, unsigned char **newp){
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    uint64_t enclen = 0;
+    unsigned long backlen_size = 0;
+    uint32_t replaced_len = 0;
+    uint64_t old_listpack_bytes, new_listpack_bytes;
+    unsigned long poff;
+    unsigned char *dst;
+    uint32_t numele;
+    int enctype = LP_ENCODING_STRING;
+
+    if(ele == NULL) where = LP_REPLACE;
+
+    if(where == LP_AFTER){
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    };
+    poff = p - lp;
+
+    if(ele){
+        enctype = lpEncodeGetType(ele,size,intenc,&enclen);
+        backlen_size = lpEncodeBacklen(backlen,enclen);
+    };
+
+    old_listpack_bytes = lpGetTotalBytes(lp);
+    if(where == LP_REPLACE){
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    };
+
+    new_listpack_bytes = old_listpack_bytes + enclen + backlen_size - replaced_len;
+    if(new_listpack_bytes > UINT32_MAX) return NULL;
+
+    /* Grow before moving the tail, shrink after. */
+    dst = lp + poff;
+    if(new_listpack_bytes > old_listpack_bytes){
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    };
+
+    if(where == LP_BEFORE){
+        memmove(dst + enclen + backlen_size,dst,old_listpack_bytes - poff);
+    }else{
+        long lendiff = (enclen + backlen_size) - replaced_len;
+        memmove(dst + replaced_len + lendiff,dst + replaced_len,old_listpack_bytes - poff - replaced_len);
+    };
+
+    if(new_listpack_bytes < old_listpack_bytes){
+        lp = zrealloc(lp,new_listpack_bytes);
+        dst = lp + poff;
+    };
+
+    if(newp){
+        *newp = dst;
+        if(ele == NULL && dst[0] == LP_EOF) *newp = NULL;
+    };
+
+    if(ele){
+        if(enctype == LP_ENCODING_INT){
+            memcpy(dst,intenc,enclen);
+        }else{
+            lpEncodeString(dst,ele,size);
+        };
+        dst += enclen;
+        memcpy(dst,backlen,backlen_size);
+    };
+
+    if(where != LP_REPLACE || ele == NULL){
+        numele = lpGetNumElements(lp);
+        if(numele != LP_HDR_NUMELE_UNKNOWN){
+            if(ele) numele++;
+            else numele--;
+            lpSetNumElements(lp,numele);
+        };
+    };
+    lpSetTotalBytes(lp,new_listpack_bytes);
+    return lp;
+};
+
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size){
+    uint64_t listpack_bytes = lpGetTotalBytes(lp);
+    unsigned char *eofptr = lp + listpack_bytes - 1;
+
+    return lpInsert(lp,ele,size,eofptr,LP_BEFORE,NULL);
+};
+
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size){
+    return lpInsert(lp,ele,size,lp + LP_HDR_SIZE,LP_BEFORE,NULL);
+};
+
+unsigned char *lpReplace(unsigned char *lp, unsigned char *p, unsigned char *ele, uint32_t size){
+    return lpInsert(lp,ele,size,p,LP_REPLACE,NULL);
+};
+
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp){
+    return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
+};
+
+/* Delete 'num' elements starting at 'index', which can be negative to
+ * count from the tail. A single memmove, whatever the number of elements. */
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num){
+    unsigned char *first, *tail;
+    uint32_t bytes, numele;
+    unsigned long deleted = 0;
+
+    if(num == 0) return lp;
+    if((first = lpSeek(lp,index)) == NULL) return lp;
+
+    tail = first;
+    while(tail[0] != LP_EOF && deleted < num){
+        tail = lpSkip(tail);
+        deleted++;
+    };
+
+    bytes = lpGetTotalBytes(lp);
+    memmove(first,tail,lp + bytes - tail);
+    bytes -= tail - first;
+    lp = zrealloc(lp,bytes);
+    lpSetTotalBytes(lp,bytes);
+
+    numele = lpGetNumElements(lp);
+    if(numele != LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,numele - deleted);
+    return lp;
+};
+
+/* Merge two listpacks, same contract as ziplistMerge(): the larger one is
+ * reallocated and kept, the other is freed and its pointer set to NULL.
+ * No entry needs to be rewritten, the second body is copied as is. */
+unsigned char *lpMerge(unsigned char **first, unsigned char **second){
+    unsigned char *source, *target;
+    size_t first_bytes, second_bytes, lpbytes;
+    unsigned long first_len, second_len, lplength;
+    int append;
+
+    if(first == NULL || *first == NULL || second == NULL || *second == NULL) return NULL;
+    if(*first == *second) return NULL;
+
+    first_bytes = lpGetTotalBytes(*first);
+    second_bytes = lpGetTotalBytes(*second);
+    first_len = lpLength(*first);
+    second_len = lpLength(*second);
+
+    if(first_len >= second_len){
+        target = *first;
+        source = *second;
+        append = 1;
+    }else{
+        target = *second;
+        source = *first;
+        append = 0;
+    };
+
+    lpbytes = first_bytes + second_bytes - LP_HDR_SIZE - 1;
+    if(lpbytes > UINT32_MAX) return NULL;
+    lplength = first_len + second_len;
+    if(lplength > LP_HDR_NUMELE_UNKNOWN) lplength = LP_HDR_NUMELE_UNKNOWN;
+
+    target = zrealloc(target,lpbytes);
+    if(append){
+        memcpy(target + first_bytes - 1,source + LP_HDR_SIZE,second_bytes - LP_HDR_SIZE);
+    }else{
+        memmove(target + first_bytes - 1,target + LP_HDR_SIZE,second_bytes - LP_HDR_SIZE);
+        memcpy(target,source,first_bytes - 1);
+    };
+    lpSetTotalBytes(target,lpbytes);
+    lpSetNumElements(target,lplength);
+
+    if(append){
+        zfree(*second);
+        *second = NULL;
+        *first = target;
+    }else{
+        zfree(*first);
+        *first = NULL;
+        *second = target;
+    };
+    return target;
+};
+
+/* Return the element at 'index', negative indexes counting from the tail.
+ * When the element count is known the list is walked from the nearest end. */
+unsigned char *lpSeek(unsigned char *lp, long index){
+    int forward = 1;
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned char *p;
+
+    if(numele != LP_HDR_NUMELE_UNKNOWN){
+        if(index < 0) index = (long)numele + index;
+        if(index < 0) return NULL;
+        if(index >= (long)numele) return NULL;
+        if(index > (long)numele / 2){
+            forward = 0;
+            index -= numele;
+        };
+    }else{
+        if(index < 0) forward = 0;
+    };
+
+    if(forward){
+        p = lpFirst(lp);
+        while(index > 0 && p){
+            p = lpNext(lp,p);
+            index--;
+        };
+    }else{
+        p = lpLast(lp);
+        while(index < -1 && p){
+            p = lpPrev(lp,p);
+            index++;
+        };
+    };
+    return p;
+};
+
+/* Return 1 if the element at 'p' is equal to the string 's', comparing
+ * integers by value like ziplistCompare() does. */
+unsigned int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen){
+    unsigned char *value;
+    int64_t sz;
+    long long sval;
+
+    if(p[0] == LP_EOF) return 0;
+    value = lpGet(p,&sz,NULL);
+    if(value) return (slen == sz) && memcmp(value,s,slen) == 0;
+    if(slen > 20 || !string2ll((char*)s,slen,&sval)) return 0;
+    return sz == sval;
+};
+
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include "adlist.h"
+#include "sds.h"
+
+static long long usec(void){
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000) + tv.tv_usec;
+};
+
+static unsigned char *createList(){
+    unsigned char *lp = lpNew();
+
+    lp = lpAppend(lp,(unsigned char*)"foo",3);
+    lp = lpAppend(lp,(unsigned char*)"quux",4);
+    lp = lpPrepend(lp,(unsigned char*)"hello",5);
+    lp = lpAppend(lp,(unsigned char*)"1024",4);
+    return lp;
+};
+
+static int lpValueEquals(unsigned char *p, const char *s){
+    return p && lpCompare(p,(unsigned char*)s,strlen(s));
+};
+
+/* Build a list of 'len' random elements mirrored in an adlist, then check
+ * every element forward and backward. */
+static void lpRandomCheck(int len){
+    unsigned char *lp = lpNew(), *p;
+    list *ref = listCreate();
+    listNode *ln;
+    char buf[1024];
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+    int j, buflen;
+
+    for(j = 0; j < len; j++){
+        switch(rand() % 3){
+        case 0:
+            buflen = sprintf(buf,"%lld",(0LL + rand()) >> 20);
+            break;
+        case 1:
+            buflen = sprintf(buf,"%lld",(0LL + rand()) * -((long long)rand()));
+            break;
+        default:
+            buflen = rand() % (int)sizeof(buf);
+            memset(buf,'a' + rand() % 26,buflen);
+            break;
+        };
+        if(rand() & 1){
+            lp = lpPrepend(lp,(unsigned char*)buf,buflen);
+            listAddNodeHead(ref,sdsnewlen(buf,buflen));
+        }else{
+            lp = lpAppend(lp,(unsigned char*)buf,buflen);
+            listAddNodeTail(ref,sdsnewlen(buf,buflen));
+        };
+    };
+    assert(lpLength(lp) == listLength(ref));
+
+    p = lpFirst(lp);
+    ln = listFirst(ref);
+    while(p){
+        assert(lpGetValue(p,&vstr,&vlen,&vll));
+        if(vstr == NULL){
+            vlen = sprintf(buf,"%lld",vll);
+            vstr = (unsigned char*)buf;
+        };
+        assert(vlen == sdslen(listNodeValue(ln)));
+        assert(memcmp(vstr,listNodeValue(ln),vlen) == 0);
+        p = lpNext(lp,p);
+        ln = ln->next;
+    };
+    assert(ln == NULL);
+
+    p = lpLast(lp);
+    ln = listLast(ref);
+    while(p){
+        assert(lpCompare(p,listNodeValue(ln),sdslen(listNodeValue(ln))));
+        p = lpPrev(lp,p);
+        ln = ln->prev;
+    };
+    assert(ln == NULL);
+
+    listSetFreeMethod(ref,(void (*)(void*))sdsfree);
+    listRelease(ref);
+    lpFree(lp);
+};
+
+int listpackTest(int argc, char *argv[]){
+    unsigned char *lp, *p;
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vll;
+    int j;
+
+    if(argc >= 4) srand(atoi(argv[3]));
+
+    printf("Create list and seek:\n");
+    {
+        lp = createList();
+        assert(lpLength(lp) == 4);
+        assert(lpValueEquals(lpSeek(lp,0),"hello"));
+        assert(lpValueEquals(lpSeek(lp,3),"1024"));
+        assert(lpValueEquals(lpSeek(lp,-1),"1024"));
+        assert(lpValueEquals(lpSeek(lp,-4),"hello"));
+        assert(lpSeek(lp,4) == NULL);
+        assert(lpSeek(lp,-5) == NULL);
+        assert(lpGetValue(lpSeek(lp,3),&vstr,&vlen,&vll) && vstr == NULL && vll == 1024);
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Integer encodings round trip:\n");
+    {
+        long long values[] = {0, 127, 128, -1, 4095, -4096, 4096, 32767, -32768,
+                              8388607, -8388608, 2147483647LL, -2147483648LL,
+                              LLONG_MAX, LLONG_MIN};
+        char buf[32];
+
+        lp = lpNew();
+        for(j = 0; j < (int)(sizeof(values)/sizeof(values[0])); j++){
+            int len = sprintf(buf,"%lld",values[j]);
+            lp = lpAppend(lp,(unsigned char*)buf,len);
+        };
+        p = lpFirst(lp);
+        for(j = 0; j < (int)(sizeof(values)/sizeof(values[0])); j++){
+            assert(lpGetValue(p,&vstr,&vlen,&vll) && vstr == NULL && vll == values[j]);
+            p = lpNext(lp,p);
+        };
+        assert(p == NULL);
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Insert, replace and delete in the middle:\n");
+    {
+        lp = createList();
+        p = lpSeek(lp,1);
+        lp = lpInsert(lp,(unsigned char*)"mid",3,p,LP_BEFORE,&p);
+        assert(lpValueEquals(p,"mid"));
+        lp = lpInsert(lp,(unsigned char*)"after",5,p,LP_AFTER,&p);
+        assert(lpValueEquals(lpSeek(lp,2),"after"));
+        lp = lpReplace(lp,lpSeek(lp,2),(unsigned char*)"-12345",6);
+        assert(lpGetValue(lpSeek(lp,2),&vstr,&vlen,&vll) && vstr == NULL && vll == -12345);
+        assert(lpLength(lp) == 6);
+
+        p = lpSeek(lp,1);
+        lp = lpDelete(lp,p,&p);
+        assert(lpValueEquals(p,"-12345"));
+        p = lpLast(lp);
+        lp = lpDelete(lp,p,&p);
+        assert(p == NULL);
+        assert(lpLength(lp) == 4);
+        assert(lpValueEquals(lpLast(lp),"quux"));
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Delete range:\n");
+    {
+        lp = createList();
+        lp = lpDeleteRange(lp,1,2);
+        assert(lpLength(lp) == 2);
+        assert(lpValueEquals(lpFirst(lp),"hello"));
+        assert(lpValueEquals(lpLast(lp),"1024"));
+        lp = lpDeleteRange(lp,-1,10);
+        assert(lpLength(lp) == 1);
+        lp = lpDeleteRange(lp,0,1);
+        assert(lpLength(lp) == 0 && lpFirst(lp) == NULL && lpBytes(lp) == LP_HDR_SIZE + 1);
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Large strings and backlen sizes:\n");
+    {
+        uint32_t sizes[] = {63, 64, 127, 128, 4095, 4096, 16383, 70000};
+        char *big = zmalloc(70000);
+
+        memset(big,'x',70000);
+        lp = lpNew();
+        for(j = 0; j < (int)(sizeof(sizes)/sizeof(sizes[0])); j++){
+            lp = lpAppend(lp,(unsigned char*)big,sizes[j]);
+        };
+        p = lpLast(lp);
+        for(j = (int)(sizeof(sizes)/sizeof(sizes[0])) - 1; j >= 0; j--){
+            assert(lpGetValue(p,&vstr,&vlen,&vll) && vstr && vlen == sizes[j]);
+            p = lpPrev(lp,p);
+        };
+        assert(p == NULL);
+        lpFree(lp);
+        zfree(big);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Merge:\n");
+    {
+        unsigned char *a = createList(), *b = lpNew();
+
+        b = lpAppend(b,(unsigned char*)"tail",4);
+        lpMerge(&a,&b);
+        assert(b == NULL && lpLength(a) == 5);
+        assert(lpValueEquals(lpLast(a),"tail"));
+
+        b = lpNew();
+        b = lpAppend(b,(unsigned char*)"head",4);
+        lpMerge(&b,&a);
+        assert(b == NULL && lpLength(a) == 6);
+        assert(lpValueEquals(lpFirst(a),"head"));
+        assert(lpValueEquals(lpLast(a),"tail"));
+        lpFree(a);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("More than 65535 elements:\n");
+    {
+        lp = lpNew();
+        for(j = 0; j < 70000; j++) lp = lpAppend(lp,(unsigned char*)"1",1);
+        assert(lpLength(lp) == 70000);
+        assert(lpSeek(lp,-1) && lpSeek(lp,69999) && lpSeek(lp,70000) == NULL);
+        lp = lpDeleteRange(lp,0,10000);
+        assert(lpLength(lp) == 60000);
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Random lists:\n");
+    {
+        for(j = 0; j < 2000; j++) lpRandomCheck(rand() % 256);
+        printf("SUCCESS\n\n");
+    }
+
+    printf("Push and pop from the head:\n");
+    {
+        long long start = usec();
+
+        lp = lpNew();
+        for(j = 0; j < 10000; j++) lp = lpPrepend(lp,(unsigned char*)"quux",4);
+        while((p = lpFirst(lp)) != NULL) lp = lpDelete(lp,p,NULL);
+        printf("10000 push+pop: %lld usec\n",usec() - start);
+        lpFree(lp);
+        printf("SUCCESS\n\n");
+    }
+    return 0;
+};
+
+#endif
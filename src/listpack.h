@@ -0,0 +1,39 @@
+#ifndef __LISTPACK_H
+#define __LISTPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LP_HDR_SIZE 6
+#define LP_INTBUF_SIZE 21
+
+#define LP_BEFORE 0
+#define LP_AFTER 1
+#define LP_REPLACE 2
+
+
+unsigned char *lpNew(void);
+void lpFree(unsigned char *lp);
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, unsigned char *p, int where, unsigned char **newp);
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size);
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size);
+unsigned char *lpReplace(unsigned char *lp, unsigned char *p, unsigned char *ele, uint32_t size);
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp);
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num);
+unsigned char *lpMerge(unsigned char **first, unsigned char **second);
+unsigned long lpLength(unsigned char *lp);
+unsigned char *lpGet(unsigned char *p, int64_t *count, unsigned char *intbuf);
+unsigned int lpGetValue(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval);
+unsigned char *lpFirst(unsigned char *lp);
+unsigned char *lpLast(unsigned char *lp);
+unsigned char *lpNext(unsigned char *lp, unsigned char *p);
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p);
+unsigned char *lpSeek(unsigned char *lp, long index);
+unsigned int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen);
+size_t lpBytes(unsigned char *lp);
+
+#ifdef REDIS_TEST
+int listpackTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -1,11 +1,18 @@
 #include "server.h"
 
+#define MULTI_ARGV_CHUNK_SIZE 1024
+
 void initClientMultiState(client *c){
     c->mstate.commands = NULL;
     c->mstate.count = 0;
+    c->mstate.size = 0;
+    c->mstate.chunks = NULL;
 };
 
+/* Release the arguments still owned by the queue and the arena. EXEC
+ * empties the argv of the commands it has run. */
 void freeClientMultiState(client *c){
+    multiArgvChunk *chunk, *next;
     int j;
 
     for(j = 0; j < c->mstate.count; j++){
@@ -14,26 +21,50 @@ void freeClientMultiState(client *c){
         for(i = 0; i < mc->argc; i++){
             decrRefCount(mc->argv[i]);
         };
-        zfree(mc->argv);
     };
 
     zfree(c->mstate.commands);
+    for(chunk = c->mstate.chunks; chunk != NULL; chunk = next){
+        next = chunk->next;
+        zfree(chunk);
+    };
+};
+
+static robj **multiArgvAlloc(multiState *ms, int argc){
+    multiArgvChunk *chunk = ms->chunks;
+    robj **argv;
+
+    if(chunk == NULL || chunk->size - chunk->used < argc){
+        int size = (argc > MULTI_ARGV_CHUNK_SIZE) ? argc : MULTI_ARGV_CHUNK_SIZE;
+
+        chunk = zmalloc(sizeof(*chunk) + sizeof(robj*) * size);
+        chunk->used = 0;
+        chunk->size = size;
+        chunk->next = ms->chunks;
+        ms->chunks = chunk;
+    };
+    argv = chunk->argv + chunk->used;
+    chunk->used += argc;
+    return argv;
 };
 
+/* Queue the current command. Its arguments are moved to the arena and the
+ * client argv is left empty, so resetting the client releases nothing. */
 void queueMultiCommand(client *c){
+    multiState *ms = &c->mstate;
     multiCmd *mc;
-    int j;
 
-    c->mstate.commands = zrealloc(c->mstate.commands, sizeof(multiCmd) * (c->mstate.count + 1));
-    mc = c->mstate.commands + c->mstate.count;
+    if(ms->count == ms->size){
+        ms->size = ms->size ? ms->size * 2 : 16;
+        ms->commands = zrealloc(ms->commands, sizeof(multiCmd) * ms->size);
+    };
+    mc = ms->commands + ms->count;
     mc->cmd = c->cmd;
     mc->argc = c->argc;
-    mc->argv = zmalloc(sizeof(robj *) * c->argc);
+    mc->argv = multiArgvAlloc(ms,c->argc);
     memcpy(mc->argv, c->argv,sizeof(robj *) * c->argc);
-    for(j = 0; j < c->argc; j++){
-        incrRefCount(mc->argv[j]);
-    };
-    c->mstate.count++;
+    c->argc = 0;
+    ms->count++;
 };
 
 
@@ -77,12 +108,37 @@ void execCommandPropagateMulti(client *c){
     decrRefCount(multistring);
 };
 
+/* Emit what the commands of a transaction propagated, wrapped in a single
+ * MULTI/EXEC block when there is more than one op. */
+static void execPropagateOps(redisOpArray *oa){
+    int j, target = 0;
+    robj *argv;
+
+    if(oa->numops == 0) return;
+    for(j = 0; j < oa->numops; j++) target |= oa->ops[j].target;
+
+    if(oa->numops > 1){
+        argv = createStringObject("MULTI",5);
+        propagate(server.multiCommand,oa->ops[0].dbid,&argv,1,target);
+        decrRefCount(argv);
+    };
+    for(j = 0; j < oa->numops; j++){
+        redisOp *rop = oa->ops + j;
+        propagate(rop->cmd,rop->dbid,rop->argv,rop->argc,rop->target);
+    };
+    if(oa->numops > 1){
+        argv = createStringObject("EXEC",4);
+        propagate(server.execCommand,oa->ops[oa->numops - 1].dbid,&argv,1,target);
+        decrRefCount(argv);
+    };
+};
+
 void execCommand(client *c){
-    int j;
-    robj **orig_argv;
-    int orig_argc;
+    int j, i;
+    robj **orig_argv, **argv = NULL;
+    int orig_argc, argv_size = 0;
     struct redisCommand *orig_cmd;
-    int must_propagate = 0;
+    redisOpArray ops;
 
     if(!(c->flags & CLIENT_MULTI)){
         addReplyError(c,"EXEC without MULTI");
@@ -99,30 +155,43 @@ void execCommand(client *c){
     orig_argv = c->argv;
     orig_argc = c->argc;
     orig_cmd = c->cmd;
+    redisOpArrayInit(&ops);
+    server.exec_propagate = &ops;
     addReplyMultiBulkLen(c,c->mstate.count);
     for(j = 0; j < c->mstate.count;j++){
-        c->argc = c->mstate.commands[j].argc;
-        c->argv = c->mstate.commands[j].argv;
-        c->cmd = c->mstate.commands[j].cmd;
+        multiCmd *mc = c->mstate.commands + j;
 
-        if(!must_propagate && !(c->cmd->flags & CMD_READONLY)){
-            execCommandPropagateMulti(c);
-            must_propagate = 1;
+        /* Hand the arguments over to a private vector: the command may
+         * rewrite or replace it, which the arena does not support. */
+        if(argv_size < mc->argc){
+            argv = zrealloc(argv,sizeof(robj*) * mc->argc);
+            argv_size = mc->argc;
         };
+        memcpy(argv,mc->argv,sizeof(robj*) * mc->argc);
+        c->argc = mc->argc;
+        c->argv = argv;
+        c->cmd = mc->cmd;
+        mc->argc = 0;
 
         call(c,CMD_CALL_FULL);
 
-        c->mstate.commands[j].argc = c->argc;
-        c->mstate.commands[j].argv = c->argv;
-        c->mstate.commands[j].cmd = c->cmd;
+        for(i = 0; i < c->argc; i++) decrRefCount(c->argv[i]);
+        if(c->argv != argv){
+            argv = c->argv;
+            argv_size = c->argc;
+        };
     };
+    zfree(argv);
+    server.exec_propagate = NULL;
 
     c->argv = orig_argv;
     c->argc = orig_argc;
     c->cmd = orig_cmd;
 
+    execPropagateOps(&ops);
+    redisOpArrayFree(&ops);
+    preventCommandPropagation(c);
     discardTransaction(c);
-    if(must_propagate) server.dirty++;
 
 handle_monitor:
     if(listLength(server.monitors) && !server.loading){
@@ -268,3 +337,74 @@ void unwatchCommand(client *c){
 
 
 
+
+#ifdef REDIS_TEST
+#define MULTI_TEST_ASSERT(_e) do { \
+    if(!(_e)){ \
+        printf("\n%s:%d: assertion failed: %s\n",__FILE__,__LINE__,#_e); \
+        exit(1); \
+    } \
+} while(0)
+
+int multiTest(int argc, char **argv){
+    struct redisCommand pexpire = {"pexpire",NULL,3,"wF",0,NULL,1,1,1,0,0};
+    struct redisCommand set = {"set",NULL,-3,"wm",0,NULL,1,1,1,0,0};
+    struct redisCommand del = {"del",NULL,-2,"w",0,NULL,1,-1,1,0,0};
+    redisDb *db;
+    redisOpArray ops;
+
+    UNUSED(argc);
+    UNUSED(argv);
+
+    server.hz = CONFIG_DEFAULT_HZ;
+    createSharedObjects();
+    server.delCommand = &del;
+    server.aof_state = AOF_OFF;
+    server.dbnum = 1;
+    server.db = db = zcalloc(sizeof(redisDb));
+    db->dict = dictCreate(&dbDictType,NULL);
+    db->expires = dictCreate(&expiresDictType,NULL);
+
+    printf("Lazy expire DEL keeps its place in the EXEC block: ");{
+        robj *key = createStringObject("key",3);
+        robj *pexpireArgv[3], *setArgv[3];
+
+        pexpireArgv[0] = createStringObject("PEXPIRE",7);
+        pexpireArgv[1] = key;
+        pexpireArgv[2] = createStringObject("1",1);
+        setArgv[0] = createStringObject("SET",3);
+        setArgv[1] = key;
+        setArgv[2] = createStringObject("new",3);
+        dbAdd(db,key,createStringObject("old",3));
+
+        /* MULTI; PEXPIRE key 1; GET key (after the deadline); SET key new; EXEC */
+        redisOpArrayInit(&ops);
+        server.exec_propagate = &ops;
+        setExpire(NULL,db,key,mstime() - 1);
+        propagate(&pexpire,db->id,pexpireArgv,3,PROPAGATE_AOF|PROPAGATE_REPL);
+        MULTI_TEST_ASSERT(expireIfNeeded(db,key) == 1);
+        propagate(&set,db->id,setArgv,3,PROPAGATE_AOF|PROPAGATE_REPL);
+        server.exec_propagate = NULL;
+
+        MULTI_TEST_ASSERT(ops.numops == 3);
+        MULTI_TEST_ASSERT(ops.ops[0].cmd == &pexpire);
+        MULTI_TEST_ASSERT(ops.ops[1].cmd == &del && ops.ops[1].argc == 2);
+        MULTI_TEST_ASSERT(ops.ops[1].argv[0] == shared.del && equalStringObjects(ops.ops[1].argv[1],key));
+        MULTI_TEST_ASSERT(ops.ops[2].cmd == &set);
+        redisOpArrayFree(&ops);
+
+        decrRefCount(pexpireArgv[0]);
+        decrRefCount(pexpireArgv[2]);
+        decrRefCount(setArgv[0]);
+        decrRefCount(setArgv[2]);
+        decrRefCount(key);
+        printf("OK\n");
+    }
+
+    expireIndexEmpty(db);
+    dictRelease(db->dict);
+    dictRelease(db->expires);
+    zfree(db);
+    return 0;
+}
+#endif
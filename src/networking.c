@@ -24,12 +24,16 @@ size_t getStringObjectSdsUsedMemory(robj *o){
     }
 };
 
+/* Reply list nodes are raw string objects. Most are private to a client,
+ * but addReplyShared() queues the same object to many clients, so copying
+ * an output buffer only takes references. */
 void *dupClientReplyValue(void *o){
-    return sdsdup(o);
+    if(o) incrRefCount((robj*)o);
+    return o;
 };
 
 void freeClientReplyValue(void *o){
-    sdsfree(o);
+    if(o) decrRefCount((robj*)o);
 };
 
 int listMatchObjects(void *a, void *b){
@@ -134,79 +138,64 @@ int _addReplyToBuffer(client *c, const char *s, size_t len){
     return C_OK;
 };
 
+/* Return the last node of the reply list if 'len' more bytes can be
+ * appended to it in place. Objects referenced by other clients are never
+ * written to. */
+static robj *_replyListAppendableTail(client *c, size_t len){
+    listNode *ln = listLast(c->reply);
+    robj *tail;
+
+    if(ln == NULL) return NULL;
+    tail = listNodeValue(ln);
+    if(tail == NULL || tail->refcount != 1) return NULL;
+    if(sdslen(tail->ptr) + len > PROTO_REPLY_CHUNK_BYTES) return NULL;
+    return tail;
+};
+
 void _addReplyObjectToList(client *c, robj *o){
+    robj *tail;
+
     if(c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if(listLength(c->reply) == 0){
-        sds s = sdsdup(o->ptr);
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
+    if((tail = _replyListAppendableTail(c,sdslen(o->ptr))) != NULL){
+        tail->ptr = sdscatsds(tail->ptr,o->ptr);
     }else{
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        if(tail && sdslen(tail) + sdslen(o->ptr) <= PROTO_REPLY_CHUNK_BYTES){
-            tail = sdscatsds(tail,o->ptr);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(o->ptr);
-        }else{
-            sds s = sdsdup(o->ptr);
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
-
+        listAddNodeTail(c->reply,createObject(OBJ_STRING,sdsdup(o->ptr)));
     }
+    c->reply_bytes += sdslen(o->ptr);
     asyncCloseClientOnOutputBufferLimitReached(c);
 };
 
 void _addReplySdsToList(client *c, sds s){
+    robj *tail;
+
     if(c->flags & CLIENT_CLOSE_AFTER_REPLY){
         sdsfree(s);
         return;
     };
 
-    if(listLength(c->reply) == 0){
-        listAddNodeTail(c->reply,s);
-        c->reply_bytes += sdslen(s);
+    c->reply_bytes += sdslen(s);
+    if((tail = _replyListAppendableTail(c,sdslen(s))) != NULL){
+        tail->ptr = sdscatsds(tail->ptr,s);
+        sdsfree(s);
     }else{
-        listNode *ln = listLast(c->reply);
-        sds tail = listNodeValue(ln);
-
-        if(tail && sdslen(tail) + sdslen(s) <= PROTO_REPLY_CHUNK_BYTES){ 
-            tail = sdscatsds(tail,s);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += sdslen(s);
-            sdsfree(s);
-        }else{
-            listAddNodeTail(c->reply,s);
-            c->reply_bytes += sdslen(s);
-        }
-    }    
+        listAddNodeTail(c->reply,createObject(OBJ_STRING,s));
+    }
     asyncCloseClientOnOutputBufferLimitReached(c);
 };
 
 
 void _addReplyStringToList(client *c, const char *s, size_t len){
+    robj *tail;
+
     if(c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
 
-    if(listLength(c->reply) == 0){
-        sds node = sdsnewlen(s,len);
-        listAddNodeTail(c->reply,node);
-        c->reply_bytes += len;
+    if((tail = _replyListAppendableTail(c,len)) != NULL){
+        tail->ptr = sdscatlen(tail->ptr,s,len);
     }else{
-        listNode *ln = sdsnewlen(s,len);
-        sds tail = listNodeValue(ln); 
-
-        if(tail && sdslen(tail) + len <= PROTO_REPLY_CHUNK_BYTES){
-            tail = sdscatlen(tail,s,len);
-            listNodeValue(ln) = tail;
-            c->reply_bytes += len;
-        }else{
-            sds node = sdsnewlen(s,len);
-            listAddNodeTail(c->reply,node);
-            c->reply_bytes += len;
-        }
+        listAddNodeTail(c->reply,createObject(OBJ_STRING,sdsnewlen(s,len)));
     };
+    c->reply_bytes += len;
     asyncCloseClientOnOutputBufferLimitReached(c);
 };
 
@@ -238,6 +227,24 @@ void addReply(client *c, robj *obj){
     }
 };
 
+/* Queue a reply that is the same for many clients, like a PUBLISH frame.
+ * The reply list takes a reference to 'o' instead of a copy, so it must be
+ * a raw string object that is not modified afterwards. Frames shorter
+ * than PROTO_SHARED_REPLY_MIN_BYTES are copied to the static buffer when
+ * it has room, which is cheaper than a list node. */
+void addReplyShared(client *c, robj *o){
+    size_t len = sdslen(o->ptr);
+
+    if(prepareClientToWrite(c) != C_OK) return;
+    if(len < PROTO_SHARED_REPLY_MIN_BYTES && _addReplyToBuffer(c,o->ptr,len) == C_OK) return;
+    if(c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    incrRefCount(o);
+    listAddNodeTail(c->reply,o);
+    c->reply_bytes += len;
+    asyncCloseClientOnOutputBufferLimitReached(c);
+};
+
 void addReplySds(client *c, sds s){
     if(prepareClientToWrite(c)!= C_OK){
         sdsfree(s);
@@ -258,6 +265,39 @@ void addReplyString(client *c, const char *s, size_t len){
     };
 };
 
+/* Reserve 'len' bytes of output for the caller to fill in place, so that
+ * a reply made of many small items can be serialized in one pass instead
+ * of one addReply*() call per item. The space is taken from the static
+ * buffer when it has room, from the tail of the reply list otherwise.
+ * Returns NULL if the client gets no reply: the caller must then skip
+ * writing. */
+char *addReplyReserve(client *c, size_t len){
+    robj *tail;
+    char *p;
+
+    if(prepareClientToWrite(c) != C_OK) return NULL;
+    if(c->flags & CLIENT_CLOSE_AFTER_REPLY) return NULL;
+
+    if(listLength(c->reply) == 0 && sizeof(c->buf) - c->bufpos >= len){
+        p = c->buf + c->bufpos;
+        c->bufpos += len;
+        return p;
+    };
+
+    if((tail = _replyListAppendableTail(c,len)) != NULL){
+        tail->ptr = sdsMakeRoomFor(tail->ptr,len);
+        p = (char *)tail->ptr + sdslen(tail->ptr);
+        sdsIncrLen(tail->ptr,len);
+    }else{
+        sds s = sdsnewlen(NULL,len);
+        p = s;
+        listAddNodeTail(c->reply,createObject(OBJ_STRING,s));
+    };
+    c->reply_bytes += len;
+    asyncCloseClientOnOutputBufferLimitReached(c);
+    return p;
+};
+
 void addReplyErrorLength(client *c, const char *s, size_t len){
     addReplyString(c,"-ERR",5);
     addReplyString(c,s,len);
@@ -312,22 +352,22 @@ void *addDeferredMultiBulkLength(client *c){
 
 void setDeferredMutliBulkLength(client *c, void *node, long length){
     listNode *ln = (listNode*) node;
-    sds len, next;
+    robj *next;
+    sds len;
 
     if(node == NULL) return;
 
     len = sdscatprintf(sdsnewlen("*",1),"%ld\r\n",length);
-    listNodeValue(ln) = len;
     c->reply_bytes += sdslen(len);
 
     if(ln->next != NULL){
         next = listNodeValue(ln->next);
-        if(next != NULL){
-           len = sdscatsds(len,next); 
+        if(next != NULL && next->refcount == 1){
+           len = sdscatsds(len,next->ptr); 
            listDelNode(c->reply,ln->next);
-           listNodeValue(ln) = len;
         };
     };
+    listNodeValue(ln) = createObject(OBJ_STRING,len);
     asyncCloseClientOnOutputBufferLimitReached(c);
 };
 
@@ -337,8 +377,13 @@ void addReplyDouble(client *c, double d){
     if(isinf(d)){
         addReplyBulkCString(c,d>0 ? "inf" : "-inf");
     }else{
-        dlen = snprintf(dbuf,sizeof(dbuf),"%.17g",d);
-        slen = snprintf(dbuf,sizeof(sbuf),"$%d\r\n%s\r\n",dlen,dbuf);
+        dlen = d2string(dbuf,sizeof(dbuf),d);
+        sbuf[0] = '$';
+        slen = 1 + ll2string(sbuf + 1,sizeof(sbuf) - 1,dlen);
+        memcpy(sbuf + slen,"\r\n",2);
+        memcpy(sbuf + slen + 2,dbuf,dlen);
+        memcpy(sbuf + slen + 2 + dlen,"\r\n",2);
+        slen += dlen + 4;
         addReplyString(c,sbuf,slen);
     }
 };
@@ -636,7 +681,7 @@ void freeClient(client *c){
     listRelease(c->watched_keys);
 
     pubsubUnsubscribeAllChannels(c,0);
-    pubsubUnsubscribeAllChannels(c,0);
+    pubsubUnsubscribeAllPatterns(c,0);
 
     dictRelease(c->pubsub_channels);
     listRelease(c->pubsub_patterns);
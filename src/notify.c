@@ -69,37 +69,89 @@ sds keyspaceEventsFlagsToString(int flags){
     return res;
 };
 
-void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid){
-    sds chan;
-    robj *chanobj, *eventobj;
-    int len = -1;
-    char buf[24];
+/* Subscriber tracking.
+ *
+ * Building the channel names of an event is most of its cost, so
+ * server.notify_keyspace_listeners and server.notify_keyevent_listeners
+ * count the subscribed channels and patterns that may receive keyspace
+ * and keyevent notifications. A pattern is counted when its literal prefix
+ * and the channel family prefix agree on their common length. */
+static int notifyNameHasFamily(sds name, size_t len, int pattern, const char *family){
+    size_t flen = strlen(family);
 
-    if(!(server.notify_keyspace_events & type)) return;
+    if(len < flen) return pattern && memcmp(name,family,len) == 0;
+    return memcmp(name,family,flen) == 0;
+};
+
+void notifyTrackSubscription(robj *name, int pattern, int delta){
+    size_t len = pattern ? pubsubPatternPrefixLen(name) : sdslen(name->ptr);
 
-    if(server.notify_keyspace_events & NOTIFY_KEYSPACE){
-        chan = sdsnewlen("__keyspace@",11);
-        len = ll2string(buf,sizeof(buf),dbid);
-        chan = sdscatlen(chan,buf,len);
-        chan = sdscatlen(chan,"__:",3);
-        chan = sdscatsds(chan,key->ptr);
-        chanobj = createObject(OBJ_STRING,chan);   
-        pubsubPublishMessage(chanobj,eventobj);
-        decrRefCount(chanobj);
+    if(notifyNameHasFamily(name->ptr,len,pattern,"__keyspace@")){
+        server.notify_keyspace_listeners += delta;
+    };
+    if(notifyNameHasFamily(name->ptr,len,pattern,"__keyevent@")){
+        server.notify_keyevent_listeners += delta;
     };
+};
+
+/* Names are built in a stack buffer with a sdshdr8 header when they fit,
+ * so publishing does not allocate them. */
+#define NOTIFY_STACK_SDS_SIZE 256
+
+static sds notifyStackSdsNew(char *buf, size_t len){
+    struct sdshdr8 *sh = (void*)buf;
 
-    if(server.notify_keyspace_events & NOTIFY_KEYEVENT){
-        chan = sdsnewlen("__keyevent@",11);
-        if(len == -1) len = ll2string(buf,sizeof(buf),dbid);
-        chan = sdscatlen(chan,buf,len);
-        chan = sdscatlen(chan,"__:",3);
-        chan = sdscatsds(chan,eventobj->ptr);
-        pubsubPublishMessage(chanobj,key);
-        decrRefCount(chanobj);
+    if(len > NOTIFY_STACK_SDS_SIZE - sizeof(*sh) - 1){
+        return sdsMakeRoomForNonGreedy(sdsempty(),len);
     };
-    decrRefCount(eventobj);
+    sh->len = 0;
+    sh->alloc = NOTIFY_STACK_SDS_SIZE - sizeof(*sh) - 1;
+    sh->flags = SDS_TYPE_8;
+    sh->buf[0] = '\0';
+    return sh->buf;
 };
 
+static void notifyStackSdsFree(char *buf, sds s){
+    if(s != buf + sizeof(struct sdshdr8)) sdsfree(s);
+};
 
+static sds notifyChannelName(char *buf, const char *family, const char *db, int dblen, sds name){
+    sds chan = notifyStackSdsNew(buf,11 + dblen + 3 + sdslen(name));
 
+    chan = sdscatlen(chan,family,11);
+    chan = sdscatlen(chan,db,dblen);
+    chan = sdscatlen(chan,"__:",3);
+    return sdscatsds(chan,name);
+};
 
+void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid){
+    char chanbuf[NOTIFY_STACK_SDS_SIZE], eventbuf[NOTIFY_STACK_SDS_SIZE];
+    robj chanobj, eventobj;
+    sds chan, ev;
+    int keyspace, keyevent, len;
+    char buf[24];
+
+    if(!(server.notify_keyspace_events & type)) return;
+    keyspace = (server.notify_keyspace_events & NOTIFY_KEYSPACE) && server.notify_keyspace_listeners;
+    keyevent = (server.notify_keyspace_events & NOTIFY_KEYEVENT) && server.notify_keyevent_listeners;
+    if(!keyspace && !keyevent) return;
+
+    len = ll2string(buf,sizeof(buf),dbid);
+    ev = sdscat(notifyStackSdsNew(eventbuf,strlen(event)),event);
+    initStaticStringObject(eventobj,ev);
+
+    if(keyspace){
+        chan = notifyChannelName(chanbuf,"__keyspace@",buf,len,key->ptr);
+        initStaticStringObject(chanobj,chan);
+        pubsubPublishMessage(&chanobj,&eventobj);
+        notifyStackSdsFree(chanbuf,chan);
+    };
+
+    if(keyevent){
+        chan = notifyChannelName(chanbuf,"__keyevent@",buf,len,ev);
+        initStaticStringObject(chanobj,chan);
+        pubsubPublishMessage(&chanobj,key);
+        notifyStackSdsFree(chanbuf,chan);
+    };
+    notifyStackSdsFree(eventbuf,ev);
+};
@@ -69,10 +69,13 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len)
         memset(sh->buf, 0, len + 1);
     }
 
-    return 0;
+    return o;
 };
 
-#define OBJ_ENCODING_EMBSTR_SIZE_LIMIT 44
+/* Strings up to this length are allocated together with their robj as a
+ * single robj + sdshdr8 + string + terminator block that fits the 64 byte
+ * allocator class: 44 bytes with a 16 byte robj. */
+#define OBJ_ENCODING_EMBSTR_SIZE_LIMIT (64 - sizeof(robj) - sizeof(struct sdshdr8) - 1)
 robj *createStringObject(const char *ptr, size_t len)
 {
     if (len <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT)
@@ -85,12 +88,18 @@ robj *createStringObject(const char *ptr, size_t len)
     };
 };
 
-robj *createStringObjectFromLongLong(long long value)
+/* Shared integers have OBJ_SHARED_REFCOUNT, which incrRefCount() and
+ * decrRefCount() leave alone, so they are handed out as they are. When
+ * 'valueobj' is set the object is going to be stored as a key value: if the
+ * maxmemory policy needs a per object LRU/LFU field the integer is encoded
+ * inline in a private object instead, which costs the same 16 bytes as the
+ * robj alone. */
+static robj *createStringObjectFromLongLongWithOptions(long long value, int valueobj)
 {
     robj *o;
-    if (value >= 0 && value < OBJ_SHARED_INTEGERS)
+    if (value >= 0 && value < OBJ_SHARED_INTEGERS &&
+        !(valueobj && server.maxmemory && (server.maxmemory_policy & MAXMEMORY_FLAG_NO_SHARED_INTEGERS)))
     {
-        incrRefCount(shared.integers[value]);
         o = shared.integers[value];
     }
     else
@@ -109,6 +118,16 @@ robj *createStringObjectFromLongLong(long long value)
     return o;
 };
 
+robj *createStringObjectFromLongLong(long long value)
+{
+    return createStringObjectFromLongLongWithOptions(value, 0);
+};
+
+robj *createStringObjectFromLongLongForValue(long long value)
+{
+    return createStringObjectFromLongLongWithOptions(value, 1);
+};
+
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly)
 {
     char buf[256];
@@ -144,7 +163,7 @@ robj *createQuicklistObject(void)
     quicklist *l = quicklistCreate();
     robj *o = createObject(OBJ_LIST, l);
     o->encoding = OBJ_ENCODING_QUICKLIST;
-    return 0;
+    return o;
 };
 
 robj *createZiplistObject(void)
@@ -171,6 +190,14 @@ robj *createIntsetObject(void)
     return o;
 };
 
+robj *createRoaringSetObject(void)
+{
+    roaring *r = roaringNew();
+    robj *o = createObject(OBJ_SET, r);
+    o->encoding = OBJ_ENCODING_ROARING;
+    return o;
+};
+
 robj *createHashObject(void)
 {
     unsigned char *zl = ziplistNew();
@@ -237,6 +264,9 @@ void freeSetObject(robj *o)
     case OBJ_ENCODING_INTSET:
         zfree(o->ptr);
         break;
+    case OBJ_ENCODING_ROARING:
+        roaringFree((roaring *)o->ptr);
+        break;
     default:
         serverPanic("Unknown set encoding type");
     }
@@ -395,7 +425,6 @@ robj *tryObjectEncoding(robj *o)
             value >= 0 && value < OBJ_SHARED_INTEGERS)
         {
             decrRefCount(o);
-            incrRefCount(shared.integers[value]);
             return shared.integers[value];
         }
         else
@@ -404,17 +433,18 @@ robj *tryObjectEncoding(robj *o)
                 sdsfree(o->ptr);
             o->encoding = OBJ_ENCODING_INT;
             o->ptr = (void *)value;
-            return 0;
+            return o;
         };
     };
 
-    if (len < OBJ_ENCODING_EMBSTR_SIZE_LIMIT)
+    if (len <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT)
     {
         robj *emb;
 
         if (o->encoding == OBJ_ENCODING_EMBSTR)
-            return 0;
+            return o;
         emb = createEmbeddedStringObject(s, sdslen(s));
+        decrRefCount(o);
         return emb;
     };
 
@@ -734,6 +764,8 @@ char *strEncoding(int encoding)
         return "ziplist";
     case OBJ_ENCODING_INTSET:
         return "intset";
+    case OBJ_ENCODING_ROARING:
+        return "roaring";
     case OBJ_ENCODING_SKIPLIST:
         return "skiplist";
     case OBJ_ENCODING_EMBSTR:
@@ -743,14 +775,13 @@ char *strEncoding(int encoding)
     }
 };
 
-#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5
-
+/* Return the memory used by a value. Lists, intsets, ziplists and dict
+ * encoded sets and hashes keep an exact count of their allocations, so
+ * their size is known in O(1). Only skiplist encoded sorted sets are still
+ * estimated, sampling up to 'sample_size' elements. */
 size_t objectComputeSize(robj *o, size_t sample_size)
 {
-    sds ele, ele2;
     dict *d;
-    dictIterator *di;
-    struct dictEntry *de;
 
     size_t asize = 0, elesize = 0, samples = 0;
 
@@ -766,7 +797,7 @@ size_t objectComputeSize(robj *o, size_t sample_size)
         }
         else if (o->encoding == OBJ_ENCODING_EMBSTR)
         {
-            asize = sdslen(o->ptr) + 2 + sizeof(*o);
+            asize = zmalloc_size(o);
         }
         else
         {
@@ -777,19 +808,11 @@ size_t objectComputeSize(robj *o, size_t sample_size)
     {
         if (o->encoding == OBJ_ENCODING_QUICKLIST)
         {
-            quicklist *ql = o->ptr;
-            quicklistNode *node = ql->head;
-            asize = sizeof(*o) + sizeof(quicklist);
-            do
-            {
-                elesize += sizeof(quicklistNode) + ziplistBlobLen(node->zl);
-                samples++;
-            } while ((node = node->next) && samples < sample_size);
-            asize += (double)elesize / samples * listTypeLength(o);
+            asize = sizeof(*o) + quicklistBytes(o->ptr);
         }
         else if (o->encoding == OBJ_ENCODING_ZIPLIST)
         {
-            asize = sizeof(*o) + ziplistBlobLen(o->ptr);
+            asize = sizeof(*o) + zmalloc_size(o->ptr);
         }
         else
         {
@@ -800,23 +823,15 @@ size_t objectComputeSize(robj *o, size_t sample_size)
     {
         if (o->encoding == OBJ_ENCODING_HT)
         {
-            d = o->ptr;
-            di = dictGetIterator(d);
-            asize = sizeof(*o) + sizeof(dict) + (sizeof(struct dictEntry *) * dictSlots(d));
-            while ((de = dictNext(di)) != NULL && samples < sample_size)
-            {
-                ele = dictGetKey(de);
-                elesize += sizeof(struct dictEntry) + sdsAllocSize(ele);
-                samples++;
-            };
-            dictReleaseIterator(di);
-            if (samples)
-                asize += (double)elesize / samples * dictSize(d);
+            asize = sizeof(*o) + dictBytes((dict *)o->ptr);
         }
         else if (o->encoding == OBJ_ENCODING_INTSET)
         {
-            intset *is = o->ptr;
-            asize = sizeof(*o) + sizeof(*is) + is->encoding * is->length;
+            asize = sizeof(*o) + zmalloc_size(o->ptr);
+        }
+        else if (o->encoding == OBJ_ENCODING_ROARING)
+        {
+            asize = sizeof(*o) + roaringBytes((roaring *)o->ptr);
         }
         else
         {
@@ -827,7 +842,7 @@ size_t objectComputeSize(robj *o, size_t sample_size)
     {
         if (o->encoding == OBJ_ENCODING_ZIPLIST)
         {
-            asize = sizeof(*o) + (ziplistBlobLen(o->ptr));
+            asize = sizeof(*o) + zmalloc_size(o->ptr);
         }
         else if (o->encoding == OBJ_ENCODING_SKIPLIST)
         {
@@ -855,24 +870,11 @@ size_t objectComputeSize(robj *o, size_t sample_size)
     {
         if (o->encoding == OBJ_ENCODING_ZIPLIST)
         {
-            asize = sizeof(*o) + (ziplistBlobLen(o->ptr));
+            asize = sizeof(*o) + zmalloc_size(o->ptr);
         }
         else if (o->encoding == OBJ_ENCODING_HT)
         {
-            d = o->ptr;
-            di = dictGetIterator(d);
-            asize = sizeof(*o) + sizeof(dict) + (sizeof(struct dictEntry *) * dictSlots(d));
-            while ((de = dictNext(di)) != NULL && samples < sample_size)
-            {
-                ele = dictGetKey(de);
-                ele2 = dictGetVal(de);
-                elesize += sdsAllocSize(ele) + sdsAllocSize(ele2);
-                elesize += sizeof(struct dictEntry);
-                samples++;
-            };
-            dictReleaseIterator(di);
-            if (samples)
-                asize += (double)elesize / samples * dictSize(d);
+            asize = sizeof(*o) + dictBytes((dict *)o->ptr);
         }
         else
         {
@@ -896,6 +898,7 @@ size_t objectComputeSize(robj *o, size_t sample_size)
     {
         serverPanic("Unknown object type");
     }
+    return asize;
 };
 
 void freeMemoryOverheadData(struct redisMemOverhead *mh)
@@ -1178,6 +1181,251 @@ void objectCommand(client *c)
     };
 };
 
+/* Keyspace analyzer.
+ *
+ * MEMORY ANALYZE START walks every db with dictScan() from serverCron(), a
+ * few buckets at a time within MEMORY_ANALYZER_TIME_PERC percent of the
+ * cron period, and keeps the top 'count' keys by memory usage and, with an
+ * LFU maxmemory policy, by access frequency. Keys are copied into the
+ * tables, which are a snapshot: a key may be gone by the time the result
+ * is read. */
+typedef struct memoryAnalyzerKey
+{
+    sds key;
+    int dbid;
+    int type;
+    unsigned long long score;
+} memoryAnalyzerKey;
+
+typedef struct memoryAnalyzerTop
+{
+    memoryAnalyzerKey *keys;
+    int len;
+} memoryAnalyzerTop;
+
+static struct memoryAnalyzer
+{
+    int running;
+    int track_hot;
+    int count;
+    int dbid;
+    unsigned long cursor;
+    unsigned long long scanned;
+    long long start_time;
+    long long end_time;
+    memoryAnalyzerTop big;
+    memoryAnalyzerTop hot;
+} analyzer;
+
+static const char *memoryAnalyzerTypeName(int type)
+{
+    switch (type)
+    {
+    case OBJ_STRING:
+        return "string";
+    case OBJ_LIST:
+        return "list";
+    case OBJ_SET:
+        return "set";
+    case OBJ_ZSET:
+        return "zset";
+    case OBJ_HASH:
+        return "hash";
+    case OBJ_MODULE:
+        return "module";
+    default:
+        return "unknown";
+    }
+};
+
+static void memoryAnalyzerTopReset(memoryAnalyzerTop *top, int count)
+{
+    int j;
+
+    for (j = 0; j < top->len; j++)
+        sdsfree(top->keys[j].key);
+    zfree(top->keys);
+    top->keys = count ? zmalloc(sizeof(memoryAnalyzerKey) * count) : NULL;
+    top->len = 0;
+};
+
+/* Insert a key into a table kept sorted by descending score. dictScan()
+ * may report a key twice while the dict rehashes, so an existing entry for
+ * the same key is moved rather than duplicated. */
+static void memoryAnalyzerTopInsert(memoryAnalyzerTop *top, sds key, int dbid, int type, unsigned long long score)
+{
+    int j, pos, old = -1;
+
+    if (top->len == analyzer.count && score <= top->keys[top->len - 1].score)
+        return;
+
+    for (j = 0; j < top->len; j++)
+    {
+        if (top->keys[j].dbid == dbid && sdscmp(top->keys[j].key, key) == 0)
+        {
+            old = j;
+            break;
+        };
+    };
+
+    if (old != -1)
+    {
+        sdsfree(top->keys[old].key);
+        memmove(top->keys + old, top->keys + old + 1, sizeof(memoryAnalyzerKey) * (top->len - old - 1));
+        top->len--;
+    }
+    else if (top->len == analyzer.count)
+    {
+        sdsfree(top->keys[top->len - 1].key);
+        top->len--;
+    };
+
+    for (pos = top->len; pos > 0 && top->keys[pos - 1].score < score; pos--)
+        ;
+    memmove(top->keys + pos + 1, top->keys + pos, sizeof(memoryAnalyzerKey) * (top->len - pos));
+    top->keys[pos].key = sdsnewlen(key, sdslen(key));
+    top->keys[pos].dbid = dbid;
+    top->keys[pos].type = type;
+    top->keys[pos].score = score;
+    top->len++;
+};
+
+static void memoryAnalyzerScanCallback(void *privdata, const dictEntry *de)
+{
+    redisDb *db = privdata;
+    sds key = dictGetKey(de);
+    robj *val = dictGetVal(de);
+    size_t usage;
+
+    usage = objectComputeSize(val, OBJ_COMPUTE_SIZE_DEF_SAMPLES) + sdsAllocSize(key) + sizeof(dictEntry);
+    memoryAnalyzerTopInsert(&analyzer.big, key, db->id, val->type, usage);
+    if (analyzer.track_hot)
+        memoryAnalyzerTopInsert(&analyzer.hot, key, db->id, val->type, LFUPeekDecayed(val));
+    analyzer.scanned++;
+};
+
+static void memoryAnalyzerStart(int count)
+{
+    analyzer.count = count;
+    memoryAnalyzerTopReset(&analyzer.big, count);
+    memoryAnalyzerTopReset(&analyzer.hot, count);
+    analyzer.track_hot = (server.maxmemory_policy & MAXMEMORY_FLAG_LFU) != 0;
+    analyzer.dbid = 0;
+    analyzer.cursor = 0;
+    analyzer.scanned = 0;
+    analyzer.start_time = mstime();
+    analyzer.end_time = 0;
+    analyzer.running = 1;
+};
+
+static void memoryAnalyzerStop(void)
+{
+    analyzer.running = 0;
+    analyzer.end_time = mstime();
+};
+
+/* Called by serverCron(): advance the scan for at most 'timelimit'
+ * microseconds. */
+void memoryAnalyzerCron(long long timelimit)
+{
+    long long start;
+    int iteration = 0;
+
+    if (!analyzer.running)
+        return;
+    start = ustime();
+    while (analyzer.dbid < server.dbnum)
+    {
+        redisDb *db = server.db + analyzer.dbid;
+
+        analyzer.cursor = dictScan(db->dict, analyzer.cursor, memoryAnalyzerScanCallback, NULL, db);
+        if (analyzer.cursor == 0)
+            analyzer.dbid++;
+        if ((++iteration % MEMORY_ANALYZER_SCAN_STEPS) == 0 && ustime() - start > timelimit)
+            return;
+    };
+    memoryAnalyzerStop();
+};
+
+static void addReplyMemoryAnalyzerTop(client *c, memoryAnalyzerTop *top)
+{
+    int j;
+
+    addReplyMultiBulkLen(c, top->len);
+    for (j = 0; j < top->len; j++)
+    {
+        addReplyMultiBulkLen(c, 4);
+        addReplyBulkCBuffer(c, top->keys[j].key, sdslen(top->keys[j].key));
+        addReplyLongLong(c, top->keys[j].dbid);
+        addReplyBulkCString(c, memoryAnalyzerTypeName(top->keys[j].type));
+        addReplyLongLong(c, top->keys[j].score);
+    };
+};
+
+static void memoryAnalyzeCommand(client *c)
+{
+    if (c->argc == 2)
+    {
+        long long elapsed;
+
+        if (analyzer.start_time == 0)
+        {
+            addReplyError(c, "No analysis was started. Try MEMORY ANALYZE START");
+            return;
+        };
+        elapsed = (analyzer.running ? mstime() : analyzer.end_time) - analyzer.start_time;
+
+        addReplyMultiBulkLen(c, 12);
+        addReplyBulkCString(c, "status");
+        addReplyBulkCString(c, analyzer.running ? "running" : (analyzer.dbid < server.dbnum ? "stopped" : "done"));
+        addReplyBulkCString(c, "scanned.keys");
+        addReplyLongLong(c, analyzer.scanned);
+        addReplyBulkCString(c, "scanned.dbs");
+        addReplyLongLong(c, analyzer.dbid);
+        addReplyBulkCString(c, "elapsed.ms");
+        addReplyLongLong(c, elapsed);
+        addReplyBulkCString(c, "bigkeys");
+        addReplyMemoryAnalyzerTop(c, &analyzer.big);
+        addReplyBulkCString(c, "hotkeys");
+        if (analyzer.track_hot)
+            addReplyMemoryAnalyzerTop(c, &analyzer.hot);
+        else
+            addReply(c, shared.nullmultibulk);
+    }
+    else if (!strcasecmp(c->argv[2]->ptr, "start") && (c->argc == 3 || c->argc == 5))
+    {
+        long long count = MEMORY_ANALYZER_DEFAULT_COUNT;
+
+        if (c->argc == 5)
+        {
+            if (strcasecmp(c->argv[3]->ptr, "count"))
+            {
+                addReply(c, shared.syntaxerr);
+                return;
+            };
+            if (getLongLongFromObjectOrReply(c, c->argv[4], &count, NULL) == C_ERR)
+                return;
+            if (count <= 0 || count > MEMORY_ANALYZER_MAX_COUNT)
+            {
+                addReplyErrorFormat(c, "COUNT must be between 1 and %d", MEMORY_ANALYZER_MAX_COUNT);
+                return;
+            };
+        };
+        memoryAnalyzerStart(count);
+        addReply(c, shared.ok);
+    }
+    else if (!strcasecmp(c->argv[2]->ptr, "stop") && c->argc == 3)
+    {
+        if (analyzer.running)
+            memoryAnalyzerStop();
+        addReply(c, shared.ok);
+    }
+    else
+    {
+        addReply(c, shared.syntaxerr);
+    };
+};
+
 void memoryCommand(client *c)
 {
     robj *o;
@@ -1211,7 +1459,7 @@ void memoryCommand(client *c)
             return;
 
         size_t usage = objectComputeSize(o, samples);
-        usage += sdsAllocSize(c->argv[1]->ptr);
+        usage += sdsAllocSize(c->argv[2]->ptr);
         usage += sizeof(dictEntry);
         addReplyLongLong(c, usage);
     }
@@ -1309,9 +1557,13 @@ void memoryCommand(client *c)
         addReply(c, shared.ok);
 #endif
     }
+    else if (!strcasecmp(c->argv[1]->ptr, "analyze") && c->argc >= 2)
+    {
+        memoryAnalyzeCommand(c);
+    }
     else if (!strcasecmp(c->argv[1]->ptr, "help") && c->argc == 2)
     {
-        addReplyMultiBulkLen(c, 4);
+        addReplyMultiBulkLen(c, 7);
         addReplyBulkCString(c,
                             "MEMORY USAGE <key> [SAMPLES <count>] - Estimate memory usage of key");
         addReplyBulkCString(c,
@@ -1320,9 +1572,117 @@ void memoryCommand(client *c)
                             "MEMORY PURGE                         - Ask the allocator to release memory");
         addReplyBulkCString(c,
                             "MEMORY MALLOC-STATS                  - Show allocator internal stats");
+        addReplyBulkCString(c,
+                            "MEMORY ANALYZE START [COUNT <count>] - Find the biggest and hottest keys in the background");
+        addReplyBulkCString(c,
+                            "MEMORY ANALYZE STOP                  - Stop the background analysis");
+        addReplyBulkCString(c,
+                            "MEMORY ANALYZE                       - Show the progress and the keys found so far");
     }
     else
     {
         addReplyError(c, "Syntax error. Try MEMORY HELP");
     };
 };
+
+#ifdef REDIS_TEST
+#define OBJECT_TEST_VALUES 100000
+
+/* Average allocator bytes per string value of 'len' bytes. */
+static double objectTestBytesPerValue(robj *(*create)(const char *, size_t), size_t len)
+{
+    robj **objs = zmalloc(sizeof(robj *) * OBJECT_TEST_VALUES);
+    char buf[128];
+    size_t before;
+    double used;
+    int j;
+
+    memset(buf, 'x', len);
+    before = zmalloc_used_memory();
+    for (j = 0; j < OBJECT_TEST_VALUES; j++)
+        objs[j] = create(buf, len);
+    used = (double)(zmalloc_used_memory() - before) / OBJECT_TEST_VALUES;
+    for (j = 0; j < OBJECT_TEST_VALUES; j++)
+        decrRefCount(objs[j]);
+    zfree(objs);
+    return used;
+};
+
+int objectTest(int argc, char **argv)
+{
+    size_t lens[] = {8, 16, 32, 43, 44, 45, 60, 100};
+    unsigned int j;
+
+    UNUSED(argc);
+    UNUSED(argv);
+
+    server.hz = CONFIG_DEFAULT_HZ;
+    server.maxmemory = 1024 * 1024 * 1024;
+    server.maxmemory_policy = MAXMEMORY_ALLKEYS_LRU;
+
+    printf("Strings up to the limit are embedded: ");
+    {
+        char buf[OBJ_ENCODING_EMBSTR_SIZE_LIMIT + 1];
+        robj *o, *dup;
+
+        memset(buf, 'a', sizeof(buf));
+        o = createStringObject(buf, OBJ_ENCODING_EMBSTR_SIZE_LIMIT);
+        serverAssert(o->encoding == OBJ_ENCODING_EMBSTR && sdslen(o->ptr) == OBJ_ENCODING_EMBSTR_SIZE_LIMIT);
+        serverAssert(memcmp(o->ptr, buf, OBJ_ENCODING_EMBSTR_SIZE_LIMIT) == 0 && ((char *)o->ptr)[OBJ_ENCODING_EMBSTR_SIZE_LIMIT] == '\0');
+        dup = dupStringObject(o);
+        serverAssert(dup->encoding == OBJ_ENCODING_EMBSTR && sdscmp(dup->ptr, o->ptr) == 0);
+        decrRefCount(dup);
+        decrRefCount(o);
+
+        o = createStringObject(buf, OBJ_ENCODING_EMBSTR_SIZE_LIMIT + 1);
+        serverAssert(o->encoding == OBJ_ENCODING_RAW);
+        decrRefCount(o);
+
+        o = tryObjectEncoding(createRawStringObject(buf, OBJ_ENCODING_EMBSTR_SIZE_LIMIT));
+        serverAssert(o->encoding == OBJ_ENCODING_EMBSTR && sdslen(o->ptr) == OBJ_ENCODING_EMBSTR_SIZE_LIMIT);
+        serverAssert(sizeof(robj) + sizeof(struct sdshdr8) + OBJ_ENCODING_EMBSTR_SIZE_LIMIT + 1 == 64);
+        decrRefCount(o);
+
+        o = tryObjectEncoding(createRawStringObject(buf, OBJ_ENCODING_EMBSTR_SIZE_LIMIT + 1));
+        serverAssert(o->encoding == OBJ_ENCODING_RAW);
+        decrRefCount(o);
+        printf("OK\n");
+    }
+
+    printf("Integers are private when the policy needs LRU/LFU: ");
+    {
+        robj *o = tryObjectEncoding(createRawStringObject("1234", 4));
+
+        serverAssert(o->encoding == OBJ_ENCODING_INT && (long)o->ptr == 1234 && o->refcount == 1);
+        decrRefCount(o);
+        o = createStringObjectFromLongLongForValue(42);
+        serverAssert(o->encoding == OBJ_ENCODING_INT && (long)o->ptr == 42 && o->refcount == 1);
+        decrRefCount(o);
+        printf("OK\n");
+    }
+
+    printf("Peeking at the LFU counter does not decay it: ");
+    {
+        robj *o = createStringObject("v", 1);
+        unsigned int lru;
+
+        server.unixtime = 3600;
+        server.lfu_decay_time = 1;
+        o->lru = lru = ((LFUGetTimeInMinutes() - 10) << 8) | 20;
+        serverAssert(LFUPeekDecayed(o) == 10 && o->lru == lru);
+        serverAssert(LFUDecrAndReturn(o) == 10 && o->lru == ((LFUGetTimeInMinutes() << 8) | 10));
+        serverAssert(LFUPeekDecayed(o) == 10);
+        decrRefCount(o);
+        printf("OK\n");
+    }
+
+    printf("Allocator bytes per string value, robj + sds -> createStringObject():\n");
+    for (j = 0; j < sizeof(lens) / sizeof(lens[0]); j++)
+    {
+        printf("  %3zu bytes: %6.1f -> %6.1f\n", lens[j],
+               objectTestBytesPerValue(createRawStringObject, lens[j]),
+               objectTestBytesPerValue(createStringObject, lens[j]));
+    }
+    return 0;
+};
+#endif
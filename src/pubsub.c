@@ -1,24 +1,40 @@
 #include "server.h"
 
-void freePubsubPattern(void *p){
-    pubsubPattern *pat = p;
-    decrRefCount(pat->pattern);
-    zfree(pat);
+int clientSubscriptionsCount(client *c){
+    return dictSize(c->pubsub_channels) + listLength(c->pubsub_patterns);
 };
 
-int listMatchPubsubPattern(void *a, void *b){
-    pubsubPattern *pa = a, *pb = b;
+void pubsubSubscribersRelease(pubsubSubscribers *subs){
+    zfree(subs->clients);
+    zfree(subs);
+};
 
-    return (pa->client == pb->client) && (equalStringObjects(pa->pattern,pb->pattern));
+static void pubsubSubscribersAdd(pubsubSubscribers *subs, client *c){
+    if(subs->count == subs->size){
+        subs->size = subs->size ? subs->size * 2 : 4;
+        subs->clients = zrealloc(subs->clients,sizeof(client*) * subs->size);
+    };
+    subs->clients[subs->count++] = c;
 };
 
-int clientSubscriptionsCount(client *c){
-    return dictSize(c->pubsub_channels) + listLength(c->pubsub_patterns);
+static int pubsubSubscribersRemove(pubsubSubscribers *subs, client *c){
+    unsigned long j;
+
+    for(j = 0; j < subs->count; j++){
+        if(subs->clients[j] != c) continue;
+        subs->clients[j] = subs->clients[--subs->count];
+        if(subs->size > 16 && subs->count < subs->size / 4){
+            subs->size /= 2;
+            subs->clients = zrealloc(subs->clients,sizeof(client*) * subs->size);
+        };
+        return 1;
+    };
+    return 0;
 };
 
 int pubsubSubscribeChannel(client *c, robj *channel){
     dictEntry *de;
-    list *clients = NULL;
+    pubsubSubscribers *subs = NULL;
     int retval = 0;
 
     if(dictAdd(c->pubsub_channels, channel, NULL) == DICT_OK){
@@ -26,13 +42,14 @@ int pubsubSubscribeChannel(client *c, robj *channel){
         incrRefCount(channel);
         de = dictFind(server.pubsub_channels, channel);
         if(de == NULL){
-           clients = listCreate(); 
-           dictAdd(server.pubsub_channels,channel,clients);
+           subs = zcalloc(sizeof(*subs)); 
+           dictAdd(server.pubsub_channels,channel,subs);
            incrRefCount(channel);
+           notifyTrackSubscription(channel,0,1);
         }else{
-            clients = dictGetVal(de);
+            subs = dictGetVal(de);
         }
-        listAddNodeTail(clients,c);
+        pubsubSubscribersAdd(subs,c);
     };
 
 
@@ -43,7 +60,387 @@ int pubsubSubscribeChannel(client *c, robj *channel){
     return retval;
 };
 
+int pubsubUnsubscribeChannel(client *c, robj *channel, int notify){
+    dictEntry *de;
+    pubsubSubscribers *subs;
+    int retval = 0;
+
+    incrRefCount(channel);
+    if(dictDelete(c->pubsub_channels,channel) == DICT_OK){
+        retval = 1;
+        de = dictFind(server.pubsub_channels,channel);
+        serverAssert(de != NULL);
+        subs = dictGetVal(de);
+        serverAssert(pubsubSubscribersRemove(subs,c));
+        if(subs->count == 0){
+            notifyTrackSubscription(channel,0,-1);
+            dictDelete(server.pubsub_channels,channel);
+        };
+    };
+
+    if(notify){
+        addReply(c,shared.mbulkhdr[3]);
+        addReply(c,shared.unsubscribebulk);
+        addReplyBulk(c,channel);
+        addReplyLongLong(c,clientSubscriptionsCount(c));
+    };
+    decrRefCount(channel);
+    return retval;
+};
+
+/* Pattern index.
+ *
+ * server.pubsub_patterns maps every distinct pattern to its subscribers,
+ * so clients sharing a pattern share one entry. Patterns are also filed in
+ * server.pubsub_pattern_prefixes by their literal prefix, the part before
+ * the first glob special character, truncated to PUBSUB_PATTERN_PREFIX_MAX
+ * bytes. A pattern can only match channels starting with its prefix, so
+ * PUBLISH only looks up the prefixes of the channel name, skipping the
+ * lengths no pattern uses, and glob matches the patterns found there. */
+size_t pubsubPatternPrefixLen(robj *pattern){
+    sds p = pattern->ptr;
+    size_t j, len = sdslen(p);
+
+    if(len > PUBSUB_PATTERN_PREFIX_MAX) len = PUBSUB_PATTERN_PREFIX_MAX;
+    for(j = 0; j < len; j++){
+        if(p[j] == '*' || p[j] == '?' || p[j] == '[' || p[j] == '\\') break;
+    };
+    return j;
+};
+
+static void pubsubPatternIndexAdd(robj *pattern){
+    size_t plen = pubsubPatternPrefixLen(pattern);
+    sds prefix = sdsnewlen(pattern->ptr,plen);
+    dictEntry *de = dictFind(server.pubsub_pattern_prefixes,prefix);
+    list *patterns;
+
+    if(de == NULL){
+        patterns = listCreate();
+        listSetFreeMethod(patterns,decrRefCountVoid);
+        dictAdd(server.pubsub_pattern_prefixes,prefix,patterns);
+    }else{
+        patterns = dictGetVal(de);
+        sdsfree(prefix);
+    };
+    incrRefCount(pattern);
+    listAddNodeTail(patterns,pattern);
+    server.pubsub_pattern_prefix_lens[plen]++;
+};
+
+static void pubsubPatternIndexDel(robj *pattern){
+    size_t plen = pubsubPatternPrefixLen(pattern);
+    sds prefix = sdsnewlen(pattern->ptr,plen);
+    dictEntry *de = dictFind(server.pubsub_pattern_prefixes,prefix);
+    list *patterns;
+    listNode *ln;
+    listIter li;
+
+    serverAssert(de != NULL);
+    patterns = dictGetVal(de);
+    listRewind(patterns,&li);
+    while((ln = listNext(&li)) != NULL){
+        if(equalStringObjects(listNodeValue(ln),pattern)){
+            listDelNode(patterns,ln);
+            break;
+        };
+    };
+    if(listLength(patterns) == 0) dictDelete(server.pubsub_pattern_prefixes,prefix);
+    server.pubsub_pattern_prefix_lens[plen]--;
+    sdsfree(prefix);
+};
+
+int pubsubSubscribePattern(client *c, robj *pattern){
+    int retval = 0;
+
+    if(listSearchKey(c->pubsub_patterns,pattern) == NULL){
+        dictEntry *de;
+        pubsubSubscribers *subs;
+
+        retval = 1;
+        pattern = getDecodedObject(pattern);
+        listAddNodeTail(c->pubsub_patterns,pattern);
+        de = dictFind(server.pubsub_patterns,pattern);
+        if(de == NULL){
+            subs = zcalloc(sizeof(*subs));
+            incrRefCount(pattern);
+            dictAdd(server.pubsub_patterns,pattern,subs);
+            pubsubPatternIndexAdd(pattern);
+            notifyTrackSubscription(pattern,1,1);
+        }else{
+            subs = dictGetVal(de);
+        };
+        pubsubSubscribersAdd(subs,c);
+        server.pubsub_pattern_subscriptions++;
+    };
+
+    addReply(c,shared.mbulkhdr[3]);
+    addReply(c,shared.psubscribebulk);
+    addReplyBulk(c,pattern);
+    addReplyLongLong(c,clientSubscriptionsCount(c));
+    return retval;
+};
+
+int pubsubUnsubscribePattern(client *c, robj *pattern, int notify){
+    listNode *ln;
+    int retval = 0;
 
+    incrRefCount(pattern);
+    if((ln = listSearchKey(c->pubsub_patterns,pattern)) != NULL){
+        dictEntry *de;
+        pubsubSubscribers *subs;
 
+        retval = 1;
+        listDelNode(c->pubsub_patterns,ln);
+        de = dictFind(server.pubsub_patterns,pattern);
+        serverAssert(de != NULL);
+        subs = dictGetVal(de);
+        serverAssert(pubsubSubscribersRemove(subs,c));
+        if(subs->count == 0){
+            pubsubPatternIndexDel(dictGetKey(de));
+            notifyTrackSubscription(pattern,1,-1);
+            dictDelete(server.pubsub_patterns,pattern);
+        };
+        server.pubsub_pattern_subscriptions--;
+    };
+
+    if(notify){
+        addReply(c,shared.mbulkhdr[3]);
+        addReply(c,shared.punsubscribebulk);
+        addReplyBulk(c,pattern);
+        addReplyLongLong(c,clientSubscriptionsCount(c));
+    };
+    decrRefCount(pattern);
+    return retval;
+};
+
+int pubsubUnsubscribeAllChannels(client *c, int notify){
+    dictIterator *di = dictGetSafeIterator(c->pubsub_channels);
+    dictEntry *de;
+    int count = 0;
+
+    while((de = dictNext(di)) != NULL){
+        robj *channel = dictGetKey(de);
+
+        count += pubsubUnsubscribeChannel(c,channel,notify);
+    };
+
+    if(notify && count == 0){
+        addReply(c,shared.mbulkhdr[3]);
+        addReply(c,shared.unsubscribebulk);
+        addReply(c,shared.nullbulk);
+        addReplyLongLong(c,dictSize(c->pubsub_channels) + listLength(c->pubsub_patterns));
+    };
+    dictReleaseIterator(di);
+    return count;
+};
 
+int pubsubUnsubscribeAllPatterns(client *c, int notify){
+    listNode *ln;
+    listIter li;
+    int count = 0;
 
+    listRewind(c->pubsub_patterns,&li);
+    while((ln = listNext(&li)) != NULL){
+        robj *pattern = ln->value;
+
+        count += pubsubUnsubscribePattern(c,pattern,notify);
+    };
+
+    if(notify && count == 0){
+        addReply(c,shared.mbulkhdr[3]);
+        addReply(c,shared.punsubscribebulk);
+        addReply(c,shared.nullbulk);
+        addReplyLongLong(c,dictSize(c->pubsub_channels) + listLength(c->pubsub_patterns));
+    };
+    return count;
+};
+
+static sds pubsubCatBulk(sds s, robj *o){
+    char buf[LONG_STR_SIZE + 3];
+    int len;
+
+    buf[0] = '$';
+    len = 1 + ll2string(buf + 1,sizeof(buf) - 1,sdslen(o->ptr));
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    s = sdscatlen(s,buf,len);
+    s = sdscatlen(s,o->ptr,sdslen(o->ptr));
+    return sdscatlen(s,"\r\n",2);
+};
+
+/* Encode a "message" frame, or a "pmessage" one if 'pattern' is not NULL,
+ * in a single allocation. */
+static robj *pubsubCreateFrame(robj *pattern, robj *channel, robj *message){
+    size_t len = sdslen(channel->ptr) + sdslen(message->ptr) + (LONG_STR_SIZE + 5) * 3 + 32;
+    sds s;
+
+    if(pattern) len += sdslen(pattern->ptr);
+    s = sdsMakeRoomForNonGreedy(sdsempty(),len);
+    if(pattern){
+        s = sdscatlen(s,"*4\r\n$8\r\npmessage\r\n",18);
+        s = pubsubCatBulk(s,pattern);
+    }else{
+        s = sdscatlen(s,"*3\r\n$7\r\nmessage\r\n",17);
+    };
+    s = pubsubCatBulk(s,channel);
+    s = pubsubCatBulk(s,message);
+    return createObject(OBJ_STRING,s);
+};
+
+static void pubsubDeliverFrame(pubsubSubscribers *subs, robj *frame){
+    unsigned long j;
+
+    for(j = 0; j < subs->count; j++) addReplyShared(subs->clients[j],frame);
+};
+
+/* Glob match the patterns filed under one prefix of the channel name. */
+static int pubsubPublishToPrefix(sds prefix, robj *channel, robj *message){
+    dictEntry *de = dictFind(server.pubsub_pattern_prefixes,prefix);
+    int receivers = 0;
+    listNode *ln;
+    listIter li;
+
+    if(de == NULL) return 0;
+    listRewind(dictGetVal(de),&li);
+    while((ln = listNext(&li)) != NULL){
+        robj *pattern = listNodeValue(ln);
+        pubsubSubscribers *subs;
+        robj *frame;
+
+        if(!stringmatchlen(pattern->ptr,sdslen(pattern->ptr),channel->ptr,sdslen(channel->ptr),0)){
+            continue;
+        };
+        subs = dictFetchValue(server.pubsub_patterns,pattern);
+        frame = pubsubCreateFrame(pattern,channel,message);
+        pubsubDeliverFrame(subs,frame);
+        decrRefCount(frame);
+        receivers += subs->count;
+    };
+    return receivers;
+};
+
+/* Deliver a message to the subscribers of 'channel' and of the patterns
+ * matching it. Each frame is encoded once, for the channel and for every
+ * matching pattern, and shared by the reply lists of its subscribers. */
+int pubsubPublishMessage(robj *channel, robj *message){
+    int receivers = 0;
+    dictEntry *de;
+    robj *frame;
+
+    channel = getDecodedObject(channel);
+    message = getDecodedObject(message);
+
+    de = dictFind(server.pubsub_channels,channel);
+    if(de){
+        pubsubSubscribers *subs = dictGetVal(de);
+
+        frame = pubsubCreateFrame(NULL,channel,message);
+        pubsubDeliverFrame(subs,frame);
+        receivers += subs->count;
+        decrRefCount(frame);
+    };
+
+    if(dictSize(server.pubsub_patterns)){
+        size_t j, maxlen = sdslen(channel->ptr);
+        sds prefix;
+
+        if(maxlen > PUBSUB_PATTERN_PREFIX_MAX) maxlen = PUBSUB_PATTERN_PREFIX_MAX;
+        prefix = sdsnewlen(channel->ptr,maxlen);
+        for(j = 0; j <= maxlen; j++){
+            if(server.pubsub_pattern_prefix_lens[j] == 0) continue;
+            sdssetlen(prefix,j);
+            receivers += pubsubPublishToPrefix(prefix,channel,message);
+        };
+        sdsfree(prefix);
+    };
+
+    decrRefCount(channel);
+    decrRefCount(message);
+    return receivers;
+};
+
+
+void subscribeCommand(client *c){
+    int j;
+
+    for(j = 1; j < c->argc; j++) pubsubSubscribeChannel(c,c->argv[j]);
+    c->flags |= CLIENT_PUBSUB;
+};
+
+void unsubscribeCommand(client *c){
+    if(c->argc == 1){
+        pubsubUnsubscribeAllChannels(c,1);
+    }else{
+        int j;
+
+        for(j = 1; j < c->argc; j++) pubsubUnsubscribeChannel(c,c->argv[j],1);
+    };
+    if(clientSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+};
+
+void psubscribeCommand(client *c){
+    int j;
+
+    for(j = 1; j < c->argc; j++) pubsubSubscribePattern(c,c->argv[j]);
+    c->flags |= CLIENT_PUBSUB;
+};
+
+void punsubscribeCommand(client *c){
+    if(c->argc == 1){
+        pubsubUnsubscribeAllPatterns(c,1);
+    }else{
+        int j;
+
+        for(j = 1; j < c->argc; j++) pubsubUnsubscribePattern(c,c->argv[j],1);
+    };
+    if(clientSubscriptionsCount(c) == 0) c->flags &= ~CLIENT_PUBSUB;
+};
+
+void publishCommand(client *c){
+    int receivers = pubsubPublishMessage(c->argv[1],c->argv[2]);
+
+    if(server.cluster_enabled){
+        clusterPropagatePublish(c->argv[1],c->argv[2]);
+    }else{
+        forceCommandPropagation(c,PROPAGATE_REPL);
+    };
+    addReplyLongLong(c,receivers);
+};
+
+void pubsubCommand(client *c){
+    if(!strcasecmp(c->argv[1]->ptr,"channels") && (c->argc == 2 || c->argc == 3)){
+        sds pat = (c->argc == 2) ? NULL : c->argv[2]->ptr;
+        dictIterator *di = dictGetIterator(server.pubsub_channels);
+        dictEntry *de;
+        long mblen = 0;
+        void *replylen;
+
+        replylen = addDeferredMultiBulkLength(c);
+        while((de = dictNext(di)) != NULL){
+            robj *cobj = dictGetKey(de);
+            sds channel = cobj->ptr;
+
+            if(!pat || stringmatchlen(pat,sdslen(pat),channel,sdslen(channel),0)){
+                addReplyBulk(c,cobj);
+                mblen++;
+            };
+        };
+        dictReleaseIterator(di);
+        setDeferredMultiBulkLength(c,replylen,mblen);
+    }else if(!strcasecmp(c->argv[1]->ptr,"numsub") && c->argc >= 2){
+        int j;
+
+        addReplyMultiBulkLen(c,(c->argc - 2) * 2);
+        for(j = 2; j < c->argc; j++){
+            dictEntry *de = dictFind(server.pubsub_channels,c->argv[j]);
+            pubsubSubscribers *subs = de ? dictGetVal(de) : NULL;
+
+            addReplyBulk(c,c->argv[j]);
+            addReplyLongLong(c,subs ? subs->count : 0);
+        };
+    }else if(!strcasecmp(c->argv[1]->ptr,"numpat") && c->argc == 2){
+        addReplyLongLong(c,server.pubsub_pattern_subscriptions);
+    }else{
+        addReplyErrorFormat(c,"Unknown PUBSUB subcommand or wrong number of arguments for '%s'",(char*)c->argv[1]->ptr);
+    };
+};
@@ -1,13 +1,24 @@
 #include <string.h>
+#include <strings.h>
 #include "quicklist.h"
 #include "zmalloc.h"
 #include "ziplist.h"
+#include "listpack.h"
 #include "util.h"
 #include "lzf.h"
 
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 
 #if defined(REDIS_TEST) || defined(REDIS_TEST_VERBOSE)
 #include <stdio.h>
+#include <stdlib.h>
 #endif
 
 
@@ -25,6 +36,8 @@ static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
 
 #define MIN_COMPRESS_IMPROVE 8
 
+#define QUICKLIST_ZSTD_LEVEL 3
+
 
 #ifndef REDIS_TEST_VERBOSE
 #define D(...)
@@ -56,6 +69,18 @@ static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
 #define unlikely(x) (x)
 #endif
 
+/* quicklist->bytes is the exact allocation size of the quicklist, its
+ * nodes and their listpacks, compressed or not. Every place that reallocates
+ * a listpack snapshots zmalloc_size() of the old one and charges the
+ * difference; nodes are charged when linked and discharged when unlinked.
+ * Decompressing a node for a read changes its size too, so the counter is
+ * also updated through a const quicklist pointer. */
+#define quicklistChargeBytes(_ql, _before, _after) \
+    (((struct quicklist *)(_ql))->bytes += (size_t)(_after) - (size_t)(_before))
+
+#define quicklistNodeBytes(_node) \
+    (zmalloc_size((_node)) + ((_node)->zl ? zmalloc_size((_node)->zl) : 0))
+
 
 
 quicklist *quicklistCreate(void){
@@ -66,7 +91,11 @@ quicklist *quicklistCreate(void){
     quicklist->head = quicklist->tail = NULL;
     quicklist->len = 0;
     quicklist->count = 0;
+    quicklist->bytes = zmalloc_size(quicklist);
+    quicklist->index = NULL;
+    quicklist->index_lookups = 0;
     quicklist->compress = 0; 
+    quicklist->codec = QUICKLIST_CODEC_LZF;
     quicklist->fill = -1;
     return quicklist;
 }
@@ -83,9 +112,9 @@ void quicklistSetCompressDepth(quicklist *quicklist, int compress){
     quicklist->compress = compress;
 }; 
 
-#define FILL_MAX (1 << 15)
+#define FILL_MAX ((1 << 15) - 1)
 void quicklistSetFill(quicklist *quicklist, int fill){
-    if(fill < FILL_MAX){
+    if(fill > FILL_MAX){
         fill = FILL_MAX;
     }else if(fill < -5){
         fill = -5;
@@ -98,6 +127,13 @@ void quicklistSetOptions(quicklist *quicklist, int fill, int depth){
     quicklistSetCompressDepth(quicklist,depth);
 };
 
+/* Nodes compressed from now on use 'codec'; nodes already compressed keep
+ * the codec they were tagged with. Unavailable codecs fall back to LZF. */
+void quicklistSetCodec(quicklist *quicklist, int codec){
+    if(!quicklistCodecAvailable(codec)) codec = QUICKLIST_CODEC_LZF;
+    quicklist->codec = codec;
+};
+
 quicklist *quicklistNew(int fill, int compress){
     quicklist *quicklist = quicklistCreate();
     quicklistSetOptions(quicklist, fill, compress);
@@ -112,7 +148,8 @@ REDIS_STATIC quicklistNode *quicklistCreateNode(void){
     node->sz = 0;
     node->next = node->prev = NULL;
     node->encoding = QUICKLIST_NODE_ENCODING_RAW;
-    node->container = QUICKLIST_NODE_CONTAINER_ZIPLIST;
+    node->codec = QUICKLIST_CODEC_LZF;
+    node->container = QUICKLIST_NODE_CONTAINER_PACKED;
     node->recompress = 0;
     return node;
 }
@@ -120,6 +157,126 @@ REDIS_STATIC quicklistNode *quicklistCreateNode(void){
 
 unsigned int quicklistCount(const quicklist *ql){ return ql->count;};
 
+size_t quicklistBytes(const quicklist *ql){ return ql->bytes;};
+
+
+/* Node index, see quicklistNodeIndex in quicklist.h. It is only worth it
+ * for lists with many nodes, and is built on the second lookup in a row
+ * that is not separated by a change invalidating it, so that alternating
+ * writes in the middle and reads never pay for a rebuild. */
+#define QUICKLIST_INDEX_MIN_NODES 32
+
+static size_t quicklistNodeIndexBytes(const quicklistNodeIndex *idx){
+    return zmalloc_size((void*)idx) + zmalloc_size(idx->nodes) + zmalloc_size(idx->start);
+};
+
+static void quicklistNodeIndexDrop(quicklist *quicklist){
+    quicklistNodeIndex *idx = quicklist->index;
+
+    quicklist->index_lookups = 0;
+    if(idx == NULL) return;
+    quicklist->bytes -= quicklistNodeIndexBytes(idx);
+    zfree(idx->nodes);
+    zfree(idx->start);
+    zfree(idx);
+    quicklist->index = NULL;
+};
+
+/* Slots are allocated with room on both sides for new head and tail nodes. */
+static void quicklistNodeIndexBuild(quicklist *quicklist){
+    quicklistNodeIndex *idx = zmalloc(sizeof(*idx));
+    quicklistNode *node;
+    long long pos = 0;
+    unsigned long j;
+
+    idx->size = quicklist->len * 2 + 16;
+    idx->nodes = zmalloc(sizeof(quicklistNode*) * idx->size);
+    idx->start = zmalloc(sizeof(long long) * idx->size);
+    idx->first = (idx->size - quicklist->len) / 2;
+    idx->last = idx->first + quicklist->len;
+    idx->origin = 0;
+    for(j = idx->first, node = quicklist->head; node; node = node->next, j++){
+        idx->nodes[j] = node;
+        idx->start[j] = pos;
+        pos += node->count;
+    };
+    quicklist->index = idx;
+    quicklist->bytes += quicklistNodeIndexBytes(idx);
+};
+
+/* Called after the head node grew or shrank by 'delta' elements. With
+ * 'created' the head is a new node, to be put in front of the others. */
+static void quicklistNodeIndexHeadChanged(quicklist *quicklist, int delta, int created){
+    quicklistNodeIndex *idx = quicklist->index;
+
+    if(idx == NULL) return;
+    if(created){
+        if(idx->first == 0){
+            quicklistNodeIndexDrop(quicklist);
+            return;
+        };
+        idx->first--;
+        idx->nodes[idx->first] = quicklist->head;
+    };
+    idx->origin -= delta;
+    idx->start[idx->first] = idx->origin;
+};
+
+/* Called after a new tail node was linked and counted. Growth of an
+ * existing tail node needs nothing, as its start does not move. */
+static void quicklistNodeIndexTailCreated(quicklist *quicklist){
+    quicklistNodeIndex *idx = quicklist->index;
+
+    if(idx == NULL) return;
+    if(idx->last == idx->size){
+        quicklistNodeIndexDrop(quicklist);
+        return;
+    };
+    idx->nodes[idx->last] = quicklist->tail;
+    idx->start[idx->last] = idx->origin + quicklist->count - quicklist->tail->count;
+    idx->last++;
+};
+
+/* Called before 'node' is unlinked. */
+static void quicklistNodeIndexNodeRemoved(quicklist *quicklist, quicklistNode *node){
+    quicklistNodeIndex *idx = quicklist->index;
+
+    if(idx == NULL) return;
+    if(node == quicklist->head && node != quicklist->tail){
+        idx->origin += node->count;
+        idx->first++;
+    }else if(node == quicklist->tail && node != quicklist->head){
+        idx->last--;
+    }else{
+        quicklistNodeIndexDrop(quicklist);
+    };
+};
+
+/* Find the node holding the element at forward position 'index', or NULL
+ * if there is no usable index. */
+static quicklistNode *quicklistNodeIndexLookup(quicklist *quicklist, unsigned long long index, unsigned long long *offset){
+    quicklistNodeIndex *idx;
+    unsigned long lo, hi;
+    long long pos;
+
+    if(quicklist->index == NULL){
+        if(quicklist->len < QUICKLIST_INDEX_MIN_NODES || quicklist->index_lookups++ == 0) return NULL;
+        quicklistNodeIndexBuild(quicklist);
+    };
+
+    idx = quicklist->index;
+    pos = idx->origin + (long long)index;
+    lo = idx->first;
+    hi = idx->last - 1;
+    while(lo < hi){
+        unsigned long mid = lo + (hi - lo + 1) / 2;
+        if(idx->start[mid] <= pos) lo = mid;
+        else hi = mid - 1;
+    };
+    *offset = pos - idx->start[lo];
+    return idx->nodes[lo];
+};
+
 void quicklistRelease(quicklist *quicklist){
 
     unsigned long len;  
@@ -134,10 +291,152 @@ void quicklistRelease(quicklist *quicklist){
         quicklist->len--;
         current = next;
     }
+    quicklistNodeIndexDrop(quicklist);
     zfree(quicklist);
 }
 
-REDIS_STATIC int __quicklistCompressNode(quicklistNode *node){
+/* Node compression codecs. Both callbacks return the number of bytes
+ * written to 'out', or 0 if the output does not fit or the input is
+ * corrupt. The codec used for a node is stored in node->codec, so lists
+ * whose codec is changed keep decoding their older nodes. */
+typedef struct quicklistCodec {
+    const char *name;
+    size_t (*compress)(const void *in, size_t inlen, void *out, size_t outlen);
+    size_t (*decompress)(const void *in, size_t inlen, void *out, size_t outlen);
+} quicklistCodec;
+
+static size_t lzfCodecCompress(const void *in, size_t inlen, void *out, size_t outlen){
+    return lzf_compress(in,inlen,out,outlen);
+};
+
+static size_t lzfCodecDecompress(const void *in, size_t inlen, void *out, size_t outlen){
+    return lzf_decompress(in,inlen,out,outlen);
+};
+
+#ifdef HAVE_LZ4
+static size_t lz4CodecCompress(const void *in, size_t inlen, void *out, size_t outlen){
+    int n = LZ4_compress_default(in,out,inlen,outlen);
+    return n > 0 ? (size_t)n : 0;
+};
+
+static size_t lz4CodecDecompress(const void *in, size_t inlen, void *out, size_t outlen){
+    int n = LZ4_decompress_safe(in,out,inlen,outlen);
+    return n > 0 ? (size_t)n : 0;
+};
+#endif
+
+#ifdef HAVE_ZSTD
+/* zstd dictionaries are trained offline (zstd --train) on samples of the
+ * stored values. A dictionary is never released once added: frames record
+ * the id of the dictionary they were compressed with, so nodes compressed
+ * before a newer dictionary was added can still be decoded. */
+typedef struct zstdCodecDict {
+    unsigned int id;
+    ZSTD_DDict *ddict;
+    struct zstdCodecDict *next;
+} zstdCodecDict;
+
+static ZSTD_CCtx *zstd_cctx = NULL;
+static ZSTD_DCtx *zstd_dctx = NULL;
+static ZSTD_CDict *zstd_cdict = NULL;
+static zstdCodecDict *zstd_dicts = NULL;
+
+static size_t zstdCodecCompress(const void *in, size_t inlen, void *out, size_t outlen){
+    size_t n;
+
+    if(zstd_cctx == NULL) zstd_cctx = ZSTD_createCCtx();
+    if(zstd_cdict){
+        n = ZSTD_compress_usingCDict(zstd_cctx,out,outlen,in,inlen,zstd_cdict);
+    }else{
+        n = ZSTD_compressCCtx(zstd_cctx,out,outlen,in,inlen,QUICKLIST_ZSTD_LEVEL);
+    };
+    return ZSTD_isError(n) ? 0 : n;
+};
+
+static size_t zstdCodecDecompress(const void *in, size_t inlen, void *out, size_t outlen){
+    unsigned int id = ZSTD_getDictID_fromFrame(in,inlen);
+    zstdCodecDict *d = zstd_dicts;
+    size_t n;
+
+    if(zstd_dctx == NULL) zstd_dctx = ZSTD_createDCtx();
+    if(id == 0){
+        n = ZSTD_decompressDCtx(zstd_dctx,out,outlen,in,inlen);
+    }else{
+        while(d && d->id != id) d = d->next;
+        if(d == NULL) return 0;
+        n = ZSTD_decompress_usingDDict(zstd_dctx,out,outlen,in,inlen,d->ddict);
+    };
+    return ZSTD_isError(n) ? 0 : n;
+};
+#endif
+
+static const quicklistCodec quicklistCodecs[QUICKLIST_CODEC_COUNT] = {
+    {"lzf", lzfCodecCompress, lzfCodecDecompress},
+#ifdef HAVE_LZ4
+    {"lz4", lz4CodecCompress, lz4CodecDecompress},
+#else
+    {"lz4", NULL, NULL},
+#endif
+#ifdef HAVE_ZSTD
+    {"zstd", zstdCodecCompress, zstdCodecDecompress},
+#else
+    {"zstd", NULL, NULL},
+#endif
+};
+
+int quicklistCodecAvailable(int codec){
+    return codec >= 0 && codec < QUICKLIST_CODEC_COUNT && quicklistCodecs[codec].compress != NULL;
+};
+
+const char *quicklistCodecName(int codec){
+    return (codec >= 0 && codec < QUICKLIST_CODEC_COUNT) ? quicklistCodecs[codec].name : "unknown";
+};
+
+/* Return the codec called 'name', or -1 if there is no such codec or it
+ * was not compiled in. */
+int quicklistCodecByName(const char *name){
+    for(int codec = 0; codec < QUICKLIST_CODEC_COUNT; codec++){
+        if(!strcasecmp(name,quicklistCodecs[codec].name)){
+            return quicklistCodecAvailable(codec) ? codec : -1;
+        };
+    };
+    return -1;
+};
+
+/* Make the zstd codec compress with the given trained dictionary. Returns 0
+ * on success, -1 if zstd is not available or 'dict' is not a dictionary
+ * with an id, as produced by zstd --train. */
+int quicklistCodecAddDictionary(const void *dict, size_t len){
+#ifdef HAVE_ZSTD
+    unsigned int id = ZSTD_getDictID_fromDict(dict,len);
+    ZSTD_CDict *cdict;
+    zstdCodecDict *d;
+
+    if(id == 0) return -1;
+    if((cdict = ZSTD_createCDict(dict,len,QUICKLIST_ZSTD_LEVEL)) == NULL) return -1;
+    for(d = zstd_dicts; d && d->id != id; d = d->next);
+    if(d == NULL){
+        d = zmalloc(sizeof(*d));
+        if((d->ddict = ZSTD_createDDict(dict,len)) == NULL){
+            zfree(d);
+            ZSTD_freeCDict(cdict);
+            return -1;
+        };
+        d->id = id;
+        d->next = zstd_dicts;
+        zstd_dicts = d;
+    };
+    ZSTD_freeCDict(zstd_cdict);
+    zstd_cdict = cdict;
+    return 0;
+#else
+    (void)dict;
+    (void)len;
+    return -1;
+#endif
+};
+
+REDIS_STATIC int __quicklistCompressNode(const quicklist *quicklist, quicklistNode *node){
 #ifdef REDIS_TEST
     node->attempted_compress = 1;
 #endif
@@ -146,59 +445,70 @@ REDIS_STATIC int __quicklistCompressNode(quicklistNode *node){
     };
     
     quicklistLZF *lzf = zmalloc(sizeof(*lzf) + node->sz);
-    if(((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed, node->sz)) == 0) || lzf->sz + MIN_COMPRESS_BYTES >= node->sz){
+    if(((lzf->sz = quicklistCodecs[quicklist->codec].compress(node->zl, node->sz, lzf->compressed, node->sz)) == 0) || lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz){
         zfree(lzf);
         return 0;
     };
     
     lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
+    quicklistChargeBytes(quicklist, zmalloc_size(node->zl), zmalloc_size(lzf));
     zfree(node->zl);
     node->zl = (unsigned char *)lzf;
     node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    node->codec = quicklist->codec;
     node->recompress = 0;
     return 1; 
 };
 
-#define quicklistCompressNode(_node)   \
+#define quicklistCompressNode(_ql, _node)   \
     do {   \
         if((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW){   \
-            __quicklistCompressNode((_node));   \
+            __quicklistCompressNode((_ql), (_node));   \
         }      \
    }while(0)
 
 
 
-REDIS_STATIC int __quicklistDecompressNode(quicklistNode *node){
+REDIS_STATIC int __quicklistDecompressNode(const quicklist *quicklist, quicklistNode *node){
     #ifdef REDIS_TEST
         node->attempted_compress = 0;
     #endif
         void *decompressed = zmalloc(node->sz);
         quicklistLZF *lzf = (quicklistLZF *)node->zl;
-        if(lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0){
+        if(quicklistNodeDecompressTo(node, decompressed) == 0){
             zfree(decompressed);
             return 0;
         };
+        quicklistChargeBytes(quicklist, zmalloc_size(lzf), zmalloc_size(decompressed));
         zfree(lzf);
         node->zl = decompressed;
         node->encoding = QUICKLIST_NODE_ENCODING_RAW;
         return 1;
 };
 
-#define quicklistDecompressNode(_node)   \
+#define quicklistDecompressNode(_ql, _node)   \
     do { \
        if((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF){  \
-           __quicklistDecompressNode((_node));  \
+           __quicklistDecompressNode((_ql), (_node));  \
         } \
     }while(0) 
 
-#define quicklistDecompressNodeForUse(_node)  \
+#define quicklistDecompressNodeForUse(_ql, _node)  \
    do {    \
        if((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF){ \
-           __quicklistDecompressNode((_node));   \
+           __quicklistDecompressNode((_ql), (_node));   \
            (_node)->recompress = 1;   \
         } \
     }while(0)        
 
+/* Decode the compressed 'node' into 'dst', which must hold node->sz bytes,
+ * leaving the node untouched. Returns 0 if the payload is corrupt. */
+int quicklistNodeDecompressTo(const quicklistNode *node, unsigned char *dst){
+    quicklistLZF *lzf = (quicklistLZF *)node->zl;
+    return quicklistCodecs[node->codec].decompress != NULL &&
+           quicklistCodecs[node->codec].decompress(lzf->compressed, lzf->sz, dst, node->sz) == node->sz;
+};
+
 size_t quicklistGetLzf(const quicklistNode *node, void **data){
     quicklistLZF *lzf = (quicklistLZF *)node->zl;
     *data = lzf->compressed;
@@ -215,29 +525,29 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist, quicklistNode
 #if 0
     if(quicklist->compress == 1){
         quicklistNode *h = quicklist->head, *t = quicklist->tail;
-        quicklistDecompressNode(h);
-        quicklistDecompressNode(t);
+        quicklistDecompressNode(quicklist, h);
+        quicklistDecompressNode(quicklist, t);
         if(h != node && t != node){
-            quicklistCompressNode(node);
+            quicklistCompressNode(quicklist, node);
         }
         return;
     }else if(quicklist->compress == 2){
         quicklistNode *h = quicklist->head, *hn = h->next, *hnn = hn->next;
         quicklistNode *t = quicklist->tail, *tp = t->prev, *tpp = tp ->prev;
-        quicklistDecompressNode(h);
-        quicklistDecompressNode(hn);
-        quicklistDecompressNode(t);
-        quicklistDecompressNode(tp);
+        quicklistDecompressNode(quicklist, h);
+        quicklistDecompressNode(quicklist, hn);
+        quicklistDecompressNode(quicklist, t);
+        quicklistDecompressNode(quicklist, tp);
         if(h != node && hn != node && t != node && tp != node){
-            quicklistCompressNode(node);
+            quicklistCompressNode(quicklist, node);
         };
         
         if(hnn != t){
-            quicklistCompressNode(hnn);
+            quicklistCompressNode(quicklist, hnn);
         };
         
         if(tpp != h){
-            quicklistCompressNode(tpp);
+            quicklistCompressNode(quicklist, tpp);
         };
         return;
     }
@@ -249,14 +559,15 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist, quicklistNode
     int in_depth = 0;
     
     while(depth++ < quicklist->compress){
-        quicklistDecompressNode(forward);
-        quicklistDecompressNode(reverse);
+        quicklistDecompressNode(quicklist, forward);
+        quicklistDecompressNode(quicklist, reverse);
             
         if(forward == node || reverse == node){
             in_depth = 1;
         };
         
-        if(forward == reverse){
+        /* The two walks met: every node is within depth of an end. */
+        if(forward == reverse || forward->next == reverse){
             return;
         }
         
@@ -264,16 +575,20 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist, quicklistNode
         reverse = reverse->prev;
     }; 
     
-    if(!in_depth){
-        quicklistCompressNode(forward);
-        quicklistCompressNode(reverse);
-    }; 
+    /* 'node' lies beyond the uncompressed ends, so it is compressed too. */
+    if(!in_depth && node){
+        quicklistCompressNode(quicklist, node);
+    };
+    
+    /* forward and reverse are now one node past the depth on each side. */
+    quicklistCompressNode(quicklist, forward);
+    quicklistCompressNode(quicklist, reverse);
 }; 
 
 #define quicklistCompress(_ql, _node)    \
     do {             \
        if((_node)->recompress){   \
-            quicklistCompressNode((_node));   \
+            quicklistCompressNode((_ql), (_node));   \
        }else{               \
             __quicklistCompress((_ql),(_node)); \
        }\
@@ -282,7 +597,7 @@ REDIS_STATIC void __quicklistCompress(const quicklist *quicklist, quicklistNode
 #define quicklistRecompressOnly(_ql, _node) \
     do{  \
         if((_node)->recompress){    \
-            quicklistCompressNode((_node));    \
+            quicklistCompressNode((_ql), (_node));    \
         }   \
     }while(0) 
 
@@ -319,6 +634,7 @@ REDIS_STATIC void __quicklistInsertNode(quicklist *quicklist, quicklistNode *old
         quicklist->head = quicklist->tail = new_node;
     };
     
+    quicklist->bytes += quicklistNodeBytes(new_node);
     if(old_node){
         quicklistCompress(quicklist, old_node);
     }
@@ -360,23 +676,26 @@ REDIS_STATIC int _quicklistNodeAllowInsert(const quicklistNode *node,const int f
       return 0; 
     };
     
-    int ziplist_overhead;
+    /* Listpack string header, then the backlen of header plus data. */
+    int listpack_overhead;
     
-    if(sz < 254){
-        ziplist_overhead = 1;
+    if(sz < 64){
+        listpack_overhead = 1;
+    }else if(likely(sz < 4096)){
+        listpack_overhead = 2;
     }else{
-        ziplist_overhead = 5;
+        listpack_overhead = 5;
     }
     
-    if(sz < 64){
-        ziplist_overhead += 1;
-    }else if(likely(sz < 16384)){
-        ziplist_overhead += 2;
+    if(sz + listpack_overhead <= 127){
+        listpack_overhead += 1;
+    }else if(likely(sz + listpack_overhead < 16383)){
+        listpack_overhead += 2;
     }else{
-        ziplist_overhead += 5;
+        listpack_overhead += 5;
     }
     
-    unsigned int new_sz = node->sz + sz + ziplist_overhead;
+    unsigned int new_sz = node->sz + sz + listpack_overhead;
     if(likely(_quicklistNodeSizeMeetsOptimizationRequirement(new_sz, fill))){
         return 1;
     }else if(!sizeMeetsSaftyLimit(new_sz)){
@@ -394,7 +713,7 @@ REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a, const quicklis
         return 0;
     }    
 
-    unsigned int merge_sz = a->sz + b->sz - 11;
+    unsigned int merge_sz = a->sz + b->sz - (LP_HDR_SIZE + 1);
     if(likely(_quicklistNodeSizeMeetsOptimizationRequirement(merge_sz,fill))){
         return 1;
     }else if(!sizeMeetsSaftyLimit(merge_sz)){
@@ -408,7 +727,7 @@ REDIS_STATIC int _quicklistNodeAllowMerge(const quicklistNode *a, const quicklis
 
 #define quicklistNodeUpdateSz(node)  \
     do{  \
-        (node)->sz = ziplistBlobLen((node)->zl);\
+        (node)->sz = lpBytes((node)->zl);\
     }while(0)
 
 int quicklistPushHead(quicklist *quicklist, void *value, size_t sz){
@@ -416,11 +735,13 @@ int quicklistPushHead(quicklist *quicklist, void *value, size_t sz){
     if(likely(
         _quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz)
     )){
-        quicklist->head->zl = ziplistPush(quicklist->head->zl, value, sz, ZIPLIST_HEAD);
+        size_t zlbytes = zmalloc_size(quicklist->head->zl);
+        quicklist->head->zl = lpPrepend(quicklist->head->zl, value, sz);
         quicklistNodeUpdateSz(quicklist->head);
+        quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(quicklist->head->zl));
     }else{
         quicklistNode *node = quicklistCreateNode();
-        node->zl = ziplistPush(ziplistNew(), value,sz,ZIPLIST_HEAD);
+        node->zl = lpPrepend(lpNew(), value, sz);
         
         quicklistNodeUpdateSz(node);
         _quicklistInsertNodeBefore(quicklist, quicklist->head, node);
@@ -428,6 +749,7 @@ int quicklistPushHead(quicklist *quicklist, void *value, size_t sz){
     
     quicklist->count++;
     quicklist->head->count++;
+    quicklistNodeIndexHeadChanged(quicklist, 1, orig_head != quicklist->head);
     return (orig_head != quicklist->head);
 }
 
@@ -437,11 +759,13 @@ int quicklistPushTail(quicklist *quicklist, void *value, size_t sz){
     if(likely(
         _quicklistNodeAllowInsert(quicklist->tail, quicklist->fill,sz)
     )){
-        quicklist->tail->zl = ziplistPush(quicklist->tail->zl, value, sz, ZIPLIST_TAIL);
+        size_t zlbytes = zmalloc_size(quicklist->tail->zl);
+        quicklist->tail->zl = lpAppend(quicklist->tail->zl, value, sz);
         quicklistNodeUpdateSz(quicklist->tail);
+        quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(quicklist->tail->zl));
     }else{
         quicklistNode *node = quicklistCreateNode();
-        node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_TAIL);
+        node->zl = lpAppend(lpNew(), value, sz);
         
         quicklistNodeUpdateSz(node);
         _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
@@ -449,21 +773,28 @@ int quicklistPushTail(quicklist *quicklist, void *value, size_t sz){
     
     quicklist->count++;
     quicklist->tail->count++;
+    if(orig_tail != quicklist->tail){
+        quicklistNodeIndexTailCreated(quicklist);
+    };
     return (orig_tail != quicklist->tail);
 };
 
 
-void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl){
+/* Link an already built listpack as a new tail node, as loaded from RDB. */
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *zl){
     quicklistNode *node = quicklistCreateNode();
     
+    quicklistNodeIndexDrop(quicklist);    
     node->zl = zl;
-    node->count = ziplistLen(node->zl);
-    node->sz = ziplistBlobLen(zl);
+    node->count = lpLength(node->zl);
+    node->sz = lpBytes(zl);
     
     _quicklistInsertNodeAfter(quicklist, quicklist->tail, node);
     quicklist->count += node->count;
 };
 
+/* Ziplists are only met when loading old RDB files: their elements are
+ * copied into listpack nodes and the ziplist is freed. */
 quicklist *quicklistAppendValuesFromZiplist(quicklist *quicklist, unsigned char *zl){
     unsigned char *value;
     unsigned int sz;
@@ -499,6 +830,7 @@ quicklist *quicklistCreateFromZiplist(int fill, int compress, unsigned char *zl)
     }while(0)
 
 REDIS_STATIC void __quicklistDelNode(quicklist *quicklist, quicklistNode *node){
+    quicklistNodeIndexNodeRemoved(quicklist, node);
     if(node->next){
         node->next->prev = node->prev;
     }
@@ -518,6 +850,7 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist, quicklistNode *node){
     __quicklistCompress(quicklist,NULL); 
     
     quicklist->count -= node->count;
+    quicklist->bytes -= quicklistNodeBytes(node);
     
     zfree(node->zl);
     zfree(node);
@@ -526,8 +859,15 @@ REDIS_STATIC void __quicklistDelNode(quicklist *quicklist, quicklistNode *node){
 
 REDIS_STATIC int quicklistDelIndex(quicklist *quicklist, quicklistNode *node, unsigned char **p){
     int gone = 0;
+    size_t zlbytes = zmalloc_size(node->zl);
     
-    node->zl = ziplistDelete(node->zl, p);
+    if(node == quicklist->head){
+        quicklistNodeIndexHeadChanged(quicklist, -1, 0);
+    }else if(node != quicklist->tail){
+        quicklistNodeIndexDrop(quicklist);
+    };
+    node->zl = lpDelete(node->zl, *p, p);
+    quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(node->zl));
     node->count--;
     if(node->count == 0){
         gone = 1;
@@ -562,9 +902,10 @@ void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry){
 int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data, int sz){
     quicklistEntry entry;
     if(likely(quicklistIndex(quicklist, index,&entry))){
-        entry.node->zl = ziplistDelete(entry.node->zl, &entry.zi);
-        entry.node->zl = ziplistInsert(entry.node->zl, entry.zi,data,sz);
+        size_t zlbytes = zmalloc_size(entry.node->zl);
+        entry.node->zl = lpReplace(entry.node->zl, entry.zi, data, sz);
         quicklistNodeUpdateSz(entry.node);
+        quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(entry.node->zl));
         quicklistCompress(quicklist,entry.node);
         return 1;
     }else{
@@ -572,12 +913,13 @@ int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data, int sz
     };
 };
 
-REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist, quicklistNode *a, quicklistNode *b){
+REDIS_STATIC quicklistNode *_quicklistListpackMerge(quicklist *quicklist, quicklistNode *a, quicklistNode *b){
     D("requested merge (a,b) (%u, %u)", a->count, b->count);
-    quicklistCompressNode(a);
-    quicklistCompressNode(b);
+    quicklistDecompressNode(quicklist, a);
+    quicklistDecompressNode(quicklist, b);
+    size_t zlbytes = zmalloc_size(a->zl) + zmalloc_size(b->zl);
     
-    if((ziplistMerge(&a->zl, &b->zl))){
+    if((lpMerge(&a->zl, &b->zl))){
         quicklistNode *keep = NULL, *nokeep = NULL;
         if(!a->zl){
             nokeep = a;
@@ -587,8 +929,9 @@ REDIS_STATIC quicklistNode *_quicklistZiplistMerge(quicklist *quicklist, quickli
             keep = a;
         };
         
-        keep->count = ziplistLen(keep->zl);
+        keep->count = lpLength(keep->zl);
         quicklistNodeUpdateSz(keep);
+        quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(keep->zl));
         
         nokeep->count = 0;
         __quicklistDelNode(quicklist,nokeep);
@@ -619,29 +962,29 @@ REDIS_STATIC void _quicklistMergeNodes(quicklist *quicklist, quicklistNode *cent
     }; 
     
     if(_quicklistNodeAllowMerge(prev,prev_prev,fill)){
-        _quicklistZiplistMerge(quicklist, prev_prev, prev);
+        _quicklistListpackMerge(quicklist, prev_prev, prev);
         prev_prev = prev = NULL;
     };    
     
     if(_quicklistNodeAllowMerge(next,next_next,fill)){
-        _quicklistZiplistMerge(quicklist, next, next_next);
+        _quicklistListpackMerge(quicklist, next, next_next);
         next = next_next = NULL;
     };
     
     if(_quicklistNodeAllowMerge(center, center->prev, fill)){
-        target = _quicklistZiplistMerge(quicklist, center->prev, center);
+        target = _quicklistListpackMerge(quicklist, center->prev, center);
         center = NULL;
     }else{
         target = center;
     }; 
     
     if(_quicklistNodeAllowMerge(target, target->next, fill)){
-        _quicklistZiplistMerge(quicklist, target, target->next);
+        _quicklistListpackMerge(quicklist, target, target->next);
     };
 }
 
-REDIS_STATIC quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset, int after){
-    size_t zl_sz = node->sz;
+REDIS_STATIC quicklistNode *_quicklistSplitNode(struct quicklist *quicklist, quicklistNode *node, int offset, int after){
+    size_t zl_sz = node->sz, zlbytes = zmalloc_size(node->zl);
     
     quicklistNode *new_node = quicklistCreateNode();
     new_node->zl = zmalloc(zl_sz);
@@ -655,12 +998,13 @@ REDIS_STATIC quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset,
     
     D("After %d (%d); ranges: [%d, %d], [%d, %d]", after, offset, orig_start, orig_extent, new_start, new_extent);
     
-    node->zl = ziplistDeleteRange(node->zl, orig_start, orig_extent);
-    node->count = ziplistLen(node->zl);
+    node->zl = lpDeleteRange(node->zl, orig_start, orig_extent);
+    node->count = lpLength(node->zl);
     quicklistNodeUpdateSz(node);
+    quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(node->zl));
     
-    new_node->zl = ziplistDeleteRange(new_node->zl, new_start,new_extent);
-    new_node->count = ziplistLen(new_node->zl);
+    new_node->zl = lpDeleteRange(new_node->zl, new_start,new_extent);
+    new_node->count = lpLength(new_node->zl);
     quicklistNodeUpdateSz(new_node);
     
     D("After split lengths: orig (%d), new (%d)", node->count, new_node->count);
@@ -674,10 +1018,11 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
     quicklistNode *node = entry->node;
     quicklistNode *new_node = NULL;
     
+    quicklistNodeIndexDrop(quicklist);
     if(!node){
         D("No node given");
         new_node = quicklistCreateNode(); 
-        new_node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+        new_node->zl = lpPrepend(lpNew(), value, sz);
         __quicklistInsertNode(quicklist,NULL,new_node,after);
         new_node->count++;
         quicklist->count++;
@@ -690,7 +1035,7 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
     };
     
     if(after && (entry->offset == node->count)){
-        D("At Tail of current ziplist");
+        D("At Tail of current listpack");
         at_tail = 1;
         if(!_quicklistNodeAllowInsert(node->next,fill,sz)){
             D("Next node is full too.");
@@ -708,51 +1053,54 @@ REDIS_STATIC void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
     
     if(!full && after){
         D("Not full, inserting after current position.");
-        quicklistDecompressNodeForUse(node);
-        unsigned char *next = ziplistNext(node->zl, entry->zi);
-        if(next == NULL){
-            node->zl = ziplistPush(node->zl,value, sz,ZIPLIST_TAIL);
-        }else{
-            node->zl = ziplistInsert(node->zl,next,value,sz);
-        }
+        quicklistDecompressNodeForUse(quicklist, node);
+        size_t zlbytes = zmalloc_size(node->zl);
+        node->zl = lpInsert(node->zl, value, sz, entry->zi, LP_AFTER, NULL);
         node->count++;
         quicklistNodeUpdateSz(node); 
+        quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(node->zl));
         quicklistRecompressOnly(quicklist,node);
     }else if(!full && !after){
         D("Not full, inserting before current position");
-        quicklistDecompressNodeForUse(node);
-        node->zl = ziplistInsert(node->zl, entry->zi, value, sz);
+        quicklistDecompressNodeForUse(quicklist, node);
+        size_t zlbytes = zmalloc_size(node->zl);
+        node->zl = lpInsert(node->zl, value, sz, entry->zi, LP_BEFORE, NULL);
         node->count++;
         quicklistNodeUpdateSz(node);
+        quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(node->zl));
         quicklistRecompressOnly(quicklist,node);
     }else if(full && at_tail && node->next && !full_next && after){
         D("Full and tail, but next isn't full; inserting next node head");
         new_node = node->next;
-        quicklistDecompressNodeForUse(new_node);
-        new_node->zl = ziplistPush(new_node->zl, value, sz,ZIPLIST_HEAD);
+        quicklistDecompressNodeForUse(quicklist, new_node);
+        size_t zlbytes = zmalloc_size(new_node->zl);
+        new_node->zl = lpPrepend(new_node->zl, value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
+        quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(new_node->zl));
         quicklistRecompressOnly(quicklist,new_node);
     }else if(full && at_head && node->prev && !full_prev && !after){
         D("Full and head, but prev isn't full, inserting prev node tail");
         new_node = node->prev;
-        quicklistDecompressNodeForUse(new_node);
-        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_TAIL);
+        quicklistDecompressNodeForUse(quicklist, new_node);
+        size_t zlbytes = zmalloc_size(new_node->zl);
+        new_node->zl = lpAppend(new_node->zl, value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
+        quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(new_node->zl));
         quicklistRecompressOnly(quicklist,new_node);
     }else if(full && ((at_tail && node->next && full_next && after) || (at_head && node->prev && full_prev && !after))){
         D("\t provisioning new node...");  
         new_node = quicklistCreateNode();
-        new_node->zl = ziplistPush(ziplistNew(),value,sz,ZIPLIST_HEAD);
+        new_node->zl = lpPrepend(lpNew(), value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
         __quicklistInsertNode(quicklist, node,new_node,after);
     }else if(full){
         D("\t splitting node...");
-        quicklistDecompressNodeForUse(node);
-        new_node = _quicklistSplitNode(node,entry->offset,after);
-        new_node->zl = ziplistPush(new_node->zl, value,sz, after ? ZIPLIST_HEAD : ZIPLIST_TAIL);
+        quicklistDecompressNodeForUse(quicklist, node);
+        new_node = _quicklistSplitNode(quicklist,node,entry->offset,after);
+        new_node->zl = after ? lpPrepend(new_node->zl, value, sz) : lpAppend(new_node->zl, value, sz);
         new_node->count++;
         quicklistNodeUpdateSz(new_node);
         __quicklistInsertNode(quicklist,node,new_node,after);
@@ -793,6 +1141,7 @@ int quicklistDelRange(quicklist *quicklist, const long start, const long count){
     };
     
     D("Quicklist delete request for start %ld, count %ld, extent: %ld", start, count, extent);
+    quicklistNodeIndexDrop(quicklist);
     quicklistNode *node = entry.node;
     
     while(extent){
@@ -817,9 +1166,11 @@ int quicklistDelRange(quicklist *quicklist, const long start, const long count){
         if(delete_entire_node){
             __quicklistDelNode(quicklist,node);
         }else{
-            quicklistDecompressNodeForUse(node);
-            node->zl = ziplistDeleteRange(node->zl, entry.offset, del);
+            quicklistDecompressNodeForUse(quicklist, node);
+            size_t zlbytes = zmalloc_size(node->zl);
+            node->zl = lpDeleteRange(node->zl, entry.offset, del);
             quicklistNodeUpdateSz(node);
+            quicklistChargeBytes(quicklist, zlbytes, zmalloc_size(node->zl));
             node->count -= del;
             quicklist->count -= del;
             quicklistDeleteIfEmpty(quicklist,node);
@@ -836,7 +1187,7 @@ int quicklistDelRange(quicklist *quicklist, const long start, const long count){
 };
 
 int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len){
-    return ziplistCompare(p1,p2,p2_len);
+    return lpCompare(p1,p2,p2_len);
 };
 
 quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction){
@@ -860,7 +1211,7 @@ quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction){
 
 
 
-quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist, const int direction, const long long idx){
+quicklistIter *quicklistGetIteratorAtIdx(quicklist *quicklist, const int direction, const long long idx){
     quicklistEntry entry;
     
     if(quicklistIndex(quicklist, idx, &entry)){
@@ -903,14 +1254,14 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry){
     int offset_update = 0;
     
     if(!iter->zi){
-        quicklistDecompressNodeForUse(iter->current);
-        iter->zi = ziplistIndex(iter->current->zl, iter->offset);
+        quicklistDecompressNodeForUse(iter->quicklist, iter->current);
+        iter->zi = lpSeek(iter->current->zl, iter->offset);
     }else{
         if(iter->direction == AL_START_HEAD){
-            nextFn = ziplistNext;
+            nextFn = lpNext;
             offset_update = 1;
         }else if(iter->direction == AL_START_TAIL){
-            nextFn = ziplistPrev;
+            nextFn = lpPrev;
             offset_update = -1;
         } 
         
@@ -922,7 +1273,7 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry){
     entry->offset = iter->offset;
     
     if(iter->zi){
-        ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval); 
+        lpGetValue(entry->zi, &entry->value, &entry->sz, &entry->longval);
         return 1; 
     }else{
         quicklistCompress(iter->quicklist, iter->current);
@@ -942,10 +1293,38 @@ int quicklistNext(quicklistIter *iter, quicklistEntry *entry){
 };
 
 
+/* Like quicklistNext(), but returns the whole run of entries left in the
+ * current node, capped at 'max', instead of one entry at a time. '*p' is
+ * set to the first entry of the run inside the listpack '*lp', which stays
+ * valid until the iterator moves again. Returns the number of entries in
+ * the run and leaves the iterator on its last one, or returns 0 when the
+ * iteration is over. */
+unsigned long quicklistNextRun(quicklistIter *iter, unsigned char **lp, unsigned char **p, unsigned long max){
+    unsigned char *(*nextFn)(unsigned char *, unsigned char *);
+    unsigned char *last, *q;
+    unsigned long n = 1;
+    quicklistEntry entry;
+
+    if(max == 0 || !quicklistNext(iter, &entry)) return 0;
+
+    nextFn = (iter->direction == AL_START_HEAD) ? lpNext : lpPrev;
+    *lp = entry.node->zl;
+    *p = last = entry.zi;
+    while(n < max && (q = nextFn(*lp, last)) != NULL){
+        last = q;
+        n++;
+    };
+    iter->zi = last;
+    iter->offset += (iter->direction == AL_START_HEAD) ? (long)(n - 1) : -(long)(n - 1);
+    return n;
+};
+
+
 quicklist *quicklistDup(quicklist *orig){
     quicklist *copy;
         
     copy =  quicklistNew(orig->fill, orig->compress);
+    copy->codec = orig->codec;
     for(quicklistNode *current = orig->head; current; current = current->next){
         quicklistNode *node = quicklistCreateNode();
         if(current->encoding == QUICKLIST_NODE_ENCODING_LZF){
@@ -962,6 +1341,7 @@ quicklist *quicklistDup(quicklist *orig){
         copy->count += node->count;
         node->sz = current->sz;
         node->encoding = current->encoding;
+        node->codec = current->codec;
         
         _quicklistInsertNodeAfter(copy, copy->tail,node);
     };
@@ -969,7 +1349,7 @@ quicklist *quicklistDup(quicklist *orig){
 };
 
 
-int quicklistIndex(const quicklist *quicklist, const long long idx, quicklistEntry *entry){
+int quicklistIndex(quicklist *quicklist, const long long idx, quicklistEntry *entry){
     quicklistNode *n;
     unsigned long long accum = 0;
     
@@ -989,6 +1369,13 @@ int quicklistIndex(const quicklist *quicklist, const long long idx, quicklistEnt
         return 0;
     }
     
+    if((n = quicklistNodeIndexLookup(quicklist, forward ? index : quicklist->count - 1 - index, &accum))){
+        entry->node = n;
+        entry->offset = forward ? (int)accum : (int)accum - (int)n->count;
+        goto found;
+    };
+    n = forward ? quicklist->head : quicklist->tail;
+    
     while(likely(n)){
         if((accum + n->count) > index){
             break;
@@ -1012,9 +1399,10 @@ int quicklistIndex(const quicklist *quicklist, const long long idx, quicklistEnt
         entry->offset = (-index) - 1 + accum;
     } 
     
-    quicklistDecompressNodeForUse(entry->node);
-    entry->zi = ziplistIndex(entry->node->zl, entry->offset);
-    ziplistGet(entry->zi, &entry->value, &entry->sz,&entry->longval);
+found:
+    quicklistDecompressNodeForUse(quicklist, entry->node);
+    entry->zi = lpSeek(entry->node->zl, entry->offset);
+    lpGetValue(entry->zi, &entry->value, &entry->sz,&entry->longval);
     
     return 1; 
 }
@@ -1025,21 +1413,31 @@ void quicklistRotate(quicklist *quicklist){
         return;
     };
     
-    unsigned char *p = ziplistIndex(quicklist->tail->zl, -1);
+    unsigned char *p = lpSeek(quicklist->tail->zl, -1);
     unsigned char *value;
     long long longval;
     unsigned int sz;
     char longstr[32] = {0};
-    ziplistGet(p,&value,&sz,&longval);
+    int copied = 0;
+    lpGetValue(p,&value,&sz,&longval);
     if(!value){
         sz = ll2string(longstr, sizeof(longstr), longval);
         value = (unsigned char *)longstr;
+    }else if(quicklist->len == 1){
+        /* Pushing to the head may realloc the listpack 'value' points into. */
+        unsigned char *copy = zmalloc(sz);
+        memcpy(copy, value, sz);
+        value = copy;
+        copied = 1;
     }
     
     quicklistPushHead(quicklist, value, sz);
+    if(copied){
+        zfree(value);
+    }
     
     if(quicklist->len == 1){
-        p = ziplistIndex(quicklist->tail->zl,-1);
+        p = lpSeek(quicklist->tail->zl,-1);
     }
 
     quicklistDelIndex(quicklist, quicklist->tail, &p);
@@ -1078,8 +1476,8 @@ int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data, un
         return 0; 
     }
     
-    p = ziplistIndex(node->zl, pos);
-    if(ziplistGet(p,&vstr, &vlen, &vlong)){
+    p = lpSeek(node->zl, pos);
+    if(lpGetValue(p,&vstr, &vlen, &vlong)){
         if(vstr){
             if(data){
                 *data = saver(vstr,vlen);
@@ -1186,9 +1584,9 @@ static void ql_info(quicklist *ql) {
     printf("Container length: %lu\n", ql->len);
     printf("Container size: %lu\n", ql->count);
     if (ql->head)
-        printf("\t(zsize head: %d)\n", ziplistLen(ql->head->zl));
+        printf("\t(zsize head: %lu)\n", (unsigned long)lpLength(ql->head->zl));
     if (ql->tail)
-        printf("\t(zsize tail: %d)\n", ziplistLen(ql->tail->zl));
+        printf("\t(zsize tail: %lu)\n", (unsigned long)lpLength(ql->tail->zl));
     printf("\n");
 #else
     UNUSED(ql);
@@ -1264,6 +1662,37 @@ static int _ql_verify(quicklist *ql, uint32_t len, uint32_t count,
         errors++;
     }
 
+    size_t bytes = zmalloc_size(ql);
+    for (quicklistNode *node = ql->head; node; node = node->next)
+        bytes += quicklistNodeBytes(node);
+    if (ql->index)
+        bytes += quicklistNodeIndexBytes(ql->index);
+    if (bytes != ql->bytes) {
+        yell("quicklist bytes wrong: expected %zu, got %zu", bytes, ql->bytes);
+        errors++;
+    }
+
+    if (ql->index) {
+        quicklistNodeIndex *idx = ql->index;
+        unsigned long slot = idx->first;
+        long long pos = idx->origin;
+
+        for (quicklistNode *node = ql->head; node; node = node->next, slot++) {
+            if (slot >= idx->last || idx->nodes[slot] != node ||
+                idx->start[slot] != pos) {
+                yell("quicklist node index out of sync at slot %lu", slot);
+                errors++;
+                break;
+            }
+            pos += node->count;
+        }
+        if (!errors && slot != idx->last) {
+            yell("quicklist node index has %lu slots for %u nodes",
+                 idx->last - idx->first, ql->len);
+            errors++;
+        }
+    }
+
     int loopr = itrprintr(ql, 0);
     if (loopr != (int)ql->count) {
         yell("quicklist cached count not match actual count: expected %lu, got "
@@ -1286,18 +1715,18 @@ static int _ql_verify(quicklist *ql, uint32_t len, uint32_t count,
     }
 
     if (ql->head && head_count != ql->head->count &&
-        head_count != ziplistLen(ql->head->zl)) {
+        head_count != lpLength(ql->head->zl)) {
         yell("quicklist head count wrong: expected %d, "
              "got cached %d vs. actual %d",
-             head_count, ql->head->count, ziplistLen(ql->head->zl));
+             head_count, ql->head->count, lpLength(ql->head->zl));
         errors++;
     }
 
     if (ql->tail && tail_count != ql->tail->count &&
-        tail_count != ziplistLen(ql->tail->zl)) {
+        tail_count != lpLength(ql->tail->zl)) {
         yell("quicklist tail count wrong: expected %d, "
              "got cached %u vs. actual %d",
-             tail_count, ql->tail->count, ziplistLen(ql->tail->zl));
+             tail_count, ql->tail->count, lpLength(ql->tail->zl));
         errors++;
     }
 
@@ -1342,6 +1771,66 @@ static char *genstr(char *prefix, int i) {
     return result;
 }
 
+/* Compression ratio and speed of every available codec on the nodes of a
+ * list of log lines, the kind of data long lists usually hold. */
+static void codecBenchmark(void) {
+    static const char *levels[] = {"INFO", "WARN", "DEBUG", "ERROR"};
+    quicklist *ql = quicklistNew(-2, QUICKLIST_NOCOMPRESS);
+    char buf[160];
+    size_t raw = 0;
+
+    for (int i = 0; i < 50000; i++) {
+        int sz = snprintf(buf, sizeof(buf),
+                          "2026-10-19T12:%02d:%02d.%03dZ %s [worker-%d] GET "
+                          "/api/v1/items/%d 200 %dms",
+                          (i / 60000) % 60, (i / 1000) % 60, i % 1000,
+                          levels[rand() % 4], rand() % 32, rand() % 100000,
+                          rand() % 500);
+        quicklistPushTail(ql, buf, sz);
+    }
+    for (quicklistNode *node = ql->head; node; node = node->next)
+        raw += node->sz;
+
+    for (int codec = 0; codec < QUICKLIST_CODEC_COUNT; codec++) {
+        const quicklistCodec *c = quicklistCodecs + codec;
+        unsigned char *out, *back;
+        long long ctime = 0, dtime = 0, start;
+        size_t packed = 0;
+        int rounds = 20;
+
+        if (!quicklistCodecAvailable(codec)) {
+            printf("codec %s: not compiled in\n", c->name);
+            continue;
+        }
+        out = zmalloc(SIZE_SAFETY_LIMIT * 2);
+        back = zmalloc(SIZE_SAFETY_LIMIT * 2);
+        for (int r = 0; r < rounds; r++) {
+            for (quicklistNode *node = ql->head; node; node = node->next) {
+                size_t n;
+
+                start = ustime();
+                n = c->compress(node->zl, node->sz, out, SIZE_SAFETY_LIMIT * 2);
+                ctime += ustime() - start;
+                if (r == 0) packed += n ? n : node->sz;
+                if (n == 0) continue;
+                start = ustime();
+                if (c->decompress(out, n, back, node->sz) != node->sz ||
+                    memcmp(back, node->zl, node->sz))
+                    printf("ERROR! codec %s round trip failed\n", c->name);
+                dtime += ustime() - start;
+            }
+        }
+        printf("codec %s: ratio %.2f, compress %.0f MB/s, decompress %.0f "
+               "MB/s\n",
+               c->name, (double)raw / packed,
+               (double)raw * rounds / (ctime ? ctime : 1),
+               (double)raw * rounds / (dtime ? dtime : 1));
+        zfree(out);
+        zfree(back);
+    }
+    quicklistRelease(ql);
+}
+
 /* main test, but callable from other files */
 int quicklistTest(int argc, char *argv[]) {
     UNUSED(argc);
@@ -1616,6 +2105,42 @@ int quicklistTest(int argc, char *argv[]) {
             quicklistRelease(ql);
         }
 
+        TEST("iterate in runs over 500 list from index") {
+            quicklist *ql = quicklistNew(-2, options[_i]);
+            quicklistSetFill(ql, 32);
+            for (int i = 0; i < 500; i++)
+                quicklistPushTail(ql, genstr("hello", i), 32);
+            for (int dir = 0; dir < 2; dir++) {
+                int forward = dir == 0;
+                quicklistIter *iter = quicklistGetIteratorAtIdx(
+                    ql, forward ? AL_START_HEAD : AL_START_TAIL,
+                    forward ? 10 : 489);
+                unsigned char *lp, *p, *vstr;
+                unsigned int vlen;
+                long long vlong;
+                unsigned long n;
+                int i = forward ? 10 : 489, seen = 0;
+                while ((n = quicklistNextRun(iter, &lp, &p, 7)) != 0) {
+                    if (n > 7)
+                        ERR("Run of %lu entries longer than 7", n);
+                    for (unsigned long j = 0; j < n; j++) {
+                        lpGetValue(p, &vstr, &vlen, &vlong);
+                        char *h = genstr("hello", i);
+                        if (strcmp((char *)vstr, h))
+                            ERR("value [%s] didn't match [%s] at position %d",
+                                vstr, h, i);
+                        p = forward ? lpNext(lp, p) : lpPrev(lp, p);
+                        i += forward ? 1 : -1;
+                        seen++;
+                    }
+                }
+                if (seen != 490)
+                    ERR("Didn't iterate over exactly 490 elements (%d)", seen);
+                quicklistReleaseIterator(iter);
+            }
+            quicklistRelease(ql);
+        }
+
         TEST("insert before with 0 elements") {
             quicklist *ql = quicklistNew(-2, options[_i]);
             quicklistEntry entry;
@@ -1971,6 +2496,56 @@ int quicklistTest(int argc, char *argv[]) {
             quicklistRelease(ql);
         }
 
+        TEST("node index with pushes and pops at both ends") {
+            quicklist *ql = quicklistNew(-2, options[_i]);
+            char buf[160];
+            long head_id = 0, tail_id = -1;
+            quicklistEntry entry;
+            unsigned char *data;
+
+            for (int i = 0; i < 4000; i++) {
+                int sz = snprintf(buf, sizeof(buf), "%ld:%0140d", ++tail_id, 0);
+                quicklistPushTail(ql, buf, sz);
+            }
+            for (int round = 0; round < 4000; round++) {
+                int sz;
+                switch (rand() % 4) {
+                case 0:
+                    sz = snprintf(buf, sizeof(buf), "%ld:%0140d", --head_id, 0);
+                    quicklistPushHead(ql, buf, sz);
+                    break;
+                case 1:
+                    sz = snprintf(buf, sizeof(buf), "%ld:%0140d", ++tail_id, 0);
+                    quicklistPushTail(ql, buf, sz);
+                    break;
+                case 2:
+                    quicklistPop(ql, QUICKLIST_HEAD, &data, NULL, NULL);
+                    zfree(data);
+                    head_id++;
+                    break;
+                default:
+                    quicklistPop(ql, QUICKLIST_TAIL, &data, NULL, NULL);
+                    zfree(data);
+                    tail_id--;
+                    break;
+                }
+                for (int k = 0; k < 4; k++) {
+                    long long at = rand() % ql->count;
+                    if (!quicklistIndex(ql, (k & 1) ? at - (long long)ql->count : at, &entry) ||
+                        strtol((char *)entry.value, NULL, 10) != head_id + at)
+                        ERR("Wrong element at %lld in round %d", at, round);
+                    /* quicklistIndex() leaves the node it read decompressed. */
+                    if (entry.node)
+                        quicklistCompress(ql, entry.node);
+                }
+            }
+            if (!ql->index)
+                ERR("Index not built for %u nodes", ql->len);
+            ql_verify(ql, ql->len, ql->count, ql->head->count,
+                      ql->tail->count);
+            quicklistRelease(ql);
+        }
+
         TEST("numbers larger list read") {
             quicklist *ql = quicklistNew(-2, options[_i]);
             quicklistSetFill(ql, 32);
@@ -2368,6 +2943,41 @@ int quicklistTest(int argc, char *argv[]) {
     }
     long long stop = mstime();
 
+    TEST("mixed codecs in one list") {
+        for (int codec = 0; codec < QUICKLIST_CODEC_COUNT; codec++) {
+            if (!quicklistCodecAvailable(codec))
+                continue;
+            quicklist *ql = quicklistNew(-2, 1);
+            char buf[160];
+            int tagged = 0;
+
+            for (int i = 0; i < 4000; i++) {
+                if (i == 2000)
+                    quicklistSetCodec(ql, codec);
+                int sz = snprintf(buf, sizeof(buf), "%d %0140d", i, 0);
+                quicklistPushTail(ql, buf, sz);
+            }
+            for (quicklistNode *node = ql->head; node; node = node->next)
+                if (quicklistNodeIsCompressed(node) && node->codec == codec)
+                    tagged++;
+            if (!tagged)
+                ERR("No node compressed with %s", quicklistCodecName(codec));
+
+            quicklist *copy = quicklistDup(ql);
+            for (int i = 0; i < 4000; i++) {
+                quicklistEntry entry;
+                if (!quicklistIndex(copy, i, &entry) ||
+                    strtol((char *)entry.value, NULL, 10) != i)
+                    ERR("Wrong element %d with %s", i,
+                        quicklistCodecName(codec));
+            }
+            quicklistRelease(copy);
+            quicklistRelease(ql);
+        }
+    }
+
+    codecBenchmark();
+
     printf("\n");
     for (size_t i = 0; i < option_count; i++)
         printf("Test Loop %02d: %0.2f seconds.\n", options[i],
@@ -6,30 +6,52 @@ typedef struct quicklistNode {
     struct quicklistNode *prev;
     struct quicklistNode *next;
     
-    unsigned char *zl;
+    unsigned char *zl;      /* listpack, or quicklistLZF when compressed */
     unsigned int sz;
     unsigned int count : 16;
     unsigned int encoding : 2;
     unsigned int container : 2;
     unsigned int recompress : 1;
     unsigned int attempted_compress : 1;
-    unsigned int extra : 10;
+    unsigned int codec : 2;
+    unsigned int extra : 8;
 } quicklistNode;
 
 
+/* Compressed node payload. Despite the name, 'compressed' holds the output
+ * of whatever codec node->codec says; only LZF payloads can be written to
+ * an RDB file as they are. */
 typedef struct quicklistLZF{
     unsigned int sz;
     char compressed[];
 } quicklistLZF;
 
 
+/* Optional array of the nodes of a long quicklist, with the position of
+ * the first element of each node, so that quicklistIndex() can binary
+ * search instead of walking. Positions are relative to 'origin', the
+ * position of the list head, so head pushes and pops only touch one slot.
+ * Built lazily and dropped by changes in the middle of the list. */
+typedef struct quicklistNodeIndex {
+    quicklistNode **nodes;
+    long long *start;
+    unsigned long first;
+    unsigned long last;
+    unsigned long size;
+    long long origin;
+} quicklistNodeIndex;
+
 typedef struct quicklist {
     quicklistNode *head;
     quicklistNode *tail;
     unsigned long count;
     unsigned int len;
+    size_t bytes;
+    quicklistNodeIndex *index;
+    unsigned int index_lookups;
     int fill : 16;
     unsigned int compress : 16;
+    unsigned int codec : 2;
 } quicklist;
 
 
@@ -61,21 +83,33 @@ typedef struct quicklistEntry{
 
 #define QUICKLIST_NOCOMPRESS 0
 
+/* Node compression codecs. LZF is always available, LZ4 and zstd only when
+ * built with HAVE_LZ4 / HAVE_ZSTD. */
+#define QUICKLIST_CODEC_LZF 0
+#define QUICKLIST_CODEC_LZ4 1
+#define QUICKLIST_CODEC_ZSTD 2
+#define QUICKLIST_CODEC_COUNT 3
+
 #define QUICKLIST_NODE_CONTAINER_NONE 1
-#define QUICKLIST_NODE_CONTAINER_ZIPLIST 2
+#define QUICKLIST_NODE_CONTAINER_PACKED 2
 
-#define quicklistNodeIsCompressed(node) ((node) >encoding == QUICKLIST_NODE_ENCODING_LZF) 
+#define quicklistNodeIsCompressed(node) ((node)->encoding == QUICKLIST_NODE_ENCODING_LZF) 
 
 quicklist *quicklistCreate(void);
 quicklist *quicklistNew(int fill, int compress);
 void quicklistSetCompressDepth(quicklist *quicklist, int depth);
 void quicklistSetFill(quicklist *quicklist, int fill);
 void quicklistSetOptions(quicklist *quicklist, int fill, int depth);
+void quicklistSetCodec(quicklist *quicklist, int codec);
+int quicklistCodecAvailable(int codec);
+int quicklistCodecByName(const char *name);
+const char *quicklistCodecName(int codec);
+int quicklistCodecAddDictionary(const void *dict, size_t len);
 void quicklistRelease(quicklist *quicklist);
 int quicklistPushHead(quicklist *quicklist, void *value, const size_t sz);
 int quicklistPushTail(quicklist *quicklist, void *value, const size_t sz);
 void quicklistPush(quicklist *quicklist, void *value, const size_t sz, int where);
-void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl);
+void quicklistAppendListpack(quicklist *quicklist, unsigned char *zl);
 quicklist *quicklistAppendValuesFromZiplist(quicklist *quicklist, unsigned char *zl);
 quicklist *quicklistCreateFromZiplist(int fill, int compress, unsigned char *zl);
 
@@ -89,13 +123,14 @@ int quicklistDelRange(quicklist *quicklsit, const long start, const long stop);
 
 
 quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction);
-quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist, int direction, const long long idx);
+quicklistIter *quicklistGetIteratorAtIdx(quicklist *quicklist, int direction, const long long idx);
 
 
 int quicklistNext(quicklistIter *iter, quicklistEntry *node);
+unsigned long quicklistNextRun(quicklistIter *iter, unsigned char **lp, unsigned char **p, unsigned long max);
 void quicklistReleaseIterator(quicklistIter *iter);
 quicklist *quicklistDup(quicklist *orig);
-int quicklistIndex(const quicklist *quicklist, const long long index, quicklistEntry *entry);
+int quicklistIndex(quicklist *quicklist, const long long index, quicklistEntry *entry);
 
 void quicklistRewind(quicklist *quicklist, quicklistIter *li);
 void quicklistRewindTail(quicklist *quicklist, quicklistIter *li);
@@ -105,8 +140,10 @@ int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data, un
 
 int quicklistPop(quicklist *quicklist, int where, unsigned char **data, unsigned int *sz, long long *slong);
 unsigned int quicklistCount(const quicklist *ql);
+size_t quicklistBytes(const quicklist *ql);
 int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len);
 size_t quicklistGetLzf(const quicklistNode *node, void **data);
+int quicklistNodeDecompressTo(const quicklistNode *node, unsigned char *dst);
 
 
 #ifdef REDIS_TEST
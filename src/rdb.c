@@ -203,7 +203,7 @@ void *rdbLoadIntegerObject(rio *rdb, int enctype, int flags, size_t *lenptr){
         memcpy(p,buf,len)
         return p;
     }else if(encode){
-        return createStringObjectFromLongLong(val); 
+        return createStringObjectFromLongLongForValue(val);
     }else{
         return createObject(OBJ_STRING,sdsfromlonglong(val)); 
     } 
@@ -480,7 +480,7 @@ int rdbSaveObjectType(rio *rdb, robj *o){
            return rdbSaveType(rdb,RDB_TYPE_STRING); 
         case OBJ_LIST:
            if(o->encoding == OBJ_ENCODING_QUICKLIST){
-                return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST);
+                return rdbSaveType(rdb,RDB_TYPE_LIST_QUICKLIST_2);
            }else{
                 serverPanic("Unknown list encoding");        
            }
@@ -489,6 +489,8 @@ int rdbSaveObjectType(rio *rdb, robj *o){
                 return rdbSaveType(rdb,RDB_TYPE_SET_INTSET); 
            }else if(o->encoding == OBJ_ENCODING_HT){
                 return rdbSaveType(rdb,RDB_TYPE_SET); 
+           }else if(o->encoding == OBJ_ENCODING_ROARING){
+                return rdbSaveType(rdb,RDB_TYPE_SET_ROARING);
            }else{
                 serverPanic("Unknown set encoding"); 
            }
@@ -535,17 +537,32 @@ ssize_t rdbSaveObject(rio *rdb, robj *o){
             
             if((n = rdbSaveLen(rdb,ql->len)) == -1) return -1;
             nwritten += n;
-            do{
-                if(quicklistNodeIsCompressed(node)){
+            while(node){
+                if((n = rdbSaveLen(rdb,node->container)) == -1) return -1;
+                nwritten += n;
+                if(quicklistNodeIsCompressed(node) && node->codec == QUICKLIST_CODEC_LZF){
                     void *data;
                     size_t compress_len = quicklistGetLzf(node,&data); 
                     if((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
                     nwritten += n;
+                }else if(quicklistNodeIsCompressed(node)){
+                    /* Other codecs are private to this process: save the
+                     * node decoded, rdbSaveRawString() applies LZF again. */
+                    unsigned char *lp = zmalloc(node->sz);
+                    if(!quicklistNodeDecompressTo(node,lp)){
+                        zfree(lp);
+                        return -1;
+                    };
+                    n = rdbSaveRawString(rdb,lp,node->sz);
+                    zfree(lp);
+                    if(n == -1) return -1;
+                    nwritten += n;
                 }else{
                     if((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1; 
                     nwritten += n;
                 }   
-            }while(); 
+                node = node->next;
+            }; 
         }else{
             serverPanic("Unknown list encoding"); 
         } 
@@ -565,10 +582,20 @@ ssize_t rdbSaveObject(rio *rdb, robj *o){
                 nwritten += n;
             }; 
             dictReleaseIterator(di);
-        }else if(o->type == OBJ_ENCODING_INTSET){
+        }else if(o->encoding == OBJ_ENCODING_INTSET){
             size_t l  = intsetBlobLen((intset*)o->ptr); 
             if((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
+        }else if(o->encoding == OBJ_ENCODING_ROARING){
+            /* The bitmap is not contiguous in memory: serialize it first and
+             * save the result as a single blob. */
+            size_t l = roaringSerializedSize((roaring*)o->ptr);
+            unsigned char *buf = zmalloc(l);
+            roaringSerialize((roaring*)o->ptr,buf);
+            n = rdbSaveRawString(rdb,buf,l);
+            zfree(buf);
+            if(n == -1) return -1;
+            nwritten += n;
         }else{
             serverPanic("Unkown set encoding"); 
         } 
@@ -726,7 +753,7 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi){
         if(rdbSaveLen(rdb,j) == -1) goto werr;
         uint32_t db_size, expires_size;
         db_size = (dictSize(db->dict) <= UINT32_MAX) ? dictSize(db->dict) : UINT32_MAX;
-        expires_size = (dictSize(db->expires) <= UINT32_MAX) ? dictSize(db->expires) : UINT32_MAX; 
+        expires_size = (dbExpiresCount(db) <= UINT32_MAX) ? dbExpiresCount(db) : UINT32_MAX; 
         if(rdbSaveType(rdb,RDB_OPCODE_RESIZEDB) == -1) goto werr;
         if(rdbSaveLen(rdb,db_size) == -1) goto werr;
         if(rdbSaveLen(rdb,expires_size) == -1) goto werr;
@@ -876,6 +903,58 @@ void rdbRemoveTempFile(pid_t childpid){
     unlink(tmpfile);
 };
 
+/* Cheap header check of a listpack blob read from disk: the stored total
+ * size must match the blob and the terminator must be in place. */
+static int rdbListpackIsValid(unsigned char *lp, size_t size){
+    if(size < LP_HDR_SIZE + 1) return 0;
+    if(lpBytes(lp) != size) return 0;
+    return lp[size - 1] == 0xFF;
+};
+
+/* The same check for the ziplist nodes of old RDB_TYPE_LIST_QUICKLIST
+ * payloads, which are decoded element by element on load. */
+static int rdbZiplistIsValid(unsigned char *zl, size_t size){
+    if(size < sizeof(uint32_t) * 2 + sizeof(uint16_t) + 1) return 0;
+    if(ziplistBlobLen(zl) != size) return 0;
+    return zl[size - 1] == 0xFF;
+};
+
+/* With set_use_roaring, large sets made only of integers are kept as a
+ * roaring bitmap rather than a hash table of sds strings. The setType*
+ * helpers do not handle OBJ_ENCODING_ROARING yet, so it defaults to off. */
+static void rdbIntsetToRoaring(robj *o){
+    intset *is = o->ptr;
+    roaring *r = roaringNew();
+    int64_t llval;
+    uint32_t j;
+
+    for(j = 0; j < intsetLen(is); j++){
+        intsetGet(is,j,&llval);
+        roaringAdd(r,llval);
+    };
+    zfree(is);
+    o->ptr = r;
+    o->encoding = OBJ_ENCODING_ROARING;
+};
+
+/* Called when a non integer member shows up while loading a set that was
+ * started as a roaring bitmap. */
+static void rdbRoaringToSet(robj *o, uint64_t len){
+    roaring *r = o->ptr;
+    dict *d = dictCreate(&setDictType,NULL);
+    roaringIter it;
+    int64_t llval;
+
+    if(len > DICT_HT_INITIAL_SIZE) dictExpand(d,len);
+    roaringIterInit(r,&it);
+    while(roaringIterNext(&it,&llval)){
+        dictAdd(d,sdsfromlonglong(llval),NULL);
+    };
+    roaringFree(r);
+    o->ptr = d;
+    o->encoding = OBJ_ENCODING_HT;
+};
+
 
 robj *rdbLoadObject(int rdbtype, rio *rdb){
     robj *o = Null, *ele, *dec; 
@@ -889,6 +968,7 @@ robj *rdbLoadObject(int rdbtype, rio *rdb){
         if((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL; 
         o = createQuicklistObject();
         quicklistSetOptions(o->ptr,server.list_max_ziplist_size,server.list_compress_depth);
+        quicklistSetCodec(o->ptr,server.list_compress_codec);
         while(len--){
            if((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;  
            dec = getDecodedObject(ele);
@@ -900,9 +980,15 @@ robj *rdbLoadObject(int rdbtype, rio *rdb){
     }else if(rdbtype == RDB_TYPE_SET){
         if((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL; 
         if(len > server.set_max_intset_entries){
-            o = createSetObject(); 
-            if(len > DICT_HT_INITIAL_SIZE){
-                dictExpand(o->ptr,len); 
+            if(server.set_use_roaring){
+                /* Assume integers until proven otherwise: a roaring bitmap
+                 * is far smaller than the equivalent hash table. */
+                o = createRoaringSetObject();
+            }else{
+                o = createSetObject(); 
+                if(len > DICT_HT_INITIAL_SIZE){
+                    dictExpand(o->ptr,len); 
+                }
             }
         }else{
             o = createIntsetObject(); 
@@ -921,6 +1007,12 @@ robj *rdbLoadObject(int rdbtype, rio *rdb){
                     setTypeConvert(o,OBJ_ENCODING_HT); 
                     dictExpand(o->ptr,len);
                 } 
+            }else if(o->encoding == OBJ_ENCODING_ROARING){
+                if(isSdsRepresentableAsLongLong(sdsele,&llval) == C_OK){
+                    roaringAdd(o->ptr,llval);
+                }else{
+                    rdbRoaringToSet(o,len);
+                }
             };
             
            if(o->encoding == OBJ_ENCODING_HT){
@@ -1013,11 +1105,58 @@ robj *rdbLoadObject(int rdbtype, rio *rdb){
             if((len=rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;              
             o = createQuicklistObject();
             quicklistSetOptions(o->ptr, server.list_max_ziplist_size, server.list_compress_depth);
+            quicklistSetCodec(o->ptr, server.list_compress_codec);
             while(len--){
-                unsigned char *zl = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,NULL); 
+                size_t zlbytes;
+                unsigned char *zl = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&zlbytes); 
                 if(zl == NULL) return NULL;
-                quicklistAppendZiplist(o->ptr,zl);
+                if(!rdbZiplistIsValid(zl,zlbytes)){
+                    rdbExitReportCorruptRDB("Ziplist integrity check failed");
+                };
+                quicklistAppendValuesFromZiplist(o->ptr,zl);
             }
+       }else if(rdbtype == RDB_TYPE_LIST_QUICKLIST_2){
+            if((len=rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;              
+            o = createQuicklistObject();
+            quicklistSetOptions(o->ptr, server.list_max_ziplist_size, server.list_compress_depth);
+            quicklistSetCodec(o->ptr, server.list_compress_codec);
+            while(len--){
+                uint64_t container;
+                size_t lpbytes;
+                unsigned char *lp;
+
+                if((container = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return NULL;
+                if(container != QUICKLIST_NODE_CONTAINER_PACKED){
+                    rdbExitReportCorruptRDB("Unknown quicklist node container %llu",(unsigned long long)container);
+                };
+                if((lp = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&lpbytes)) == NULL) return NULL;
+                if(!rdbListpackIsValid(lp,lpbytes)){
+                    rdbExitReportCorruptRDB("Listpack integrity check failed");
+                };
+                if(lpFirst(lp) == NULL){
+                    lpFree(lp);
+                    continue;
+                };
+                quicklistAppendListpack(o->ptr,lp);
+            }
+       }else if(rdbtype == RDB_TYPE_SET_ROARING){
+            size_t encoded_len;
+            unsigned char *encoded;
+            roaring *r;
+
+            /* Only a server running with set_use_roaring writes this type. */
+            if(!server.set_use_roaring){
+                rdbExitReportCorruptRDB("Roaring set found but set_use_roaring is off");
+            };
+            encoded = rdbGenericLoadStringObject(rdb,RDB_LOAD_PLAIN,&encoded_len);
+            if(encoded == NULL) return NULL;
+            r = roaringDeserialize(encoded,encoded_len);
+            zfree(encoded);
+            if(r == NULL){
+                rdbExitReportCorruptRDB("Roaring bitmap integrity check failed");
+            };
+            o = createObject(OBJ_SET,r);
+            o->encoding = OBJ_ENCODING_ROARING;
        }else if( rdbtype == RDB_TYPE_HASH_ZIPMAP ||
                  rdbtype == RDB_TYPE_LIST_ZIPLIST ||
                  rdbtype == RDB_TYPE_SET_INTSET ||
@@ -1065,7 +1204,11 @@ robj *rdbLoadObject(int rdbtype, rio *rdb){
                    o->type = OBJ_SET;
                    o->encoding = OBJ_ENCODING_INTSET; 
                    if(intsetLen(o->ptr) > server.set_max_intset_entries){
-                        setTypeConvert(o,OBJ_ENCODING_HT); 
+                        if(server.set_use_roaring){
+                            rdbIntsetToRoaring(o);
+                        }else{
+                            setTypeConvert(o,OBJ_ENCODING_HT); 
+                        }
                    }
                    break;
                case RDB_TYPE_ZSET_ZIPLIST:
@@ -1215,7 +1358,7 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi){
             };
 
             dictExpand(db->dict,db_size);
-            dictExpand(db->expires,expires_size);
+            if(!server.expires_inline) dictExpand(db->expires,expires_size);
             continue;
         }else if(type == RDB_OPCODE_AUX){
             robj *auxkey, *auxval;  
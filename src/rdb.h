@@ -6,7 +6,7 @@
 
 
 #include "server.h"
-#define RDB_VERSION 8
+#define RDB_VERSION 10
 
 #define RDB_6BITLEN 0
 #define RDB_14BITLEN 1
@@ -39,8 +39,17 @@
 #define RDB_TYPE_ZSET_ZIPLIST 12
 #define RDB_TYPE_HASH_ZIPLIST 13
 #define RDB_TYPE_LIST_QUICKLIST 14
-
-#define rdbIsObjectType(t) ((t >= 0 && t<= 6) || (t >= 9 && t <= 14))
+/* Upstream ids for listpack encoded hashes and sorted sets, kept reserved.
+ * Both are still ziplists in memory here, so these types are not loaded. */
+#define RDB_TYPE_HASH_LISTPACK 16
+#define RDB_TYPE_ZSET_LISTPACK 17
+#define RDB_TYPE_LIST_QUICKLIST_2 18
+/* Not an upstream type: upstream assigns type ids upwards from the bottom
+ * and opcodes downwards from 255, so a private id sits in the middle. */
+#define RDB_TYPE_SET_ROARING 128
+
+#define rdbIsObjectType(t) ((t >= 0 && t<= 6) || (t >= 9 && t <= 14) || t == RDB_TYPE_LIST_QUICKLIST_2 || \
+                            t == RDB_TYPE_SET_ROARING)
 
 #define RDB_OPCODE_AUX 250
 #define RDB_OPCODE_RESIZEDB 251
@@ -0,0 +1,817 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "zmalloc.h"
+#include "endianconv.h"
+#include "roaring.h"
+#include "redisassert.h"
+
+
+/* Roaring bitmap of signed 64 bit integers.
+ *
+ * Values are biased by 2^63 so that negative values sort first, then the
+ * high 48 bits are the key of a container and the low 16 bits are stored
+ * in it. Containers are kept sorted by key. A container with up to
+ * ROARING_ARRAY_MAX values is a sorted array of uint16_t, above that it is
+ * a bitmap of 65536 bits, so a container never takes more than 8KB and
+ * dense ranges cost about one bit per value.
+ *
+ * Serialized layout, all fields little endian:
+ *
+ * <containers:4> <container> ... <container>
+ *
+ * where each container is <key:8> <card-1:2> followed by either 'card'
+ * increasing 16 bit values (arrays) or ROARING_BITMAP_WORDS 64 bit words
+ * (bitmaps). r->bytes tracks the exact allocation size of the bitmap like
+ * quicklist->bytes does. */
+
+#define ROARING_SIGN_BIAS ((uint64_t)1 << 63)
+#define ROARING_BITMAP_BYTES (ROARING_BITMAP_WORDS * sizeof(uint64_t))
+#define ROARING_MIN_ARRAY_CAP 4
+
+#define roaringIsBitmap(c) ((c)->card > ROARING_ARRAY_MAX)
+#define roaringChargeBytes(_r, _before, _after) \
+    ((_r)->bytes += (size_t)(_after) - (size_t)(_before))
+
+static inline uint64_t roaringKey(int64_t value){
+    return ((uint64_t)value ^ ROARING_SIGN_BIAS) >> 16;
+};
+
+static inline int64_t roaringValue(uint64_t key, uint16_t low){
+    return (int64_t)(((key << 16) | low) ^ ROARING_SIGN_BIAS);
+};
+
+/* Index of the first element of a[0..n) that is not below 'v'. */
+static uint32_t roaringArrayLowerBound(const uint16_t *a, uint32_t n, uint16_t v){
+    const uint16_t *base = a;
+
+    if(n == 0) return 0;
+    while(n > 1){
+        uint32_t half = n / 2;
+        base = (base[half] < v) ? base + half : base;
+        n -= half;
+    }
+    return (base - a) + (*base < v);
+};
+
+static int roaringContainerHas(const roaringContainer *c, uint16_t low){
+    if(roaringIsBitmap(c)){
+        return (((const uint64_t *)c->data)[low >> 6] >> (low & 63)) & 1;
+    }else{
+        const uint16_t *a = c->data;
+        uint32_t pos = roaringArrayLowerBound(a,c->card,low);
+        return pos < c->card && a[pos] == low;
+    }
+};
+
+/* Index of the container with 'key', or of the position where it would be
+ * inserted. Appending past the last key, the common case when loading or
+ * adding increasing ids, skips the search. */
+static uint32_t roaringSeek(const roaring *r, uint64_t key, int *found){
+    uint32_t lo = 0, hi = r->len;
+
+    if(r->len == 0 || r->containers[r->len - 1].key < key){
+        *found = 0;
+        return r->len;
+    }
+    while(lo < hi){
+        uint32_t mid = lo + (hi - lo) / 2;
+        if(r->containers[mid].key < key){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    *found = r->containers[lo].key == key;
+    return lo;
+};
+
+static roaringContainer *roaringInsertContainer(roaring *r, uint32_t idx, uint64_t key){
+    roaringContainer *c;
+
+    if(r->len == r->cap){
+        size_t before = r->containers ? zmalloc_size(r->containers) : 0;
+        r->cap = r->cap ? r->cap * 2 : 4;
+        r->containers = zrealloc(r->containers,r->cap * sizeof(*r->containers));
+        roaringChargeBytes(r,before,zmalloc_size(r->containers));
+    }
+    memmove(r->containers + idx + 1,r->containers + idx,(r->len - idx) * sizeof(*c));
+    r->len++;
+    c = r->containers + idx;
+    c->key = key;
+    c->card = 0;
+    c->cap = 0;
+    c->data = NULL;
+    return c;
+};
+
+static void roaringRemoveContainer(roaring *r, uint32_t idx){
+    roaringContainer *c = r->containers + idx;
+
+    if(c->data){
+        roaringChargeBytes(r,zmalloc_size(c->data),0);
+        zfree(c->data);
+    }
+    memmove(c,c + 1,(r->len - idx - 1) * sizeof(*c));
+    r->len--;
+    if(r->len == 0){
+        roaringChargeBytes(r,zmalloc_size(r->containers),0);
+        zfree(r->containers);
+        r->containers = NULL;
+        r->cap = 0;
+    }else if(r->cap > 4 && r->len <= r->cap / 4){
+        size_t before = zmalloc_size(r->containers);
+        r->cap /= 2;
+        r->containers = zrealloc(r->containers,r->cap * sizeof(*c));
+        roaringChargeBytes(r,before,zmalloc_size(r->containers));
+    }
+};
+
+/* Replace the data of 'c' with 'data', keeping r->bytes exact. */
+static void roaringSetData(roaring *r, roaringContainer *c, void *data, uint32_t cap){
+    if(c->data){
+        roaringChargeBytes(r,zmalloc_size(c->data),0);
+        zfree(c->data);
+    }
+    c->data = data;
+    c->cap = cap;
+    if(data) roaringChargeBytes(r,0,zmalloc_size(data));
+};
+
+static void roaringArrayResize(roaring *r, roaringContainer *c, uint32_t cap){
+    size_t before = c->data ? zmalloc_size(c->data) : 0;
+
+    c->data = zrealloc(c->data,cap * sizeof(uint16_t));
+    c->cap = cap;
+    roaringChargeBytes(r,before,zmalloc_size(c->data));
+};
+
+static void roaringArrayToBitmap(const uint16_t *a, uint32_t n, uint64_t *words){
+    for(uint32_t j = 0; j < n; j++) words[a[j] >> 6] |= (uint64_t)1 << (a[j] & 63);
+};
+
+static uint32_t roaringBitmapToArray(const uint64_t *words, uint16_t *a){
+    uint32_t n = 0;
+
+    for(uint32_t w = 0; w < ROARING_BITMAP_WORDS; w++){
+        uint64_t bits = words[w];
+        while(bits){
+            a[n++] = (w << 6) + __builtin_ctzll(bits);
+            bits &= bits - 1;
+        }
+    }
+    return n;
+};
+
+static uint32_t roaringBitmapCard(const uint64_t *words){
+    uint32_t card = 0;
+
+    for(uint32_t w = 0; w < ROARING_BITMAP_WORDS; w++) card += __builtin_popcountll(words[w]);
+    return card;
+};
+
+/* The representation of a container follows its cardinality, so these are
+ * called right when the cardinality crosses ROARING_ARRAY_MAX, before it
+ * is updated. */
+static void roaringContainerToBitmap(roaring *r, roaringContainer *c){
+    uint64_t *words = zcalloc(ROARING_BITMAP_BYTES);
+
+    roaringArrayToBitmap(c->data,c->card,words);
+    roaringSetData(r,c,words,0);
+};
+
+static void roaringContainerToArray(roaring *r, roaringContainer *c){
+    uint16_t *a = zmalloc(ROARING_ARRAY_MAX * sizeof(uint16_t));
+
+    roaringBitmapToArray(c->data,a);
+    roaringSetData(r,c,a,ROARING_ARRAY_MAX);
+};
+
+
+roaring *roaringNew(void){
+    roaring *r = zmalloc(sizeof(*r));
+
+    r->card = 0;
+    r->len = 0;
+    r->cap = 0;
+    r->containers = NULL;
+    r->bytes = zmalloc_size(r);
+    return r;
+};
+
+void roaringFree(roaring *r){
+    for(uint32_t j = 0; j < r->len; j++) zfree(r->containers[j].data);
+    zfree(r->containers);
+    zfree(r);
+};
+
+/* Append a copy of the first 'n' values of the array 'a' as a container
+ * with 'key', which must be larger than every key in 'r'. */
+static void roaringAppendArray(roaring *r, uint64_t key, const uint16_t *a, uint32_t n){
+    roaringContainer *c;
+
+    if(n == 0) return;
+    c = roaringInsertContainer(r,r->len,key);
+    roaringSetData(r,c,zmalloc(n * sizeof(uint16_t)),n);
+    memcpy(c->data,a,n * sizeof(uint16_t));
+    c->card = n;
+    r->card += n;
+};
+
+/* Like roaringAppendArray() for a bitmap, stored as an array if small. */
+static void roaringAppendBitmap(roaring *r, uint64_t key, const uint64_t *words){
+    uint32_t card = roaringBitmapCard(words);
+    roaringContainer *c;
+
+    if(card <= ROARING_ARRAY_MAX){
+        uint16_t a[ROARING_ARRAY_MAX];
+        roaringAppendArray(r,key,a,roaringBitmapToArray(words,a));
+        return;
+    }
+    c = roaringInsertContainer(r,r->len,key);
+    roaringSetData(r,c,zmalloc(ROARING_BITMAP_BYTES),0);
+    memcpy(c->data,words,ROARING_BITMAP_BYTES);
+    c->card = card;
+    r->card += card;
+};
+
+static void roaringAppendCopy(roaring *r, const roaringContainer *c){
+    if(roaringIsBitmap(c)){
+        roaringAppendBitmap(r,c->key,c->data);
+    }else{
+        roaringAppendArray(r,c->key,c->data,c->card);
+    }
+};
+
+/* Expand any container to bitmap words. */
+static void roaringContainerBits(const roaringContainer *c, uint64_t *words){
+    if(roaringIsBitmap(c)){
+        memcpy(words,c->data,ROARING_BITMAP_BYTES);
+    }else{
+        memset(words,0,ROARING_BITMAP_BYTES);
+        roaringArrayToBitmap(c->data,c->card,words);
+    }
+};
+
+roaring *roaringDup(const roaring *r){
+    roaring *copy = roaringNew();
+
+    for(uint32_t j = 0; j < r->len; j++) roaringAppendCopy(copy,r->containers + j);
+    return copy;
+};
+
+/* Add 'value'. Returns 1 if it was added, 0 if it was already there. */
+int roaringAdd(roaring *r, int64_t value){
+    uint64_t key = roaringKey(value);
+    uint16_t low = (uint16_t)value;
+    roaringContainer *c;
+    uint32_t idx;
+    int found;
+
+    idx = roaringSeek(r,key,&found);
+    c = found ? r->containers + idx : roaringInsertContainer(r,idx,key);
+    if(roaringIsBitmap(c)){
+        uint64_t *words = c->data, bit = (uint64_t)1 << (low & 63);
+
+        if(words[low >> 6] & bit) return 0;
+        words[low >> 6] |= bit;
+    }else{
+        uint16_t *a = c->data;
+        uint32_t pos = roaringArrayLowerBound(a,c->card,low);
+
+        if(pos < c->card && a[pos] == low) return 0;
+        if(c->card == ROARING_ARRAY_MAX){
+            roaringContainerToBitmap(r,c);
+            ((uint64_t *)c->data)[low >> 6] |= (uint64_t)1 << (low & 63);
+        }else{
+            if(c->card == c->cap){
+                uint32_t cap = c->cap ? c->cap * 2 : ROARING_MIN_ARRAY_CAP;
+                roaringArrayResize(r,c,cap > ROARING_ARRAY_MAX ? ROARING_ARRAY_MAX : cap);
+            }
+            a = c->data;
+            memmove(a + pos + 1,a + pos,(c->card - pos) * sizeof(uint16_t));
+            a[pos] = low;
+        }
+    }
+    c->card++;
+    r->card++;
+    return 1;
+};
+
+/* Remove 'value'. Returns 1 if it was removed, 0 if it was not there. */
+int roaringRemove(roaring *r, int64_t value){
+    uint64_t key = roaringKey(value);
+    uint16_t low = (uint16_t)value;
+    roaringContainer *c;
+    uint32_t idx;
+    int found;
+
+    idx = roaringSeek(r,key,&found);
+    if(!found) return 0;
+    c = r->containers + idx;
+    if(roaringIsBitmap(c)){
+        uint64_t *words = c->data, bit = (uint64_t)1 << (low & 63);
+
+        if(!(words[low >> 6] & bit)) return 0;
+        words[low >> 6] &= ~bit;
+        if(c->card - 1 == ROARING_ARRAY_MAX) roaringContainerToArray(r,c);
+    }else{
+        uint16_t *a = c->data;
+        uint32_t pos = roaringArrayLowerBound(a,c->card,low);
+
+        if(pos == c->card || a[pos] != low) return 0;
+        memmove(a + pos,a + pos + 1,(c->card - pos - 1) * sizeof(uint16_t));
+        if(c->card - 1 > ROARING_MIN_ARRAY_CAP && c->card - 1 <= c->cap / 4){
+            roaringArrayResize(r,c,c->cap / 2);
+        }
+    }
+    c->card--;
+    r->card--;
+    if(c->card == 0) roaringRemoveContainer(r,idx);
+    return 1;
+};
+
+int roaringContains(const roaring *r, int64_t value){
+    int found;
+    uint32_t idx = roaringSeek(r,roaringKey(value),&found);
+
+    return found && roaringContainerHas(r->containers + idx,(uint16_t)value);
+};
+
+uint64_t roaringCardinality(const roaring *r){
+    return r->card;
+};
+
+size_t roaringBytes(const roaring *r){
+    return r->bytes;
+};
+
+/* Store in *value the element of rank 'rank' in increasing order. Returns
+ * 0 if there are not that many elements. */
+int roaringSelect(const roaring *r, uint64_t rank, int64_t *value){
+    for(uint32_t j = 0; j < r->len; j++){
+        const roaringContainer *c = r->containers + j;
+
+        if(rank >= c->card){
+            rank -= c->card;
+            continue;
+        }
+        if(!roaringIsBitmap(c)){
+            *value = roaringValue(c->key,((const uint16_t *)c->data)[rank]);
+            return 1;
+        }
+        for(uint32_t w = 0; w < ROARING_BITMAP_WORDS; w++){
+            uint64_t bits = ((const uint64_t *)c->data)[w];
+            uint32_t pc = __builtin_popcountll(bits);
+
+            if(rank >= pc){
+                rank -= pc;
+                continue;
+            }
+            while(rank--) bits &= bits - 1;
+            *value = roaringValue(c->key,(w << 6) + __builtin_ctzll(bits));
+            return 1;
+        }
+    }
+    return 0;
+};
+
+int64_t roaringRandom(const roaring *r){
+    uint64_t rank = (((uint64_t)rand() << 31) ^ (uint64_t)rand()) % r->card;
+    int64_t value = 0;
+
+    roaringSelect(r,rank,&value);
+    return value;
+};
+
+void roaringIterInit(const roaring *r, roaringIter *it){
+    it->r = r;
+    it->ci = 0;
+    it->pos = 0;
+};
+
+/* Store the next element in increasing order in *value. Returns 0 when
+ * the iteration is over. The bitmap must not be modified meanwhile. */
+int roaringIterNext(roaringIter *it, int64_t *value){
+    while(it->ci < it->r->len){
+        const roaringContainer *c = it->r->containers + it->ci;
+
+        if(!roaringIsBitmap(c)){
+            if(it->pos < c->card){
+                *value = roaringValue(c->key,((const uint16_t *)c->data)[it->pos++]);
+                return 1;
+            }
+        }else if(it->pos < ROARING_BITMAP_WORDS * 64){
+            const uint64_t *words = c->data;
+            uint32_t w = it->pos >> 6;
+            uint64_t bits = words[w] & (~(uint64_t)0 << (it->pos & 63));
+
+            while(bits == 0 && ++w < ROARING_BITMAP_WORDS) bits = words[w];
+            if(bits){
+                uint32_t low = (w << 6) + __builtin_ctzll(bits);
+                it->pos = low + 1;
+                *value = roaringValue(c->key,low);
+                return 1;
+            }
+        }
+        it->ci++;
+        it->pos = 0;
+    }
+    return 0;
+};
+
+#define ROARING_OP_AND 0
+#define ROARING_OP_OR 1
+#define ROARING_OP_ANDNOT 2
+
+/* Combine two containers with the same key and append the result to 'r'.
+ * Arrays against arrays are merged, anything involving a bitmap is done a
+ * word at a time. */
+static void roaringCombine(roaring *r, const roaringContainer *x, const roaringContainer *y, int op){
+    uint64_t wx[ROARING_BITMAP_WORDS], wy[ROARING_BITMAP_WORDS];
+
+    if(!roaringIsBitmap(x) && (op != ROARING_OP_OR || !roaringIsBitmap(y))){
+        const uint16_t *a = x->data;
+        uint16_t out[ROARING_ARRAY_MAX];
+        uint32_t n = 0;
+
+        if(op == ROARING_OP_OR && x->card + y->card > ROARING_ARRAY_MAX){
+            roaringContainerBits(x,wx);
+            roaringArrayToBitmap(y->data,y->card,wx);
+            roaringAppendBitmap(r,x->key,wx);
+            return;
+        }
+        if(op == ROARING_OP_OR){
+            const uint16_t *b = y->data;
+            uint32_t i = 0, j = 0;
+
+            while(i < x->card && j < y->card){
+                uint16_t u = a[i], v = b[j];
+                out[n++] = u < v ? u : v;
+                i += u <= v;
+                j += v <= u;
+            }
+            while(i < x->card) out[n++] = a[i++];
+            while(j < y->card) out[n++] = b[j++];
+        }else{
+            int keep = op == ROARING_OP_AND;
+            for(uint32_t i = 0; i < x->card; i++){
+                if(roaringContainerHas(y,a[i]) == keep) out[n++] = a[i];
+            }
+        }
+        roaringAppendArray(r,x->key,out,n);
+        return;
+    }
+
+    if(op == ROARING_OP_AND && !roaringIsBitmap(y)){
+        roaringCombine(r,y,x,op);
+        return;
+    }
+    roaringContainerBits(x,wx);
+    roaringContainerBits(y,wy);
+    for(uint32_t w = 0; w < ROARING_BITMAP_WORDS; w++){
+        if(op == ROARING_OP_AND){
+            wx[w] &= wy[w];
+        }else if(op == ROARING_OP_OR){
+            wx[w] |= wy[w];
+        }else{
+            wx[w] &= ~wy[w];
+        }
+    }
+    roaringAppendBitmap(r,x->key,wx);
+};
+
+static roaring *roaringSetOp(const roaring *a, const roaring *b, int op){
+    roaring *r = roaringNew();
+    uint32_t i = 0, j = 0;
+
+    while(i < a->len && j < b->len){
+        const roaringContainer *x = a->containers + i, *y = b->containers + j;
+
+        if(x->key == y->key){
+            roaringCombine(r,x,y,op);
+            i++;
+            j++;
+        }else if(x->key < y->key){
+            if(op != ROARING_OP_AND) roaringAppendCopy(r,x);
+            i++;
+        }else{
+            if(op == ROARING_OP_OR) roaringAppendCopy(r,y);
+            j++;
+        }
+    }
+    if(op != ROARING_OP_AND){
+        for(; i < a->len; i++) roaringAppendCopy(r,a->containers + i);
+    }
+    if(op == ROARING_OP_OR){
+        for(; j < b->len; j++) roaringAppendCopy(r,b->containers + j);
+    }
+    return r;
+};
+
+roaring *roaringAnd(const roaring *a, const roaring *b){
+    return roaringSetOp(a,b,ROARING_OP_AND);
+};
+
+roaring *roaringOr(const roaring *a, const roaring *b){
+    return roaringSetOp(a,b,ROARING_OP_OR);
+};
+
+roaring *roaringAndNot(const roaring *a, const roaring *b){
+    return roaringSetOp(a,b,ROARING_OP_ANDNOT);
+};
+
+size_t roaringSerializedSize(const roaring *r){
+    size_t size = 4;
+
+    for(uint32_t j = 0; j < r->len; j++){
+        const roaringContainer *c = r->containers + j;
+        size += 8 + 2 + (roaringIsBitmap(c) ? ROARING_BITMAP_BYTES : c->card * sizeof(uint16_t));
+    }
+    return size;
+};
+
+/* Write the bitmap to 'buf', which must hold roaringSerializedSize() bytes. */
+void roaringSerialize(const roaring *r, unsigned char *buf){
+    uint32_t len = intrev32ifbe(r->len);
+
+    memcpy(buf,&len,4);
+    buf += 4;
+    for(uint32_t j = 0; j < r->len; j++){
+        const roaringContainer *c = r->containers + j;
+        uint64_t key = intrev64ifbe(c->key);
+        uint16_t card = intrev16ifbe((uint16_t)(c->card - 1));
+
+        memcpy(buf,&key,8);
+        memcpy(buf + 8,&card,2);
+        buf += 10;
+        if(roaringIsBitmap(c)){
+            const uint64_t *words = c->data;
+            for(uint32_t w = 0; w < ROARING_BITMAP_WORDS; w++){
+                uint64_t v = intrev64ifbe(words[w]);
+                memcpy(buf,&v,8);
+                buf += 8;
+            }
+        }else{
+            const uint16_t *a = c->data;
+            for(uint32_t k = 0; k < c->card; k++){
+                uint16_t v = intrev16ifbe(a[k]);
+                memcpy(buf,&v,2);
+                buf += 2;
+            }
+        }
+    }
+};
+
+/* Build a bitmap from 'len' bytes written by roaringSerialize(). Returns
+ * NULL if the blob is truncated or breaks an invariant: keys must be
+ * increasing, arrays increasing and no larger than ROARING_ARRAY_MAX, and
+ * bitmaps larger than that with as many bits set as declared. */
+roaring *roaringDeserialize(const unsigned char *buf, size_t len){
+    const unsigned char *end = buf + len;
+    uint32_t count;
+    roaring *r;
+
+    if(len < 4) return NULL;
+    memcpy(&count,buf,4);
+    count = intrev32ifbe(count);
+    buf += 4;
+
+    r = roaringNew();
+    for(uint32_t j = 0; j < count; j++){
+        roaringContainer *c;
+        uint64_t key;
+        uint16_t card16;
+        uint32_t card;
+
+        if(end - buf < 10) goto corrupt;
+        memcpy(&key,buf,8);
+        memcpy(&card16,buf + 8,2);
+        key = intrev64ifbe(key);
+        card = (uint32_t)intrev16ifbe(card16) + 1;
+        buf += 10;
+        if(key >> 48) goto corrupt;
+        if(r->len && key <= r->containers[r->len - 1].key) goto corrupt;
+
+        c = roaringInsertContainer(r,r->len,key);
+        if(card > ROARING_ARRAY_MAX){
+            uint64_t *words;
+
+            if((size_t)(end - buf) < ROARING_BITMAP_BYTES) goto corrupt;
+            roaringSetData(r,c,zmalloc(ROARING_BITMAP_BYTES),0);
+            words = c->data;
+            for(uint32_t w = 0; w < ROARING_BITMAP_WORDS; w++){
+                memcpy(words + w,buf,8);
+                words[w] = intrev64ifbe(words[w]);
+                buf += 8;
+            }
+            if(roaringBitmapCard(words) != card) goto corrupt;
+        }else{
+            uint16_t *a;
+
+            if((size_t)(end - buf) < card * sizeof(uint16_t)) goto corrupt;
+            roaringSetData(r,c,zmalloc(card * sizeof(uint16_t)),card);
+            a = c->data;
+            for(uint32_t k = 0; k < card; k++){
+                memcpy(a + k,buf,2);
+                a[k] = intrev16ifbe(a[k]);
+                buf += 2;
+                if(k && a[k] <= a[k - 1]) goto corrupt;
+            }
+        }
+        c->card = card;
+        r->card += card;
+    }
+    if(buf != end) goto corrupt;
+    return r;
+
+corrupt:
+    roaringFree(r);
+    return NULL;
+};
+
+#ifdef REDIS_TEST
+#include <sys/time.h>
+#include "intset.h"
+
+#define ROARING_TEST_ASSERT(_e) do { \
+    if(!(_e)){ \
+        printf("\n%s:%d: assertion failed: %s\n",__FILE__,__LINE__,#_e); \
+        exit(1); \
+    } \
+} while(0)
+
+static long long roaringTestUsec(void){
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec) * 1000000) + tv.tv_usec;
+};
+
+static int64_t roaringTestValue(int spread){
+    int64_t v = rand() % spread;
+
+    if(rand() % 4 == 0) v = -v;
+    if(rand() % 16 == 0) v += (int64_t)rand() << 32;
+    return v;
+};
+
+/* The bitmap must hold exactly the elements of the intset, in order. */
+static void roaringTestCompare(roaring *r, intset *is){
+    roaringIter it;
+    int64_t v, expect;
+    uint32_t j = 0;
+
+    ROARING_TEST_ASSERT(roaringCardinality(r) == intsetLen(is));
+    roaringIterInit(r,&it);
+    while(roaringIterNext(&it,&v)){
+        ROARING_TEST_ASSERT(intsetGet(is,j++,&expect) && v == expect);
+    }
+    ROARING_TEST_ASSERT(j == intsetLen(is));
+};
+
+static roaring *roaringTestFromIntset(intset *is){
+    roaring *r = roaringNew();
+    int64_t v;
+
+    for(uint32_t j = 0; intsetGet(is,j,&v); j++) roaringAdd(r,v);
+    return r;
+};
+
+int roaringTest(int argc, char *argv[]){
+    (void)argc;
+    (void)argv;
+
+    printf("Add, remove and lookup against an intset: ");{
+        int spreads[] = {1000, 30000, 300000};
+        for(int s = 0; s < 3; s++){
+            roaring *r = roaringNew();
+            intset *is = intsetNew();
+
+            for(int j = 0; j < 50000; j++){
+                int64_t v = roaringTestValue(spreads[s]);
+                uint8_t added;
+                int removed;
+
+                if(rand() % 3){
+                    is = intsetAdd(is,v,&added);
+                    ROARING_TEST_ASSERT(roaringAdd(r,v) == added);
+                }else{
+                    is = intsetRemove(is,v,&removed);
+                    ROARING_TEST_ASSERT(roaringRemove(r,v) == removed);
+                }
+                v = roaringTestValue(spreads[s]);
+                ROARING_TEST_ASSERT(roaringContains(r,v) == intsetFind(is,v));
+            }
+            roaringTestCompare(r,is);
+            for(int j = 0; j < 1000; j++){
+                uint64_t rank = rand() % intsetLen(is);
+                int64_t v, expect;
+                ROARING_TEST_ASSERT(roaringSelect(r,rank,&v) && intsetGet(is,rank,&expect) && v == expect);
+            }
+            roaringFree(r);
+            zfree(is);
+        }
+        printf("OK\n");
+    }
+
+    printf("Containers switch between array and bitmap: ");{
+        roaring *r = roaringNew();
+        size_t bytes = roaringBytes(r);
+
+        for(int j = 0; j < 10000; j++) roaringAdd(r,j * 3);
+        ROARING_TEST_ASSERT(r->len == 1 && roaringIsBitmap(r->containers));
+        for(int j = 0; j < 10000; j++) ROARING_TEST_ASSERT(roaringRemove(r,j * 3));
+        ROARING_TEST_ASSERT(r->len == 0 && roaringCardinality(r) == 0);
+        ROARING_TEST_ASSERT(roaringBytes(r) == bytes);
+        roaringFree(r);
+        printf("OK\n");
+    }
+
+    printf("And, or and andnot against intsets: ");{
+        for(int round = 0; round < 50; round++){
+            int spread = (round % 2) ? 20000 : 400000;
+            intset *ia = intsetNew(), *ib = intsetNew(), *idiff = intsetNew();
+            roaring *a, *b, *res;
+            int64_t v;
+
+            for(int j = 0; j < 10000; j++) ia = intsetAdd(ia,roaringTestValue(spread),NULL);
+            for(int j = 0; j < 10000; j++) ib = intsetAdd(ib,roaringTestValue(spread),NULL);
+            for(uint32_t j = 0; intsetGet(ia,j,&v); j++){
+                if(!intsetFind(ib,v)) idiff = intsetAdd(idiff,v,NULL);
+            }
+            a = roaringTestFromIntset(ia);
+            b = roaringTestFromIntset(ib);
+
+            intset *expect = intsetIntersection(ia,ib);
+            res = roaringAnd(a,b);
+            roaringTestCompare(res,expect);
+            roaringFree(res);
+            zfree(expect);
+
+            expect = intsetUnion(ia,ib);
+            res = roaringOr(a,b);
+            roaringTestCompare(res,expect);
+            roaringFree(res);
+            zfree(expect);
+
+            res = roaringAndNot(a,b);
+            roaringTestCompare(res,idiff);
+            roaringFree(res);
+
+            roaringFree(a);
+            roaringFree(b);
+            zfree(ia);
+            zfree(ib);
+            zfree(idiff);
+        }
+        printf("OK\n");
+    }
+
+    printf("Serialize and deserialize: ");{
+        roaring *r = roaringNew(), *copy;
+        roaringIter ia, ib;
+        int64_t va, vb;
+        unsigned char *buf;
+        size_t len;
+
+        for(int j = 0; j < 50000; j++) roaringAdd(r,roaringTestValue(200000));
+        len = roaringSerializedSize(r);
+        buf = zmalloc(len);
+        roaringSerialize(r,buf);
+        copy = roaringDeserialize(buf,len);
+        ROARING_TEST_ASSERT(copy != NULL && roaringCardinality(copy) == roaringCardinality(r));
+        ROARING_TEST_ASSERT(roaringBytes(copy) <= roaringBytes(r));
+        roaringIterInit(r,&ia);
+        roaringIterInit(copy,&ib);
+        while(roaringIterNext(&ia,&va)) ROARING_TEST_ASSERT(roaringIterNext(&ib,&vb) && va == vb);
+        ROARING_TEST_ASSERT(!roaringIterNext(&ib,&vb));
+        roaringFree(copy);
+
+        ROARING_TEST_ASSERT(roaringDeserialize(buf,len - 1) == NULL);
+        buf[4 + 8] ^= 1;
+        ROARING_TEST_ASSERT(roaringDeserialize(buf,len) == NULL);
+        zfree(buf);
+        roaringFree(r);
+        printf("OK\n");
+    }
+
+    printf("Memory of one million dense ids:\n");{
+        roaring *r = roaringNew();
+        long long start = roaringTestUsec();
+        int64_t base = 100000000;
+
+        for(int j = 0; j < 1000000; j++) roaringAdd(r,base + j + (j / 7) * 3);
+        printf("  roaring: %.2f bytes per element, built in %lld usec\n",
+            (double)roaringBytes(r) / roaringCardinality(r),roaringTestUsec() - start);
+        start = roaringTestUsec();
+        for(int j = 0; j < 1000000; j++){
+            if(!roaringContains(r,base + j + (j / 7) * 3)) printf("ERROR! missing element\n");
+        }
+        printf("  1000000 lookups in %lld usec\n",roaringTestUsec() - start);
+        roaringFree(r);
+    }
+    return 0;
+};
+#endif
@@ -0,0 +1,59 @@
+#ifndef __ROARING_H
+#define __ROARING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Compressed bitmap of 64 bit integers. Values are split on their low 16
+ * bits: the high 48 bits select a container, which holds the low bits
+ * either as a sorted array, up to ROARING_ARRAY_MAX values, or as a bitmap
+ * of 65536 bits. */
+#define ROARING_ARRAY_MAX 4096
+#define ROARING_BITMAP_WORDS 1024
+
+typedef struct roaringContainer{
+    uint64_t key;
+    uint32_t card;
+    uint32_t cap;
+    void *data;
+} roaringContainer;
+
+typedef struct roaring{
+    uint64_t card;
+    size_t bytes;
+    uint32_t len;
+    uint32_t cap;
+    roaringContainer *containers;
+} roaring;
+
+typedef struct roaringIter{
+    const roaring *r;
+    uint32_t ci;
+    uint32_t pos;
+} roaringIter;
+
+
+roaring *roaringNew(void);
+void roaringFree(roaring *r);
+roaring *roaringDup(const roaring *r);
+int roaringAdd(roaring *r, int64_t value);
+int roaringRemove(roaring *r, int64_t value);
+int roaringContains(const roaring *r, int64_t value);
+uint64_t roaringCardinality(const roaring *r);
+size_t roaringBytes(const roaring *r);
+int roaringSelect(const roaring *r, uint64_t rank, int64_t *value);
+int64_t roaringRandom(const roaring *r);
+void roaringIterInit(const roaring *r, roaringIter *it);
+int roaringIterNext(roaringIter *it, int64_t *value);
+roaring *roaringAnd(const roaring *a, const roaring *b);
+roaring *roaringOr(const roaring *a, const roaring *b);
+roaring *roaringAndNot(const roaring *a, const roaring *b);
+size_t roaringSerializedSize(const roaring *r);
+void roaringSerialize(const roaring *r, unsigned char *buf);
+roaring *roaringDeserialize(const unsigned char *buf, size_t len);
+
+#ifdef REDIS_TEST
+int roaringTest(int argc, char *argv[]);
+#endif
+
+#endif
@@ -108,6 +108,56 @@ sds sdsnewlen(const void *init, size_t initlen){
 };
 
 
+/* Size of the buffer sdsnewinplace() needs for a string of 'initlen'
+ * bytes with room for 'avail' more. */
+size_t sdsinplacesize(size_t initlen, size_t avail){
+    char type = sdsReqType(initlen + avail);
+    if(type == SDS_TYPE_5) type = SDS_TYPE_8;
+    return sdsHdrSize(type) + initlen + avail + 1;
+};
+
+/* Build an sds inside a buffer owned by the caller, at least
+ * sdsinplacesize(initlen,avail) bytes long. SDS_TYPE_5 is never used, so
+ * the string has an alloc field and spare flag bits like any other. It
+ * must not be freed, nor grown past 'avail', with the sds API. */
+sds sdsnewinplace(void *buf, const void *init, size_t initlen, size_t avail){
+    char type = sdsReqType(initlen + avail);
+    sds s;
+
+    if(type == SDS_TYPE_5) type = SDS_TYPE_8;
+    s = (char *)buf + sdsHdrSize(type);
+    switch(type){
+        case SDS_TYPE_8:{
+            SDS_HDR_VAR(8,s);
+            sh->len = initlen;
+            sh->alloc = initlen + avail;
+            break;
+        }
+        case SDS_TYPE_16:{
+            SDS_HDR_VAR(16,s);
+            sh->len = initlen;
+            sh->alloc = initlen + avail;
+            break;
+        }
+        case SDS_TYPE_32:{
+            SDS_HDR_VAR(32,s);
+            sh->len = initlen;
+            sh->alloc = initlen + avail;
+            break;
+        }
+        case SDS_TYPE_64:{
+            SDS_HDR_VAR(64,s);
+            sh->len = initlen;
+            sh->alloc = initlen + avail;
+            break;
+        }
+    };
+    s[-1] = type;
+    if(initlen) memcpy(s,init,initlen);
+    s[initlen] = '\0';
+    return s;
+};
+
 sds sdsempty(void){
     return sdsnewlen("",0);
 }
@@ -138,7 +188,7 @@ void sdsclear(sds s){
 };
 
 
-sds sdsMakeRoomFor(sds s, size_t addlen){
+static sds _sdsMakeRoomFor(sds s, size_t addlen, int greedy){
     void *sh, *newsh;
     size_t avail = sdsavail(s);
     size_t len,newlen;
@@ -150,10 +200,12 @@ sds sdsMakeRoomFor(sds s, size_t addlen){
     len = sdslen(s);
     sh = (char *)s - sdsHdrSize(oldtype); 
     newlen = (len + addlen);
-    if(newlen < SDS_MAX_PREALLOC){
-        newlen *= 2;
-    }else{
-        newlen += SDS_MAX_PREALLOC;
+    if(greedy){
+        if(newlen < SDS_MAX_PREALLOC){
+            newlen *= 2;
+        }else{
+            newlen += SDS_MAX_PREALLOC;
+        }
     }
     
     type = sdsReqType(newlen);
@@ -179,6 +231,16 @@ sds sdsMakeRoomFor(sds s, size_t addlen){
     return s;
 };
 
+sds sdsMakeRoomFor(sds s, size_t addlen){
+    return _sdsMakeRoomFor(s,addlen,1);
+};
+
+/* Like sdsMakeRoomFor() but allocates exactly addlen more bytes, for
+ * strings that are not going to keep growing. */
+sds sdsMakeRoomForNonGreedy(sds s, size_t addlen){
+    return _sdsMakeRoomFor(s,addlen,0);
+};
+
 sds sdsRemoveFreeSpace(sds s){
     void *sh, *newsh;
     char type, oldtype = s[-1] & SDS_TYPE_MASK;
@@ -304,54 +366,49 @@ sds sdscpy(sds s,const char *t){
 };
 
 #define SDS_LLSTR_SIZE 21
-int sdsll2str(char *s, long long value){
-    char *p, aux;
-    unsigned long long v;
-    size_t l;
-    
-    v = (value < 0) ? -value : value;
-    p = s;
-    do{
-        *p++ = '0' + (v%10);
-        v /= 10;
-    }while(v);
-    
-    if(value < 0) *p++ = '-'; 
-    l = p - s;
-    
-    *p = '\0';
-    p--;
-    while(s < p){
-        aux = *s;
-        *s = *p;
-        *p = aux;
-        s++;
-        p--;
-    };    
-    return l;
-};
+/* Two ASCII digits for every value in 0..99: the conversions below emit
+ * two digits per division, right to left into a scratch buffer, so no
+ * reversal pass is needed. */
+static const char sdsDigitPairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
 
 int sdsull2str(char *s, unsigned long long v){
-    char *p, aux;
+    char buf[SDS_LLSTR_SIZE];
+    char *p = buf + sizeof(buf);
     size_t l;
-    p = s;
-    do{
-        *p++ = '0' + (v%10);
-        v /= 10;
-    }while(v);
-    l = p - s;
-    *p = '\0';
-    p--;
-    while(s<p){
-        aux = *s;
-        *s = *p;
-        *p = aux;
-        s++;
-        p--;
-    }; 
+
+    while(v >= 100){
+        unsigned int const i = (unsigned int)(v % 100) * 2;
+        v /= 100;
+        *--p = sdsDigitPairs[i + 1];
+        *--p = sdsDigitPairs[i];
+    };
+    if(v < 10){
+        *--p = '0' + (char)v;
+    }else{
+        unsigned int const i = (unsigned int)v * 2;
+        *--p = sdsDigitPairs[i + 1];
+        *--p = sdsDigitPairs[i];
+    };
+    l = buf + sizeof(buf) - p;
+    memcpy(s,p,l);
+    s[l] = '\0';
     return l;
 };
 
+int sdsll2str(char *s, long long value){
+    /* Negate one more than the value so that LLONG_MIN does not overflow. */
+    if(value < 0){
+        *s = '-';
+        return sdsull2str(s + 1,((unsigned long long)-(value + 1)) + 1) + 1;
+    };
+    return sdsull2str(s,(unsigned long long)value);
+};
+
 sds sdsfromlonglong(long long value){
     char buf[SDS_LLSTR_SIZE];
     int len = sdsll2str(buf,value);
@@ -189,6 +189,8 @@ static inline void sdssetalloc(sds s, size_t newlen){
 
 
 sds sdsnewlen(const void *init, size_t initlen);
+size_t sdsinplacesize(size_t initlen, size_t avail);
+sds sdsnewinplace(void *buf, const void *init, size_t initlen, size_t avail);
 sds sdsnew(const char *init);
 sds sdsempty(void);
 sds sdsdup(const sds s);
@@ -227,6 +229,7 @@ sds sdsjoinsds(sds *argv, int argc, const char *sep, size_t seplen);
 
 /* Low level functions exposed to the user API*/
 sds sdsMakeRoomFor(sds s, size_t addlen);
+sds sdsMakeRoomForNonGreedy(sds s, size_t addlen);
 void sdsIncrLen(sds s, int incr);
 sds sdsRemoveFreeSpace(sds s);
 size_t sdsAllocSize(sds s);
@@ -327,6 +327,11 @@ void dictListDestructor(void *privdata, void *val){
     listRelease((list*)val);
 };
 
+void dictPubsubSubscribersDestructor(void *privdata, void *val){
+    DICT_NOTUSED(privdata);
+    pubsubSubscribersRelease(val);
+};
+
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2){
     int l1, l2;
     DICT_NOTUSED(privdata);
@@ -352,6 +357,23 @@ void dictSdsDestructor(void *privdata, void *val){
     sdsfree(val);
 };
 
+size_t dictSdsBytes(const void *key){
+    return zmalloc_size(sdsAllocPtr((sds)key));
+};
+
+/* Keys of db->dict are embedded in their dict entry. They get the room for
+ * an inline expire time and index handles up front (see keyRoomSize()),
+ * since an embedded key cannot be reallocated later. */
+size_t dictSdsEmbedSize(const void *key){
+    return sdsinplacesize(sdslen((sds)key),keyRoomSize());
+};
+
+void *dictSdsEmbed(void *buf, const void *key){
+    sds s = sdsnewinplace(buf,key,sdslen((sds)key),keyRoomSize());
+    keyInitRoom(s);
+    return s;
+};
+
 int dictObjKeyCompare(void *privdata, const void *key1, const void *key2){
     const robj *o1 = key1, *o2 = key2;
     return dictSdsKeyCompare(privdata, o1->ptr, o2->ptr);
@@ -428,6 +450,8 @@ dictType setDictType = {
     NULL,
     dictSdsKeyCompare,
     dictSdsDestructor,
+    NULL,
+    dictSdsBytes,
     NULL
 };
 
@@ -443,9 +467,14 @@ dictType zsetDictType = {
 dictType dbDictType = {
     dictSdsHash,
     NULL,
+    NULL,
     dictSdsKeyCompare,
-    dictSdsDestructor,
-    dictObjectDestructor
+    NULL,
+    dictObjectDestructor,
+    NULL,
+    NULL,
+    dictSdsEmbedSize,
+    dictSdsEmbed
 };
 
 dictType shaScriptObjectDictType = {
@@ -466,6 +495,32 @@ dictType keyptrDictType = {
     NULL
 };
 
+/* Keys of db->expires are the db->dict keys themselves. Each entry has
+ * room for the TTL index handle of its key right after it, so only the
+ * volatile keys pay for one (see dbExpireHandleRef()). */
+size_t dictExpireEmbedSize(const void *key){
+    DICT_NOTUSED(key);
+    return sizeof(void*);
+};
+
+void *dictExpireEmbed(void *buf, const void *key){
+    memset(buf,0,sizeof(void*));
+    return (void*)key;
+};
+
+dictType expiresDictType = {
+    dictSdsHash,
+    NULL,
+    NULL,
+    dictSdsKeyCompare,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    dictExpireEmbedSize,
+    dictExpireEmbed
+};
+
 dictType commandTableDictType = {
     dictSdsCaseHash,
     NULL,
@@ -482,7 +537,9 @@ dictType hashDictType = {
     NULL,
     dictSdsKeyCompare,
     dictSdsDestructor,
-    dictSdsDestructor
+    dictSdsDestructor,
+    dictSdsBytes,
+    dictSdsBytes
 };
 
 dictType keylistDictType = {
@@ -495,6 +552,24 @@ dictType keylistDictType = {
 };
 
 
+dictType pubsubChannelsDictType = {
+   dictObjHash,
+   NULL,
+   NULL, 
+   dictObjKeyCompare,
+   dictObjectDestructor,
+   dictPubsubSubscribersDestructor
+};
+
+dictType pubsubPatternPrefixDictType = {
+    dictSdsHash,
+    NULL,
+    NULL,
+    dictSdsKeyCompare,
+    dictSdsDestructor,
+    dictListDestructor
+};
+
 dictType clusterNodesDictType = {
     dictSdsHash,
     NULL,
@@ -775,6 +850,12 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData){
 
    databasesCron();
 
+   evictionCron();
+
+   lazyfreeReclaimCron(1000000 * LAZYFREE_RECLAIM_CRON_TIME_PERC / server.hz / 100);
+
+   memoryAnalyzerCron(1000000 * MEMORY_ANALYZER_TIME_PERC / server.hz / 100);
+
    if(server.rdb_child_pid == -1 && server.aof_child_pid == -1 && server.aof_rewrite_scheduled){
         rewriteAppendOnlyFileBackground(); 
    }
@@ -877,6 +958,8 @@ void beforeSleep(struct aeEventLoop *eventLoop){
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST); 
     };  
 
+    lazyfreeReclaimCron(LAZYFREE_RECLAIM_FAST_DURATION);
+
     if(server.get_ack_from_slaves){
         robj *argv[3]; 
 
@@ -1039,6 +1122,7 @@ void initServerConfig(void){
 
     server.tcpkeepalive = CONFIG_DEFAULT_TCP_KEEPALIVE;
     server.active_expire_enabled = 1;
+    server.expires_inline = CONFIG_DEFAULT_EXPIRES_INLINE;
     server.active_defrag_enabled = CONFIG_DEFAULT_ACTIVE_DEFRAG;
     
     server.active_defrag_ignore_bytes = CONFIG_DEFAULT_DEFRAG_IGNORE_BYTES; 
@@ -1097,6 +1181,9 @@ void initServerConfig(void){
     server.maxmemory = CONFIG_DEFAULT_MAXMEMORY;
     server.maxmemory_policy = CONFIG_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = CONFIG_DEFAULT_MAXMEMORY_SAMPLES;
+    server.maxmemory_eviction_lowwater = CONFIG_DEFAULT_MAXMEMORY_EVICTION_LOWWATER;
+    server.maxmemory_eviction_size_aware = CONFIG_DEFAULT_MAXMEMORY_EVICTION_SIZE_AWARE;
+    server.maxmemory_eviction_index = CONFIG_DEFAULT_MAXMEMORY_EVICTION_INDEX;
 
     server.lfu_log_factor = CONFIG_DEFAULT_LFU_LOG_FACTOR;
     server.lfu_decay_time = CONFIG_DEFAULT_LFU_DECAY_TIME;
@@ -1106,7 +1193,10 @@ void initServerConfig(void){
 
     server.list_max_ziplist_size = OBJ_LIST_MAX_ZIPLIST_SIZE;
     server.list_compress_depth = OBJ_LIST_COMPRESS_DEPTH;
+    server.list_compress_codec = OBJ_LIST_COMPRESS_CODEC;
+    server.list_compress_dictionary = NULL;
     server.set_max_intset_entries = OBJ_SET_MAX_INTSET_ENTRIES;
+    server.set_use_roaring = OBJ_SET_USE_ROARING;
 
     server.zset_max_ziplist_entries = OBJ_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = OBJ_ZSET_MAX_ZIPLIST_VALUE;
@@ -1128,6 +1218,9 @@ void initServerConfig(void){
     server.lazyfree_lazy_eviction = CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION;
     server.lazyfree_lazy_expire = CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE;
     server.lazyfree_lazy_server_del = CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL;
+    server.lazyfree_incremental = CONFIG_DEFAULT_LAZYFREE_INCREMENTAL;
+    server.bio_close_file_threads = CONFIG_DEFAULT_BIO_CLOSE_FILE_THREADS;
+    server.bio_lazy_free_threads = CONFIG_DEFAULT_BIO_LAZY_FREE_THREADS;
     server.always_show_logo = CONFIG_DEFAULT_ALWAYS_SHOW_LOGO;
 
     server.lruclock = getLRUClock();
@@ -1428,19 +1521,26 @@ int initServer(void){
 
     for(j = 0; j < server.dbnum; j++){
        server.db[j].dict = dictCreate(&dbDictType, NULL);          
-       server.db[j].expires = dictCreate(&keyptrDictType, NULL);
+       server.db[j].expires = dictCreate(&expiresDictType, NULL);
+       server.db[j].expires_index = NULL;
        server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
        server.db[j].ready_keys = dictCreate(&objectKeyPointerValueDictType,NULL);
        server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
+       server.db[j].evidx = NULL;
+       server.db[j].inline_expires = 0;
        server.db[j].id = j;
        server.db[j].avg_ttl = 0;
     };
     
     evictionPoolAlloc();
-    server.pubsub_channels = dictCreate(&keylistDictType,NULL);
-    server.pubsub_patterns = listCreate();
-    listSetFreeMethod(server.pubsub_patterns, freePubsubPattern);
-    listSetMatchMethod(server.pubsub_patterns, listMatchPubsubPattern);
+    server.exec_propagate = NULL;
+    server.pubsub_channels = dictCreate(&pubsubChannelsDictType,NULL);
+    server.pubsub_patterns = dictCreate(&pubsubChannelsDictType,NULL);
+    server.pubsub_pattern_prefixes = dictCreate(&pubsubPatternPrefixDictType,NULL);
+    memset(server.pubsub_pattern_prefix_lens,0,sizeof(server.pubsub_pattern_prefix_lens));
+    server.pubsub_pattern_subscriptions = 0;
+    server.notify_keyspace_listeners = 0;
+    server.notify_keyevent_listeners = 0;
     server.cronloops = 0;
     server.rdb_child_pid = -1;
     server.aof_child_pid = -1;
@@ -1600,7 +1700,25 @@ struct redisCommand *lookupCommandOrOriginal(sds name){
     return cmd;
 }
 
+static robj **propagateArgvCopy(robj **argv, int argc){
+    robj **argvcopy = zmalloc(sizeof(robj*) * argc);
+    int j;
+
+    for(j = 0; j < argc; j++){
+        argvcopy[j] = argv[j]; 
+        incrRefCount(argv[j]);
+    };
+    return argvcopy;
+};
+
+/* While EXEC runs, server.exec_propagate collects what its commands
+ * propagate, so that it is emitted once as a MULTI/EXEC block. */
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags){
+    if(server.exec_propagate){
+        redisOpArrayAppend(server.exec_propagate,cmd,dbid,propagateArgvCopy(argv,argc),argc,flags);
+        return;
+    };
+
     if(server.aof_state != AOF_OFF && flags & PROPAGATE_AOF){
         feedAppendOnlyFile(cmd, dbid, argv, argc); 
     }
@@ -1613,20 +1731,9 @@ void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int fl
 
 
 void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int target){
-    robj **argvcopy;
-    int j;  
-
-
     if(server.loading) return;
 
-    argvcopy = zmalloc(sizeof(robj*) * argc);
-    
-    for(j = 0; j < argc; j++){
-        argvcopy[j] = argv[j]; 
-        incrRefCount(argv[j]);
-    };
-
-    redisOpArrayAppend(&server.also_propagate, cmd, dbid, argvcopy, argc, target);
+    redisOpArrayAppend(&server.also_propagate, cmd, dbid, propagateArgvCopy(argv,argc), argc, target);
 };
 
 
@@ -2282,7 +2389,8 @@ sds genRedisInfoString(char *section){
             "mem_fragmentation_ratio:%.2f\r\n"
             "mem_allocator:%s\r\n"
             "active_defrag_running:%d\r\n"
-            "lazyfree_pending_objects:%zu\r\n",
+            "lazyfree_pending_objects:%zu\r\n"
+            "lazyfree_queue_latency_ms:%lld\r\n",
             zmalloc_used,
             hmem,
             server.resident_set_size, 
@@ -2304,7 +2412,8 @@ sds genRedisInfoString(char *section){
             mh->fragmentation,
             ZMALLOC_LIB,
             server.active_defrag_running,
-            lazyfreeGetPendingObjectsCount()); 
+            lazyfreeGetPendingObjectsCount(),
+            bioQueueLatencyOfType(BIO_LAZY_FREE)); 
         
             freeMemoryOverheadData(mh);
     }
@@ -2356,6 +2465,7 @@ sds genRedisInfoString(char *section){
                 "aof_buffer_length:%zu\r\n"
                 "aof_rewrite_buffer_length:%lu\r\n"
                 "aof_pending_bio_fsync:%llu\r\n"
+                "aof_bio_fsync_queue_latency_ms:%lld\r\n"
                 "aof_delayed_fsync:%lu\r\n",
                 (long long) server.aof_current_size,
                 (long long) server.aof_rewrite_base_size,
@@ -2363,6 +2473,7 @@ sds genRedisInfoString(char *section){
                 sdslen(server.aof_buf),
                 aofRewriteBufferSize(),
                 bioPendingJobsOfType(BIO_AOF_FSYNC),
+                bioQueueLatencyOfType(BIO_AOF_FSYNC),
                 server.aof_delayed_fsync); 
             }
         if(server.loading){
@@ -2439,7 +2550,7 @@ sds genRedisInfoString(char *section){
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
-            listLength(server.pubsub_patterns),
+            server.pubsub_pattern_subscriptions,
             server.stat_fork_time,
             dictSize(server.migrate_cached_sockets),
             getSlaveKeyWithExpireCount(),
@@ -2617,7 +2728,7 @@ sds genRedisInfoString(char *section){
             long long keys, vkeys;
 
             keys = dictSize(server.db[j].dict); 
-            vkeys = dictSize(server.db[j].expires);
+            vkeys = dbExpiresCount(&server.db[j]);
             if(keys || vkeys){
                 info = sdscatprintf(info,   "db%d:keys=%lld,expires=%lld,avg_ttl=%lld\r\n",
                         j, keys, vkeys, server.db[j].avg_ttl 
@@ -2818,6 +2929,32 @@ int checkForSentinelMode(int argc, char **argv){
 
 
 
+/* Load the zstd dictionary used to compress list nodes, if configured. It
+ * must happen before the dataset is loaded so that loaded lists already
+ * compress with it. */
+static void loadListCompressDictionary(void){
+    FILE *fp;
+    char *buf;
+    long len;
+
+    if(server.list_compress_dictionary == NULL) return;
+    if((fp = fopen(server.list_compress_dictionary,"r")) == NULL ||
+       fseek(fp,0,SEEK_END) == -1 || (len = ftell(fp)) <= 0 || fseek(fp,0,SEEK_SET) == -1){
+        serverLog(LL_WARNING,"Can't read the list compression dictionary %s: %s. Exiting.",
+            server.list_compress_dictionary,strerror(errno));
+        exit(1);
+    };
+    buf = zmalloc(len);
+    if(fread(buf,len,1,fp) != 1 || quicklistCodecAddDictionary(buf,len) == -1){
+        serverLog(LL_WARNING,"Invalid list compression dictionary %s. Exiting.",
+            server.list_compress_dictionary);
+        exit(1);
+    };
+    zfree(buf);
+    fclose(fp);
+    serverLog(LL_NOTICE,"List compression dictionary loaded from %s",server.list_compress_dictionary);
+}
+
 void loadDataFromDisk(void){
     long long start = ustime();    
 
@@ -2960,10 +3097,14 @@ int main(int argc, char **argv){
     if(argc == 3 && !strcasecmp(argv[1], "test")){
         if(!strcasecmp(argv[2],"ziplist")){
             return ziplistTest(argc,argv); 
+        }else if(!strcasecmp(argv[2],"listpack")){
+            return listpackTest(argc,argv);
         }else if(!strcasecmp(argv[2],"quicklist")){
             quicklistTest(argc,argv); 
         }else if(!strcasecmp(argv[2],"intset")){
             return intsetTest(argc,argv); 
+        }else if(!strcasecmp(argv[2],"roaring")){
+            return roaringTest(argc,argv);
         }else if(!strcasecmp(argv[2],"zipmap")){
             return zipmapTest(argc,argv); 
         }else if(!strcasecmp(argv[2],"sha1test")){
@@ -2974,6 +3115,12 @@ int main(int argc, char **argv){
             return sdsTest(argc,argv); 
         }else if(!strcasecmp(argv[2],"crc64")){
             return crc64Test(argc,argv); 
+        }else if(!strcasecmp(argv[2],"evict")){
+            return evictTest(argc,argv);
+        }else if(!strcasecmp(argv[2],"multi")){
+            return multiTest(argc,argv);
+        }else if(!strcasecmp(argv[2],"object")){
+            return objectTest(argc,argv);
         };         
 
         return -1; 
@@ -3077,6 +3224,13 @@ int main(int argc, char **argv){
         serverLog(LL_WARNING,"Configuration loaded"); 
     }
 
+    if(server.maxmemory_eviction_lowwater < 0 ||
+       server.maxmemory_eviction_lowwater > CONFIG_MAX_MAXMEMORY_EVICTION_LOWWATER){
+        serverLog(LL_WARNING,"Fatal error: maxmemory-eviction-lowwater must be between 0 and %d (current value is %d).",
+            CONFIG_MAX_MAXMEMORY_EVICTION_LOWWATER,server.maxmemory_eviction_lowwater);
+        exit(1);
+    };
+
     server.supervised = redisIsSupervised(server.supervised_mode);
     int background = server.daemonize && !server.supervised;
     if(background)  daemonize();
@@ -3092,6 +3246,7 @@ int main(int argc, char **argv){
         linuxMemoryWarnings();
     #endif
         moduleLoadFromQueue();
+        loadListCompressDictionary();
         loadDataFromDisk();
         if(server.cluster_enabled){
             if(verifyClusterConfigWithData() == C_ERR){
@@ -31,7 +31,9 @@ typedef long long mstime_t;
 #include "zmalloc.h"
 #include "anet.h"
 #include "ziplist.h"
+#include "listpack.h"
 #include "intset.h"
+#include "roaring.h"
 #include "version.h"
 #include "util.h"
 #include "latency.h"
@@ -104,6 +106,10 @@ typedef long long mstime_t;
 #define CONFIG_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define CONFIG_DEFAULT_MAXMEMORY 0
 #define CONFIG_DEFAULT_MAXMEMORY_SAMPLES 5
+#define CONFIG_DEFAULT_MAXMEMORY_EVICTION_LOWWATER 0
+#define CONFIG_MAX_MAXMEMORY_EVICTION_LOWWATER 99
+#define CONFIG_DEFAULT_MAXMEMORY_EVICTION_SIZE_AWARE 0
+#define CONFIG_DEFAULT_MAXMEMORY_EVICTION_INDEX 0
 #define CONFIG_DEFAULT_LFU_LOG_FACTOR 10
 #define CONFIG_DEFAULT_LFU_DECAY_TIME 1
 #define CONFIG_DEFAULT_AOF_FILENAME "appendonly.aof"
@@ -111,6 +117,7 @@ typedef long long mstime_t;
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 0
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
+#define CONFIG_DEFAULT_EXPIRES_INLINE 0
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_MIN_SLAVES_TO_WRITE 0
 #define CONFIG_DEFAULT_MIN_SLAVES_MAX_LAG 10
@@ -126,6 +133,9 @@ typedef long long mstime_t;
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EVICTION 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_EXPIRE 0
 #define CONFIG_DEFAULT_LAZYFREE_LAZY_SERVER_DEL 0
+#define CONFIG_DEFAULT_LAZYFREE_INCREMENTAL 0
+#define CONFIG_DEFAULT_BIO_CLOSE_FILE_THREADS 1
+#define CONFIG_DEFAULT_BIO_LAZY_FREE_THREADS 2
 #define CONFIG_DEFAULT_ALWAYS_SHOW_LOGO 0
 #define CONFIG_DEFAULT_ACTIVE_DEFRAG 0
 #define CONFIG_DEFAULT_DEFRAG_THRESHOLD_LOWER 10
@@ -140,6 +150,8 @@ typedef long long mstime_t;
 #define ACTIVE_EXPIRE_CYCLE_SLOW_TIME_PERC 25
 #define ACTIVE_EXPIRE_CYCLE_SLOW 0
 #define ACTIVE_EXPIRE_CYCLE_FAST 1
+#define LAZYFREE_RECLAIM_CRON_TIME_PERC 10
+#define LAZYFREE_RECLAIM_FAST_DURATION 500
 
 #define STATS_METRIC_SAMPLES 16
 #define STATS_METRIC_COMMAND 0
@@ -151,6 +163,8 @@ typedef long long mstime_t;
 #define PROTO_MAX_QUERYBUF_LEN (1024*1024*1024)
 #define PROTO_IOBUF_LEN (1024 * 16)
 #define PROTO_REPLY_CHUNK_BYTES (16 * 1024)
+#define PROTO_SHARED_REPLY_MIN_BYTES 512
+#define PUBSUB_PATTERN_PREFIX_MAX 64
 #define PROTO_INLINE_MAX_SIZE (1024*64)
 #define PROTO_MBULK_BIG_ARG (1024*32)
 #define LONG_STR_SIZE 21
@@ -293,12 +307,14 @@ typedef long long mstime_t;
 #define OBJ_HASH_MAX_ZIPLIST_ENTRIES 512
 #define OBJ_HASH_MAX_ZIPLIST_VALUE 64
 #define OBJ_SET_MAX_INTSET_ENTRIES 512
+#define OBJ_SET_USE_ROARING 0
 #define OBJ_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define OBJ_ZSET_MAX_ZIPLIST_VALUE 64
 
 
 #define OBJ_LIST_MAX_ZIPLIST_SIZE -2
 #define OBJ_LIST_COMPRESS_DEPTH 0
+#define OBJ_LIST_COMPRESS_CODEC QUICKLIST_CODEC_LZF
 
 #define CONFIG_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
 
@@ -318,7 +334,7 @@ typedef long long mstime_t;
 #define MAXMEMORY_VOLATILE_RANDOM (3<<8)
 
 #define MAXMEMORY_ALLKEYS_LRU ((4<<8) | MAXMEMORY_FLAG_LRU | MAXMEMORY_FLAG_ALLKEYS)
-#define MAXMEMORY_ALLKEYS_LFU ((5<<8) | MAXMEMORY_ALLKEYS_LFU | MAXMEMORY_FLAG_ALLKEYS)
+#define MAXMEMORY_ALLKEYS_LFU ((5<<8) | MAXMEMORY_FLAG_LFU | MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8) | MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
 
@@ -463,6 +479,7 @@ typedef struct RedisModuleIO{
 #define OBJ_ENCODING_SKIPLIST 7
 #define OBJ_ENCODING_EMBSTR 8
 #define OBJ_ENCODING_QUICKLIST 9
+#define OBJ_ENCODING_ROARING 10
 
 
 #define LRU_BITS 24
@@ -491,13 +508,18 @@ typedef struct redisObject{
 
 
 struct evictionPoolEntry;
+struct evictionIndex;
+struct expireIndex;
 
 typedef struct redisDb{
     dict *dict;
     dict *expires;
+    struct expireIndex *expires_index;
     dict *blocking_keys;
     dict *ready_keys;
     dict *watched_keys;
+    struct evictionIndex *evidx;
+    unsigned long inline_expires;
     int id;
     long long avg_ttl;
 } redisDb;
@@ -509,9 +531,21 @@ typedef struct multiCmd{
 } multiCmd;
 
 
+/* The argv arrays of queued commands are carved out of a chain of chunks,
+ * newest first. They take over the argument objects of the client, so
+ * queueing does not touch their refcount. */
+typedef struct multiArgvChunk{
+    struct multiArgvChunk *next;
+    int used;
+    int size;
+    robj *argv[];
+} multiArgvChunk;
+
 typedef struct multiState {
     multiCmd *commands;
     int count;
+    int size;
+    multiArgvChunk *chunks;
     int minreplicas;
     time_t minreplicas_timeout;
 } multiState;
@@ -777,7 +811,10 @@ struct redisServer {
     long long stat_sync_full;
     long long stat_sync_partial_ok;
     long long stat_sync_partial_err;
-    list *slowlog;
+    struct slowlogEntry *slowlog;
+    unsigned long slowlog_size;
+    unsigned long slowlog_len;
+    unsigned long slowlog_head;
     long long slowlog_entry_id;
     long long slowlog_log_slower_than;
     unsigned long slowlog_max_len;
@@ -798,6 +835,7 @@ struct redisServer {
     int maxidletime;
     int tcpkeepalive;
     int active_expire_enabled;
+    int expires_inline;
     int active_defrag_enabled;
     size_t active_defrag_ignore_bytes;
     int active_defrag_threshold_lower;
@@ -877,6 +915,7 @@ struct redisServer {
     } child_info_data;
 
     redisOpArray also_propagate;
+    redisOpArray *exec_propagate;
     char *logfile;
     int syslog_enabled;
     char *syslog_ident;
@@ -939,6 +978,9 @@ struct redisServer {
     unsigned long long maxmemory;
     int maxmemory_policy;
     int maxmemory_samples;
+    int maxmemory_eviction_lowwater;
+    int maxmemory_eviction_size_aware;
+    int maxmemory_eviction_index;
     unsigned int lfu_log_factor;
     unsigned int lfu_decay_time;
 
@@ -954,19 +996,27 @@ struct redisServer {
     size_t hash_max_ziplist_entries;
     size_t hash_max_ziplist_value;
     size_t set_max_intset_entries;
+    int set_use_roaring;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
     size_t hll_sparse_max_bytes;
 
     int list_max_ziplist_size;
     int list_compress_depth;
+    int list_compress_codec;
+    char *list_compress_dictionary;
 
     time_t unixtime;
     long long mstime;
 
     dict *pubsub_channels;
-    list *pubsub_patterns;
+    dict *pubsub_patterns;
+    dict *pubsub_pattern_prefixes;
+    unsigned long pubsub_pattern_prefix_lens[PUBSUB_PATTERN_PREFIX_MAX + 1];
+    unsigned long pubsub_pattern_subscriptions;
     int notify_keyspace_events;
+    unsigned long notify_keyspace_listeners;
+    unsigned long notify_keyevent_listeners;
 
     int cluster_enabled;
     mstime_t cluster_node_timeout;
@@ -1001,6 +1051,9 @@ struct redisServer {
     int lazyfree_lazy_eviction;
     int lazyfree_lazy_expire;
     int lazyfree_lazy_server_del;
+    int lazyfree_incremental;
+    int bio_close_file_threads;
+    int bio_lazy_free_threads;
     
     long long latency_monitor_threshold;
     dict *latency_events;
@@ -1015,10 +1068,13 @@ struct redisServer {
     size_t system_memory_size;
 };
 
-typedef struct pubsubPattern{
-    client *client;
-    robj *pattern;
-} pubsubPattern;
+/* Subscribers of a channel or pattern. They are kept in an array so that PUBLISH
+ * walks contiguous memory; unsubscribing moves the last one in the hole. */
+typedef struct pubsubSubscribers{
+    client **clients;
+    unsigned long count;
+    unsigned long size;
+} pubsubSubscribers;
 
 
 typedef void redisCommandProc(client *c);
@@ -1104,6 +1160,7 @@ extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
 extern dictType hashDictType;
 extern dictType replScriptCacheDictType;
 extern dictType keyptrDictType;
+extern dictType expiresDictType;
 extern dictType modulesDictType;
 
 
@@ -1146,12 +1203,14 @@ void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask);
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
 void addReplyString(client *c, const char *s, size_t len);
+char *addReplyReserve(client *c, size_t len);
 void addReplyBulk(client *c, robj *obj);
 void addReplyBulkCString(client *c, const char *s);
 void addReplyBulkCBuffer(client *c, const void *p, size_t len);
 void addReplyBulkLongLong(client *c, long long ll); 
 void addReply(client *c, robj *obj);
 void addReplySds(client *c, sds s);
+void addReplyShared(client *c, robj *o);
 void addReplyBulkSds(client *c, sds s);
 void addReplyError(client *c, const char *err);
 void addReplyStatus(client *c, const char *status);
@@ -1246,11 +1305,13 @@ robj *tryObjectEncoding(robj *o);
 robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
+robj *createStringObjectFromLongLongForValue(long long value);
 robj *createStringObjectFromLongDouble(long double value, int humanfriendly);
 robj *createQuicklistObject(void);
 robj *createZiplistObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
+robj *createRoaringSetObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
 robj *createZsetZiplistObject(void);
@@ -1268,6 +1329,13 @@ int compareStringObjects(robj *a, robj *b);
 int collateStringObjects(robj *a, robj *b);
 int equalStringObjects(robj *a, robj *b);
 unsigned long long estimateObjectIdleTime(robj *o);
+#define OBJ_COMPUTE_SIZE_DEF_SAMPLES 5
+size_t objectComputeSize(robj *o, size_t sample_size);
+#define MEMORY_ANALYZER_TIME_PERC 2
+#define MEMORY_ANALYZER_SCAN_STEPS 16
+#define MEMORY_ANALYZER_DEFAULT_COUNT 16
+#define MEMORY_ANALYZER_MAX_COUNT 1024
+void memoryAnalyzerCron(long long timelimit);
 #define sdsEncodedObject(objptr) (objptr->encoding == OBJ_ENCODING_RAW || objptr->encoding == OBJ_ENCODING_EMBSTR) 
 
 ssize_t syncWrite(int fd, char *ptr, ssize_t size, long long timeout);
@@ -1356,7 +1424,7 @@ typedef struct {
 } zlexrangespec;
 
 
-zskliplist *zslCreate(void);
+zskiplist *zslCreate(void);
 void zslFree(zskiplist *zsl); 
 zskiplistNode *zslInsert(zskiplist *zsl, double score, sds ele);
 unsigned char *zzlInsert(unsigned char *zl, sds ele, double score);
@@ -1392,6 +1460,7 @@ int zslLexValueLteMax(sds value, zlexrangespec *spec);
 
 /*Core functions*/
 int freeMemoryIfNeeded(void);
+void evictionCron(void);
 int processCommand(client *c);
 void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
@@ -1400,6 +1469,8 @@ struct redisCommand *lookupCommandOrOriginal(sds name);
 void call(client *c, int flags);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags);
 void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int target);
+void redisOpArrayInit(redisOpArray *oa);
+void redisOpArrayFree(redisOpArray *oa);
 void forceCommandPropagation(client *c, int flags);
 void preventCommandPropagation(client *c);
 void preventCommandAOF(client *c);
@@ -1476,12 +1547,13 @@ int hashTypeSet(robj *o, sds field, sds value, int flags);
 
 int pubsubUnsubscribeAllChannels(client *c, int notify);
 int pubsubUnsubscribeAllPatterns(client *c, int notify);
-void freePubsubPattern(void *p);
-int listMatchPubsubPattern(void *a, void *b);
+void pubsubSubscribersRelease(pubsubSubscribers *subs);
 int pubsubPublishMessage(robj *channel, robj *message);
+size_t pubsubPatternPrefixLen(robj *pattern);
 
 
 void notifyKeyspaceEvent(int type, char *event, robj *key, int dbid);
+void notifyTrackSubscription(robj *name, int pattern, int delta);
 int keyspaceEventsStringToFlags(char *classes);
 sds keyspaceEventsFlagsToString(int flags);
 
@@ -1498,6 +1570,20 @@ int removeExpire(redisDb *db, robj *key);
 void propagateExpire(redisDb *db, robj *key, int lazy);
 int expireIfNeeded(redisDb *db, robj *key);
 long long getExpire(redisDb *db, robj *key);
+long long dbGetExpire(redisDb *db, sds key);
+long long dbGetEntryExpire(redisDb *db, dictEntry *de);
+unsigned long dbExpiresCount(redisDb *db);
+int keyHasInlineExpire(sds key);
+long long keyGetInlineExpire(sds key);
+size_t keyRoomSize(void);
+void keyInitRoom(sds key);
+int keyHasEvictionRoom(sds key);
+void *keyGetEvictionHandle(sds key);
+void keySetEvictionHandle(sds key, void *handle);
+void dbForgetKey(redisDb *db, sds key);
+void dbSetExpireHandle(redisDb *db, sds key, void *handle);
+long long dbExpireIndexRemoved(redisDb *db, sds key);
+int dbDeleteExpire(redisDb *db, sds key);
 void setExpire(client *c, redisDb *db, robj *key, long long when);
 robj *lookupKey(redisDb *db, robj *key, int flags);
 robj *lookupKeyRead(redisDb *db, robj *key);
@@ -1505,12 +1591,16 @@ robj *lookupKeyWrite(redisDb *db, robj *key);
 robj *lookupKeyReadOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyWriteOrReply(client *c, robj *key, robj *reply);
 robj *lookupKeyReadWithFlags(redisDb *db, robj *key, int flags);
+#define DB_LOOKUP_BATCH 16
+void lookupKeysReadWithFlags(redisDb *db, robj **keys, robj **vals, int count, int flags);
+void dbPrefetchKeys(redisDb *db, robj **keys, int count);
 robj *objectCommandLookup(client *c, robj *key);
 robj *objectCommandLookupOrReply(client *c, robj *key, robj *reply);
 
 #define LOOKUP_NONE 0
 #define LOOKUP_NOTOUCH (1<<0)
-void abAdd(redisDb *db, robj *key, robj *val);
+#define LOOKUP_NOSTATS (1<<1)
+void dbAdd(redisDb *db, robj *key, robj *val);
 void dbOverwrite(redisDb *db, robj *key, robj *val);
 void setKey(redisDb *db, robj *key, robj *val);
 int dbExists(redisDb *db, robj *key);
@@ -1540,6 +1630,9 @@ int dbAsyncDelete(redisDb *db, robj *key);
 void emptyDbAsync(redisDb *db);
 void slotToKeyFlushAsync(void);
 size_t lazyfreeGetPendingObjectsCount(void);
+int lazyfreeReclaimDetach(robj *val);
+size_t lazyfreeReclaimPendingBytes(void);
+void lazyfreeReclaimCron(long long timelimit);
 
 
 int *getKeysFromCommand(struct redisCommand *cmd, robj **argv, int argc, int *numkeys);
@@ -1582,6 +1675,9 @@ void disconnectAllBlockedClients(void);
 
 
 void activeExpireCycle(int type);
+void *expireIndexAdd(redisDb *db, sds key, long long when);
+void expireIndexDel(void *handle);
+void expireIndexEmpty(redisDb *db);
 void expireSlaveKeys(void);
 void rememberSlaveKeyWithExpire(redisDb *db, robj *key);
 void flushSlaveKeysWithExpireList(void);
@@ -1589,14 +1685,27 @@ size_t getSlaveKeyWithExpireCount(void);
 
 
 void evictionPoolAlloc(void);
+void evictionIndexAdd(redisDb *db, dictEntry *de);
+void evictionIndexDel(sds key);
+void evictionIndexEmpty(redisDb *db);
+#ifdef REDIS_TEST
+int evictTest(int argc, char **argv);
+int multiTest(int argc, char **argv);
+int objectTest(int argc, char **argv);
+#endif
 #define LFU_INIT_VAL 5
 unsigned long LFUGetTimeInMinutes(void);
+unsigned long LFUDecrAndReturn(robj *o);
+unsigned long LFUPeekDecayed(const robj *o);
 uint8_t LFULogIncr(uint8_t value);
 
 
 uint64_t dictSdsHash(const void *key);
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
 void dictSdsDestructor(void *privdata, void *val);
+size_t dictSdsBytes(const void *key);
+size_t dictSdsEmbedSize(const void *key);
+void *dictSdsEmbed(void *buf, const void *key);
 
 
 char *redisGitSHA1(void);
@@ -2,111 +2,152 @@
 #include "slowlog.h"
 
 
+/* Return the i-th most recent entry of the ring, 0 being the newest. */
+static slowlogEntry *slowlogGetEntry(unsigned long i){
+    unsigned long idx = (server.slowlog_head + server.slowlog_size - 1 - i) % server.slowlog_size;
+    return server.slowlog + idx;
+};
 
-slowlogEntry *slowlogCreateEntry(robj **argv, int argc, long long duration){
-    slowlogEntry *se = zmalloc(sizeof(*se));
+static void slowlogFillEntry(slowlogEntry *se, robj **argv, int argc, long long duration){
     int j, slargc = argc;
+    size_t used = 0;
 
     if(slargc > SLOWLOG_ENTRY_MAX_ARGC) slargc = SLOWLOG_ENTRY_MAX_ARGC;
     se->argc = slargc;
-    se->argv = zmalloc(sizeof(robj*) * slargc);
-
+    se->moreargs = 0;
 
     for(j = 0; j < slargc; j++){
+        char llbuf[LONG_STR_SIZE];
+        const char *p;
+        size_t len, copy;
+
         if(slargc != argc && j == slargc - 1){
-            se->argv[j] = createObject(OBJ_STRING, sdscatprintf(sdsempty,"...(%d more arguments)",argc-slargc + 1)); 
+            se->moreargs = argc - slargc + 1;
+            se->arglen[j] = 0;
+            se->argmore[j] = 0;
+            continue;
+        };
+
+        if(sdsEncodedObject(argv[j])){
+            p = argv[j]->ptr;
+            len = sdslen(argv[j]->ptr);
         }else{
-            if(argv[j]->type == OBJ_STRING &&
-               sdsEncodedObject(argv[j]) &&
-               sdslen(argv[j]->ptr) > SLOWLOG_ENTRY_MAX_STRING){
-                sds s = sdsnewlen(argv[j]->ptr, SLOWLOG_ENTRY_MAX_STRING);
-                s = sdscatprintf(s,"... (%u more bytes)", (unsigned long) sdslen(argv[j]->ptr) - SLOWLOG_ENTRY_MAX_STRING);
-                se->argv[j] = createObject(OBJ_STRING,s);
-            }else{
-                se->argv[j] = argv[j]; 
-                incrRefCount(argv[j]);
-            } 
-        } 
+            len = ll2string(llbuf,sizeof(llbuf),(long)argv[j]->ptr);
+            p = llbuf;
+        };
+
+        copy = len;
+        if(copy > SLOWLOG_ENTRY_MAX_STRING) copy = SLOWLOG_ENTRY_MAX_STRING;
+        if(copy > SLOWLOG_ENTRY_ARGV_BYTES - used) copy = SLOWLOG_ENTRY_ARGV_BYTES - used;
+        memcpy(se->argbuf + used, p, copy);
+        used += copy;
+        se->arglen[j] = copy;
+        se->argmore[j] = len - copy;
     };
-    se->time = time(NULL);
+    se->time = server.unixtime;
     se->duration = duration;
     se->id = server.slowlog_entry_id++;
-    return se;
 };
 
-void slowlogFreeEntry(void *septr){
-    slowlogEntry *se = septr;
-    int j;
+void slowlogResize(unsigned long len){
+    slowlogEntry *ring = NULL;
+    unsigned long j, keep = server.slowlog_len;
 
-    for(j = 0; j < se->argc; j++){
-        decrRefCount(se->argv[j]); 
+    if(keep > len) keep = len;
+    if(len) ring = zmalloc(sizeof(slowlogEntry) * len);
+
+    for(j = 0; j < keep; j++){
+        memcpy(ring + (keep - 1 - j), slowlogGetEntry(j), sizeof(slowlogEntry));
     };
 
-    zfree(se->argv);
-    zfree(se);
+    zfree(server.slowlog);
+    server.slowlog = ring;
+    server.slowlog_size = len;
+    server.slowlog_len = keep;
+    server.slowlog_head = len ? keep % len : 0;
 };
 
-
 void slowlogInit(void){
-    server.slowlog = listCreate();
+    server.slowlog = NULL;
+    server.slowlog_size = 0;
+    server.slowlog_len = 0;
+    server.slowlog_head = 0;
     server.slowlog_entry_id = 0;
-    listSetFreeMethod(server.slowlog,slowlogFreeEntry);
+    slowlogResize(server.slowlog_max_len);
+};
+
+/* slowlog-max-len can change at any time: bring the ring in line with it
+ * before it is read or written, so LEN and GET never report entries past
+ * the current limit. */
+static void slowlogSyncSize(void){
+    if(server.slowlog_size != server.slowlog_max_len) slowlogResize(server.slowlog_max_len);
 };
 
 void slowlogPushEntryIfNeeded(robj **argv, int argc, long long duration){
     if(server.slowlog_log_slower_than < 0) return;
-    if(duration >= server.slowlog_log_slower_than){
-        listAddNodeHead(server.slowlog, slowlogCreateEntry(argv,argc,duration)); 
-    };
-    while(listLength(server.slowlog) > server.slowlog_max_len){
-        listDelNode(server.slowlog,listLast(server.slowlog)); 
-    };
-};
+    if(duration < server.slowlog_log_slower_than) return;
+    slowlogSyncSize();
+    if(server.slowlog_size == 0) return;
 
+    slowlogFillEntry(server.slowlog + server.slowlog_head,argv,argc,duration);
+    server.slowlog_head = (server.slowlog_head + 1) % server.slowlog_size;
+    if(server.slowlog_len < server.slowlog_size) server.slowlog_len++;
+};
 
 void slowlogReset(void){
-    while(listLength(server.slowlog) > 0){
-        listDelNode(server.slowlog, listLast(server.slowlog)); 
+    server.slowlog_len = 0;
+    server.slowlog_head = 0;
+};
+
+static void addReplySlowlogArgs(client *c, slowlogEntry *se){
+    const char *p = se->argbuf;
+    int j;
+
+    addReplyMultiBulkLen(c,se->argc);
+    for(j = 0; j < se->argc; j++){
+        if(se->moreargs && j == se->argc - 1){
+            addReplyBulkSds(c,sdscatprintf(sdsempty(),"... (%d more arguments)",se->moreargs));
+        }else if(se->argmore[j]){
+            sds s = sdsnewlen(p,se->arglen[j]);
+            s = sdscatprintf(s,"... (%lu more bytes)",(unsigned long) se->argmore[j]);
+            addReplyBulkSds(c,s);
+        }else{
+            addReplyBulkCBuffer(c,p,se->arglen[j]);
+        };
+        p += se->arglen[j];
     };
 };
 
 void slowlogCommand(client *c){
     if(c->argc == 2 && !strcasecmp(c->argv[1]->ptr, "reset")){
-        slowlogReset(); 
+        slowlogReset();
         addReply(c,shared.ok);
     }else if(c->argc == 2 && !strcasecmp(c->argv[1]->ptr, "len")){
-        addReplyLongLong(c,listLength(server.slowlog)); 
-    }else if((c->argc == 2 || c->argc == 3) && 
-             !strcasecmp(c->argv[1]->ptr,"get") 
+        slowlogSyncSize();
+        addReplyLongLong(c,server.slowlog_len);
+    }else if((c->argc == 2 || c->argc == 3) &&
+             !strcasecmp(c->argv[1]->ptr,"get")
             ){
-            long count = 10, sent = 0; 
-            listIter li;
-            void *totentries;
-            listNode *ln;
+            long count = 10;
+            unsigned long j;
             slowlogEntry *se;
 
             if(c->argc == 3 && getLongFromObjectOrReply(c,c->argv[2],&count,NULL)!= C_OK){
-                return; 
+                return;
             }
-            
-           listRewind(server.slowlog,&li); 
-           totentries = addDeferredMultiBulkLength(c);
-           while(count-- && (ln = listNext(&li))){
-                int j;
-                se = ln->value; 
+            slowlogSyncSize();
+            if(count < 0 || (unsigned long)count > server.slowlog_len) count = server.slowlog_len;
+
+           addReplyMultiBulkLen(c,count);
+           for(j = 0; j < (unsigned long)count; j++){
+                se = slowlogGetEntry(j);
                 addReplyMultiBulkLen(c,4);
                 addReplyLongLong(c,se->id);
                 addReplyLongLong(c,se->time);
                 addReplyLongLong(c,se->duration);
-                addReplyMultiBulkLen(c,se->argc);
-                for(j = 0; j < se->argc; j++){
-                    addReplyBulk(c,se->argv[j]); 
-                }
-                sent++;
+                addReplySlowlogArgs(c,se);
            };
-           setDeferredMultiBulkLength(c,totentries,sent);
     }else{
-        addReplyError(c,"Unknown SLOWLOG subcommand or wrong # of args, Try GET, RESET, LEN."); 
+        addReplyError(c,"Unknown SLOWLOG subcommand or wrong # of args, Try GET, RESET, LEN.");
     };
 };
-
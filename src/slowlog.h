@@ -1,18 +1,26 @@
 #define SLOWLOG_ENTRY_MAX_ARGC 32
 #define SLOWLOG_ENTRY_MAX_STRING 128
+#define SLOWLOG_ENTRY_ARGV_BYTES 1024
 
 
+/* Slowlog entries live in a ring preallocated by slowlogInit(), so logging
+ * a slow command never allocates: arguments are truncated and copied into
+ * the inline argbuf, one after the other. */
 typedef struct slowlogEntry {
-    robj **argv;
-    int argc;
     long long id;
-    long long duration;
     time_t time;
+    long long duration;
+    int argc;
+    int moreargs;
+    unsigned short arglen[SLOWLOG_ENTRY_MAX_ARGC];
+    size_t argmore[SLOWLOG_ENTRY_MAX_ARGC];
+    char argbuf[SLOWLOG_ENTRY_ARGV_BYTES];
 } slowlogEntry;
 
 
 
 void slowlogInit(void);
+void slowlogResize(unsigned long len);
 void slowlogPushEntryIfNeeded(robj **argv, int argc, long long duration);
 
 
@@ -42,6 +42,86 @@ unsigned long listTypeLength(const robj *subject){
 };
 
 
+/* Reply with the 'n' entries of listpack 'lp' that start at 'p', walking
+ * in 'direction', as bulk strings. The protocol size of the whole run is
+ * computed first, so it is written with a single reservation of reply
+ * space instead of three reply calls per entry. */
+static void addReplyListpackRun(client *c, unsigned char *lp, unsigned char *p, unsigned long n, int direction){
+    unsigned char *(*nextFn)(unsigned char *, unsigned char *) = (direction == AL_START_HEAD) ? lpNext : lpPrev;
+    unsigned char *q, *vstr;
+    unsigned int vlen;
+    long long vlong;
+    size_t bytes = 0;
+    unsigned long j;
+    char *dst;
+
+    for(j = 0, q = p; j < n; j++, q = nextFn(lp,q)){
+        lpGetValue(q,&vstr,&vlen,&vlong);
+        if(vstr == NULL) vlen = sdigits10(vlong);
+        bytes += 1 + digits10(vlen) + 2 + vlen + 2;
+    };
+
+    if((dst = addReplyReserve(c,bytes)) == NULL) return;
+    for(j = 0, q = p; j < n; j++, q = nextFn(lp,q)){
+        char lenbuf[LONG_STR_SIZE], numbuf[LONG_STR_SIZE];
+        int lenlen;
+
+        lpGetValue(q,&vstr,&vlen,&vlong);
+        if(vstr == NULL){
+            vlen = ll2string(numbuf,sizeof(numbuf),vlong);
+            vstr = (unsigned char *)numbuf;
+        };
+        lenlen = ll2string(lenbuf,sizeof(lenbuf),vlen);
+        *dst++ = '$';
+        memcpy(dst,lenbuf,lenlen);
+        dst += lenlen;
+        *dst++ = '\r';
+        *dst++ = '\n';
+        memcpy(dst,vstr,vlen);
+        dst += vlen;
+        *dst++ = '\r';
+        *dst++ = '\n';
+    };
+};
+
+void lrangeCommand(client *c){
+    robj *o;
+    long start, end, llen, rangelen;
+
+    if((getLongFromObjectOrReply(c,c->argv[2],&start,NULL) != C_OK) ||
+       (getLongFromObjectOrReply(c,c->argv[3],&end,NULL) != C_OK)) return;
+
+    if((o = lookupKeyReadOrReply(c,c->argv[1],shared.emptymultibulk)) == NULL ||
+       checkType(c,o,OBJ_LIST)) return;
+    llen = listTypeLength(o);
+
+    if(start < 0) start = llen + start;
+    if(end < 0) end = llen + end;
+    if(start < 0) start = 0;
+
+    if(start > end || start >= llen){
+        addReply(c,shared.emptymultibulk);
+        return;
+    };
+    if(end >= llen) end = llen - 1;
+    rangelen = (end - start) + 1;
+
+    addReplyMultiBulkLen(c,rangelen);
+    if(o->encoding == OBJ_ENCODING_QUICKLIST){
+        quicklistIter *iter = quicklistGetIteratorAtIdx(o->ptr,AL_START_HEAD,start);
+        unsigned char *lp, *p;
+        unsigned long n;
+
+        while(rangelen && (n = quicklistNextRun(iter,&lp,&p,rangelen)) != 0){
+            addReplyListpackRun(c,lp,p,n,AL_START_HEAD);
+            rangelen -= n;
+        };
+        quicklistReleaseIterator(iter);
+    }else{
+        serverPanic("List encoding is not QUICKLIST!");
+    };
+};
+
 void unblockClientWaitingData(client *c){
     dictEntry *de;
     dictIterator *di;
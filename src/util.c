@@ -12,6 +12,7 @@
 #include <errno.h>
 
 #include "util.h"
+#include "config.h"
 #include "sha1.h"
 
 
@@ -237,104 +238,154 @@ uint32_t sdigits10(int64_t v){
 };
 
 
-int ll2string(char *dst, size_t dstlen, long long svalue){
-    static const char digits[201] = 
-        "0001020304050607080910111213141516171819"
-        "2021222324252627282930313233343536373839"
-        "4041424344454647484950515253545556575859"
-        "6061626364656667686970717273747576777879"
-        "8081828384858687888990919293949596979899";
-    int negative;
-    unsigned long long value;
-    
-    if(svalue < 0){
-        if(svalue != LLONG_MIN){
-            value = -svalue;
-        }else{
-            value = ((unsigned long long) LLONG_MAX) + 1;
-        }
-        negative = 1;
-    }else{
-        value = svalue;
-        negative = 0;
-    };
-    
-    uint32_t const length = digits10(value) + negative;
+/* Two ASCII digits for every value in 0..99, so that integers are emitted
+ * two digits per division instead of one. */
+static const char utilDigitPairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+
+/* Convert an unsigned long long into a string. Returns the number of
+ * characters needed to represent the number. If the buffer is not big
+ * enough to store the string, 0 is returned.
+ *
+ * Digits are written from the right. Four digits are peeled off per 64 bit
+ * division and split into two pairs with cheap 32 bit arithmetic, then the
+ * last one to four digits are emitted from the pair table. */
+int ull2string(char *dst, size_t dstlen, unsigned long long value){
+    uint32_t const length = digits10(value);
+    uint32_t next;
+
     if(length >= dstlen) return 0;
-    uint32_t next = length;
-    dst[next] = '\0';
-    while(value >=  100){
-        int const i = (value %100) * 2;
+    dst[length] = '\0';
+    next = length - 1;
+    while(value >= 10000){
+        uint32_t const r = (uint32_t)(value % 10000);
+        uint32_t const hi = (r / 100) * 2, lo = (r % 100) * 2;
+        value /= 10000;
+        dst[next] = utilDigitPairs[lo + 1];
+        dst[next - 1] = utilDigitPairs[lo];
+        dst[next - 2] = utilDigitPairs[hi + 1];
+        dst[next - 3] = utilDigitPairs[hi];
+        next -= 4;
+    };
+    if(value >= 100){
+        uint32_t const i = (uint32_t)(value % 100) * 2;
         value /= 100;
-        dst[next] = digits[i+1]; 
-        dst[next - 1] = digits[i];
+        dst[next] = utilDigitPairs[i + 1];
+        dst[next - 1] = utilDigitPairs[i];
         next -= 2;
-    } 
-   
+    };
     if(value < 10){
-        dst[next] = '0' + (uint32_t) value;
+        dst[next] = '0' + (uint32_t)value;
     }else{
-        int i = (uint32_t) value * 2;
-        dst[next] = digits[i+1]; 
-        dst[next - 1] = digits[i];
-    } 
-    
-    if(negative) dst[0] = '-';
+        uint32_t const i = (uint32_t)value * 2;
+        dst[next] = utilDigitPairs[i + 1];
+        dst[next - 1] = utilDigitPairs[i];
+    };
     return length;
 };
 
 
+/* Convert a long long into a string. Returns the number of characters
+ * needed to represent the number, or 0 if the buffer is too small. */
+int ll2string(char *dst, size_t dstlen, long long svalue){
+    unsigned long long value;
+    int len;
+
+    if(svalue >= 0) return ull2string(dst,dstlen,(unsigned long long)svalue);
+
+    /* Negating LLONG_MIN overflows, so negate one more than the value. */
+    value = ((unsigned long long)-(svalue + 1)) + 1;
+    if(dstlen < 2) return 0;
+    len = ull2string(dst + 1,dstlen - 1,value);
+    if(len == 0) return 0;
+    dst[0] = '-';
+    return len + 1;
+};
+
+
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+/* True if all the eight bytes loaded into 'chunk' are ASCII digits: the high
+ * nibble of every byte must be 3, and adding 6 to every byte must not carry
+ * into the high nibble, which happens only for ':' and above. */
+static inline int utilIsEightDigits(uint64_t chunk){
+    return ((chunk & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+           0x3333333333333333ULL;
+};
+
+/* Value of the eight ASCII digits loaded into 'chunk', the first byte in
+ * memory being the most significant digit. Each step merges adjacent lanes,
+ * so the 8 digits become 4 two digit numbers, then 2 four digit numbers and
+ * at last a single eight digit number, with three multiplications. */
+static inline uint32_t utilParseEightDigits(uint64_t chunk){
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return (uint32_t)(((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+};
+#endif
+
+
+/* Convert a string into a long long. Returns 1 if the string could be parsed
+ * into a (non-overflowing) signed long long, 0 otherwise. The value will be
+ * set to the parsed value when appropriate.
+ *
+ * Only the exact textual representation produced by ll2string() is accepted:
+ * no spaces, no '+' sign and no leading zeroes. Up to 19 digits cannot
+ * overflow the unsigned accumulator, so those are validated and summed
+ * without per-digit overflow checks, eight digits at a time where the byte
+ * order allows it. Longer inputs take the checked loop. */
 int string2ll(const char *s, size_t slen, long long *value){
     const char *p = s;
-    size_t plen = 0;
+    const char *end = s + slen;
     int negative = 0;
-    unsigned long long v;
-    
-    if(plen == slen){
-        return 0;
-    }
-    
+    unsigned long long v = 0;
+
+    if(slen == 0) return 0;
+
     if(slen == 1 && p[0] == '0'){
         if(value != NULL) *value = 0;
         return 1;
     };
-    
+
     if(p[0] == '-'){
         negative = 1;
         p++;
-        plen++; 
-        
-        if(plen == slen){
-            return 0;
-        };
+        if(p == end) return 0;
     };
-    
-    if(p[0] >= '1' && p[0] <= '9'){
-        v = p[0] - '0';
-        p++;
-        plen++;
-    }else if(p[0] == '0' && slen == 1){
-        *value = 0;
-        return 1;
+
+    if(p[0] < '1' || p[0] > '9') return 0;
+
+    if(end - p <= 19){
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+        while(end - p >= 8){
+            uint64_t chunk;
+            memcpy(&chunk,p,sizeof(chunk));
+            if(!utilIsEightDigits(chunk)) return 0;
+            v = v * 100000000 + utilParseEightDigits(chunk);
+            p += 8;
+        };
+#endif
+        while(p < end){
+            if(p[0] < '0' || p[0] > '9') return 0;
+            v = v * 10 + (p[0] - '0');
+            p++;
+        };
     }else{
-        return 0;
-    }
-    
-    while(plen < slen && p[0] >= '0' && p[0] <= '9'){
-        if(v > (ULLONG_MAX / 10)){return 0;};
-        v *= 10;
-        if(v > (ULLONG_MAX - (p[0] - '0'))){
-            return 0;
-        }
-        v += p[0] - '0';
-        p++;
-        plen++;
+        while(p < end){
+            if(p[0] < '0' || p[0] > '9') return 0;
+            if(v > (ULLONG_MAX / 10)) return 0;
+            v *= 10;
+            if(v > (ULLONG_MAX - (p[0] - '0'))) return 0;
+            v += p[0] - '0';
+            p++;
+        };
     };
-    
-    if(plen < slen){
-        return 0;
-    }
-    
+
     if(negative){
         if(v > ((unsigned long long)(-(LLONG_MIN + 1)) + 1)){return 0;};
         if(value != NULL) *value = -v;
@@ -384,6 +435,325 @@ int string2ld(const char *s, size_t slen, long double *dp){
 };
 
 
+/* Shortest round trip formatting of doubles, using the Grisu2 algorithm by
+ * Florian Loitsch ("Printing Floating-Point Numbers Quickly and Accurately
+ * with Integers", PLDI 2010). The value is scaled by a cached power of ten
+ * so that its digits can be generated with 64 bit integer arithmetic, and
+ * digit generation stops as soon as the digits identify the value uniquely
+ * among its neighbours. The result reads back to the same double, and is
+ * the shortest such string in the vast majority of cases. */
+typedef struct utilDiyFp{
+    uint64_t f;
+    int e;
+} utilDiyFp;
+
+#define UTIL_DP_SIGNIFICAND_SIZE 52
+#define UTIL_DP_EXPONENT_BIAS (0x3FF + UTIL_DP_SIGNIFICAND_SIZE)
+#define UTIL_DP_HIDDEN_BIT 0x0010000000000000ULL
+#define UTIL_DP_SIGNIFICAND_MASK 0x000FFFFFFFFFFFFFULL
+#define UTIL_DP_EXPONENT_MASK 0x7FF0000000000000ULL
+
+/* 10^(-348 + 8 * i), normalized so that the top bit of the significand is
+ * set. Eight decimal exponents between entries are enough to bring every
+ * double in the range Grisu needs. */
+static const utilDiyFp utilCachedPowers[] = {
+    {0xfa8fd5a0081c0288ULL,-1220},
+    {0xbaaee17fa23ebf76ULL,-1193},
+    {0x8b16fb203055ac76ULL,-1166},
+    {0xcf42894a5dce35eaULL,-1140},
+    {0x9a6bb0aa55653b2dULL,-1113},
+    {0xe61acf033d1a45dfULL,-1087},
+    {0xab70fe17c79ac6caULL,-1060},
+    {0xff77b1fcbebcdc4fULL,-1034},
+    {0xbe5691ef416bd60cULL,-1007},
+    {0x8dd01fad907ffc3cULL,-980},
+    {0xd3515c2831559a83ULL,-954},
+    {0x9d71ac8fada6c9b5ULL,-927},
+    {0xea9c227723ee8bcbULL,-901},
+    {0xaecc49914078536dULL,-874},
+    {0x823c12795db6ce57ULL,-847},
+    {0xc21094364dfb5637ULL,-821},
+    {0x9096ea6f3848984fULL,-794},
+    {0xd77485cb25823ac7ULL,-768},
+    {0xa086cfcd97bf97f4ULL,-741},
+    {0xef340a98172aace5ULL,-715},
+    {0xb23867fb2a35b28eULL,-688},
+    {0x84c8d4dfd2c63f3bULL,-661},
+    {0xc5dd44271ad3cdbaULL,-635},
+    {0x936b9fcebb25c996ULL,-608},
+    {0xdbac6c247d62a584ULL,-582},
+    {0xa3ab66580d5fdaf6ULL,-555},
+    {0xf3e2f893dec3f126ULL,-529},
+    {0xb5b5ada8aaff80b8ULL,-502},
+    {0x87625f056c7c4a8bULL,-475},
+    {0xc9bcff6034c13053ULL,-449},
+    {0x964e858c91ba2655ULL,-422},
+    {0xdff9772470297ebdULL,-396},
+    {0xa6dfbd9fb8e5b88fULL,-369},
+    {0xf8a95fcf88747d94ULL,-343},
+    {0xb94470938fa89bcfULL,-316},
+    {0x8a08f0f8bf0f156bULL,-289},
+    {0xcdb02555653131b6ULL,-263},
+    {0x993fe2c6d07b7facULL,-236},
+    {0xe45c10c42a2b3b06ULL,-210},
+    {0xaa242499697392d3ULL,-183},
+    {0xfd87b5f28300ca0eULL,-157},
+    {0xbce5086492111aebULL,-130},
+    {0x8cbccc096f5088ccULL,-103},
+    {0xd1b71758e219652cULL,-77},
+    {0x9c40000000000000ULL,-50},
+    {0xe8d4a51000000000ULL,-24},
+    {0xad78ebc5ac620000ULL,3},
+    {0x813f3978f8940984ULL,30},
+    {0xc097ce7bc90715b3ULL,56},
+    {0x8f7e32ce7bea5c70ULL,83},
+    {0xd5d238a4abe98068ULL,109},
+    {0x9f4f2726179a2245ULL,136},
+    {0xed63a231d4c4fb27ULL,162},
+    {0xb0de65388cc8ada8ULL,189},
+    {0x83c7088e1aab65dbULL,216},
+    {0xc45d1df942711d9aULL,242},
+    {0x924d692ca61be758ULL,269},
+    {0xda01ee641a708deaULL,295},
+    {0xa26da3999aef774aULL,322},
+    {0xf209787bb47d6b85ULL,348},
+    {0xb454e4a179dd1877ULL,375},
+    {0x865b86925b9bc5c2ULL,402},
+    {0xc83553c5c8965d3dULL,428},
+    {0x952ab45cfa97a0b3ULL,455},
+    {0xde469fbd99a05fe3ULL,481},
+    {0xa59bc234db398c25ULL,508},
+    {0xf6c69a72a3989f5cULL,534},
+    {0xb7dcbf5354e9beceULL,561},
+    {0x88fcf317f22241e2ULL,588},
+    {0xcc20ce9bd35c78a5ULL,614},
+    {0x98165af37b2153dfULL,641},
+    {0xe2a0b5dc971f303aULL,667},
+    {0xa8d9d1535ce3b396ULL,694},
+    {0xfb9b7cd9a4a7443cULL,720},
+    {0xbb764c4ca7a44410ULL,747},
+    {0x8bab8eefb6409c1aULL,774},
+    {0xd01fef10a657842cULL,800},
+    {0x9b10a4e5e9913129ULL,827},
+    {0xe7109bfba19c0c9dULL,853},
+    {0xac2820d9623bf429ULL,880},
+    {0x80444b5e7aa7cf85ULL,907},
+    {0xbf21e44003acdd2dULL,933},
+    {0x8e679c2f5e44ff8fULL,960},
+    {0xd433179d9c8cb841ULL,986},
+    {0x9e19db92b4e31ba9ULL,1013},
+    {0xeb96bf6ebadf77d9ULL,1039},
+    {0xaf87023b9bf0ee6bULL,1066},
+};
+
+static const uint64_t utilPow10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static utilDiyFp utilDiyFpMake(uint64_t f, int e){
+    utilDiyFp r;
+    r.f = f;
+    r.e = e;
+    return r;
+};
+
+static utilDiyFp utilDiyFpNormalize(utilDiyFp x){
+#if defined(__GNUC__)
+    int s = __builtin_clzll(x.f);
+    x.f <<= s;
+    x.e -= s;
+#else
+    while(!(x.f & 0x8000000000000000ULL)){
+        x.f <<= 1;
+        x.e--;
+    };
+#endif
+    return x;
+};
+
+/* Upper 64 bits of the 128 bit product, rounded. */
+static utilDiyFp utilDiyFpMul(utilDiyFp x, utilDiyFp y){
+    const uint64_t m32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+    tmp += 1ULL << 31;
+    return utilDiyFpMake(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32),x.e + y.e + 64);
+};
+
+/* Cached power c such that c * 2^e has a binary exponent in [-60,-32].
+ * Sets *k so that c is about 10^-k. */
+static utilDiyFp utilGetCachedPower(int e, int *k){
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    unsigned int index;
+
+    if(dk - ik > 0.0) ik++;
+    index = (unsigned int)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+    return utilCachedPowers[index];
+};
+
+/* Step the last generated digit down while that brings the digits closer to
+ * the exact value and keeps them inside the rounding interval. */
+static void utilGrisuRound(char *buf, int len, uint64_t delta, uint64_t rest,
+                           uint64_t tenkappa, uint64_t wpw){
+    while(rest < wpw && delta - rest >= tenkappa &&
+          (rest + tenkappa < wpw || wpw - rest > rest + tenkappa - wpw)){
+        buf[len - 1]--;
+        rest += tenkappa;
+    };
+};
+
+static int utilDigitGen(utilDiyFp w, utilDiyFp mp, uint64_t delta, char *buf, int *k){
+    utilDiyFp one = utilDiyFpMake(1ULL << -mp.e,mp.e);
+    uint64_t wpw = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+    uint64_t p2 = mp.f & (one.f - 1);
+    int kappa = (int)digits10(p1);
+    int len = 0;
+
+    while(kappa > 0){
+        uint32_t const div = (uint32_t)utilPow10[kappa - 1];
+        uint32_t const d = p1 / div;
+        uint64_t tmp;
+
+        p1 %= div;
+        if(d || len) buf[len++] = '0' + d;
+        kappa--;
+        tmp = ((uint64_t)p1 << -one.e) + p2;
+        if(tmp <= delta){
+            *k += kappa;
+            utilGrisuRound(buf,len,delta,tmp,utilPow10[kappa] << -one.e,wpw);
+            return len;
+        };
+    };
+
+    for(;;){
+        uint32_t d;
+
+        p2 *= 10;
+        delta *= 10;
+        d = (uint32_t)(p2 >> -one.e);
+        if(d || len) buf[len++] = '0' + d;
+        p2 &= one.f - 1;
+        kappa--;
+        if(p2 < delta){
+            *k += kappa;
+            utilGrisuRound(buf,len,delta,p2,one.f,
+                           wpw * (-kappa < 20 ? utilPow10[-kappa] : 0));
+            return len;
+        };
+    };
+};
+
+/* Generate the decimal digits of the finite, positive double 'value' into
+ * 'buf', at most 17 of them. Returns the number of digits and sets *k so
+ * that value == digits * 10^k once read back. */
+static int utilGrisu2(double value, char *buf, int *k){
+    uint64_t bits, f;
+    int e, biased;
+    utilDiyFp v, wp, wm, c, w;
+
+    memcpy(&bits,&value,sizeof(bits));
+    biased = (int)((bits & UTIL_DP_EXPONENT_MASK) >> UTIL_DP_SIGNIFICAND_SIZE);
+    f = bits & UTIL_DP_SIGNIFICAND_MASK;
+    if(biased != 0){
+        f += UTIL_DP_HIDDEN_BIT;
+        e = biased - UTIL_DP_EXPONENT_BIAS;
+    }else{
+        e = 1 - UTIL_DP_EXPONENT_BIAS;
+    };
+    v = utilDiyFpMake(f,e);
+
+    /* Boundaries halfway to the neighbouring doubles, on a common exponent.
+     * The lower neighbour is closer when f is a power of two. */
+    wp = utilDiyFpMake((f << 1) + 1,e - 1);
+    while(!(wp.f & (UTIL_DP_HIDDEN_BIT << 1))){
+        wp.f <<= 1;
+        wp.e--;
+    };
+    wp.f <<= 64 - UTIL_DP_SIGNIFICAND_SIZE - 2;
+    wp.e -= 64 - UTIL_DP_SIGNIFICAND_SIZE - 2;
+    if(f == UTIL_DP_HIDDEN_BIT){
+        wm = utilDiyFpMake((f << 2) - 1,e - 2);
+    }else{
+        wm = utilDiyFpMake((f << 1) - 1,e - 1);
+    };
+    wm.f <<= wm.e - wp.e;
+    wm.e = wp.e;
+
+    c = utilGetCachedPower(wp.e,k);
+    w = utilDiyFpMul(utilDiyFpNormalize(v),c);
+    wp = utilDiyFpMul(wp,c);
+    wm = utilDiyFpMul(wm,c);
+    wm.f++;
+    wp.f--;
+    return utilDigitGen(w,wp,wp.f - wm.f,buf,k);
+};
+
+/* Lay out 'len' digits worth digits * 10^k the way printf's "%g" does:
+ * plain notation when the decimal exponent is in [-4,17), scientific
+ * notation with at least two exponent digits otherwise. 'dst' must have
+ * room for 32 bytes. */
+static int utilFormatDigits(char *dst, const char *digits, int len, int k){
+    char *p = dst;
+    int exp10;
+
+    while(len > 1 && digits[len - 1] == '0'){
+        len--;
+        k++;
+    };
+    exp10 = len + k - 1;
+
+    if(exp10 >= 17 || exp10 < -4){
+        *p++ = digits[0];
+        if(len > 1){
+            *p++ = '.';
+            memcpy(p,digits + 1,len - 1);
+            p += len - 1;
+        };
+        *p++ = 'e';
+        if(exp10 < 0){
+            *p++ = '-';
+            exp10 = -exp10;
+        }else{
+            *p++ = '+';
+        };
+        if(exp10 < 10) *p++ = '0';
+        p += ull2string(p,4,exp10);
+    }else if(exp10 < 0){
+        *p++ = '0';
+        *p++ = '.';
+        memset(p,'0',-exp10 - 1);
+        p += -exp10 - 1;
+        memcpy(p,digits,len);
+        p += len;
+    }else if(len <= exp10 + 1){
+        memcpy(p,digits,len);
+        p += len;
+        memset(p,'0',exp10 + 1 - len);
+        p += exp10 + 1 - len;
+    }else{
+        memcpy(p,digits,exp10 + 1);
+        p += exp10 + 1;
+        *p++ = '.';
+        memcpy(p,digits + exp10 + 1,len - exp10 - 1);
+        p += len - exp10 - 1;
+    };
+    *p = '\0';
+    return p - dst;
+};
+
+
+/* Convert a double to a string representation. Returns the number of bytes
+ * required, or 0 if the buffer is too small. The representation is the
+ * shortest one that reads back to the same double with strtod(), laid out
+ * like "%.17g" would. */
 int d2string(char *buf, size_t len, double value){
     if(isnan(value)){
         len = snprintf(buf,len,"nan");
@@ -407,8 +777,20 @@ int d2string(char *buf, size_t len, double value){
                 len = ll2string(buf,len,(long long)value);
             }else
         #endif
-            len = snprintf(buf,len,"%.17g",value);     
-            
+            {
+                char digits[20], tmp[32], *p = tmp;
+                int k, l;
+
+                if(value < 0){
+                    *p++ = '-';
+                    value = -value;
+                };
+                l = utilGrisu2(value,digits,&k);
+                l = (p - tmp) + utilFormatDigits(p,digits,l,k);
+                if((size_t)l >= len) return 0;
+                memcpy(buf,tmp,l + 1);
+                len = l;
+            }
     }
     return len;
 };
@@ -429,6 +811,13 @@ int ld2string(char *buf, size_t len, long double value, int humanfriendly){
             memcpy(buf,"-inf",4); 
             l = 4;
         }
+    }else if(value > -1e17L && value < 1e17L &&
+             (value != 0 || !signbit(value)) &&
+             value == (long double)((long long)value)){
+        /* Integral values print the same in both modes, and are the common
+         * case for INCRBYFLOAT counters: skip the libc formatter. */
+        l = ll2string(buf,len,(long long)value);
+        if(l == 0) return 0;
     }else if(humanfriendly){
         l = snprintf(buf,len,"%.17Lf",value);
         if(l + 1 > len) return 0;
@@ -566,7 +955,7 @@ static void test_string2ll(void){
     strcpy(buf," 1");
     assert(string2ll(buf,strlen(buf),&v) == 0);
     
-    strcpy(buf,"1 ")
+    strcpy(buf,"1 ");
     assert(string2ll(buf,strlen(buf),&v) == 0);
     
     strcpy(buf,"01");
@@ -606,10 +995,26 @@ static void test_string2ll(void){
     strcpy(buf,"9223372036854775808");
     assert(string2ll(buf,strlen(buf),&v) == 0);
 
+    /* A bad byte in every position of the eight digit chunks. */
+    strcpy(buf,"12345678901234567");
+    for(int j = 1; j < 17; j++){
+        char saved = buf[j];
+        buf[j] = (j & 1) ? ':' : '/';
+        assert(string2ll(buf,strlen(buf),&v) == 0);
+        buf[j] = saved;
+    }
+    assert(string2ll(buf,strlen(buf),&v) == 1);
+    assert(v == 12345678901234567LL);
+
+    strcpy(buf,"18446744073709551616");
+    assert(string2ll(buf,strlen(buf),&v) == 0);
+
+    strcpy(buf,"-00000000000000000001");
+    assert(string2ll(buf,strlen(buf),&v) == 0);
 }
 
 
-static void test-string2l(void){
+static void test_string2l(void){
     char buf[32];
     long v;
     
@@ -699,6 +1104,145 @@ static void test_ll2string(void){
     sz = ll2string(buf,sizeof buf, v);
     assert(sz == 19);
     assert(!strcmp(buf,"9223372036854775807"));
+
+    /* Too small buffers are refused, never truncated. */
+    assert(ll2string(buf,3,-99) == 0);
+    assert(ll2string(buf,4,-99) == 3);
+    assert(ll2string(buf,1,0) == 0);
+}
+
+static unsigned long long utilTestRand64(void){
+    return ((unsigned long long)rand() << 62) ^
+           ((unsigned long long)rand() << 31) ^ (unsigned long long)rand();
+}
+
+static long long usec(void){
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000 ) + tv.tv_usec;
+}
+
+/* Random values of every length, checked against libc both ways. */
+static void test_ll2string_random(void){
+    char buf[32], ref[32];
+    long long v, parsed;
+    int j, sz;
+
+    for(j = 0; j < 200000; j++){
+        v = (long long)(utilTestRand64() >> (rand() % 64));
+        if((j & 1) && v != LLONG_MIN) v = -v;
+        sz = ll2string(buf,sizeof(buf),v);
+        snprintf(ref,sizeof(ref),"%lld",v);
+        assert(sz == (int)strlen(ref) && !strcmp(buf,ref));
+        assert(string2ll(buf,sz,&parsed) == 1 && parsed == v);
+    }
+}
+
+static void test_d2string(void){
+    char buf[128];
+    double v;
+    int j, sz, longer = 0;
+
+    sz = d2string(buf,sizeof(buf),0.1);
+    assert(sz == 3 && !strcmp(buf,"0.1"));
+    sz = d2string(buf,sizeof(buf),-2.5);
+    assert(sz == 4 && !strcmp(buf,"-2.5"));
+    d2string(buf,sizeof(buf),123456.789);
+    assert(!strcmp(buf,"123456.789"));
+    d2string(buf,sizeof(buf),0.0001);
+    assert(!strcmp(buf,"0.0001"));
+    d2string(buf,sizeof(buf),1.2345e-5);
+    assert(!strcmp(buf,"1.2345e-05"));
+    d2string(buf,sizeof(buf),1e20);
+    assert(!strcmp(buf,"1e+20"));
+    d2string(buf,sizeof(buf),1.5e300);
+    assert(!strcmp(buf,"1.5e+300"));
+    d2string(buf,sizeof(buf),5e-324);
+    assert(!strcmp(buf,"5e-324"));
+    d2string(buf,sizeof(buf),DBL_MAX);
+    assert(!strcmp(buf,"1.7976931348623157e+308"));
+    d2string(buf,sizeof(buf),3.14);
+    assert(!strcmp(buf,"3.14"));
+    assert(d2string(buf,4,3.14) == 0);
+    d2string(buf,sizeof(buf),-0.0);
+    assert(!strcmp(buf,"-0"));
+
+    /* Random bit patterns cover every exponent: the output must read back
+     * to the same double. Grisu2 narrows the rounding interval to account
+     * for its own imprecision, so in rare cases it misses the shortest
+     * "%.*e" that reads back and falls back to 17 digits. */
+    for(j = 0; j < 200000; j++){
+        unsigned long long bits = utilTestRand64();
+        char ref[32], *p;
+        int digits = 0, zeros = 0, prec;
+
+        memcpy(&v,&bits,sizeof(v));
+        if(isnan(v) || isinf(v)) continue;
+        sz = d2string(buf,sizeof(buf),v);
+        assert(sz > 0 && strtod(buf,NULL) == v);
+        for(p = buf; *p && *p != 'e'; p++){
+            if(*p < '0' || *p > '9') continue;
+            if(*p == '0'){
+                zeros++;
+            }else{
+                if(digits) digits += zeros;
+                digits++;
+                zeros = 0;
+            }
+        }
+        for(prec = 1; prec < 17; prec++){
+            snprintf(ref,sizeof(ref),"%.*e",prec - 1,v);
+            if(strtod(ref,NULL) == v) break;
+        }
+        assert(digits <= 17);
+        if(digits > prec) longer++;
+    }
+    assert(longer < 200);
+}
+
+static void bench_conversions(void){
+    char buf[128];
+    long long start, ours, libc;
+    unsigned long long sink = 0;
+    int j, n = 1000000;
+    static long long lls[1024];
+    static double dbls[1024];
+    static char strs[1024][24];
+
+    for(j = 0; j < 1024; j++){
+        lls[j] = (long long)(utilTestRand64() >> (rand() % 64));
+        dbls[j] = (double)rand() / ((rand() % 1000) + 1) - 1000;
+        snprintf(strs[j],sizeof(strs[j]),"%lld",lls[j]);
+    }
+
+    start = usec();
+    for(j = 0; j < n; j++) sink += ll2string(buf,sizeof(buf),lls[j & 1023]);
+    ours = usec() - start;
+    start = usec();
+    for(j = 0; j < n; j++) sink += snprintf(buf,sizeof(buf),"%lld",lls[j & 1023]);
+    libc = usec() - start;
+    printf("ll2string: %lld ns, snprintf %%lld: %lld ns\n",ours * 1000 / n,libc * 1000 / n);
+
+    start = usec();
+    for(j = 0; j < n; j++){
+        long long v;
+        string2ll(strs[j & 1023],strlen(strs[j & 1023]),&v);
+        sink += v;
+    }
+    ours = usec() - start;
+    start = usec();
+    for(j = 0; j < n; j++) sink += strtoll(strs[j & 1023],NULL,10);
+    libc = usec() - start;
+    printf("string2ll: %lld ns, strtoll: %lld ns\n",ours * 1000 / n,libc * 1000 / n);
+
+    start = usec();
+    for(j = 0; j < n; j++) sink += d2string(buf,sizeof(buf),dbls[j & 1023]);
+    ours = usec() - start;
+    start = usec();
+    for(j = 0; j < n; j++) sink += snprintf(buf,sizeof(buf),"%.17g",dbls[j & 1023]);
+    libc = usec() - start;
+    printf("d2string: %lld ns, snprintf %%.17g: %lld ns\n",ours * 1000 / n,libc * 1000 / n);
+    if(sink == 42) printf("\n");
 }
 
 
@@ -706,10 +1250,13 @@ static void test_ll2string(void){
 int utilTest(int argc, char **argv){
     UNUSED(argc);
     UNUSED(argv);
-    
+
     test_string2ll();
     test_string2l();
     test_ll2string();
+    test_ll2string_random();
+    test_d2string();
+    bench_conversions();
     return 0;
 }
 #endif
@@ -8,9 +8,10 @@
 int stringmatchlen(const char *p, int plen, const char *s, int slen, int nocase);
 int stringmatch(const char *p, const char *s, int nocase);
 long long memtoll(const char *p, int *err);
-uint32_t digis10(uint64_t v);
+uint32_t digits10(uint64_t v);
 uint32_t sdigits10(int64_t v);
 
+int ull2string(char *s, size_t len, unsigned long long value);
 int ll2string(char *s, size_t len, long long value);
 int string2ll(const char *s, size_t slen, long long *value);
 int string2l(const char *s, size_t slen, long *value);
@@ -140,7 +140,7 @@ unsigned int zipStoreEntryEncoding(unsigned char *p, unsigned char encoding, uns
                         (lensize) = 2;\
                 }else if((encoding == ZIP_STR_32B)){      \
                         (lensize) = 5;\
-                        (len) = ((ptr)[1] << 24) | ((ptr)[2] << 16) | ((ptr)[3] << 8) | ((ptr)[4]);\
+                        (len) = ((unsigned int)(ptr)[1] << 24) | ((ptr)[2] << 16) | ((ptr)[3] << 8) | ((ptr)[4]);\
                 }else{   \
                         panic("Invalid string encoding 0x%02X",(encoding));\
                 }\
@@ -238,17 +238,18 @@ int zipTryEncoding(unsigned char *entry, unsigned int entrylen, long long *v, un
                 }
 
                 *v = value;
+                return 1;
         };
         return 0; 
 };
 
 
-int64_t zipSaveInteger(unsigned char *p,int64_t value,  unsigned char encoding){
+void zipSaveInteger(unsigned char *p,int64_t value,  unsigned char encoding){
         int16_t i16;
         int32_t i32;
         int64_t i64;
 
-        if(encoding = ZIP_INT_8B){
+        if(encoding == ZIP_INT_8B){
                 ((int8_t*)p)[0] = (int8_t)value;
         }else if(encoding == ZIP_INT_16B){
                 i16 = value;
@@ -260,8 +261,8 @@ int64_t zipSaveInteger(unsigned char *p,int64_t value,  unsigned char encoding){
                 memcpy(p, ((uint8_t*)&i32) + 1, sizeof(i32) - sizeof(uint8_t));
         }else if(encoding == ZIP_INT_32B){
                 i32 = value;
-                memcpy(p,&i32,sizeof(i32))
-                        memrev32ifbe(p);
+                memcpy(p,&i32,sizeof(i32));
+                memrev32ifbe(p);
         }else if(encoding == ZIP_INT_64B){
                 i64 = value;
                 memcpy(p,&i64,sizeof(i64));
@@ -349,7 +350,7 @@ unsigned char *__ziplistCascadeUpdate(unsigned char *zl, unsigned char *p){
                         p = zl + offset;
 
                         np = p + rawlen;
-                        offset = np - zl;
+                        noffset = np - zl;
 
                         if((zl + intrev32ifbe(ZIPLIST_TAIL_OFFSET(zl))) != np){
                                 ZIPLIST_TAIL_OFFSET(zl) = 
@@ -504,7 +505,7 @@ unsigned char *ziplistMerge(unsigned char **first, unsigned char **second){
         }
 
         size_t first_bytes = intrev32ifbe(ZIPLIST_BYTES(*first));        
-        size_t first_len = intrev16ifbe(ZIPLIST_BYTES(*first));
+        size_t first_len = intrev16ifbe(ZIPLIST_LENGTH(*first));
 
         size_t second_bytes = intrev32ifbe(ZIPLIST_BYTES(*second));
         size_t second_len = intrev16ifbe(ZIPLIST_LENGTH(*second));
@@ -532,7 +533,7 @@ unsigned char *ziplistMerge(unsigned char **first, unsigned char **second){
         zllength = zllength < UINT16_MAX ? zllength : UINT16_MAX;
 
         size_t first_offset = intrev32ifbe(ZIPLIST_TAIL_OFFSET(*first));
-        size_t second_offset = intrev16ifbe(ZIPLIST_TAIL_OFFSET(*second));
+        size_t second_offset = intrev32ifbe(ZIPLIST_TAIL_OFFSET(*second));
 
         target = zrealloc(target, zlbytes);
 
@@ -544,9 +545,9 @@ unsigned char *ziplistMerge(unsigned char **first, unsigned char **second){
         }
 
         ZIPLIST_BYTES(target) = intrev32ifbe(zlbytes);
-        ZIPLIST_BYTES(target) = intrev16ifbe(zllength);
+        ZIPLIST_LENGTH(target) = intrev16ifbe(zllength);
 
-        ZIPLIST_TAIL_OFFSET(target) = intrev32ifbe((first_bytes - ZIPLIST_END_SIZE) + (second_offset - ZIPLIST_END_SIZE)); 
+        ZIPLIST_TAIL_OFFSET(target) = intrev32ifbe((first_bytes - ZIPLIST_END_SIZE) + (second_offset - ZIPLIST_HEADER_SIZE)); 
         target = __ziplistCascadeUpdate(target, target + first_offset);
 
         if(append){
@@ -635,12 +636,13 @@ unsigned int ziplistGet(unsigned char *p, unsigned char **sstr, unsigned int *sl
                 if(sstr){
                         *slen = entry.len;
                         *sstr = p + entry.headersize;
-                }else{
-                        if(sval){
-                                *sval = zipLoadInteger(p+entry.headersize, entry.encoding);
-                        }
+                }
+        }else{
+                if(sval){
+                        *sval = zipLoadInteger(p+entry.headersize, entry.encoding);
                 }
         }
+        return 1;
 };
 
 
@@ -661,6 +663,36 @@ unsigned char *ziplistDeleteRange(unsigned char *zl, int index, unsigned int num
 };
 
 
+/* Equality of two strings of the same length, used by ziplistFind() and
+ * ziplistCompare(). Most candidates are rejected inline on their first
+ * byte or last word (fields often share a prefix and differ at the end),
+ * without calling memcmp(). */
+
+/* The benchmark in ziplistTest() turns the inline header decoding of
+ * ziplistFind() and the inline rejection off to time the original path. */
+#ifdef REDIS_TEST
+static int zipFindFastPath = 1;
+#else
+#define zipFindFastPath 1
+#endif
+
+static inline int zipStringEquals(const unsigned char *a, const unsigned char *b, unsigned int len){
+        if(len == 0) return 1;
+        if(!zipFindFastPath) return memcmp(a,b,len) == 0;
+        if(a[0] != b[0]) return 0;
+        if(len >= sizeof(uint64_t)){
+                uint64_t wa, wb;
+
+                memcpy(&wa,a + len - sizeof(wa),sizeof(wa));
+                memcpy(&wb,b + len - sizeof(wb),sizeof(wb));
+                if(wa != wb) return 0;
+        }else if(a[len - 1] != b[len - 1]){
+                return 0;
+        }
+        return memcmp(a,b,len) == 0;
+};
+
+
 unsigned int ziplistCompare(unsigned char *p, unsigned char *sstr, unsigned int slen){
         zlentry entry;
         unsigned char sencoding;
@@ -670,7 +702,7 @@ unsigned int ziplistCompare(unsigned char *p, unsigned char *sstr, unsigned int
         zipEntry(p,&entry);
         if(ZIP_IS_STR(entry.encoding)){
                 if(entry.len == slen){
-                        return memcmp(p+entry.headersize, sstr,slen) == 0;
+                        return zipStringEquals(p+entry.headersize, sstr,slen);
                 }else{
                         return 0;
                 }
@@ -680,7 +712,7 @@ unsigned int ziplistCompare(unsigned char *p, unsigned char *sstr, unsigned int
                         return zval == sval;
                 };
         };
-
+        return 0;
 };
 
 unsigned char *ziplistFind(unsigned char *p, unsigned char *vstr, unsigned int vlen, unsigned int skip){
@@ -692,14 +724,23 @@ unsigned char *ziplistFind(unsigned char *p, unsigned char *vstr, unsigned int v
                 unsigned int prevlensize, encoding, lensize, len;
                 unsigned char *q;
 
-                ZIP_DECODE_PREVLENSIZE(p,prevlensize); 
-                ZIP_DECODE_LENGTH(p + prevlensize, encoding, lensize, len);
+                /* Most entries of small hashes and sorted sets have a one
+                 * byte prevlen and a 6 bit string length: decode those inline. */
+                if(zipFindFastPath && p[0] < ZIP_BIG_PREVLEN && (p[1] & ZIP_STR_MASK) == ZIP_STR_06B){
+                        prevlensize = 1;
+                        lensize = 1;
+                        encoding = ZIP_STR_06B;
+                        len = p[1] & 0x3f;
+                }else{
+                        ZIP_DECODE_PREVLENSIZE(p,prevlensize); 
+                        ZIP_DECODE_LENGTH(p + prevlensize, encoding, lensize, len);
+                }
 
                 q = p + prevlensize + lensize;
 
                 if(skipcnt == 0){
                         if(ZIP_IS_STR(encoding)){
-                                if(len == vlen && memcmp(q, vstr, vlen) == 0){
+                                if(len == vlen && zipStringEquals(q, vstr, vlen)){
                                         return p;
                                 }
                         }else{
@@ -785,7 +826,6 @@ void ziplistRepr(unsigned char *zl){
                                 entry.prevrawlen,
                                 entry.prevrawlensize,
                                 entry.len);
-                p += entry.headersize;
                 for(unsigned int i = 0; i < entry.headersize + entry.len;i++){
                         printf("%02x|",p[i]);
                 }; 
@@ -881,6 +921,54 @@ static void stress(int pos, int num, int maxsize, int dnum){
 };
 
 
+/* Time ziplistFind() on hash-like ziplists (field, value, field, ...),
+ * looking up every field with skip 1, first on the original path (full
+ * header decoding and a memcmp() per candidate) and then with the inline
+ * decoding and rejection. Fields share a prefix and differ at the end. */
+static void findBenchmark(void){
+        int sizes[] = {16, 32, 64, 128, 256};
+        unsigned int flens[] = {8, 24, 64};
+        const char *names[2] = {"original", "fast path"};
+        char fields[256][65];
+        char value[32];
+        unsigned int s, f, i, k, round;
+
+        for(f = 0; f < sizeof(flens)/sizeof(flens[0]); f++){
+                for(s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+                        unsigned int rounds = 4000000 / (sizes[s] * sizes[s]) + 1;
+                        unsigned char *zl = ziplistNew();
+                        long long elapsed[2];
+
+                        for(i = 0; i < (unsigned int)sizes[s]; i++){
+                                snprintf(fields[i],sizeof(fields[i]),"f%0*u",(int)flens[f] - 1,i);
+                                snprintf(value,sizeof(value),"value-%u",i);
+                                zl = ziplistPush(zl,(unsigned char*)fields[i],flens[f],ZIPLIST_TAIL);
+                                zl = ziplistPush(zl,(unsigned char*)value,strlen(value),ZIPLIST_TAIL);
+                        }
+
+                        for(k = 0; k < 2; k++){
+                                long long start = usec();
+
+                                zipFindFastPath = k;
+                                for(round = 0; round < rounds; round++){
+                                        for(i = 0; i < (unsigned int)sizes[s]; i++){
+                                                unsigned char *p = ziplistFind(ziplistIndex(zl,0),(unsigned char*)fields[i],flens[f],1);
+                                                assert(p != NULL);
+                                        }
+                                }
+                                elapsed[k] = usec() - start;
+                        }
+                        printf("%3d pairs, %2u byte fields: %s %.1f ns, %s %.1f ns per lookup (%.2fx)\n",
+                               sizes[s],flens[f],
+                               names[0],(double)elapsed[0] * 1000 / ((double)rounds * sizes[s]),
+                               names[1],(double)elapsed[1] * 1000 / ((double)rounds * sizes[s]),
+                               elapsed[1] ? (double)elapsed[0] / elapsed[1] : 0);
+                        zfree(zl);
+                }
+        }
+        zipFindFastPath = 1;
+};
+
 static unsigned char *pop(unsigned char *zl, int where){
         unsigned char *p, *vstr;
         unsigned int vlen;
@@ -1144,7 +1232,7 @@ int ziplistTest(int argc, char **argv){
                 while(ziplistGet(p, &entry, &elen, &value)){
                         printf("Entry: ");
                         if(entry){
-                                if(elen & fwrite(entry, elen, 1, stdout) == 0) perror("fwrite");
+                                if(elen && fwrite(entry, elen, 1, stdout) == 0) perror("fwrite");
                         }else{
                                 printf("%lld",value);
                         }
@@ -1159,7 +1247,7 @@ int ziplistTest(int argc, char **argv){
         {
                 zl = createList();
                 p = ziplistIndex(zl,-1);
-                while(ziplistGet(p, &entry, &elen, &value){
+                while(ziplistGet(p, &entry, &elen, &value)){
                                 printf("ENtry: ");
                                 if(entry){
                                 if(elen && fwrite(entry, elen, 1, stdout) == 0) perror("fwrite");
@@ -1184,7 +1272,7 @@ int ziplistTest(int argc, char **argv){
                                 {
                                         zl = createList();
                                         zl = ziplistDeleteRange(zl, 0,2);
-                                        ziplistRepr(2);
+                                        ziplistRepr(zl);
                                         zfree(zl);
                                 }
                                 printf("Delete inclusive range 1,2:\n");
@@ -1254,13 +1342,13 @@ int ziplistTest(int argc, char **argv){
                                 {
                                         char v[3][257] = {{0}}; 
                                         zlentry e[3] = {{.prevrawlensize = 0, .prevrawlen = 0, .lensize = 0, .len = 0, .headersize = 0, .encoding = 0, .p = NULL}};
-                                        size_t t;
+                                        size_t i;
                                         for(i = 0; i < (sizeof(v)/sizeof(v[0]));i++){
                                                 memset(v[i], 'a' + i, sizeof(v[0])); 
                                         };
                                         v[0][256] = '\0';
-                                        v[0][  1] = '\0';
-                                        v[0][256] = '\0';
+                                        v[1][  1] = '\0';
+                                        v[2][256] = '\0';
 
                                         zl = ziplistNew();
                                         for(i = 0; i < (sizeof(v)/sizeof(v[0]));i++){
@@ -1367,7 +1455,7 @@ int ziplistTest(int argc, char **argv){
                                                 printf("ERROR: not \"hello\"\n");
                                                 return 1;
                                         };
-                                        if(!ziplistCompare(p,(unsigned char*)"hella",5)){
+                                        if(ziplistCompare(p,(unsigned char*)"hella",5)){
                                                 printf("ERROR: not \"hella\"\n");
                                                 return 1;
                                         };
@@ -1377,7 +1465,7 @@ int ziplistTest(int argc, char **argv){
                                                 printf("ERROR: not \"1024\"\n");
                                                 return 1;
                                         }; 
-                                        if(!ziplistCompare(p,(unsigned char*)"1025",4)){
+                                        if(ziplistCompare(p,(unsigned char*)"1025",4)){
                                                 printf("ERROR: not \"1025\"\n");
                                                 return 1;
                                         }; 
@@ -1387,7 +1475,7 @@ int ziplistTest(int argc, char **argv){
                                                 printf("ERROR: not \"hello\"\n");
                                                 return 1;
                                         };
-                                        if(!ziplistCompare(p,(unsigned char*)"hella",5)){
+                                        if(ziplistCompare(p,(unsigned char*)"hella",5)){
                                                 printf("ERROR: not \"hella\"\n");
                                                 return 1;
                                         };
@@ -1397,7 +1485,7 @@ int ziplistTest(int argc, char **argv){
                                                 printf("ERROR: not \"1024\"\n");
                                                 return 1;
                                         }; 
-                                        if(!ziplistCompare(p,(unsigned char*)"1025",4)){
+                                        if(ziplistCompare(p,(unsigned char*)"1025",4)){
                                                 printf("ERROR: not \"1025\"\n");
                                                 return 1;
                                         }; 
@@ -1414,7 +1502,7 @@ int ziplistTest(int argc, char **argv){
                                         list *ref;
                                         listNode *refnode;
 
-                                        unsigned char **sstr;
+                                        unsigned char *sstr;
                                         unsigned int slen;
                                         long long sval;
 
@@ -1422,6 +1510,7 @@ int ziplistTest(int argc, char **argv){
                                                 zl = ziplistNew();
                                                 ref = listCreate();
                                                 listSetFreeMethod(ref, (void (*)(void *))sdsfree);
+                                                len = rand() % 256;
 
                                                 for(j = 0; j < len; j++){
                                                         where = (rand() & 1) ? ZIPLIST_HEAD : ZIPLIST_TAIL; 
@@ -1446,13 +1535,13 @@ int ziplistTest(int argc, char **argv){
                                                         zl = ziplistPush(zl,(unsigned char*)buf,buflen,where);
                                                         if(where == ZIPLIST_HEAD){
                                                                 listAddNodeHead(ref,sdsnewlen(buf,buflen));
-                                                        }else{
+                                                        }else if(where == ZIPLIST_TAIL){
                                                                 listAddNodeTail(ref,sdsnewlen(buf,buflen));
                                                         }else{
                                                                 assert(NULL);
                                                         };
                                                 };
-                                                assert(listLength(ref) == ziplistBlobLen(zl));
+                                                assert(listLength(ref) == ziplistLen(zl));
                                                 for(j = 0; j < len; j++){
                                                         p = ziplistIndex(zl,j);
                                                         refnode = listIndex(ref,j);
@@ -1480,6 +1569,11 @@ int ziplistTest(int argc, char **argv){
                                         stress(ZIPLIST_HEAD, 100000,16384,256); 
                                         stress(ZIPLIST_TAIL, 100000,16384,256);
                                 }
+
+                                printf("Benchmark ziplistFind:\n");
+                                {
+                                        findBenchmark();
+                                }
                                 return 0;
 };
 